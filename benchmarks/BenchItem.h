@@ -0,0 +1,52 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CacheItems.h"
+
+namespace MBMS_RT::Bench {
+  /**
+   *  A cache item backed by a plain buffer instead of a FLUTE file or CDN download, for feeding the
+   *  cache with recorded or synthetic content. Items may share one buffer.
+   */
+  class BenchItem : public CacheItem {
+    public:
+      BenchItem(const std::string& location, std::shared_ptr<const std::vector<char>> data, uint32_t length,
+          ItemSource source = ItemSource::Broadcast, ItemType type = ItemType::File)
+        : CacheItem( location, static_cast<unsigned long>(time(nullptr)) )
+        , _data( std::move(data) )
+        , _length( length )
+        , _source( source )
+        , _type( type ) {}
+
+      virtual ItemType item_type() const { return _type; };
+      virtual ItemPayload payload() const { return { _data, _data->data(), _length }; };
+      virtual uint32_t content_length() const { return _length; };
+      virtual ItemSource item_source() const { return _source; };
+
+    private:
+      std::shared_ptr<const std::vector<char>> _data;
+      uint32_t _length;
+      ItemSource _source;
+      ItemType _type;
+  };
+}
@@ -0,0 +1,194 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+namespace MBMS_RT::Bench {
+  /**
+   *  Keep the compiler from optimising a computed value away
+   */
+  template <typename T>
+  inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+  }
+
+  /**
+   *  Minimal benchmark runner for the mw hot paths.
+   *
+   *  Every benchmark is a function that runs its operation a given number of times. The runner grows
+   *  the count until a run takes at least --min-time seconds and reports the time per operation.
+   *  Results are printed as a table and, with --json <file>, written in the JSON layout of Google
+   *  Benchmark, so its compare tooling can track them across versions.
+   *
+   *  Options: --json <file>, --filter <substring>, --min-time <seconds>
+   */
+  class Runner {
+    public:
+      typedef std::function<void(uint64_t iterations)> benchmark_t;
+
+      Runner(int argc, char** argv) {
+        for (int i = 1; i < argc; i++) {
+          if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            _json_path = argv[++i];
+          } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            _filter = argv[++i];
+          } else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            _min_time = strtod(argv[++i], nullptr);
+          } else {
+            _args.emplace_back(argv[i]);
+          }
+        }
+        spdlog::set_level(spdlog::level::warn);
+        _executable = argc > 0 ? argv[0] : "";
+      };
+
+      /**
+       *  @return Arguments the runner did not consume, for benchmark specific options
+       */
+      const std::vector<std::string>& args() const { return _args; };
+
+      /**
+       *  @param items_per_iteration  Items (bytes, requests, ...) one iteration processes, for the
+       *                              items_per_second column. 0 omits it.
+       */
+      void run(const std::string& name, const benchmark_t& benchmark, uint64_t items_per_iteration = 0) {
+        _last_skipped = !_filter.empty() && name.find(_filter) == std::string::npos;
+        if (_last_skipped) {
+          return;
+        }
+        uint64_t iterations = 1;
+        double real_s = 0;
+        double cpu_s = 0;
+        for (;;) {
+          auto cpu_start = cpu_seconds();
+          auto start = std::chrono::steady_clock::now();
+          benchmark(iterations);
+          real_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          cpu_s = cpu_seconds() - cpu_start;
+          if (real_s >= _min_time || iterations >= MAX_ITERATIONS) {
+            break;
+          }
+          // Aim a bit past min_time so the last round usually is the final one
+          auto factor = real_s > 0 ? _min_time * 1.4 / real_s : 10.0;
+          iterations = std::max(iterations + 1, static_cast<uint64_t>(iterations * std::min(factor, 10.0)));
+        }
+        Result result{ name, iterations, real_s * 1e9 / iterations, cpu_s * 1e9 / iterations,
+          items_per_iteration > 0 ? items_per_iteration * iterations / real_s : 0, {} };
+        printf("%-56s %12.0f ns %12.0f ns %10llu", name.c_str(), result.real_ns, result.cpu_ns,
+            static_cast<unsigned long long>(iterations));
+        if (result.items_per_second > 0) {
+          printf(" %14.0f items/s", result.items_per_second);
+        }
+        printf("\n");
+        fflush(stdout);
+        _results.push_back(std::move(result));
+      };
+
+      /**
+       *  Attach a counter, e.g. a latency percentile, to the benchmark that ran last. It is printed
+       *  below its row and written as a user counter to the JSON results.
+       */
+      void counter(const std::string& name, double value) {
+        if (_last_skipped || _results.empty()) {
+          return;
+        }
+        printf("  %-54s %12.1f\n", name.c_str(), value);
+        fflush(stdout);
+        _results.back().counters.emplace_back(name, value);
+      };
+
+      /**
+       *  Write the JSON results, if requested.
+       *
+       *  @return Exit code for main
+       */
+      int finish() const {
+        if (_json_path.empty()) {
+          return 0;
+        }
+        std::ofstream out(_json_path);
+        if (!out) {
+          fprintf(stderr, "Could not write %s\n", _json_path.c_str());
+          return 1;
+        }
+        char date[32];
+        auto now = time(nullptr);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+        out << "{\n  \"context\": {\n    \"date\": \"" << date << "\",\n    \"executable\": \"" << _executable
+          << "\",\n    \"library_build_type\": \"" << BUILD_TYPE << "\"\n  },\n  \"benchmarks\": [";
+        for (size_t i = 0; i < _results.size(); i++) {
+          const auto& r = _results[i];
+          out << (i ? ",\n" : "\n") << "    {\n      \"name\": \"" << r.name << "\",\n      \"run_type\": \"iteration\""
+            << ",\n      \"iterations\": " << r.iterations << ",\n      \"real_time\": " << r.real_ns
+            << ",\n      \"cpu_time\": " << r.cpu_ns << ",\n      \"time_unit\": \"ns\"";
+          if (r.items_per_second > 0) {
+            out << ",\n      \"items_per_second\": " << r.items_per_second;
+          }
+          for (const auto& [counter, value] : r.counters) {
+            out << ",\n      \"" << counter << "\": " << value;
+          }
+          out << "\n    }";
+        }
+        out << "\n  ]\n}\n";
+        return out ? 0 : 1;
+      };
+
+    private:
+      static constexpr uint64_t MAX_ITERATIONS = 1000000000;
+#ifdef NDEBUG
+      static constexpr const char* BUILD_TYPE = "release";
+#else
+      static constexpr const char* BUILD_TYPE = "debug";
+#endif
+
+      struct Result {
+        std::string name;
+        uint64_t iterations;
+        double real_ns;
+        double cpu_ns;
+        double items_per_second;
+        std::vector<std::pair<std::string, double>> counters;
+      };
+
+      static double cpu_seconds() {
+        timespec ts = {};
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+      };
+
+      std::string _executable;
+      std::string _json_path;
+      std::string _filter;
+      double _min_time = 0.5;
+      bool _last_skipped = false;
+      std::vector<std::string> _args;
+      std::vector<Result> _results;
+  };
+}
@@ -0,0 +1,140 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Benchmark.h"
+#include "CacheManagement.h"
+#include "BenchItem.h"
+
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <libconfig.h++>
+
+using MBMS_RT::Bench::BenchItem;
+using MBMS_RT::Bench::do_not_optimize;
+
+namespace {
+  constexpr unsigned CACHE_SIZE_MB = 64;
+  constexpr size_t LOOKUP_THREADS = 4;
+
+  auto location(size_t i) -> std::string {
+    return "watchfolder/stream_1080p/segment_" + std::to_string(i) + ".ts";
+  }
+
+  struct Environment {
+    explicit Environment(size_t items) : item_size( static_cast<uint32_t>(CACHE_SIZE_MB * 1024ULL * 1024 / items) ) {
+      cfg.readString(("mw: { cache: { max_total_size: " + std::to_string(CACHE_SIZE_MB) +
+            "; max_file_age: 3600; }; };").c_str());
+      data = std::make_shared<std::vector<char>>(item_size);
+    }
+    auto make_cache() -> std::unique_ptr<MBMS_RT::CacheManagement> {
+      return std::make_unique<MBMS_RT::CacheManagement>(cfg, io_service);
+    }
+    auto make_item(size_t i) -> std::shared_ptr<BenchItem> {
+      return std::make_shared<BenchItem>(location(i), data, item_size);
+    }
+
+    libconfig::Config cfg;
+    boost::asio::io_service io_service;
+    uint32_t item_size;
+    std::shared_ptr<const std::vector<char>> data;
+  };
+}
+
+int main(int argc, char** argv) {
+  MBMS_RT::Bench::Runner runner(argc, argv);
+
+  for (size_t count : { 1000, 10000, 100000 }) {
+    auto suffix = "/" + std::to_string(count);
+    // Sized so that count items exactly fill the cache
+    Environment env(count);
+
+    std::vector<std::shared_ptr<BenchItem>> items;
+    items.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      items.push_back(env.make_item(i));
+    }
+    runner.run("CacheManagement/insert" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          auto cache = env.make_cache();
+          for (const auto& item : items) {
+            cache->add_item(item);
+          }
+          do_not_optimize(cache->item_count());
+        }
+      }, count);
+
+    auto cache = env.make_cache();
+    for (const auto& item : items) {
+      cache->add_item(item);
+    }
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      keys.push_back(location(i));
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+    runner.run("CacheManagement/lookup_hit" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          do_not_optimize(cache->find_item(keys[i % count]));
+        }
+      }, 1);
+
+    runner.run("CacheManagement/lookup_miss" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          do_not_optimize(cache->find_item(keys[i % count] + ".missing"));
+        }
+      }, 1);
+
+    // Several HTTP workers looking up at once, contending only on the shard locks. One iteration is a
+    // lookup on every thread.
+    runner.run("CacheManagement/lookup_hit_threads:" + std::to_string(LOOKUP_THREADS) + suffix, [&](uint64_t n) {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < LOOKUP_THREADS; t++) {
+          threads.emplace_back([&, t]() {
+              for (uint64_t i = 0; i < n; i++) {
+                do_not_optimize(cache->find_item(keys[(i + t * 7919) % count]));
+              }
+            });
+        }
+        for (auto& thread : threads) {
+          thread.join();
+        }
+      }, LOOKUP_THREADS);
+
+    // The cache is full, every insert of a new segment evicts the oldest one
+    size_t next = count;
+    runner.run("CacheManagement/insert_evict" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          cache->add_item(env.make_item(next++));
+        }
+        do_not_optimize(cache->item_count());
+      }, 1);
+
+    runner.run("CacheManagement/remove_insert" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          cache->remove_item(location(next - count));
+          cache->add_item(env.make_item(next++));
+        }
+      }, 1);
+  }
+
+  return runner.finish();
+}
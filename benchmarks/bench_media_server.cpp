@@ -0,0 +1,185 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Benchmark.h"
+#include "BenchItem.h"
+#include "CacheManagement.h"
+#include "MediaServer.h"
+#include "RestHandler.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <libconfig.h++>
+
+using MBMS_RT::Bench::BenchItem;
+using MBMS_RT::Bench::do_not_optimize;
+using boost::asio::ip::tcp;
+
+namespace {
+  /**
+   *  A keep-alive HTTP/1.1 client on a blocking socket. Both servers are driven by the same client,
+   *  so the comparison is not skewed by the cost of the cpprest client.
+   */
+  class Connection {
+    public:
+      Connection(boost::asio::io_service& io_service, unsigned short port)
+        : _socket(io_service) {
+        _socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+        _socket.set_option(tcp::no_delay(true));
+      };
+
+      /**
+       *  Send request and read the response
+       *
+       *  @return The body length, 0 if the response carries no Content-Length
+       */
+      size_t get(const std::string& request) {
+        boost::asio::write(_socket, boost::asio::buffer(request));
+        auto head_length = boost::asio::read_until(_socket, _buffer, "\r\n\r\n");
+        std::string head(boost::asio::buffers_begin(_buffer.data()),
+            boost::asio::buffers_begin(_buffer.data()) + head_length);
+        _buffer.consume(head_length);
+        std::transform(head.begin(), head.end(), head.begin(), ::tolower);
+        size_t length = 0;
+        auto field = head.find("\r\ncontent-length:");
+        if (field != std::string::npos) {
+          length = std::stoul(head.substr(field + 17));
+        }
+        if (_buffer.size() < length) {
+          boost::asio::read(_socket, _buffer, boost::asio::transfer_exactly(length - _buffer.size()));
+        }
+        _buffer.consume(length);
+        return length;
+      };
+
+    private:
+      tcp::socket _socket;
+      boost::asio::streambuf _buffer;
+  };
+
+  /**
+   *  Every connection sends n requests back to back from its own thread. The latency of each
+   *  request, in microseconds, ends up in latencies.
+   */
+  void load(std::vector<std::unique_ptr<Connection>>& pool, const std::string& request, uint64_t n,
+      std::vector<double>& latencies) {
+    std::vector<std::vector<double>> per_connection(pool.size());
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < pool.size(); c++) {
+      threads.emplace_back([&, c]() {
+          per_connection[c].reserve(n);
+          for (uint64_t i = 0; i < n; i++) {
+            auto start = std::chrono::steady_clock::now();
+            do_not_optimize(pool[c]->get(request));
+            per_connection[c].push_back(
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+          }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    latencies.clear();
+    for (const auto& samples : per_connection) {
+      latencies.insert(latencies.end(), samples.begin(), samples.end());
+    }
+  }
+
+  auto percentile(std::vector<double> samples, double p) -> double {
+    if (samples.empty()) {
+      return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, static_cast<size_t>(samples.size() * p))];
+  }
+}
+
+/**
+ *  Requests per second and latency percentiles of the epoll MediaServer, next to the cpprest
+ *  RestHandler serving the same cache, for a media playlist and a 256 kB segment.
+ *
+ *  Extra options: --rest-port <port> (default 3091), --media-port <port> (default 3092)
+ */
+int main(int argc, char** argv) {
+  MBMS_RT::Bench::Runner runner(argc, argv);
+  std::string rest_port = "3091";
+  std::string media_port = "3092";
+  for (size_t i = 0; i + 1 < runner.args().size(); i++) {
+    if (runner.args()[i] == "--rest-port") {
+      rest_port = runner.args()[++i];
+    } else if (runner.args()[i] == "--media-port") {
+      media_port = runner.args()[++i];
+    }
+  }
+
+  libconfig::Config cfg;
+  auto settings = "mw: { cache: { max_total_size: 256; max_file_age: 3600; }; media_server: { address: \"127.0.0.1\"; "
+    "port: " + media_port + "; threads: 2; }; };";
+  cfg.readString(settings.c_str());
+  boost::asio::io_service io_service;
+  MBMS_RT::CacheManagement cache(cfg, io_service);
+
+  std::string playlist = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:2\n#EXT-X-MEDIA-SEQUENCE:100\n";
+  for (int s = 100; s < 105; s++) {
+    playlist += "#EXTINF:2.000,\nsegment_" + std::to_string(s) + ".ts\n";
+  }
+  auto playlist_data = std::make_shared<std::vector<char>>(playlist.begin(), playlist.end());
+  cache.add_item(std::make_shared<BenchItem>("bench/index.m3u8", playlist_data,
+        static_cast<uint32_t>(playlist_data->size()), MBMS_RT::ItemSource::Generated,
+        MBMS_RT::CacheItem::ItemType::Playlist));
+  auto segment_data = std::make_shared<std::vector<char>>(256 * 1024, 'x');
+  cache.add_item(std::make_shared<BenchItem>("bench/segment_104.ts", segment_data,
+        static_cast<uint32_t>(segment_data->size())));
+
+  std::unique_ptr<MBMS_RT::ServiceAnnouncement> service_announcement;
+  std::map<std::string, std::shared_ptr<MBMS_RT::Service>> services;
+  std::shared_ptr<MBMS_RT::FetchEngine> fetch_engine;
+  MBMS_RT::RestHandler api(cfg, "http://127.0.0.1:" + rest_port + "/", cache, &service_announcement,
+      [&services]() { return services; }, &fetch_engine);
+  MBMS_RT::MediaServer media_server(cfg, cache);
+  media_server.start();
+
+  const std::vector<std::pair<std::string, unsigned short>> servers = {
+    { "RestHandler", static_cast<unsigned short>(std::stoul(rest_port)) },
+    { "MediaServer", static_cast<unsigned short>(std::stoul(media_port)) } };
+  for (const auto& [server, port] : servers) {
+    for (const auto& [item, path] : { std::make_pair("playlist", "/bench/index.m3u8"),
+                                      std::make_pair("segment", "/bench/segment_104.ts") }) {
+      auto request = std::string("GET ") + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+      for (size_t clients : { 1, 16, 64 }) {
+        std::vector<std::unique_ptr<Connection>> pool;
+        for (size_t c = 0; c < clients; c++) {
+          pool.push_back(std::make_unique<Connection>(io_service, port));
+        }
+        std::vector<double> latencies;
+        auto name = server + "/get_" + item + "/clients:" + std::to_string(clients);
+        runner.run(name, [&](uint64_t n) { load(pool, request, n, latencies); }, clients);
+        runner.counter("p50_us", percentile(latencies, 0.5));
+        runner.counter("p99_us", percentile(latencies, 0.99));
+      }
+    }
+  }
+
+  media_server.stop();
+  return runner.finish();
+}
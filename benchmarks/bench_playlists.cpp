@@ -0,0 +1,106 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Benchmark.h"
+#include "HlsMediaPlaylist.h"
+#include "HlsMediaPlaylistWriter.h"
+#include "HlsPrimaryPlaylist.h"
+
+using MBMS_RT::Bench::do_not_optimize;
+
+namespace {
+  // A live playlist as published by the 5GBC core: 2 s segments, a window of the given length
+  auto media_playlist(int segments, int first_seq) -> std::string {
+    MBMS_RT::HlsMediaPlaylist playlist;
+    playlist.set_target_duration(2);
+    for (int i = 0; i < segments; i++) {
+      int seq = first_seq + i;
+      playlist.add_segment({ "stream_1080p/segment_" + std::to_string(seq) + ".ts", seq, 2.002 });
+    }
+    return playlist.to_string();
+  }
+
+  auto primary_playlist(int variants) -> std::string {
+    std::string content = "#EXTM3U\n#EXT-X-VERSION:3\n";
+    for (int i = 0; i < variants; i++) {
+      content += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string(800000 * (i + 1)) +
+        ",RESOLUTION=" + std::to_string(640 + 320 * i) + "x" + std::to_string(360 + 180 * i) +
+        ",CODECS=\"avc1.64001f,mp4a.40.2\",FRAME-RATE=25.000\n";
+      content += "stream_" + std::to_string(i) + "/index.m3u8\n";
+    }
+    return content;
+  }
+}
+
+int main(int argc, char** argv) {
+  MBMS_RT::Bench::Runner runner(argc, argv);
+
+  for (int segments : { 5, 30, 300 }) {
+    auto content = media_playlist(segments, 100000);
+    runner.run("HlsMediaPlaylist/parse/" + std::to_string(segments), [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          MBMS_RT::HlsMediaPlaylist playlist(content);
+          do_not_optimize(playlist);
+        }
+      }, content.size());
+
+    MBMS_RT::HlsMediaPlaylist parsed(content);
+    runner.run("HlsMediaPlaylist/to_string/" + std::to_string(segments), [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          auto out = parsed.to_string();
+          do_not_optimize(out);
+        }
+      }, content.size());
+
+    // The seamless switching path: slide the window by one segment and publish
+    MBMS_RT::HlsMediaPlaylistWriter writer;
+    writer.set_target_duration(2);
+    for (const auto& segment : parsed.segments()) {
+      writer.add_segment(segment);
+    }
+    int next_seq = 100000 + segments;
+    runner.run("HlsMediaPlaylistWriter/slide_and_publish/" + std::to_string(segments), [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          writer.add_segment({ "stream_1080p/segment_" + std::to_string(next_seq) + ".ts", next_seq, 2.002 });
+          writer.remove_segment(next_seq - segments);
+          next_seq++;
+          auto out = writer.to_string();
+          do_not_optimize(out);
+        }
+      });
+  }
+
+  for (int variants : { 3, 12 }) {
+    auto content = primary_playlist(variants);
+    runner.run("HlsPrimaryPlaylist/parse/" + std::to_string(variants), [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          MBMS_RT::HlsPrimaryPlaylist playlist(content, "watchfolder/");
+          do_not_optimize(playlist);
+        }
+      }, content.size());
+
+    MBMS_RT::HlsPrimaryPlaylist parsed(content, "watchfolder/");
+    runner.run("HlsPrimaryPlaylist/to_string/" + std::to_string(variants), [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          auto out = parsed.to_string();
+          do_not_optimize(out);
+        }
+      }, content.size());
+  }
+
+  return runner.finish();
+}
@@ -0,0 +1,199 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Benchmark.h"
+#include "BenchItem.h"
+#include "CacheManagement.h"
+#include "RestHandler.h"
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include <boost/asio.hpp>
+#include <libconfig.h++>
+#include "cpprest/http_client.h"
+
+using MBMS_RT::Bench::BenchItem;
+using MBMS_RT::Bench::do_not_optimize;
+using web::http::client::http_client;
+using web::http::methods;
+
+namespace {
+  /**
+   *  One object of a recorded session, in the order it reached the cache
+   */
+  struct SessionItem {
+    std::string location;
+    MBMS_RT::ItemSource source;
+    MBMS_RT::CacheItem::ItemType type;
+    std::shared_ptr<const std::vector<char>> data;
+  };
+
+  /**
+   *  Read a session recorded from a live middleware. <dir>/session.txt lists one object per line,
+   *
+   *      <offset ms> <broadcast|cdn|playlist> <content location> <file below dir>
+   *
+   *  in reception order. Empty lines and lines starting with # are skipped.
+   */
+  auto load_session(const std::string& dir) -> std::vector<SessionItem> {
+    std::vector<SessionItem> items;
+    std::ifstream index(dir + "/session.txt");
+    if (!index) {
+      fprintf(stderr, "Could not read %s/session.txt\n", dir.c_str());
+      return items;
+    }
+    std::string line;
+    while (std::getline(index, line)) {
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      std::istringstream fields(line);
+      unsigned long offset_ms = 0;
+      std::string kind;
+      std::string location;
+      std::string file;
+      if (!(fields >> offset_ms >> kind >> location >> file)) {
+        fprintf(stderr, "Skipping malformed session line: %s\n", line.c_str());
+        continue;
+      }
+      std::ifstream body(dir + "/" + file, std::ios::binary);
+      auto data = std::make_shared<std::vector<char>>(std::istreambuf_iterator<char>(body), std::istreambuf_iterator<char>());
+      items.push_back({ location,
+          kind == "cdn" ? MBMS_RT::ItemSource::CDN : kind == "playlist" ? MBMS_RT::ItemSource::Generated : MBMS_RT::ItemSource::Broadcast,
+          kind == "playlist" ? MBMS_RT::CacheItem::ItemType::Playlist : MBMS_RT::CacheItem::ItemType::File,
+          std::move(data) });
+    }
+    return items;
+  }
+
+  /**
+   *  Without a recording: three HLS representations of 2 s segments, every fifth segment of the lowest
+   *  one repaired from the CDN, and each media playlist republished after its segment arrived.
+   */
+  auto synthetic_session(int segments) -> std::vector<SessionItem> {
+    const std::array<std::pair<const char*, size_t>, 3> representations = {{
+      { "stream_1080p", 1500 * 1024 }, { "stream_720p", 750 * 1024 }, { "stream_360p", 250 * 1024 } }};
+    std::vector<SessionItem> items;
+    for (const auto& [name, size] : representations) {
+      auto data = std::make_shared<std::vector<char>>(size, 'x');
+      for (int seq = 0; seq < segments; seq++) {
+        auto source = std::string(name) == "stream_360p" && seq % 5 == 0 ? MBMS_RT::ItemSource::CDN : MBMS_RT::ItemSource::Broadcast;
+        items.push_back({ "watchfolder/" + std::string(name) + "/segment_" + std::to_string(seq) + ".ts", source,
+            MBMS_RT::CacheItem::ItemType::File, data });
+        std::string playlist = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:2\n#EXT-X-MEDIA-SEQUENCE:" +
+          std::to_string(std::max(seq - 4, 0)) + "\n";
+        for (int s = std::max(seq - 4, 0); s <= seq; s++) {
+          playlist += "#EXTINF:2.000,\nsegment_" + std::to_string(s) + ".ts\n";
+        }
+        items.push_back({ "watchfolder/" + std::string(name) + "/index.m3u8", MBMS_RT::ItemSource::Generated,
+            MBMS_RT::CacheItem::ItemType::Playlist, std::make_shared<std::vector<char>>(playlist.begin(), playlist.end()) });
+      }
+    }
+    return items;
+  }
+
+  auto get(http_client& client, const std::string& path) -> pplx::task<size_t> {
+    return client.request(methods::GET, path).then([](web::http::http_response response) {
+        return response.extract_vector();
+      }).then([](std::vector<unsigned char> body) {
+        return body.size();
+      });
+  }
+}
+
+/**
+ *  End to end throughput of the RestHandler: a recorded (or synthetic) FLUTE/CDN session is replayed
+ *  into the cache while HTTP clients on loopback follow its live edge.
+ *
+ *  Extra options: --session <dir>, --port <port> (default 3089)
+ */
+int main(int argc, char** argv) {
+  MBMS_RT::Bench::Runner runner(argc, argv);
+  std::string session_dir;
+  std::string port = "3089";
+  for (size_t i = 0; i + 1 < runner.args().size(); i++) {
+    if (runner.args()[i] == "--session") {
+      session_dir = runner.args()[++i];
+    } else if (runner.args()[i] == "--port") {
+      port = runner.args()[++i];
+    }
+  }
+  auto session = session_dir.empty() ? synthetic_session(60) : load_session(session_dir);
+  if (session.empty()) {
+    return 1;
+  }
+
+  libconfig::Config cfg;
+  cfg.readString("mw: { cache: { max_total_size: 256; max_file_age: 3600; }; };");
+  boost::asio::io_service io_service;
+  MBMS_RT::CacheManagement cache(cfg, io_service);
+  std::unique_ptr<MBMS_RT::ServiceAnnouncement> service_announcement;
+  std::map<std::string, std::shared_ptr<MBMS_RT::Service>> services;
+  std::shared_ptr<MBMS_RT::FetchEngine> fetch_engine;
+  auto url = "http://127.0.0.1:" + port + "/";
+  MBMS_RT::RestHandler api(cfg, url, cache, &service_announcement, [&services]() { return services; },
+                           &fetch_engine);
+
+  for (size_t clients : { 1, 8, 32 }) {
+    std::vector<std::unique_ptr<http_client>> pool;
+    for (size_t c = 0; c < clients; c++) {
+      pool.push_back(std::make_unique<http_client>(url));
+    }
+    auto suffix = "/clients:" + std::to_string(clients);
+
+    // One iteration publishes the next session object and has every client fetch it. Past the end the
+    // session repeats under a new prefix, so there is always a new live edge.
+    size_t position = 0;
+    runner.run("RestHandler/replay" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++, position++) {
+          const auto& item = session[position % session.size()];
+          auto location = "r" + std::to_string(position / session.size()) + "/" + item.location;
+          cache.add_item(std::make_shared<BenchItem>(location, item.data, item.data->size(), item.source, item.type));
+          std::vector<pplx::task<size_t>> requests;
+          for (auto& client : pool) {
+            requests.push_back(get(*client, "/" + location));
+          }
+          do_not_optimize(pplx::when_all(requests.begin(), requests.end()).get());
+        }
+      }, clients);
+
+    // The raw serving rate for a hot segment, as when many players join the same stream
+    const auto& hot = session.front();
+    cache.add_item(std::make_shared<BenchItem>(hot.location, hot.data, hot.data->size(), hot.source, hot.type));
+    runner.run("RestHandler/get_hot_segment" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          std::vector<pplx::task<size_t>> requests;
+          for (auto& client : pool) {
+            requests.push_back(get(*client, "/" + hot.location));
+          }
+          do_not_optimize(pplx::when_all(requests.begin(), requests.end()).get());
+        }
+      }, clients);
+  }
+
+  http_client client(url);
+  runner.run("RestHandler/get_api_cache", [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        do_not_optimize(get(client, "/mw-api/cache").get());
+      }
+    }, 1);
+
+  return runner.finish();
+}
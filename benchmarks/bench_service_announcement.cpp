@@ -0,0 +1,225 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Benchmark.h"
+#include "CacheManagement.h"
+#include "ContentStream.h"
+#include "ServiceAnnouncement.h"
+
+#include <array>
+#include <map>
+#include <memory>
+#include <boost/asio.hpp>
+#include <libconfig.h++>
+#include <gzip/compress.hpp>
+#include "File.h"
+
+using MBMS_RT::Bench::do_not_optimize;
+
+namespace {
+  // Streams are registered but never join: lazy join defers that until a request arrives
+  constexpr const char* CONFIG = "mw: { lazy_join: { enabled: true; }; cache: { max_total_size: 64; }; };";
+
+  auto sdp(int service, int tsi) -> std::string {
+    auto group = "238.1.1." + std::to_string(service + 1);
+    return "v=0\r\n"
+      "o=- 3761560265 3761560265 IN IP4 10.0.0.1\r\n"
+      "s=Service " + std::to_string(service) + "\r\n"
+      "c=IN IP4 " + group + "/255\r\n"
+      "t=0 0\r\n"
+      "b=AS:6000\r\n"
+      "a=FEC-declaration:0 encoding-id=1; instance-id=0\r\n"
+      "a=source-filter: incl IN IP4 " + group + " 10.0.0.1\r\n"
+      "a=flute-tsi:" + std::to_string(tsi) + "\r\n"
+      "m=application 40085 FLUTE/UDP 0\r\n"
+      "a=FEC:0\r\n";
+  }
+
+  auto base(int service) -> std::string {
+    return "http://localhost/watchfolder" + std::to_string(service) + "/";
+  }
+
+  auto part(std::string& out, const std::string& type, const std::string& location, const std::string& body) -> void {
+    out += "--boundary-5gmag\r\nContent-Type: " + type + "\r\nContent-Location: " + location + "\r\n\r\n" + body + "\r\n";
+  }
+
+  /**
+   *  A bootstrap multipart as sent by the 5GBC core: envelope, USD bundle, and an SDP and primary
+   *  playlist per service. tsi_offset changes the SDP of the first service only. With media_segments,
+   *  every variant also gets an embedded media playlist of that many segments, as sent for a bouquet.
+   */
+  auto bootstrap(int services, int tsi_offset = 0, int media_segments = 0) -> std::string {
+    std::string envelope = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<metadataEnvelope xmlns=\"urn:3gpp:metadata:2005:MBMS:envelope\">\n";
+    std::string usd = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<bundleDescription xmlns=\"urn:3GPP:metadata:2005:MBMS:userServiceDescription\" "
+      "xmlns:r12=\"urn:3GPP:metadata:2013:MBMS:userServiceDescription\">\n";
+    std::string fragments;
+    auto add_item = [&](const std::string& uri, unsigned version) {
+      envelope += "  <item metadataURI=\"" + uri + "\" version=\"" + std::to_string(version) +
+        "\" validFrom=\"2024-01-01T00:00:00.000Z\" validUntil=\"2034-01-01T00:00:00.000Z\" contentType=\"\"/>\n";
+    };
+    add_item("http://localhost/usd.xml", 1);
+    for (int s = 0; s < services; s++) {
+      auto manifest = base(s) + "manifest.m3u8";
+      auto session = base(s) + "session.sdp";
+      usd += "  <userServiceDescription serviceId=\"urn:5gmag:service:" + std::to_string(s) + "\">\n"
+        "    <name lang=\"en\">Service " + std::to_string(s) + "</name>\n"
+        "    <deliveryMethod sessionDescriptionURI=\"" + session + "\">\n"
+        "      <r12:broadcastAppService><r12:basePattern>" + manifest + "</r12:basePattern></r12:broadcastAppService>\n"
+        "    </deliveryMethod>\n"
+        "    <r12:appService mimeType=\"application/vnd.apple.mpegurl\" appServiceDescriptionURI=\"" + manifest + "\">\n"
+        "      <r12:alternativeContent><r12:basePattern>" + manifest + "</r12:basePattern></r12:alternativeContent>\n"
+        "    </r12:appService>\n"
+        "  </userServiceDescription>\n";
+      std::string primary = "#EXTM3U\n#EXT-X-VERSION:3\n";
+      for (int v = 0; v < 3; v++) {
+        primary += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string(1000000 * (v + 1)) +
+          ",RESOLUTION=1280x720,CODECS=\"avc1.64001f,mp4a.40.2\"\nstream_" + std::to_string(v) + "/index.m3u8\n";
+      }
+      part(fragments, "application/vnd.apple.mpegurl", manifest, primary);
+      for (int v = 0; media_segments > 0 && v < 3; v++) {
+        auto media_location = base(s) + "stream_" + std::to_string(v) + "/index.m3u8";
+        std::string media = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:2\n#EXT-X-MEDIA-SEQUENCE:1000\n";
+        for (int seg = 0; seg < media_segments; seg++) {
+          media += "#EXTINF:2.000,\nsegment_" + std::to_string(s) + "_" + std::to_string(v) + "_" +
+            std::to_string(1000 + seg) + ".ts\n";
+        }
+        part(fragments, "application/vnd.apple.mpegurl", media_location, media);
+        add_item(media_location, 1);
+      }
+      part(fragments, "application/sdp", session, sdp(s, s + 1 + (s == 0 ? tsi_offset : 0)));
+      add_item(manifest, 1);
+      add_item(session, s == 0 ? 1 + tsi_offset : 1);
+    }
+    envelope += "</metadataEnvelope>\n";
+    usd += "</bundleDescription>\n";
+
+    std::string out = "MIME-Version: 1.0\r\nContent-Type: multipart/related; boundary=\"boundary-5gmag\"\r\n\r\n";
+    part(out, "application/mbms-envelope+xml", "http://localhost/envelope.xml", envelope);
+    part(out, "application/mbms-user-service-description+xml", "http://localhost/usd.xml", usd);
+    out += fragments;
+    out += "--boundary-5gmag--\r\n";
+    return out;
+  }
+
+  /**
+   *  The bootstrap as received over FLUTE with gzip content encoding
+   */
+  auto gzip_file(const std::string& content) -> std::shared_ptr<LibFlute::File> {
+    auto gzipped = gzip::compress(content.data(), content.size());
+    LibFlute::FecOti fec_oti{};
+    fec_oti.transfer_length = gzipped.size();
+    return std::make_shared<LibFlute::File>(1, fec_oti, "http://localhost/bootstrap.multipart", "application/x-gzip",
+        0, gzipped.data(), gzipped.size(), true);
+  }
+
+  struct Environment {
+    Environment() {
+      cfg.readString(CONFIG);
+      cache = std::make_unique<MBMS_RT::CacheManagement>(cfg, io_service);
+    }
+    auto announcement() -> std::unique_ptr<MBMS_RT::ServiceAnnouncement> {
+      return std::make_unique<MBMS_RT::ServiceAnnouncement>(cfg, "000001", "", 0, "lo", io_service, *cache, false,
+          nullptr, nullptr, nullptr,
+          [this](const std::string& id) { auto it = services.find(id); return it == services.end() ? nullptr : it->second; },
+          [this](const std::string& id, std::shared_ptr<MBMS_RT::Service> service) { services[id] = std::move(service); });
+    }
+
+    libconfig::Config cfg;
+    boost::asio::io_service io_service;
+    std::unique_ptr<MBMS_RT::CacheManagement> cache;
+    std::map<std::string, std::shared_ptr<MBMS_RT::Service>> services;
+  };
+}
+
+int main(int argc, char** argv) {
+  MBMS_RT::Bench::Runner runner(argc, argv);
+  Environment env;
+
+  for (int services : { 1, 8, 32 }) {
+    auto content = bootstrap(services);
+    auto suffix = "/" + std::to_string(services);
+
+    // First reception: every service and its streams are set up
+    runner.run("ServiceAnnouncement/parse_bootstrap/initial" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          env.services.clear();
+          auto sa = env.announcement();
+          sa->parse_bootstrap(content);
+          do_not_optimize(sa->update_stats());
+        }
+      }, content.size());
+
+    // A repeated carousel version: items are compared, no service is touched
+    auto sa = env.announcement();
+    env.services.clear();
+    sa->parse_bootstrap(content);
+    runner.run("ServiceAnnouncement/parse_bootstrap/unchanged" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          sa->parse_bootstrap(content);
+          do_not_optimize(sa->update_stats());
+        }
+      }, content.size());
+
+    // One service's SDP changes between versions
+    std::array<std::string, 2> versions = { content, bootstrap(services, 100) };
+    runner.run("ServiceAnnouncement/parse_bootstrap/one_changed" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          sa->parse_bootstrap(versions[i % 2]);
+          do_not_optimize(sa->update_stats());
+        }
+      }, content.size());
+  }
+
+  // Bouquets of about 1 and 5 MB received gzip compressed, parsed while they are inflated. Throughput
+  // is given in bytes of the inflated bootstrap.
+  for (int services : { 100, 500 }) {
+    auto content = bootstrap(services, 0, 60);
+    auto file = gzip_file(content);
+    auto suffix = "/" + std::to_string(content.size() / 1024) + "KiB";
+
+    runner.run("ServiceAnnouncement/parse_bootstrap/gzip_bouquet_initial" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          env.services.clear();
+          auto sa = env.announcement();
+          sa->parse_bootstrap(file, std::chrono::steady_clock::now());
+          do_not_optimize(sa->update_stats());
+        }
+      }, content.size());
+
+    auto sa = env.announcement();
+    env.services.clear();
+    sa->parse_bootstrap(file, std::chrono::steady_clock::now());
+    runner.run("ServiceAnnouncement/parse_bootstrap/gzip_bouquet_unchanged" + suffix, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          sa->parse_bootstrap(file, std::chrono::steady_clock::now());
+          do_not_optimize(sa->update_stats());
+        }
+      }, content.size());
+  }
+
+  auto session = sdp(0, 1);
+  auto stream = std::make_shared<MBMS_RT::ContentStream>(base(0) + "manifest.m3u8", "lo", env.io_service, *env.cache,
+      MBMS_RT::DeliveryProtocol::HLS, env.cfg);
+  runner.run("ContentStream/configure_5gbc_delivery_from_sdp", [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        do_not_optimize(stream->configure_5gbc_delivery_from_sdp(session));
+      }
+    }, session.size());
+
+  return runner.finish();
+}
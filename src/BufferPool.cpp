@@ -0,0 +1,115 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "BufferPool.h"
+#include <cstdlib>
+#include <new>
+#include "spdlog/spdlog.h"
+
+MBMS_RT::PooledBuffer::~PooledBuffer()
+{
+  _pool->release(_data, _capacity, _requested, _size_class);
+}
+
+MBMS_RT::BufferPool::~BufferPool()
+{
+  for (auto& list : _free_lists) {
+    for (auto data : list) {
+      free(data);
+    }
+  }
+}
+
+auto MBMS_RT::BufferPool::size_class_for(size_t size) -> int
+{
+  size_t class_size = MIN_CLASS_SIZE;
+  for (int size_class = 0; size_class < CLASS_COUNT; size_class++) {
+    if (size <= class_size) {
+      return size_class;
+    }
+    class_size <<= 1;
+  }
+  return -1;
+}
+
+auto MBMS_RT::BufferPool::acquire(size_t size) -> std::shared_ptr<PooledBuffer>
+{
+  auto size_class = size_class_for(size);
+  // Oversized buffers are allocated exactly and never retained
+  size_t capacity = size_class < 0 ? size : (MIN_CLASS_SIZE << size_class);
+  char* data = nullptr;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (size_class >= 0 && !_free_lists[size_class].empty()) {
+      data = _free_lists[size_class].back();
+      _free_lists[size_class].pop_back();
+      _free_bytes -= capacity;
+      _hits++;
+    } else {
+      _misses++;
+    }
+    _in_use_bytes += capacity;
+    _requested_bytes += size;
+    _buffers_in_use++;
+  }
+  if (data == nullptr) {
+    data = static_cast<char*>(malloc(capacity));
+    if (data == nullptr) {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      _in_use_bytes -= capacity;
+      _requested_bytes -= size;
+      _buffers_in_use--;
+      throw std::bad_alloc();
+    }
+  }
+  return std::make_shared<PooledBuffer>(shared_from_this(), data, capacity, size, size_class);
+}
+
+auto MBMS_RT::BufferPool::release(char* data, size_t capacity, size_t requested, int size_class) -> void
+{
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _in_use_bytes -= capacity;
+    _requested_bytes -= requested;
+    _buffers_in_use--;
+    if (size_class >= 0 && _free_bytes + capacity <= _max_retained_bytes) {
+      _free_lists[size_class].push_back(data);
+      _free_bytes += capacity;
+      return;
+    }
+  }
+  free(data);
+}
+
+auto MBMS_RT::BufferPool::stats() const -> Stats
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  uint64_t buffers_free = 0;
+  for (const auto& list : _free_lists) {
+    buffers_free += list.size();
+  }
+  return Stats{
+    _in_use_bytes,
+    _requested_bytes,
+    _free_bytes,
+    _buffers_in_use,
+    buffers_free,
+    _hits,
+    _misses,
+    _in_use_bytes == 0 ? 0.0 : 1.0 - static_cast<double>(_requested_bytes) / static_cast<double>(_in_use_bytes)
+  };
+}
@@ -0,0 +1,100 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace MBMS_RT {
+  class BufferPool;
+
+  /**
+   *  A segment buffer taken from a BufferPool. Returns its memory to the pool when destroyed.
+   */
+  class PooledBuffer {
+    public:
+      PooledBuffer(std::shared_ptr<BufferPool> pool, char* data, size_t capacity, size_t requested, int size_class)
+        : _pool( std::move(pool) ), _data( data ), _capacity( capacity ), _requested( requested ), _size_class( size_class ) {};
+      virtual ~PooledBuffer();
+      PooledBuffer(const PooledBuffer&) = delete;
+      PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+      char* data() const { return _data; };
+      size_t capacity() const { return _capacity; };
+      size_t requested() const { return _requested; };
+
+    private:
+      std::shared_ptr<BufferPool> _pool;
+      char* _data;
+      size_t _capacity;
+      size_t _requested;
+      int _size_class;
+  };
+
+  /**
+   *  Size-classed free lists for segment sized buffers.
+   *
+   *  Buffers are rounded up to a power of two between 64 KiB and 32 MiB and reused for later
+   *  requests of the same class, which keeps segment churn from fragmenting the heap. The amount of
+   *  memory retained in the free lists is bounded, buffers returned beyond that are released.
+   */
+  class BufferPool : public std::enable_shared_from_this<BufferPool> {
+    public:
+      BufferPool(uint64_t max_retained_bytes)
+        : _max_retained_bytes( max_retained_bytes ) {};
+      virtual ~BufferPool();
+
+      /**
+       *  @return A buffer of at least size bytes
+       */
+      std::shared_ptr<PooledBuffer> acquire(size_t size);
+
+      struct Stats {
+        uint64_t in_use_bytes;        /**< capacity of all buffers currently handed out */
+        uint64_t requested_bytes;     /**< bytes actually requested for these buffers */
+        uint64_t free_bytes;          /**< capacity retained in the free lists */
+        uint64_t buffers_in_use;
+        uint64_t buffers_free;
+        uint64_t hits;                /**< acquisitions served from a free list */
+        uint64_t misses;              /**< acquisitions that had to allocate */
+        double fragmentation;         /**< share of in-use capacity not covered by requested bytes */
+      };
+      Stats stats() const;
+
+    private:
+      friend class PooledBuffer;
+      void release(char* data, size_t capacity, size_t requested, int size_class);
+
+      static constexpr size_t MIN_CLASS_SIZE = 64 * 1024;
+      static constexpr int CLASS_COUNT = 10;
+      static int size_class_for(size_t size);
+
+      mutable std::mutex _mutex;
+      std::array<std::vector<char*>, CLASS_COUNT> _free_lists;
+      uint64_t _max_retained_bytes;
+      uint64_t _in_use_bytes = 0;
+      uint64_t _requested_bytes = 0;
+      uint64_t _free_bytes = 0;
+      uint64_t _buffers_in_use = 0;
+      uint64_t _hits = 0;
+      uint64_t _misses = 0;
+  };
+}
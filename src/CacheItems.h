@@ -17,9 +17,17 @@
 
 #pragma once
 
+#include <atomic>
+#include <list>
+#include <string>
+#include <vector>
 #include <libconfig.h++>
 #include <boost/asio.hpp>
+#include <pplx/pplxtasks.h>
 #include "seamless/Segment.h"
+#include "ContentSnapshot.h"
+#include "HttpCaching.h"
+#include "ItemPayload.h"
 #include "ItemSource.h"
 
 namespace MBMS_RT {
@@ -38,10 +46,72 @@ namespace MBMS_RT {
         Manifest
       };
       virtual ItemType item_type() const = 0;
-      virtual char* buffer() const = 0;
+
+      /**
+       *  @return A view of the item data that stays valid for as long as it is held
+       */
+      virtual ItemPayload payload() const = 0;
       virtual uint32_t content_length() const = 0;
+
+      /**
+       *  @return The memory the item data occupies, which is what counts against the cache budget.
+       *          Larger than content_length() for data held in a rounded up pool buffer.
+       */
+      virtual uint32_t memory_size() const { return content_length(); };
+
+      /**
+       *  @return The payload in the content coding preferred by an Accept-Encoding header, payload()
+       *          for items that are only kept unencoded
+       */
+      virtual ItemPayload negotiated_payload(const std::string& /*accept_encoding*/) const { return payload(); };
+
+      /**
+       *  Where payload() lives in a file, for sending it with sendfile(2)
+       */
+      struct FileRegion {
+        std::shared_ptr<const void> holder;   // keeps fd open for as long as the region is in use
+        int fd = -1;
+        uint64_t offset = 0;
+      };
+
+      /**
+       *  @return The file region holding the payload, fd -1 for items only held in memory
+       */
+      virtual FileRegion file_region() const { return {}; };
+
+      /**
+       *  Try to make the item data available if payload() is empty, e.g. by fetching it from the CDN.
+       *
+       *  @return A task that yields true once payload() has data
+       */
+      virtual pplx::task<bool> fetch_content() { return pplx::task_from_result(false); };
+
+      /**
+       *  @return The length of the item if payload() is empty because it is still arriving, and
+       *          stream_content can serve it meanwhile. 0 otherwise.
+       */
+      virtual uint64_t length_in_reception() const { return 0; };
+
+      /**
+       *  Deliver the item data in order as it arrives, see Segment::stream
+       *
+       *  @return A task that yields true once all length_in_reception() bytes were delivered
+       */
+      virtual pplx::task<bool> stream_content(Segment::chunk_callback_t /*on_chunk*/) {
+        return pplx::task_from_result(false);
+      };
       virtual ItemSource item_source() const  = 0;
 
+      /**
+       *  Called for every request served from this item, to let its producer track demand
+       */
+      virtual void record_request() {};
+
+      /**
+       *  @return The latency trace of the item, nullptr if it is not sampled
+       */
+      virtual std::shared_ptr<SegmentTrace> trace() const { return nullptr; };
+
       std::string item_source_as_string() const {
         switch (item_source()) {
           case ItemSource::Broadcast:
@@ -59,9 +129,25 @@ namespace MBMS_RT {
       std::string content_location() const { return _content_location; };
       virtual unsigned long received_at() const { return _received_at; };
 
+      /**
+       *  Lifetime in seconds for downstream HTTP caches. 0 requires revalidation on every use, -1 (the
+       *  default) sends no caching headers.
+       */
+      int max_age() const { return _max_age; };
+      void set_max_age(int seconds) { _max_age = seconds; };
+
     private:
       std::string _content_location;
       unsigned long _received_at;
+      std::atomic<int> _max_age = -1;
+
+      // Eviction bookkeeping, owned by CacheManagement and only touched under its accounting lock
+      friend class CacheManagement;
+      std::list<CacheItem*>::iterator _age_pos;
+      bool _age_linked = false;
+      uint32_t _accounted_size = 0;
+      ItemSource _accounted_source = ItemSource::Unavailable;
+      unsigned long _accounted_received_at = 0;   // position key in the age list
   };
 
   class CachedFile : public CacheItem {
@@ -74,12 +160,15 @@ namespace MBMS_RT {
       virtual ~CachedFile() = default;
 
       virtual ItemType item_type() const { return ItemType::File; };
-      virtual char* buffer() const { return _file->buffer(); };
+      virtual ItemPayload payload() const { return { _file, _file->buffer(), content_length() }; };
       virtual uint32_t content_length() const { return _file->length(); };
       virtual ItemSource item_source() const { return ItemSource::Broadcast; };
+      virtual std::shared_ptr<SegmentTrace> trace() const { return _trace; };
+      void set_trace(std::shared_ptr<SegmentTrace> trace) { _trace = std::move(trace); };
 
     private:
       std::shared_ptr<LibFlute::File> _file;
+      std::shared_ptr<SegmentTrace> _trace;
   };
   class CachedSegment : public CacheItem {
     public:
@@ -91,9 +180,17 @@ namespace MBMS_RT {
       virtual ~CachedSegment() = default;
 
       virtual ItemType item_type() const { return ItemType::Segment; };
-      virtual char* buffer() const { return _segment->buffer(); };
+      virtual ItemPayload payload() const { return _segment->payload(); };
+      virtual pplx::task<bool> fetch_content() { return _segment->fetch(); };
+      virtual uint64_t length_in_reception() const { return _segment->length_in_reception(); };
+      virtual pplx::task<bool> stream_content(Segment::chunk_callback_t on_chunk) {
+        return _segment->stream(std::move(on_chunk));
+      };
       virtual uint32_t content_length() const { return _segment->content_length(); };
+      virtual uint32_t memory_size() const { return _segment->memory_size(); };
       virtual ItemSource item_source() const { return _segment->data_source(); };
+      virtual void record_request() { _segment->record_request(); };
+      virtual std::shared_ptr<SegmentTrace> trace() const { return _segment->trace(); };
 
       virtual unsigned long received_at() const { return _segment->received_at(); };
 
@@ -104,38 +201,65 @@ namespace MBMS_RT {
   class CachedPlaylist : public CacheItem {
     public:
       CachedPlaylist(const std::string& content_location, unsigned long received_at,
-          std::function<const std::string&(void)> playlist_cb)
+          std::shared_ptr<const SnapshotPublisher> playlist)
         : CacheItem( content_location, received_at ) 
-        , _playlist_cb( playlist_cb ) 
+        , _playlist( std::move(playlist) ) 
         {}
       virtual ~CachedPlaylist() = default;
 
       virtual ItemType item_type() const { return ItemType::Playlist; };
-      virtual char* buffer() const { return (char*)_playlist_cb().c_str(); };
-      virtual uint32_t content_length() const { return _playlist_cb().size(); };
+      virtual ItemPayload payload() const { return snapshot_payload(_playlist->current()); };
+      virtual ItemPayload negotiated_payload(const std::string& accept_encoding) const {
+        // Both variants come from one snapshot, so they always match each other
+        auto snapshot = _playlist->current();
+        auto payload = snapshot_payload(snapshot);
+        if (!snapshot || snapshot->encoded().empty()) {
+          return payload;
+        }
+        payload.varies = true;
+        std::vector<std::string> codings;
+        for (const auto& encoded : snapshot->encoded()) {
+          codings.push_back(encoded.coding);
+        }
+        auto coding = HttpCaching::negotiate_encoding(accept_encoding, codings);
+        for (const auto& encoded : snapshot->encoded()) {
+          if (encoded.coding == coding) {
+            payload.data = encoded.content.data();
+            payload.length = static_cast<uint32_t>(encoded.content.size());
+            payload.content_encoding = coding;
+          }
+        }
+        return payload;
+      };
+      virtual uint32_t content_length() const {
+        auto snapshot = _playlist->current();
+        return snapshot ? snapshot->content().size() : 0;
+      };
       virtual ItemSource item_source() const { return ItemSource::Generated; };
-      virtual unsigned long received_at() const { return time(nullptr); };
+      virtual unsigned long received_at() const {
+        auto snapshot = _playlist->current();
+        return snapshot ? snapshot->created_at() : 0;
+      };
+
+    protected:
+      static ItemPayload snapshot_payload(const std::shared_ptr<const ContentSnapshot>& snapshot) {
+        if (!snapshot) return {};
+        return { snapshot, snapshot->content().data(),
+          static_cast<uint32_t>(snapshot->content().size()), snapshot->version() };
+      };
 
     private:
-      std::function<const std::string&(void)> _playlist_cb;
+      std::shared_ptr<const SnapshotPublisher> _playlist;
   };
 
-  class CachedManifest : public CacheItem {
+  class CachedManifest : public CachedPlaylist {
     public:
       CachedManifest(const std::string& content_location, unsigned long received_at,
-          std::function<const std::string&(void)> playlist_cb)
-        : CacheItem( content_location, received_at ) 
-        , _playlist_cb( playlist_cb ) 
+          std::shared_ptr<const SnapshotPublisher> manifest)
+        : CachedPlaylist( content_location, received_at, std::move(manifest) ) 
         {}
       virtual ~CachedManifest() = default;
 
       virtual ItemType item_type() const { return ItemType::Manifest; };
-      virtual char* buffer() const { return (char*)_playlist_cb().c_str(); };
-      virtual uint32_t content_length() const { return _playlist_cb().size(); };
-      virtual ItemSource item_source() const { return ItemSource::Generated; };
-      virtual unsigned long received_at() const { return time(nullptr); };
-
-    private:
-      std::function<const std::string&(void)> _playlist_cb;
   };
 }
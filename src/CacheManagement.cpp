@@ -16,42 +16,343 @@
 //
 
 #include "CacheManagement.h"
+#include "Logging.h"
+#include <iterator>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <malloc.h>
 #include "spdlog/spdlog.h"
 
 MBMS_RT::CacheManagement::CacheManagement(const libconfig::Config& cfg, boost::asio::io_service& io_service)
   : _io_service(io_service)
+  , _disk(std::make_unique<DiskSegmentStore>(cfg))
 {
-  cfg.lookupValue("mw.cache.max_total_size", _max_cache_size);
-  _max_cache_size *= 1024 * 1024;
+  unsigned max_cache_size = 512;
+  cfg.lookupValue("mw.cache.max_total_size", max_cache_size);
+  _max_cache_size = static_cast<uint64_t>(max_cache_size) * 1024 * 1024;
   cfg.lookupValue("mw.cache.max_file_age", _max_cache_file_age);
+
+  // Optional sub-budgets per item source. 0 means the source is only bounded by the total limit.
+  unsigned max_size = 0;
+  if (cfg.lookupValue("mw.cache.max_broadcast_size", max_size)) {
+    _max_size_by_source[source_index(ItemSource::Broadcast)] = static_cast<uint64_t>(max_size) * 1024 * 1024;
+  }
+  max_size = 0;
+  if (cfg.lookupValue("mw.cache.max_cdn_size", max_size)) {
+    _max_size_by_source[source_index(ItemSource::CDN)] = static_cast<uint64_t>(max_size) * 1024 * 1024;
+  }
+  max_size = 0;
+  if (cfg.lookupValue("mw.cache.max_generated_size", max_size)) {
+    _max_size_by_source[source_index(ItemSource::Generated)] = static_cast<uint64_t>(max_size) * 1024 * 1024;
+  }
+
+  uint64_t max_pooled_size = _max_cache_size / 4;
+  unsigned max_pooled_mb = 0;
+  if (cfg.lookupValue("mw.cache.max_pooled_size", max_pooled_mb)) {
+    max_pooled_size = std::min(static_cast<uint64_t>(max_pooled_mb) * 1024 * 1024, _max_cache_size);
+  }
+  _buffer_pool = std::make_shared<BufferPool>(max_pooled_size);
+
+  // Segment buffers allocated outside the pool (FLUTE reception) are served from mmap above this
+  // size, so they are returned to the OS on release instead of fragmenting the heap.
+  unsigned mmap_threshold_kb = 0;
+  if (cfg.lookupValue("mw.cache.mmap_threshold_kb", mmap_threshold_kb) && mmap_threshold_kb > 0) {
+    if (mallopt(M_MMAP_THRESHOLD, static_cast<int>(mmap_threshold_kb) * 1024) == 0) {
+      spdlog::warn("Cache management could not set mmap threshold to {} kB", mmap_threshold_kb);
+    }
+  }
 }
 
-auto MBMS_RT::CacheManagement::check_file_expiry_and_cache_size() -> void
+auto MBMS_RT::CacheManagement::add_item(std::shared_ptr<CacheItem> item) -> void
 {
-  std::multimap<unsigned, std::string> items_by_age;
-  for (auto it = _cache_items.cbegin(); it != _cache_items.cend();) {
-    spdlog::debug("checking {}", it->second->content_location());
-    if (it->second->received_at() != 0) {
-      auto age = time(nullptr) - it->second->received_at();
-      if (age > _max_cache_file_age) {
-        spdlog::info("Cache management deleting expired item at {} after {} seconds",
-            it->second->content_location(), age);
-        it = _cache_items.erase(it);
-      } else {
-        items_by_age.insert(std::make_pair(age, it->first));
-        ++it;
-      }
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  auto& shard = shard_for(item->content_location());
+  std::shared_ptr<CacheItem> replaced;
+  {
+    const std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto& slot = shard.items[item->content_location()];
+    replaced = std::move(slot);
+    slot = item;
+  }
+  _version++;
+  if (replaced) {
+    unaccount(*replaced);
+  }
+  account(*item);
+  enforce_size_limits();
+}
+
+auto MBMS_RT::CacheManagement::remove_item(const std::string& location) -> void
+{
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  auto removed = erase_from_index(location);
+  if (removed) {
+    spill(*removed);
+    unaccount(*removed);
+  }
+}
+
+auto MBMS_RT::CacheManagement::item_changed(const std::string& location) -> void
+{
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  // Only items in memory are accounted, a disk tier hit is a temporary copy
+  auto item = find_in_memory(location);
+  if (item) {
+    _version++;
+    unaccount(*item);
+    account(*item);
+    enforce_size_limits();
+  }
+}
+
+auto MBMS_RT::CacheManagement::find_item(const std::string& location) const -> std::shared_ptr<CacheItem>
+{
+  auto& metrics = Metrics::instance();
+  if (auto item = find_in_memory(location)) {
+    metrics.cache_lookup(true, item->item_source());
+    return item;
+  }
+  auto item = _disk->find(location);
+  metrics.cache_lookup(item != nullptr, item ? item->item_source() : ItemSource::Unavailable, true);
+  return item;
+}
+
+auto MBMS_RT::CacheManagement::find_in_memory(const std::string& location) const -> std::shared_ptr<CacheItem>
+{
+  const auto& shard = shard_for(location);
+  const std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.items.find(location);
+  return it == shard.items.end() ? nullptr : it->second;
+}
+
+auto MBMS_RT::CacheManagement::for_each_item(const std::function<void(const std::shared_ptr<CacheItem>&)>& fn) const -> void
+{
+  for (const auto& shard : _shards) {
+    const std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    for (const auto& item : shard.items) {
+      fn(item.second);
+    }
+  }
+}
+
+auto MBMS_RT::CacheManagement::item_count() const -> size_t
+{
+  size_t count = 0;
+  for (const auto& shard : _shards) {
+    const std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    count += shard.items.size();
+  }
+  return count;
+}
+
+auto MBMS_RT::CacheManagement::total_size() const -> uint64_t
+{
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  return _total_cache_size;
+}
+
+auto MBMS_RT::CacheManagement::size_by_source(ItemSource source) const -> uint64_t
+{
+  if (source == ItemSource::Unavailable) return 0;
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  return _size_by_source[source_index(source)];
+}
+
+auto MBMS_RT::CacheManagement::charge_external(uint64_t size) -> void
+{
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  _external_size += size;
+  _total_cache_size += size;
+  enforce_size_limits();
+}
+
+auto MBMS_RT::CacheManagement::release_external(uint64_t size) -> void
+{
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  size = std::min(size, _external_size);
+  _external_size -= size;
+  _total_cache_size -= size;
+}
+
+auto MBMS_RT::CacheManagement::external_size() const -> uint64_t
+{
+  const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+  return _external_size;
+}
+
+// Must be called with _accounting_mutex held
+auto MBMS_RT::CacheManagement::erase_from_index(const std::string& location, const CacheItem* only_if) -> std::shared_ptr<CacheItem>
+{
+  auto& shard = shard_for(location);
+  const std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.items.find(location);
+  if (it == shard.items.end() || (only_if != nullptr && it->second.get() != only_if)) {
+    return nullptr;
+  }
+  auto item = std::move(it->second);
+  shard.items.erase(it);
+  _version++;
+  return item;
+}
+
+// Must be called with _accounting_mutex held
+auto MBMS_RT::CacheManagement::account(CacheItem& item) -> void
+{
+  auto source = item.item_source();
+  if (source == ItemSource::Unavailable) {
+    return;
+  }
+  // Pooled buffers are charged with their whole size class, the rounding is memory the cache holds
+  auto size = item.memory_size();
+  if (size == 0) {
+    return;
+  }
+  auto idx = source_index(source);
+  auto received_at = item.received_at();
+  if (received_at == 0) {
+    received_at = static_cast<unsigned long>(time(nullptr));
+  }
+  item._accounted_size = size;
+  item._accounted_source = source;
+  item._accounted_received_at = received_at;
+  _size_by_source[idx] += size;
+  if (source != ItemSource::Generated) {
+    _total_cache_size += size;
+  }
+
+  // Keep the list ordered by receive time. Items are mostly filled in that order, so the position is
+  // found from the back in a step or two.
+  auto& list = _age_lists[idx];
+  auto pos = list.end();
+  while (pos != list.begin() && (*std::prev(pos))->_accounted_received_at > received_at) {
+    --pos;
+  }
+  item._age_pos = list.insert(pos, &item);
+  item._age_linked = true;
+}
+
+// Must be called with _accounting_mutex held
+auto MBMS_RT::CacheManagement::unaccount(CacheItem& item) -> void
+{
+  if (!item._age_linked) {
+    return;
+  }
+  auto idx = source_index(item._accounted_source);
+  _age_lists[idx].erase(item._age_pos);
+  _size_by_source[idx] -= item._accounted_size;
+  if (item._accounted_source != ItemSource::Generated) {
+    _total_cache_size -= item._accounted_size;
+  }
+  item._age_linked = false;
+  item._accounted_size = 0;
+  item._accounted_source = ItemSource::Unavailable;
+}
+
+// Must be called with _accounting_mutex held
+auto MBMS_RT::CacheManagement::evict(CacheItem* item, Metrics::EvictionReason reason) -> void
+{
+  static constexpr std::array<const char*, 3> REASONS = { "source size limit", "cache size limit", "expired" };
+  static Logging::RateLimitedLog evict_log(Logging::Category::Cache);
+  evict_log.info("Cache management deleting item at {} ({})", item->content_location(),
+      REASONS[static_cast<size_t>(reason)]);
+  Metrics::instance().eviction(reason);
+  // Keep the item alive until it is unlinked, the index may hold the last reference
+  auto removed = erase_from_index(item->content_location(), item);
+  if (removed) {
+    spill(*removed);
+  }
+  unaccount(*item);
+}
+
+// Must be called with _accounting_mutex held
+auto MBMS_RT::CacheManagement::spill(CacheItem& item) -> void
+{
+  if (!_disk->enabled() || item.item_type() == CacheItem::ItemType::Playlist ||
+      item.item_type() == CacheItem::ItemType::Manifest) {
+    return;
+  }
+  auto source = item.item_source();
+  if (source != ItemSource::Broadcast && source != ItemSource::CDN) {
+    return;
+  }
+  // Received playlists and manifests are only valid while live
+  auto location = item.content_location();
+  if (is_manifest_location(location)) {
+    return;
+  }
+  _disk->store(location, item.payload(), item.received_at(), source);
+}
+
+auto MBMS_RT::CacheManagement::is_manifest_location(const std::string& location) -> bool
+{
+  for (const auto* suffix : { ".m3u8", ".mpd", ".sdp" }) {
+    auto length = strlen(suffix);
+    if (location.size() >= length && location.compare(location.size() - length, length, suffix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+auto MBMS_RT::CacheManagement::record_served(const CacheItem& item) const -> void
+{
+  if (_first_segment_served_ms >= 0) {
+    return;
+  }
+  auto type = item.item_type();
+  if ((type != CacheItem::ItemType::Segment && type != CacheItem::ItemType::File) ||
+      is_manifest_location(item.content_location())) {
+    return;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - _started_at).count();
+  int64_t unset = -1;
+  if (_first_segment_served_ms.compare_exchange_strong(unset, elapsed)) {
+    spdlog::info("First segment served {} ms after startup ({})", elapsed, item.content_location());
+  }
+}
+
+// Must be called with _accounting_mutex held
+auto MBMS_RT::CacheManagement::enforce_size_limits() -> void
+{
+  for (size_t idx = 0; idx < SOURCE_COUNT; idx++) {
+    auto& list = _age_lists[idx];
+    while (_max_size_by_source[idx] > 0 && _size_by_source[idx] > _max_size_by_source[idx] && !list.empty()) {
+      evict(list.front(), Metrics::EvictionReason::SourceSizeLimit);
+    }
+  }
+
+  // Generated items are tiny and required to play a service. They are not part of the total, which
+  // only received content is evicted for, and are bounded by max_generated_size alone.
+  auto& broadcast = _age_lists[source_index(ItemSource::Broadcast)];
+  auto& cdn = _age_lists[source_index(ItemSource::CDN)];
+  while (_total_cache_size > _max_cache_size && !(broadcast.empty() && cdn.empty())) {
+    if (cdn.empty() ||
+        (!broadcast.empty() && broadcast.front()->_accounted_received_at <= cdn.front()->_accounted_received_at)) {
+      evict(broadcast.front(), Metrics::EvictionReason::CacheSizeLimit);
     } else {
-      ++it;
+      evict(cdn.front(), Metrics::EvictionReason::CacheSizeLimit);
     }
   }
-  uint32_t total_size = 0;
-  for (const auto& it : items_by_age) {
-    total_size += _cache_items[it.second]->content_length();
-    if (total_size > _max_cache_size) {
-        spdlog::info("Cache management deleting item at {} (aged {} secs) due to cache size limit",
-            it.second, it.first);
-        _cache_items.erase(it.second);
+}
+
+auto MBMS_RT::CacheManagement::check_file_expiry_and_cache_size() -> void
+{
+  {
+    const std::lock_guard<std::mutex> accounting_lock(_accounting_mutex);
+    auto now = time(nullptr);
+    for (auto source : { ItemSource::Broadcast, ItemSource::CDN }) {
+      auto& list = _age_lists[source_index(source)];
+      while (!list.empty()) {
+        auto oldest = list.front();
+        if (now - static_cast<time_t>(oldest->_accounted_received_at) <= _max_cache_file_age) {
+          break;
+        }
+        evict(oldest, Metrics::EvictionReason::Expired);
+      }
     }
+    enforce_size_limits();
   }
+  _disk->maintain();
 }
@@ -17,30 +17,148 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <libconfig.h++>
 #include <boost/asio.hpp>
+#include "BufferPool.h"
 #include "CacheItems.h"
+#include "DiskSegmentStore.h"
+#include "Metrics.h"
 
 namespace MBMS_RT {
+  /**
+   *  Index of all items available for delivery, keyed by content location.
+   *
+   *  The index is split into shards by the hash of the content location. Each shard has its own
+   *  reader/writer lock, so lookups from the HTTP worker threads run concurrently with each other and
+   *  only contend with writers (FLUTE / CDN completion paths) that hit the same shard.
+   *
+   *  Byte totals are kept per item source and updated when an item is added, filled or removed. Items
+   *  holding data are linked into a list per source ordered by receive time, so expiry and size
+   *  eviction only ever look at the oldest entries.
+   *
+   *  With mw.cache.disk enabled, received segments leaving the index are written to a DiskSegmentStore
+   *  and lookups that miss the index are served from there.
+   */
   class CacheManagement {
     public:
       CacheManagement(const libconfig::Config& cfg, boost::asio::io_service& io_service);
       virtual ~CacheManagement() = default;
 
-      void add_item(std::shared_ptr<CacheItem> item) {
-        _cache_items[item->content_location()] = item;
-      };
-      void remove_item(const std::string& location) { _cache_items.erase(location); };
-      const std::map<std::string, std::shared_ptr<CacheItem>>& item_map() const { return _cache_items; };
+      void add_item(std::shared_ptr<CacheItem> item);
+      void remove_item(const std::string& location);
+
+      /**
+       *  Look up the item at a content location, in memory first and then in the disk tier.
+       *
+       *  @return The item, or nullptr if there is none at this location
+       */
+      std::shared_ptr<CacheItem> find_item(const std::string& location) const;
+
+      /**
+       *  Call fn for every item in the cache. Each shard is read-locked while its items are visited,
+       *  so fn must not call back into add_item / remove_item.
+       */
+      void for_each_item(const std::function<void(const std::shared_ptr<CacheItem>&)>& fn) const;
+      size_t item_count() const;
+
+      /**
+       *  Re-account the item at a location after its content has been filled or replaced.
+       */
+      void item_changed(const std::string& location);
 
       void check_file_expiry_and_cache_size();
 
+      /**
+       *  @return A counter that changes whenever an item is added, removed or changes its content
+       */
+      uint64_t version() const { return _version; };
+
+      /**
+       *  Called by the HTTP servers for every item they serve. The first media segment served is
+       *  logged and kept as the startup latency.
+       */
+      void record_served(const CacheItem& item) const;
+
+      /**
+       *  @return Milliseconds from startup until the first media segment was served, -1 until then
+       */
+      int64_t first_segment_served_ms() const { return _first_segment_served_ms; };
+
+      /**
+       *  @return Bytes held by received (broadcast and CDN) items, which max_total_size applies to
+       */
+      uint64_t total_size() const;
+      uint64_t size_by_source(ItemSource source) const;
+      uint64_t max_total_size() const { return _max_cache_size; };
+
+      /**
+       *  Charge memory held outside the index, like FLUTE files waiting for their playlist entry,
+       *  against the total budget. Cached items are evicted if the total limit is exceeded.
+       */
+      void charge_external(uint64_t size);
+      void release_external(uint64_t size);
+      uint64_t external_size() const;
+
+      /**
+       *  Pool for segment sized buffers. Its free lists are bounded by mw.cache.max_pooled_size, which
+       *  defaults to a quarter of the total cache budget.
+       */
+      std::shared_ptr<BufferPool> buffer_pool() const { return _buffer_pool; };
+
+      /**
+       *  Seconds of time-shift that playlists can offer beyond the segments held in memory, 0 without
+       *  the disk tier
+       */
+      unsigned dvr_window() const { return _disk->dvr_window(); };
+      bool disk_enabled() const { return _disk->enabled(); };
+      DiskSegmentStore::Stats disk_stats() const { return _disk->stats(); };
 
     private:
-      std::map<std::string, std::shared_ptr<CacheItem>> _cache_items;
-      unsigned _max_cache_size = 512;
-      unsigned _total_cache_size = 0;
+      static constexpr size_t SHARD_COUNT = 16;
+
+      struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<CacheItem>> items;
+      };
+      Shard& shard_for(const std::string& location) { return _shards[std::hash<std::string>{}(location) % SHARD_COUNT]; };
+      const Shard& shard_for(const std::string& location) const { return _shards[std::hash<std::string>{}(location) % SHARD_COUNT]; };
+
+      // Index into the per-source age lists and byte totals. Unavailable items are never linked.
+      static constexpr size_t SOURCE_COUNT = 3;
+      static size_t source_index(ItemSource source) { return static_cast<size_t>(source); };
+
+      std::shared_ptr<CacheItem> find_in_memory(const std::string& location) const;
+      std::shared_ptr<CacheItem> erase_from_index(const std::string& location, const CacheItem* only_if = nullptr);
+      void account(CacheItem& item);
+      void unaccount(CacheItem& item);
+      void evict(CacheItem* item, Metrics::EvictionReason reason);
+      void spill(CacheItem& item);
+      static bool is_manifest_location(const std::string& location);
+      void enforce_size_limits();
+
+      std::array<Shard, SHARD_COUNT> _shards;
+
+      mutable std::mutex _accounting_mutex;
+      std::array<std::list<CacheItem*>, SOURCE_COUNT> _age_lists;
+      std::array<uint64_t, SOURCE_COUNT> _size_by_source = {};
+      std::array<uint64_t, SOURCE_COUNT> _max_size_by_source = {};
+      uint64_t _max_cache_size = 512;
+      uint64_t _total_cache_size = 0;   // includes _external_size
+      uint64_t _external_size = 0;
       unsigned _max_cache_file_age = 30;
+      std::shared_ptr<BufferPool> _buffer_pool;
       boost::asio::io_service& _io_service;
+      std::unique_ptr<DiskSegmentStore> _disk;
+      std::chrono::steady_clock::time_point _started_at = std::chrono::steady_clock::now();
+      mutable std::atomic<int64_t> _first_segment_served_ms = -1;
+      std::atomic<uint64_t> _version = 0;
   };
 }
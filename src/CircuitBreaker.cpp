@@ -0,0 +1,115 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "CircuitBreaker.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+MBMS_RT::CircuitBreaker::CircuitBreaker(std::string name, unsigned failure_threshold,
+    std::chrono::milliseconds retry_interval, std::chrono::milliseconds max_retry_interval)
+  : _name(std::move(name))
+  , _failure_threshold(std::max(failure_threshold, 1U))
+  , _base_retry_interval(retry_interval)
+  , _max_retry_interval(std::max(max_retry_interval, retry_interval))
+  , _retry_interval(retry_interval)
+{
+}
+
+auto MBMS_RT::CircuitBreaker::allow() -> bool
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  switch (_state) {
+    case State::Closed:
+      return true;
+    case State::Open:
+      if (std::chrono::steady_clock::now() >= _retry_at) {
+        _state = State::HalfOpen;
+        _trial_in_flight = true;
+        return true;
+      }
+      break;
+    case State::HalfOpen:
+      if (!_trial_in_flight) {
+        _trial_in_flight = true;
+        return true;
+      }
+      break;
+  }
+  _rejected++;
+  return false;
+}
+
+auto MBMS_RT::CircuitBreaker::record_success() -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  if (_state != State::Closed) {
+    spdlog::info("{} is reachable again", _name);
+  }
+  _state = State::Closed;
+  _failures = 0;
+  _trial_in_flight = false;
+  _retry_interval = _base_retry_interval;
+}
+
+auto MBMS_RT::CircuitBreaker::record_failure() -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  _failures++;
+  if (_state == State::HalfOpen) {
+    _retry_interval = std::min(_retry_interval * 2, _max_retry_interval);
+  } else if (_state == State::Closed && _failures < _failure_threshold) {
+    return;
+  } else if (_state == State::Open) {
+    return;
+  }
+  spdlog::warn("{} failed {} times, not retrying for {} ms", _name, _failures, _retry_interval.count());
+  _state = State::Open;
+  _trial_in_flight = false;
+  _retry_at = std::chrono::steady_clock::now() + _retry_interval;
+}
+
+auto MBMS_RT::CircuitBreaker::record_abandoned() -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  // Only a half-open breaker is waiting on the outcome, let the next request be the trial
+  _trial_in_flight = false;
+}
+
+auto MBMS_RT::CircuitBreaker::state() const -> State
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _state;
+}
+
+auto MBMS_RT::CircuitBreaker::state_string() const -> std::string
+{
+  switch (state()) {
+    case State::Closed: return "closed";
+    case State::Open: return "open";
+    case State::HalfOpen: return "half-open";
+  }
+  return "";
+}
+
+auto MBMS_RT::CircuitBreaker::rejected() const -> uint64_t
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _rejected;
+}
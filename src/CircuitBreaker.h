@@ -0,0 +1,76 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace MBMS_RT {
+  /**
+   *  Stops requests to a failing peer for a while, so callers fail fast instead of queueing behind timeouts.
+   *
+   *  After failure_threshold consecutive failures the breaker opens; once the retry interval has passed a
+   *  single trial request is let through (half-open). Each failed trial doubles the interval, up to
+   *  max_retry_interval, a success closes the breaker again.
+   */
+  class CircuitBreaker {
+    public:
+      enum class State {
+        Closed,
+        Open,
+        HalfOpen
+      };
+
+      CircuitBreaker(std::string name, unsigned failure_threshold, std::chrono::milliseconds retry_interval,
+          std::chrono::milliseconds max_retry_interval);
+      virtual ~CircuitBreaker() = default;
+
+      /**
+       *  @return true if a request may be made now. Every allowed request must be followed by
+       *          record_success() or record_failure().
+       */
+      bool allow();
+      void record_success();
+      void record_failure();
+      /**
+       *  For an allowed request that was given up before its outcome was known, e.g. cancelled
+       */
+      void record_abandoned();
+
+      State state() const;
+      std::string state_string() const;
+      uint64_t rejected() const;
+
+    private:
+      std::string _name;
+      unsigned _failure_threshold;
+      std::chrono::milliseconds _base_retry_interval;
+      std::chrono::milliseconds _max_retry_interval;
+
+      mutable std::mutex _mutex;
+      State _state = State::Closed;
+      unsigned _failures = 0;
+      bool _trial_in_flight = false;
+      std::chrono::milliseconds _retry_interval;
+      std::chrono::steady_clock::time_point _retry_at;
+      uint64_t _rejected = 0;
+  };
+}
@@ -0,0 +1,113 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <gzip/compress.hpp>
+
+namespace MBMS_RT {
+  /**
+   *  An immutable copy of a generated playlist or manifest, with its content-coded variants.
+   */
+  class ContentSnapshot {
+    public:
+      struct Encoded {
+        std::string coding;     /**< Content-Encoding token */
+        std::string content;
+      };
+
+      ContentSnapshot(std::string content, uint64_t version, unsigned long created_at,
+          std::vector<Encoded> encoded = {})
+        : _content( std::move(content) )
+        , _version( version )
+        , _created_at( created_at )
+        , _encoded( std::move(encoded) ) {}
+
+      const std::string& content() const { return _content; };
+      uint64_t version() const { return _version; };
+      unsigned long created_at() const { return _created_at; };
+
+      /**
+       *  @return The variants in order of preference, only those smaller than the content
+       */
+      const std::vector<Encoded>& encoded() const { return _encoded; };
+
+    private:
+      const std::string _content;
+      const uint64_t _version;
+      const unsigned long _created_at;
+      const std::vector<Encoded> _encoded;
+  };
+
+  /**
+   *  Holds the current snapshot of a piece of generated content.
+   *
+   *  Writers publish a complete new snapshot, readers take a reference to the current one and keep
+   *  using it even if a newer version is published meanwhile. The gzip variant is made once per
+   *  version here, players polling a playlist all get the same bytes.
+   */
+  class SnapshotPublisher {
+    public:
+      SnapshotPublisher() = default;
+      virtual ~SnapshotPublisher() = default;
+
+      /**
+       *  Publish new content. The version only changes if the content differs from the current one.
+       *
+       *  @return true if a new version was published
+       */
+      bool publish(std::string content) {
+        const std::lock_guard<std::mutex> lock(_publish_mutex);
+        auto current = std::atomic_load(&_current);
+        if (current && current->content() == content) {
+          return false;
+        }
+        std::vector<ContentSnapshot::Encoded> encoded;
+        if (content.size() >= MIN_COMPRESS_SIZE) {
+          auto gzipped = gzip::compress(content.data(), content.size(), GZIP_LEVEL);
+          if (gzipped.size() < content.size()) {
+            encoded.push_back({ "gzip", std::move(gzipped) });
+          }
+        }
+        std::atomic_store(&_current, std::shared_ptr<const ContentSnapshot>(
+              std::make_shared<ContentSnapshot>(std::move(content), ++_version, time(nullptr), std::move(encoded))));
+        return true;
+      };
+
+      /**
+       *  @return The current snapshot, or nullptr if nothing has been published yet
+       */
+      std::shared_ptr<const ContentSnapshot> current() const { return std::atomic_load(&_current); };
+
+    private:
+      // Below this, headers outweigh what compression saves
+      static constexpr size_t MIN_COMPRESS_SIZE = 256;
+      // Compressed once per version and sent many times, so spend the CPU on the best ratio
+      static constexpr int GZIP_LEVEL = 9;
+
+      std::mutex _publish_mutex;
+      std::shared_ptr<const ContentSnapshot> _current;
+      // Start from the wall clock so ETags from before a restart do not match new content
+      uint64_t _version = static_cast<uint64_t>(time(nullptr)) << 16;
+  };
+}
@@ -15,8 +15,8 @@
 // under the License.
 //
 
-#include <regex>
 #include "ContentStream.h"
+#include "Logging.h"
 #include "CacheItems.h"
 #include "HlsPrimaryPlaylist.h"
 
@@ -26,76 +26,32 @@
 MBMS_RT::ContentStream::ContentStream(std::string base, std::string flute_if, boost::asio::io_service &io_service,
                                       CacheManagement &cache, DeliveryProtocol protocol, const libconfig::Config &cfg)
     : _5gbc_stream_iface(std::move(flute_if)), _cfg(cfg), _delivery_protocol(protocol), _base(std::move(base)),
-      _io_service(io_service), _cache(cache), _flute_thread{} {
+      _io_service(io_service), _strand(io_service), _cache(cache) {
+  cfg.lookupValue("mw.lazy_join.enabled", _lazy_join);
 }
 
 MBMS_RT::ContentStream::~ContentStream() {
   spdlog::debug("Destroying content stream at base {}", _base);
-  if (_flute_receiver) {
-    _flute_receiver->stop();
-    _flute_thread.join();
+  if (_multicast_receiver) {
+    _multicast_receiver->remove_session(_flute_session);
   }
 }
 
 auto MBMS_RT::ContentStream::configure_5gbc_delivery_from_sdp(const std::string &sdp) -> bool {
   spdlog::debug("ContentStream parsing SDP");
-  std::istringstream iss(sdp);
-  for (std::string line; std::getline(iss, line);) {
-    const std::regex sdp_line_regex("^([a-z])\\=(.+)$");
-    std::smatch match;
-    if (std::regex_match(line, match, sdp_line_regex)) {
-      if (match.size() == 3) {
-        auto field = match[1].str();
-        auto value = match[2].str();
-        spdlog::debug("SDP line {}: {}", field, value);
-
-        if (field == "c") {
-          const std::regex value_regex("^IN (IP.) ([0-9\\.]+).*$");
-          std::smatch cmatch;
-          if (std::regex_match(value, cmatch, value_regex)) {
-            if (cmatch.size() == 3) {
-              _5gbc_stream_mcast_addr = cmatch[2].str();
-            }
-          }
-        } else if (field == "m") {
-          const std::regex value_regex("^application (.+) (.+)$");
-          std::smatch cmatch;
-          if (std::regex_match(value, cmatch, value_regex)) {
-            if (cmatch.size() == 3) {
-              _5gbc_stream_mcast_port = cmatch[1].str();
-              _5gbc_stream_type = cmatch[2].str();
-            }
-          }
-          const std::regex value_regex2("^application (.+) (.+) (.+)$");
-          if (std::regex_match(value, cmatch, value_regex2)) {
-            if (cmatch.size() == 4) {
-              _5gbc_stream_mcast_port = cmatch[1].str();
-              _5gbc_stream_type = cmatch[2].str();
-            }
-          }
-        } else if (field == "a") {
-          const std::regex value_regex("^flute-tsi:(.+)$");
-          std::smatch cmatch;
-          if (std::regex_match(value, cmatch, value_regex)) {
-            if (cmatch.size() == 2) {
-              _5gbc_stream_flute_tsi = stoul(cmatch[1].str());
-            }
-          }
-        }
-      }
-    }
-  }
-  if (!_5gbc_stream_type.empty() && !_5gbc_stream_mcast_addr.empty() &&
-      !_5gbc_stream_mcast_port.empty()) {
+  _5gbc_session = SessionDescription(sdp);
+  if (_5gbc_session.complete()) {
     spdlog::info("ContentStream SDP parsing complete. Stream type {}, TSI {}, MCast at {}:{}",
-                 _5gbc_stream_type, _5gbc_stream_flute_tsi, _5gbc_stream_mcast_addr, _5gbc_stream_mcast_port);
+                 _5gbc_session.protocol(), _5gbc_session.flute_tsi(), _5gbc_session.connection_address(),
+                 _5gbc_session.port());
     return true;
   }
   return false;
 }
 
 auto MBMS_RT::ContentStream::flute_file_received(std::shared_ptr<LibFlute::File> file) -> void {
-  spdlog::info("ContentStream: {} (TOI {}, MIME type {}) has been received at {}",
+  static Logging::RateLimitedLog received_log(Logging::Category::Stream);
+  received_log.info("ContentStream: {} (TOI {}, MIME type {}) has been received at {}",
                file->meta().content_location, file->meta().toi, file->meta().content_type, file->received_at());
   if (file->meta().content_location != "index.m3u8") { // ignore generated manifests
     std::string content_location = file->meta().content_location;
@@ -110,9 +66,13 @@ auto MBMS_RT::ContentStream::flute_file_received(std::shared_ptr<LibFlute::File>
           _base_path + "manifest.mpd", file->received_at(), std::move(file))
       );
     } else {
-      _cache.add_item(std::make_shared<CachedFile>(
-          content_location, file->received_at(), std::move(file))
-      );
+      auto trace = Tracer::instance().find(file->meta().content_location);
+      auto item = std::make_shared<CachedFile>(content_location, file->received_at(), std::move(file));
+      if (trace) {
+        trace->set_stream(_playlist_path.empty() ? _base : _playlist_path);
+        item->set_trace(std::move(trace));
+      }
+      _cache.add_item(item);
     }
 
   }
@@ -120,19 +80,154 @@ auto MBMS_RT::ContentStream::flute_file_received(std::shared_ptr<LibFlute::File>
 
 auto MBMS_RT::ContentStream::start() -> void {
   spdlog::info("ContentStream starting");
-  if (_5gbc_stream_type == "FLUTE/UDP") {
-    spdlog::info("Starting FLUTE receiver on {}:{} for TSI {}", _5gbc_stream_mcast_addr, _5gbc_stream_mcast_port,
-                 _5gbc_stream_flute_tsi);
-    _flute_thread = std::thread{[&]() {
-      _flute_receiver = std::make_unique<LibFlute::Receiver>(_5gbc_stream_iface, _5gbc_stream_mcast_addr,
-                                                             atoi(_5gbc_stream_mcast_port.c_str()),
-                                                             _5gbc_stream_flute_tsi, _io_service);
-      _flute_receiver->register_completion_callback(
-          boost::bind(&ContentStream::flute_file_received, this, _1)); //NOLINT
-    }};
+  if (is_rtp()) {
+    join();
+  } else if (_5gbc_session.protocol() == "FLUTE/UDP") {
+    if (_lazy_join) {
+      spdlog::info("Deferring FLUTE join on {}:{} for TSI {} until the stream is requested",
+                   _5gbc_session.connection_address(), _5gbc_session.port(), _5gbc_session.flute_tsi());
+    } else {
+      join();
+    }
   }
 };
 
+auto MBMS_RT::ContentStream::join() -> void {
+  const std::lock_guard<std::mutex> lock(_flute_session_mutex);
+  if (is_rtp()) {
+    join_rtp();
+    return;
+  }
+  if (_flute_session || _5gbc_session.protocol() != "FLUTE/UDP") {
+    return;
+  }
+  spdlog::info("Starting FLUTE receiver on {}:{} for TSI {}", _5gbc_session.connection_address(),
+               _5gbc_session.port(), _5gbc_session.flute_tsi());
+  std::weak_ptr<ContentStream> weak_self = shared_from_this();
+  // The stream decodes FLUTE itself, libflute's receiver does not expose the state of files in reception
+  auto session = std::make_shared<FluteSessionDecoder>(_5gbc_session.flute_tsi());
+  session->register_completion_callback(
+      [weak_self](std::shared_ptr<LibFlute::File> file) { //NOLINT
+        if (auto self = weak_self.lock()) {
+          if (self->_awaiting_first_file.exchange(false)) {
+            self->_join_delay_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - self->_joined_at).count();
+            spdlog::info("First FLUTE file for TSI {} arrived {} ms after joining", self->_5gbc_session.flute_tsi(),
+                         self->_join_delay_ms.load());
+          }
+          self->_strand.post([weak_self, file]() {
+            if (auto self = weak_self.lock()) {
+              self->flute_file_received(file);
+            }
+          });
+        }
+      });
+  try {
+    // Streams on the same group share its socket, packets are demultiplexed by TSI
+    auto receiver = MulticastReceiver::acquire(_5gbc_stream_iface, _5gbc_session.connection_address(),
+                                               _5gbc_session.port(), _io_service);
+    _joined_at = std::chrono::steady_clock::now();
+    _awaiting_first_file = true;
+    receiver->add_session(session);
+    _multicast_receiver = std::move(receiver);
+    _flute_session = std::move(session);
+  } catch (const std::exception& ex) {
+    spdlog::error("Failed to start FLUTE reception on {}:{}: {}", _5gbc_session.connection_address(),
+                  _5gbc_session.port(), ex.what());
+  }
+}
+
+auto MBMS_RT::ContentStream::join_rtp() -> void {
+  if (_rtp_relay) {
+    return;
+  }
+  std::vector<std::string> destinations;
+  if (_cfg.exists("mw.rtp_relay.destinations")) {
+    const libconfig::Setting& setting = _cfg.lookup("mw.rtp_relay.destinations");
+    for (int i = 0; i < setting.getLength(); i++) {
+      destinations.emplace_back(static_cast<const char*>(setting[i]));
+    }
+  } else {
+    destinations.emplace_back("127.0.0.1");
+  }
+  int ttl = 1;
+  _cfg.lookupValue("mw.rtp_relay.ttl", ttl);
+  try {
+    auto relay = std::make_shared<RtpRelay>(_5gbc_stream_iface, _5gbc_session.connection_address(),
+                                            _5gbc_session.port(), _5gbc_session.source_address(), destinations, ttl,
+                                            _io_service);
+    relay->start();
+    _rtp_relay = std::move(relay);
+  } catch (const std::exception& ex) {
+    spdlog::error("Failed to start RTP relay on {}:{}: {}", _5gbc_session.connection_address(),
+                  _5gbc_session.port(), ex.what());
+  }
+}
+
+auto MBMS_RT::ContentStream::leave() -> void {
+  const std::lock_guard<std::mutex> lock(_flute_session_mutex);
+  _rtp_relay.reset();
+  if (!_flute_session) {
+    return;
+  }
+  spdlog::info("Stopping FLUTE receiver on {}:{} for TSI {}", _5gbc_session.connection_address(),
+               _5gbc_session.port(), _5gbc_session.flute_tsi());
+  _multicast_receiver->remove_session(_flute_session);
+  _multicast_receiver.reset();
+  _flute_session.reset();
+  _awaiting_first_file = false;
+}
+
+auto MBMS_RT::ContentStream::touch() -> void {
+  _last_demand = std::chrono::steady_clock::now().time_since_epoch().count();
+  if (_lazy_join && !joined()) {
+    join();
+  }
+}
+
+auto MBMS_RT::ContentStream::leave_if_idle(unsigned idle_timeout) -> void {
+  // RTP sessions are relayed to clients outside the HTTP server, there is no request to wait for
+  if (!_lazy_join || is_rtp() || !joined()) {
+    return;
+  }
+  auto idle = std::chrono::steady_clock::now() -
+      std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(_last_demand.load()));
+  if (idle > std::chrono::seconds(idle_timeout)) {
+    spdlog::info("Stream {} has not been requested for {} s", _playlist_path, idle_timeout);
+    leave();
+  }
+}
+
+auto MBMS_RT::ContentStream::joined() -> bool {
+  const std::lock_guard<std::mutex> lock(_flute_session_mutex);
+  return _flute_session != nullptr || _rtp_relay != nullptr;
+}
+
+auto MBMS_RT::ContentStream::rtp_relay() -> std::shared_ptr<RtpRelay> {
+  const std::lock_guard<std::mutex> lock(_flute_session_mutex);
+  return _rtp_relay;
+}
+
+auto MBMS_RT::ContentStream::find_partial_flute_file(const std::string& content_location, ByteRanges& received,
+    std::vector<uint8_t>& data) -> bool {
+  std::shared_ptr<FluteSessionDecoder> session;
+  {
+    const std::lock_guard<std::mutex> lock(_flute_session_mutex);
+    session = _flute_session;
+  }
+  return session && session->partial_file(content_location, received, data);
+}
+
+auto MBMS_RT::ContentStream::find_flute_run(const std::string& content_location, uint64_t offset,
+    std::vector<uint8_t>& chunk, uint64_t& length) -> bool {
+  std::shared_ptr<FluteSessionDecoder> session;
+  {
+    const std::lock_guard<std::mutex> lock(_flute_session_mutex);
+    session = _flute_session;
+  }
+  return session && session->received_run(content_location, offset, chunk, length);
+}
+
 auto MBMS_RT::ContentStream::read_master_manifest(const std::string &manifest) -> void {
   if (_delivery_protocol == DeliveryProtocol::HLS) {
     auto pl = HlsPrimaryPlaylist(manifest, "");
@@ -146,10 +241,11 @@ auto MBMS_RT::ContentStream::read_master_manifest(const std::string &manifest) -
 }
 
 auto MBMS_RT::ContentStream::flute_info() const -> std::string {
-  if (_5gbc_stream_type == "none") {
+  if (_5gbc_session.protocol().empty()) {
     return "n/a";
   } else {
-    return _5gbc_stream_type + ": " + _5gbc_stream_mcast_addr + ":" + _5gbc_stream_mcast_port +
-           ", TSI " + std::to_string(_5gbc_stream_flute_tsi);
+    return _5gbc_session.protocol() + ": " + _5gbc_session.connection_address() + ":" +
+           std::to_string(_5gbc_session.port()) +
+           (is_rtp() ? std::string() : ", TSI " + std::to_string(_5gbc_session.flute_tsi()));
   }
 }
@@ -21,12 +21,17 @@
 #include <thread>
 #include <libconfig.h++>
 #include "File.h"
-#include "Receiver.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include "multicast/MulticastReceiver.h"
+#include "multicast/RtpRelay.h"
 #include "CacheManagement.h"
 #include "DeliveryProtocols.h"
+#include "SessionDescription.h"
 
 namespace MBMS_RT {
-  class ContentStream {
+  class ContentStream : public std::enable_shared_from_this<ContentStream> {
     public:
       ContentStream(std::string base, std::string flute_if, boost::asio::io_service& io_service, CacheManagement& cache, DeliveryProtocol protocol, const libconfig::Config& cfg);
       virtual ~ContentStream();
@@ -39,9 +44,34 @@ namespace MBMS_RT {
       virtual std::string stream_type_string() const { return "Basic"; };
 
       bool configure_5gbc_delivery_from_sdp(const std::string& sdp);
+      const SessionDescription& session_description() const { return _5gbc_session; };
       void read_master_manifest(const std::string& manifest);
       void start();
 
+      /**
+       *  Start / stop FLUTE reception for this stream, or relaying for RTP sessions (mw.rtp_relay).
+       *  start() joins right away unless lazy join (mw.lazy_join.enabled) is configured, in which
+       *  case the first touch() joins.
+       */
+      void join();
+      void leave();
+      bool joined();
+
+      /**
+       *  Record a client request for this stream, joining its FLUTE session if it is not received yet
+       */
+      void touch();
+
+      /**
+       *  In lazy join mode, leave the FLUTE session if the stream was not requested for idle_timeout seconds
+       */
+      void leave_if_idle(unsigned idle_timeout);
+
+      /**
+       *  @return Time from the last join to its first received file in milliseconds, -1 if not known yet
+       */
+      int64_t join_delay_ms() const { return _join_delay_ms; };
+
       virtual void flute_file_received(std::shared_ptr<LibFlute::File> file);
 
       const std::string& base() const { return _base; };
@@ -49,6 +79,11 @@ namespace MBMS_RT {
 
       std::string flute_info() const;
 
+      /**
+       *  @return The relay of an RTP session, nullptr for FLUTE streams or while not joined
+       */
+      std::shared_ptr<RtpRelay> rtp_relay();
+
       DeliveryProtocol delivery_protocol() const { return _delivery_protocol; };
       std::string delivery_protocol_string() const { return _delivery_protocol == DeliveryProtocol::HLS ? "HLS" :
         (_delivery_protocol == DeliveryProtocol::DASH ? "DASH" : "RTP"); };
@@ -70,20 +105,48 @@ namespace MBMS_RT {
     void set_base_path(std::string p) { _base_path = p; };
 
     protected:
+      /**
+       *  Copy the received part of a FLUTE file that is still in reception, see
+       *  FluteSessionDecoder::partial_file
+       *
+       *  @return false if there is no such file or the receiver is not running
+       */
+      bool find_partial_flute_file(const std::string& content_location, ByteRanges& received,
+          std::vector<uint8_t>& data);
+
+      /**
+       *  Copy the gap-free run of a FLUTE file in reception from offset on, see
+       *  FluteSessionDecoder::received_run
+       *
+       *  @return false if there is no such file or the receiver is not running
+       */
+      bool find_flute_run(const std::string& content_location, uint64_t offset, std::vector<uint8_t>& chunk,
+          uint64_t& length);
+
+      bool is_rtp() const { return _5gbc_session.protocol().rfind("RTP/", 0) == 0; };
+      void join_rtp();
+
       const libconfig::Config& _cfg;
       DeliveryProtocol _delivery_protocol;
       std::string _base = "";
       std::string _base_path;
       std::string _playlist_path;
       std::string _5gbc_stream_iface;
-      std::string _5gbc_stream_type = "none";
-      std::string _5gbc_stream_mcast_addr = {};
-      std::string _5gbc_stream_mcast_port = {};
-      unsigned long long _5gbc_stream_flute_tsi = 0;
-      std::thread _flute_thread;
-      std::unique_ptr<LibFlute::Receiver> _flute_receiver;
+      SessionDescription _5gbc_session;
+      std::shared_ptr<MulticastReceiver> _multicast_receiver;
+      std::shared_ptr<FluteSessionDecoder> _flute_session;
+      std::shared_ptr<RtpRelay> _rtp_relay;
+      std::mutex _flute_session_mutex;
+
+      bool _lazy_join = false;
+      std::atomic<std::chrono::steady_clock::rep> _last_demand = {0};
+      std::chrono::steady_clock::time_point _joined_at;
+      std::atomic<bool> _awaiting_first_file = {false};
+      std::atomic<int64_t> _join_delay_ms = {-1};
 
       boost::asio::io_service& _io_service;
+      // Serialises all handlers that touch stream state: FLUTE completions, timers and CDN results
+      boost::asio::io_service::strand _strand;
       CacheManagement& _cache;
 
       std::string _resolution;
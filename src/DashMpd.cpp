@@ -0,0 +1,472 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "DashMpd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+
+#include "spdlog/spdlog.h"
+
+using tinyxml2::XMLElement;
+
+// An open ended S@r=-1 or an unbounded static presentation is not expanded beyond this
+static constexpr uint64_t MAX_EXPANDED_SEGMENTS = 100000;
+// Segments listed for a dynamic @duration template without a time shift buffer depth
+static constexpr uint64_t DEFAULT_DURATION_WINDOW = 30;
+
+static auto uint64_attribute(const XMLElement* element, const char* name, uint64_t fallback) -> uint64_t {
+  const char* value = element ? element->Attribute(name) : nullptr;
+  return value ? strtoull(value, nullptr, 10) : fallback;
+}
+
+static auto string_attribute(const XMLElement* element, const char* name, const std::string& fallback = "")
+  -> std::string {
+  const char* value = element ? element->Attribute(name) : nullptr;
+  return value ? value : fallback;
+}
+
+static auto join_base_url(const std::string& base, const XMLElement* element) -> std::string {
+  auto base_url = element->FirstChildElement("BaseURL");
+  if (!base_url || !base_url->GetText()) {
+    return base;
+  }
+  std::string relative = base_url->GetText();
+  if (relative.find("://") != std::string::npos) {
+    // Origins are configured separately, an absolute BaseURL can not be mapped onto them
+    spdlog::debug("DashMpd: ignoring absolute BaseURL {}", relative);
+    return base;
+  }
+  return base + relative;
+}
+
+static auto unsupported_addressing(const XMLElement* element) -> const char* {
+  if (element->FirstChildElement("SegmentList")) {
+    return "SegmentList";
+  }
+  return element->FirstChildElement("SegmentBase") ? "SegmentBase" : nullptr;
+}
+
+MBMS_RT::DashMpd::DashMpd(const std::string& content)
+  : _doc( std::make_unique<tinyxml2::XMLDocument>() )
+{
+  if (_doc->Parse(content.c_str(), content.size()) != tinyxml2::XML_SUCCESS) {
+    spdlog::warn("DashMpd: failed to parse MPD: {}", _doc->ErrorStr());
+    return;
+  }
+  parse();
+  expand(time(nullptr));
+}
+
+auto MBMS_RT::DashMpd::parse() -> void
+{
+  _representations.clear();
+  _templates.clear();
+  auto mpd = _doc->FirstChildElement("MPD");
+  if (!mpd) {
+    return;
+  }
+  _valid = true;
+  _dynamic = string_attribute(mpd, "type") == "dynamic";
+  _minimum_update_period = parse_duration(mpd->Attribute("minimumUpdatePeriod"));
+  _time_shift_buffer_depth = parse_duration(mpd->Attribute("timeShiftBufferDepth"));
+  _presentation_duration = parse_duration(mpd->Attribute("mediaPresentationDuration"));
+  _availability_start_time = parse_date_time(mpd->Attribute("availabilityStartTime"));
+  auto mpd_base = join_base_url("", mpd);
+
+  double next_period_start = 0;
+  int period_idx = 0;
+  for (auto period = mpd->FirstChildElement("Period"); period; period = period->NextSiblingElement("Period")) {
+    double period_start = period->Attribute("start") ? parse_duration(period->Attribute("start")) : next_period_start;
+    next_period_start = period_start + parse_duration(period->Attribute("duration"));
+    auto period_base = join_base_url(mpd_base, period);
+    auto period_key = string_attribute(period, "id", std::to_string(period_idx++));
+
+    int set_idx = 0;
+    for (auto set = period->FirstChildElement("AdaptationSet"); set; set = set->NextSiblingElement("AdaptationSet")) {
+      auto set_template = set->FirstChildElement("SegmentTemplate");
+      auto set_base = join_base_url(period_base, set);
+      auto set_key = period_key + "/" + string_attribute(set, "id", std::to_string(set_idx++));
+
+      for (auto rep = set->FirstChildElement("Representation"); rep; rep = rep->NextSiblingElement("Representation")) {
+        auto rep_template = rep->FirstChildElement("SegmentTemplate");
+        if (!set_template && !rep_template) {
+          const char* addressing = nullptr;
+          for (const XMLElement* element : { rep, set, period }) {
+            addressing = addressing ? addressing : unsupported_addressing(element);
+          }
+          spdlog::error("DashMpd: representation {} uses {} addressing, which is not supported, leaving it out",
+              set_key + "/" + string_attribute(rep, "id"), addressing ? addressing : "no segment");
+          continue;
+        }
+        Template tmpl;
+        for (auto element : { set_template, rep_template }) {
+          if (!element) continue;
+          tmpl.media = string_attribute(element, "media", tmpl.media);
+          tmpl.initialization = string_attribute(element, "initialization", tmpl.initialization);
+          tmpl.timescale = std::max<uint64_t>(uint64_attribute(element, "timescale", tmpl.timescale), 1);
+          tmpl.start_number = uint64_attribute(element, "startNumber", tmpl.start_number);
+          if (element->Attribute("startNumber")) {
+            tmpl.start_number_element = element;
+          }
+          tmpl.duration = uint64_attribute(element, "duration", tmpl.duration);
+          tmpl.presentation_time_offset = uint64_attribute(element, "presentationTimeOffset", tmpl.presentation_time_offset);
+          if (auto timeline = element->FirstChildElement("SegmentTimeline")) {
+            tmpl.timeline = timeline;
+          }
+        }
+        if (tmpl.timeline && (!tmpl.start_number_element || tmpl.timeline->Parent() == rep_template)) {
+          // A timeline of the Representation is numbered there, even if @startNumber was inherited
+          tmpl.start_number_element = tmpl.timeline->Parent()->ToElement();
+        }
+        tmpl.period_start = period_start;
+        tmpl.base_url = join_base_url(set_base, rep);
+
+        Representation representation;
+        representation.id = string_attribute(rep, "id");
+        representation.key = set_key + "/" + representation.id;
+        representation.bandwidth = strtoul(string_attribute(rep, "bandwidth", "0").c_str(), nullptr, 10);
+        representation.mime_type = string_attribute(rep, "mimeType", string_attribute(set, "mimeType"));
+        representation.codecs = string_attribute(rep, "codecs", string_attribute(set, "codecs"));
+        if (!tmpl.initialization.empty()) {
+          representation.initialization = tmpl.base_url +
+            fill_template(tmpl.initialization, representation.id, representation.bandwidth, 0, 0);
+        }
+        _representations.push_back(std::move(representation));
+        _templates.push_back(std::move(tmpl));
+      }
+    }
+  }
+}
+
+auto MBMS_RT::DashMpd::timeline_entries(const Template& tmpl, time_t now) const -> std::vector<TimelineEntry>
+{
+  std::vector<TimelineEntry> entries;
+  if (!tmpl.timeline) {
+    return entries;
+  }
+  uint64_t cursor = 0;
+  for (auto s = tmpl.timeline->FirstChildElement("S"); s; s = s->NextSiblingElement("S")) {
+    cursor = uint64_attribute(s, "t", cursor);
+    auto d = uint64_attribute(s, "d", 0);
+    if (d == 0) {
+      continue;
+    }
+    auto r = strtoll(string_attribute(s, "r", "0").c_str(), nullptr, 10);
+    uint64_t count = r + 1;
+    if (r < 0) {
+      // Repeats until the next entry, the end of the period, or for a live stream until now
+      auto next = s->NextSiblingElement("S");
+      uint64_t end = 0;
+      if (next && next->Attribute("t")) {
+        end = uint64_attribute(next, "t", 0);
+      } else if (_dynamic && _availability_start_time > 0) {
+        auto elapsed = static_cast<double>(now - _availability_start_time) - tmpl.period_start;
+        end = elapsed > 0 ? static_cast<uint64_t>(elapsed * tmpl.timescale) + tmpl.presentation_time_offset : 0;
+      } else if (_presentation_duration > 0) {
+        end = static_cast<uint64_t>((_presentation_duration - tmpl.period_start) * tmpl.timescale) +
+          tmpl.presentation_time_offset;
+        end += d - 1;   // a last, shorter segment
+      }
+      count = end > cursor ? (end - cursor) / d : 0;
+    }
+    count = std::min(count, MAX_EXPANDED_SEGMENTS);
+    for (uint64_t i = 0; i < count; i++) {
+      entries.push_back({ cursor, d });
+      cursor += d;
+    }
+  }
+  return entries;
+}
+
+auto MBMS_RT::DashMpd::expand(time_t now) -> void
+{
+  for (size_t i = 0; i < _representations.size(); i++) {
+    auto& rep = _representations[i];
+    const auto& tmpl = _templates[i];
+    rep.segments.clear();
+    if (tmpl.media.empty()) {
+      continue;
+    }
+
+    if (tmpl.timeline) {
+      auto number = tmpl.start_number;
+      for (const auto& entry : timeline_entries(tmpl, now)) {
+        rep.segments.push_back({ number, entry.time, static_cast<double>(entry.duration) / tmpl.timescale,
+            tmpl.base_url + fill_template(tmpl.media, rep.id, rep.bandwidth, number, entry.time) });
+        number++;
+      }
+    } else if (tmpl.duration > 0) {
+      auto segment_duration = static_cast<double>(tmpl.duration) / tmpl.timescale;
+      uint64_t first = tmpl.start_number;
+      uint64_t last = tmpl.start_number;     // one past the last available
+      if (_dynamic) {
+        if (_availability_start_time == 0) {
+          continue;
+        }
+        auto elapsed = static_cast<double>(now - _availability_start_time) - tmpl.period_start;
+        if (elapsed < segment_duration) {
+          continue;
+        }
+        last += static_cast<uint64_t>(elapsed / segment_duration);
+        uint64_t window = _time_shift_buffer_depth > 0 ?
+          static_cast<uint64_t>(std::ceil(_time_shift_buffer_depth / segment_duration)) : DEFAULT_DURATION_WINDOW;
+        first = std::max(first, last > window ? last - window : first);
+      } else if (_presentation_duration > 0) {
+        last += std::min(static_cast<uint64_t>(std::ceil((_presentation_duration - tmpl.period_start) / segment_duration)),
+            MAX_EXPANDED_SEGMENTS);
+      }
+      for (auto number = first; number < last; number++) {
+        auto time = (number - tmpl.start_number) * tmpl.duration + tmpl.presentation_time_offset;
+        rep.segments.push_back({ number, time, segment_duration,
+            tmpl.base_url + fill_template(tmpl.media, rep.id, rep.bandwidth, number, time) });
+      }
+    }
+  }
+}
+
+auto MBMS_RT::DashMpd::merge(const DashMpd& other, time_t now, size_t max_segments) -> unsigned
+{
+  if (!_valid || !other._valid) {
+    return 0;
+  }
+  max_segments = std::max<size_t>(max_segments, 1);
+  unsigned added = 0;
+  std::set<XMLElement*> merged;
+  std::map<XMLElement*, size_t> dropped_by_timeline;
+  for (size_t i = 0; i < _representations.size(); i++) {
+    auto& tmpl = _templates[i];
+    // Representations of an adaptation set often share one timeline
+    if (!tmpl.timeline || !merged.insert(tmpl.timeline).second) {
+      continue;
+    }
+    const Template* theirs = nullptr;
+    for (size_t j = 0; j < other._representations.size(); j++) {
+      if (other._representations[j].key == _representations[i].key) {
+        theirs = &other._templates[j];
+        break;
+      }
+    }
+    if (!theirs || !theirs->timeline || theirs->timescale != tmpl.timescale) {
+      continue;
+    }
+
+    auto entries = timeline_entries(tmpl, now);
+    uint64_t end = entries.empty() ? 0 : entries.back().time + entries.back().duration;
+    bool changed = false;
+    for (const auto& entry : other.timeline_entries(*theirs, now)) {
+      if (entries.empty() || entry.time >= end) {
+        entries.push_back(entry);
+        end = entry.time + entry.duration;
+        added++;
+        changed = true;
+      }
+    }
+
+    uint64_t window = _dynamic && _time_shift_buffer_depth > 0 ?
+      static_cast<uint64_t>(_time_shift_buffer_depth * tmpl.timescale) : 0;
+    size_t dropped = 0;
+    while (entries.size() - dropped > max_segments ||
+        (window > 0 && entries.size() - dropped > 1 && entries[dropped].time + entries[dropped].duration + window < end)) {
+      dropped++;
+    }
+    if (dropped > 0) {
+      entries.erase(entries.begin(), entries.begin() + dropped);
+      dropped_by_timeline[tmpl.timeline] = dropped;
+      changed = true;
+    }
+    if (changed) {
+      write_timeline(tmpl.timeline, entries);
+    }
+  }
+
+  // Numbers stay attached to the same segments. @startNumber is moved on where it was read from, which
+  // may be a Representation template for each of the representations sharing a timeline.
+  std::set<XMLElement*> renumbered;
+  for (const auto& tmpl : _templates) {
+    auto dropped = tmpl.timeline ? dropped_by_timeline.find(tmpl.timeline) : dropped_by_timeline.end();
+    if (dropped != dropped_by_timeline.end() && renumbered.insert(tmpl.start_number_element).second) {
+      tmpl.start_number_element->SetAttribute("startNumber", static_cast<int64_t>(tmpl.start_number + dropped->second));
+    }
+  }
+
+  if (auto publish_time = other._doc->FirstChildElement("MPD")->Attribute("publishTime")) {
+    _doc->FirstChildElement("MPD")->SetAttribute("publishTime", publish_time);
+  }
+  parse();
+  expand(now);
+  return added;
+}
+
+auto MBMS_RT::DashMpd::set_time_shift_buffer_depth(double seconds) -> void
+{
+  if (!_valid || !_dynamic) {
+    return;
+  }
+  auto whole_seconds = static_cast<int64_t>(std::ceil(seconds));
+  _doc->FirstChildElement("MPD")->SetAttribute("timeShiftBufferDepth",
+      ("PT" + std::to_string(whole_seconds) + "S").c_str());
+  _time_shift_buffer_depth = static_cast<double>(whole_seconds);
+}
+
+auto MBMS_RT::DashMpd::write_timeline(XMLElement* timeline, const std::vector<TimelineEntry>& entries) -> void
+{
+  timeline->DeleteChildren();
+  XMLElement* run = nullptr;
+  int64_t repeat = 0;
+  uint64_t end = 0;
+  for (const auto& entry : entries) {
+    if (run && entry.time == end && static_cast<uint64_t>(run->Int64Attribute("d")) == entry.duration) {
+      run->SetAttribute("r", ++repeat);
+    } else {
+      run = timeline->GetDocument()->NewElement("S");
+      timeline->InsertEndChild(run);
+      run->SetAttribute("t", static_cast<int64_t>(entry.time));
+      run->SetAttribute("d", static_cast<int64_t>(entry.duration));
+      repeat = 0;
+    }
+    end = entry.time + entry.duration;
+  }
+}
+
+auto MBMS_RT::DashMpd::max_segment_duration() const -> double
+{
+  double max = 0;
+  for (const auto& rep : _representations) {
+    for (const auto& segment : rep.segments) {
+      max = std::max(max, segment.duration);
+    }
+  }
+  return max;
+}
+
+auto MBMS_RT::DashMpd::to_string() const -> std::string
+{
+  tinyxml2::XMLPrinter printer;
+  _doc->Print(&printer);
+  return printer.CStr();
+}
+
+auto MBMS_RT::DashMpd::fill_template(const std::string& pattern, const std::string& id, unsigned long bandwidth,
+    uint64_t number, uint64_t time) -> std::string
+{
+  std::string out;
+  size_t pos = 0;
+  while (pos < pattern.size()) {
+    auto start = pattern.find('$', pos);
+    auto end = start == std::string::npos ? std::string::npos : pattern.find('$', start + 1);
+    if (end == std::string::npos) {
+      out.append(pattern, pos, std::string::npos);
+      break;
+    }
+    out.append(pattern, pos, start - pos);
+    auto identifier = pattern.substr(start + 1, end - start - 1);
+    pos = end + 1;
+
+    // $Number%05d$ and the like: zero padded to a width
+    int width = 1;
+    auto format = identifier.find('%');
+    if (format != std::string::npos) {
+      width = std::max(atoi(identifier.c_str() + format + 1), 1);
+      identifier.erase(format);
+    }
+    auto padded = [width](uint64_t value) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%0*llu", width, static_cast<unsigned long long>(value));
+      return std::string(buf);
+    };
+    if (identifier.empty()) {
+      out += '$';
+    } else if (identifier == "RepresentationID") {
+      out += id;
+    } else if (identifier == "Number") {
+      out += padded(number);
+    } else if (identifier == "Time") {
+      out += padded(time);
+    } else if (identifier == "Bandwidth") {
+      out += padded(bandwidth);
+    } else {
+      out.append(pattern, start, end - start + 1);
+    }
+  }
+  return out;
+}
+
+auto MBMS_RT::DashMpd::parse_duration(const char* value) -> double
+{
+  if (!value || *value != 'P') {
+    return 0;
+  }
+  double seconds = 0;
+  bool time_part = false;
+  const char* pos = value + 1;
+  while (*pos) {
+    if (*pos == 'T') {
+      time_part = true;
+      pos++;
+      continue;
+    }
+    char* unit = nullptr;
+    double number = strtod(pos, &unit);
+    if (unit == pos || !*unit) {
+      break;
+    }
+    switch (*unit) {
+      case 'Y': seconds += number * 365 * 86400; break;
+      case 'M': seconds += time_part ? number * 60 : number * 30 * 86400; break;
+      case 'W': seconds += number * 7 * 86400; break;
+      case 'D': seconds += number * 86400; break;
+      case 'H': seconds += number * 3600; break;
+      case 'S': seconds += number; break;
+      default: return seconds;
+    }
+    pos = unit + 1;
+  }
+  return seconds;
+}
+
+auto MBMS_RT::DashMpd::parse_date_time(const char* value) -> time_t
+{
+  if (!value) {
+    return 0;
+  }
+  struct tm tm = {};
+  double seconds = 0;
+  int consumed = 0;
+  if (sscanf(value, "%4d-%2d-%2dT%2d:%2d:%lf%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+        &tm.tm_hour, &tm.tm_min, &seconds, &consumed) < 6) {
+    return 0;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_sec = static_cast<int>(seconds);
+  auto result = timegm(&tm);
+
+  int offset_hours = 0;
+  int offset_minutes = 0;
+  const char* zone = value + consumed;
+  if ((*zone == '+' || *zone == '-') && sscanf(zone + 1, "%2d:%2d", &offset_hours, &offset_minutes) >= 1) {
+    auto offset = offset_hours * 3600 + offset_minutes * 60;
+    result += *zone == '+' ? -offset : offset;
+  }
+  return result;
+}
@@ -0,0 +1,147 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <tinyxml2.h>
+
+namespace MBMS_RT {
+  /**
+   *  A DASH MPD with the segments its SegmentTemplates describe.
+   *
+   *  Segments are listed for templates with a SegmentTimeline, and for templates numbered by @duration.
+   *  Representations addressed by SegmentBase or SegmentList are not supported, they are left out with
+   *  an error logged.
+   *  The document is kept, so timelines can be merged from another version of the same presentation
+   *  and the result serialized again with everything else unchanged.
+   */
+  class DashMpd {
+    public:
+      DashMpd(const std::string& content);
+      virtual ~DashMpd() = default;
+      DashMpd(const DashMpd&) = delete;
+      DashMpd& operator=(const DashMpd&) = delete;
+
+      bool valid() const { return _valid; };
+      bool dynamic() const { return _dynamic; };
+
+      /**
+       *  @return MPD@minimumUpdatePeriod in seconds, 0 if not set
+       */
+      double minimum_update_period() const { return _minimum_update_period; };
+
+      /**
+       *  @return MPD@timeShiftBufferDepth in seconds, 0 if not set
+       */
+      double time_shift_buffer_depth() const { return _time_shift_buffer_depth; };
+
+      /**
+       *  Announce a different MPD@timeShiftBufferDepth, e.g. when older segments are kept for DVR
+       *  playback. Only applies to dynamic MPDs.
+       */
+      void set_time_shift_buffer_depth(double seconds);
+
+      /**
+       *  @return The longest listed segment in seconds
+       */
+      double max_segment_duration() const;
+
+      struct Segment {
+        uint64_t number;
+        uint64_t time;            // in timescale units
+        double duration;          // seconds
+        std::string uri;          // relative to the MPD
+      };
+      struct Representation {
+        std::string key;          // unique within the MPD: period, adaptation set and representation id
+        std::string id;
+        unsigned long bandwidth;
+        std::string mime_type;
+        std::string codecs;
+        std::string initialization;
+        std::vector<Segment> segments;
+      };
+      const std::vector<Representation>& representations() const { return _representations; };
+
+      /**
+       *  List the segments available at a point in time. Segments of @duration templates in a dynamic
+       *  MPD depend on it, all others are listed as given.
+       */
+      void expand(time_t now);
+
+      /**
+       *  Add the timeline entries of another version of this MPD that are newer than the last one
+       *  here, then drop the oldest so at most max_segments or the time shift buffer depth remain.
+       *  Only the SegmentTimeline elements that change are rewritten.
+       *
+       *  @return Number of segments added
+       */
+      unsigned merge(const DashMpd& other, time_t now, size_t max_segments);
+
+      std::string to_string() const;
+
+      /**
+       *  @return Seconds of an ISO 8601 duration, e.g. PT1M2.5S
+       */
+      static double parse_duration(const char* value);
+
+      /**
+       *  @return Seconds since the epoch of an xs:dateTime, 0 if it can not be parsed
+       */
+      static time_t parse_date_time(const char* value);
+
+    private:
+      struct Template {
+        std::string media;
+        std::string initialization;
+        uint64_t timescale = 1;
+        uint64_t start_number = 1;
+        uint64_t duration = 0;
+        uint64_t presentation_time_offset = 0;
+        tinyxml2::XMLElement* timeline = nullptr;
+        tinyxml2::XMLElement* start_number_element = nullptr;    // the SegmentTemplate @startNumber applies from
+        double period_start = 0;
+        std::string base_url;
+      };
+      struct TimelineEntry {
+        uint64_t time;
+        uint64_t duration;
+      };
+
+      void parse();
+      std::vector<TimelineEntry> timeline_entries(const Template& tmpl, time_t now) const;
+      void write_timeline(tinyxml2::XMLElement* timeline, const std::vector<TimelineEntry>& entries);
+      static std::string fill_template(const std::string& pattern, const std::string& id, unsigned long bandwidth,
+          uint64_t number, uint64_t time);
+
+      std::unique_ptr<tinyxml2::XMLDocument> _doc;
+      bool _valid = false;
+      bool _dynamic = false;
+      double _minimum_update_period = 0;
+      double _time_shift_buffer_depth = 0;
+      double _presentation_duration = 0;
+      time_t _availability_start_time = 0;
+
+      std::vector<Representation> _representations;
+      std::vector<Template> _templates;     // by representation index
+  };
+}
@@ -0,0 +1,407 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "DiskSegmentStore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "spdlog/spdlog.h"
+
+static constexpr const char* INDEX_FILE = "index";
+static constexpr const char* DATA_FILE_SUFFIX = ".seg";
+
+MBMS_RT::DiskSegmentStore::DiskSegmentStore(const libconfig::Config& cfg)
+{
+  cfg.lookupValue("mw.cache.disk.enabled", _enabled);
+  if (!_enabled) {
+    return;
+  }
+  cfg.lookupValue("mw.cache.disk.path", _path);
+  unsigned max_size = 4096;
+  cfg.lookupValue("mw.cache.disk.max_size", max_size);
+  _max_size = static_cast<uint64_t>(max_size) * 1024 * 1024;
+  unsigned file_size = 64;
+  cfg.lookupValue("mw.cache.disk.file_size", file_size);
+  _file_size = static_cast<uint64_t>(std::max(file_size, 1U)) * 1024 * 1024;
+  cfg.lookupValue("mw.cache.disk.max_age", _max_age);
+  cfg.lookupValue("mw.cache.disk.dvr_window", _dvr_window);
+  _dvr_window = std::min(_dvr_window, _max_age);
+
+  std::error_code ec;
+  std::filesystem::create_directories(_path, ec);
+  if (ec) {
+    spdlog::error("Disk cache disabled, cannot create {}: {}", _path, ec.message());
+    _enabled = false;
+    return;
+  }
+  load_index();
+  if (!rewrite_index()) {
+    spdlog::error("Disk cache disabled, cannot write its index in {}", _path);
+    _enabled = false;
+    return;
+  }
+  // Appending always starts a new data file, a previous run may have left a partial record at the end
+  _write_file = _files.empty() ? 0 : _files.rbegin()->first + 1;
+  _work = std::make_unique<boost::asio::io_service::work>(_disk_io);
+  _writer = std::thread([this]() { _disk_io.run(); });
+  spdlog::info("Disk cache at {} holds {} segments in {} MB, up to {} MB for {} s, DVR window {} s",
+      _path, _entries.size(), _bytes / 1024 / 1024, max_size, _max_age, _dvr_window);
+}
+
+MBMS_RT::DiskSegmentStore::~DiskSegmentStore()
+{
+  // Let the writer finish what is queued, nothing else touches the descriptors after that
+  _work.reset();
+  if (_writer.joinable()) {
+    _writer.join();
+  }
+  if (_write_fd >= 0) {
+    close(_write_fd);
+  }
+  if (_index_fd >= 0) {
+    fdatasync(_index_fd);
+    close(_index_fd);
+  }
+}
+
+MBMS_RT::DiskSegmentStore::Reader::~Reader()
+{
+  close(fd);
+}
+
+auto MBMS_RT::DiskSegmentStore::data_file_path(uint32_t number) const -> std::string
+{
+  char name[16];
+  snprintf(name, sizeof(name), "%08u", number);
+  return _path + "/" + name + DATA_FILE_SUFFIX;
+}
+
+auto MBMS_RT::DiskSegmentStore::load_index() -> void
+{
+  for (const auto& dirent : std::filesystem::directory_iterator(_path)) {
+    if (!dirent.is_regular_file() || dirent.path().extension() != DATA_FILE_SUFFIX) {
+      continue;
+    }
+    try {
+      auto number = static_cast<uint32_t>(std::stoul(dirent.path().stem().string()));
+      _files[number].size = dirent.file_size();
+      _bytes += dirent.file_size();
+    } catch (const std::exception&) {
+      spdlog::warn("Disk cache ignoring unexpected file {}", dirent.path().string());
+    }
+  }
+
+  std::ifstream index(_path + "/" + INDEX_FILE);
+  std::string line;
+  size_t skipped = 0;
+  while (std::getline(index, line)) {
+    // file, offset, length, received at, source and the location, which takes the rest of the line
+    std::istringstream fields(line);
+    Entry entry{};
+    int source = 0;
+    std::string location;
+    if (!(fields >> entry.file >> entry.offset >> entry.length >> entry.received_at >> source) ||
+        !std::getline(fields >> std::ws, location) || location.empty()) {
+      skipped++;
+      continue;
+    }
+    auto file = _files.find(entry.file);
+    if (file == _files.end() || entry.offset + entry.length > file->second.size) {
+      // The data file was deleted, or the record was not completely written
+      skipped++;
+      continue;
+    }
+    entry.source = static_cast<ItemSource>(source);
+    file->second.newest = std::max(file->second.newest, entry.received_at);
+    _entries[location] = entry;
+  }
+  if (skipped > 0) {
+    spdlog::warn("Disk cache skipped {} stale or damaged index records", skipped);
+  }
+}
+
+// Must be called on the writer thread, or before it is started
+auto MBMS_RT::DiskSegmentStore::rewrite_index() -> bool
+{
+  auto path = _path + "/" + INDEX_FILE;
+  auto tmp_path = path + ".tmp";
+  std::string content;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    for (const auto& [location, entry] : _entries) {
+      content += std::to_string(entry.file) + " " + std::to_string(entry.offset) + " " +
+        std::to_string(entry.length) + " " + std::to_string(entry.received_at) + " " +
+        std::to_string(static_cast<int>(entry.source)) + " " + location + "\n";
+    }
+  }
+
+  auto fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = ::write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()) &&
+    fsync(fd) == 0;
+  close(fd);
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  if (_index_fd >= 0) {
+    close(_index_fd);
+  }
+  _index_fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  _index_dirty = false;
+  return _index_fd >= 0;
+}
+
+auto MBMS_RT::DiskSegmentStore::store(const std::string& location, ItemPayload payload, unsigned long received_at,
+    ItemSource source) -> void
+{
+  if (!_enabled || payload.data == nullptr || payload.length == 0) {
+    return;
+  }
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _pending[location] = { std::move(payload), received_at, source };
+  }
+  _disk_io.post([this, location]() { write(location); });
+}
+
+// Must be called on the writer thread
+auto MBMS_RT::DiskSegmentStore::open_data_file(uint32_t number) -> bool
+{
+  if (_write_fd >= 0) {
+    close(_write_fd);
+  }
+  _write_fd = open(data_file_path(number).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (_write_fd < 0) {
+    spdlog::error("Disk cache cannot create {}", data_file_path(number));
+    return false;
+  }
+  _write_file = number;
+  const std::lock_guard<std::mutex> lock(_mutex);
+  _files[number];
+  return true;
+}
+
+auto MBMS_RT::DiskSegmentStore::write(const std::string& location) -> void
+{
+  Pending pending;
+  uint64_t offset = 0;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _pending.find(location);
+    if (it == _pending.end()) {
+      // Already written by an earlier post for the same location
+      return;
+    }
+    pending = it->second;
+    auto file = _files.find(_write_file);
+    offset = file == _files.end() ? 0 : file->second.size;
+  }
+
+  if (_write_fd < 0 || (offset > 0 && offset + pending.payload.length > _file_size)) {
+    if (!open_data_file(_write_fd < 0 ? _write_file : _write_file + 1)) {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      _pending.erase(location);
+      _write_errors++;
+      return;
+    }
+    const std::lock_guard<std::mutex> lock(_mutex);
+    offset = _files[_write_file].size;
+  }
+
+  size_t written = 0;
+  while (written < pending.payload.length) {
+    auto result = ::write(_write_fd, pending.payload.data + written, pending.payload.length - written);
+    if (result <= 0) {
+      break;
+    }
+    written += result;
+  }
+
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto& file = _files[_write_file];
+  // A short write still occupies the file, later offsets must account for it
+  file.size += written;
+  _bytes += written;
+  _pending.erase(location);
+  if (written < pending.payload.length) {
+    spdlog::warn("Disk cache could not write {}", location);
+    _write_errors++;
+    return;
+  }
+  file.newest = std::max(file.newest, pending.received_at);
+  Entry entry{ _write_file, offset, pending.payload.length, pending.received_at, pending.source };
+  _entries[location] = entry;
+  _stored++;
+  auto line = std::to_string(entry.file) + " " + std::to_string(entry.offset) + " " +
+    std::to_string(entry.length) + " " + std::to_string(entry.received_at) + " " +
+    std::to_string(static_cast<int>(entry.source)) + " " + location + "\n";
+  if (_index_fd < 0 || ::write(_index_fd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+    // The data stays usable for this run, it is only missing from the index after a restart
+    _write_errors++;
+  }
+  _index_dirty = true;
+}
+
+auto MBMS_RT::DiskSegmentStore::map(const Entry& entry, const Reader& reader) const -> ItemPayload
+{
+  static const auto page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  auto aligned = entry.offset - entry.offset % page_size;
+  auto length = static_cast<size_t>(entry.offset - aligned + entry.length);
+  auto* addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, reader.fd, static_cast<off_t>(aligned));
+  if (addr == MAP_FAILED) {
+    return {};
+  }
+  // The mapping stays valid when the data file is deleted, until the last payload holder is gone
+  std::shared_ptr<const void> holder(addr, [length](const void* p) { munmap(const_cast<void*>(p), length); });
+  return { holder, static_cast<const char*>(addr) + (entry.offset - aligned), entry.length };
+}
+
+auto MBMS_RT::DiskSegmentStore::find(const std::string& location) const -> std::shared_ptr<CacheItem>
+{
+  if (!_enabled) {
+    return nullptr;
+  }
+  std::shared_ptr<StoredSegment> item;
+  Entry entry{};
+  std::shared_ptr<Reader> reader;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (auto pending = _pending.find(location); pending != _pending.end()) {
+      item = std::make_shared<StoredSegment>(location, pending->second.received_at, pending->second.payload,
+          pending->second.source);
+    } else if (auto it = _entries.find(location); it != _entries.end()) {
+      entry = it->second;
+      auto file = _files.find(entry.file);
+      if (file == _files.end()) {
+        return nullptr;
+      }
+      reader = file->second.reader;
+    } else {
+      return nullptr;
+    }
+  }
+
+  if (!item) {
+    // First request for this segment or data file: open and map it without holding up other lookups
+    if (!reader) {
+      auto fd = open(data_file_path(entry.file).c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        return nullptr;
+      }
+      reader = std::make_shared<Reader>(fd);
+    }
+    if (entry.mapped.data == nullptr) {
+      entry.mapped = map(entry, *reader);
+      if (entry.mapped.data == nullptr) {
+        return nullptr;
+      }
+    }
+  }
+
+  const std::lock_guard<std::mutex> lock(_mutex);
+  if (!item) {
+    auto it = _entries.find(location);
+    if (it != _entries.end() && it->second.file == entry.file && it->second.offset == entry.offset) {
+      if (it->second.mapped.data == nullptr) {
+        it->second.mapped = entry.mapped;
+      } else {
+        // Another lookup mapped it in the meantime, share that mapping
+        entry.mapped = it->second.mapped;
+      }
+      if (auto file = _files.find(entry.file); file != _files.end() && !file->second.reader) {
+        file->second.reader = reader;
+      }
+    }
+    auto fd = reader->fd;
+    item = std::make_shared<StoredSegment>(location, entry.received_at, entry.mapped, entry.source,
+        CacheItem::FileRegion{ std::move(reader), fd, entry.offset });
+  }
+  _hits++;
+  // Stored segments do not change, downstream caches can keep them for as long as the store does
+  auto age = time(nullptr) - static_cast<time_t>(item->received_at());
+  item->set_max_age(static_cast<int>(std::max<time_t>(static_cast<time_t>(_max_age) - age, 0)));
+  return item;
+}
+
+// Must be called on the writer thread with _mutex held
+auto MBMS_RT::DiskSegmentStore::drop_oldest_file() -> void
+{
+  auto oldest = _files.begin();
+  for (auto it = _entries.begin(); it != _entries.end();) {
+    if (it->second.file == oldest->first) {
+      it = _entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  spdlog::info("Disk cache deleting {} ({} MB)", data_file_path(oldest->first), oldest->second.size / 1024 / 1024);
+  unlink(data_file_path(oldest->first).c_str());
+  _bytes -= std::min(_bytes, oldest->second.size);
+  _files.erase(oldest);
+}
+
+auto MBMS_RT::DiskSegmentStore::maintain() -> void
+{
+  if (!_enabled) {
+    return;
+  }
+  _disk_io.post([this]() { expire_and_sync(); });
+}
+
+auto MBMS_RT::DiskSegmentStore::expire_and_sync() -> void
+{
+  bool dropped = false;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto now = static_cast<unsigned long>(time(nullptr));
+    // The file being appended to is never deleted
+    while (_files.size() > 1 && _files.begin()->first != _write_file &&
+        (_bytes > _max_size || _files.begin()->second.newest + _max_age < now)) {
+      drop_oldest_file();
+      dropped = true;
+    }
+  }
+  if (dropped) {
+    // Drop the records of deleted files, so the index does not grow without bound
+    if (!rewrite_index()) {
+      spdlog::warn("Disk cache could not rewrite its index");
+    }
+  } else if (_index_dirty && _index_fd >= 0) {
+    fdatasync(_index_fd);
+    _index_dirty = false;
+  }
+  if (_write_fd >= 0) {
+    fdatasync(_write_fd);
+  }
+}
+
+auto MBMS_RT::DiskSegmentStore::stats() const -> Stats
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return { _entries.size(), _files.size(), _bytes, _stored, _hits, _write_errors };
+}
@@ -0,0 +1,176 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <libconfig.h++>
+#include <boost/asio.hpp>
+#include "CacheItems.h"
+#include "ItemPayload.h"
+#include "ItemSource.h"
+
+namespace MBMS_RT {
+  /**
+   *  On-disk second tier for segments that have left the memory cache, for time-shifted playback.
+   *
+   *  Segment data is appended to data files of up to file_size, which are deleted oldest first once the
+   *  store exceeds max_size or their newest segment is older than max_age. Every stored segment gets a
+   *  line in an append-only index that is replayed on startup and rewritten when a data file is
+   *  deleted. Writes and syncs run on a thread of the store's own, so they never hold up the
+   *  middleware's io_service. Stored segments are served as read-only memory mappings, so they live in
+   *  the page cache rather than in the middleware's heap, and carry their file region for servers that
+   *  send them with sendfile. Configured in mw.cache.disk.
+   */
+  class DiskSegmentStore {
+    public:
+      DiskSegmentStore(const libconfig::Config& cfg);
+      virtual ~DiskSegmentStore();
+      DiskSegmentStore(const DiskSegmentStore&) = delete;
+      DiskSegmentStore& operator=(const DiskSegmentStore&) = delete;
+
+      /**
+       *  @return false if the store is disabled or its directory could not be opened
+       */
+      bool enabled() const { return _enabled; };
+
+      /**
+       *  Seconds of content behind the memory window that playlists should keep listing
+       */
+      unsigned dvr_window() const { return _enabled ? _dvr_window : 0; };
+
+      /**
+       *  Write a segment to disk in the background. Until it is written, find() serves it from the
+       *  payload, which is held until then.
+       */
+      void store(const std::string& location, ItemPayload payload, unsigned long received_at, ItemSource source);
+
+      /**
+       *  @return An item serving the stored segment at a content location, or nullptr if there is none
+       */
+      std::shared_ptr<CacheItem> find(const std::string& location) const;
+
+      /**
+       *  Flush the index to disk and delete data files beyond max_size or max_age, in the background
+       */
+      void maintain();
+
+      struct Stats {
+        size_t items;
+        size_t files;
+        uint64_t bytes;
+        uint64_t stored;
+        uint64_t hits;
+        uint64_t write_errors;
+      };
+      Stats stats() const;
+
+    private:
+      struct Entry {
+        uint32_t file;
+        uint64_t offset;
+        uint32_t length;
+        unsigned long received_at;
+        ItemSource source;
+        mutable ItemPayload mapped = {};    // mapped on the first find(), released with the entry
+      };
+      // Read-only descriptor of a data file, closed when the last mapping in progress is done with it
+      struct Reader {
+        explicit Reader(int fd) : fd(fd) {}
+        ~Reader();
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        int fd;
+      };
+      struct DataFile {
+        uint64_t size = 0;
+        unsigned long newest = 0;
+        mutable std::shared_ptr<Reader> reader;
+      };
+      struct Pending {
+        ItemPayload payload;
+        unsigned long received_at;
+        ItemSource source;
+      };
+
+      void write(const std::string& location);
+      void expire_and_sync();
+      bool open_data_file(uint32_t number);
+      void load_index();
+      bool rewrite_index();
+      void drop_oldest_file();
+      std::string data_file_path(uint32_t number) const;
+      ItemPayload map(const Entry& entry, const Reader& reader) const;
+
+      bool _enabled = false;
+      std::string _path = "/var/cache/5gmag-rt";
+      uint64_t _max_size = 0;
+      uint64_t _file_size = 0;
+      unsigned _max_age = 3600;
+      unsigned _dvr_window = 0;
+
+      // Writes, syncs and deletions all run on _writer, which owns the write and index descriptors.
+      // _mutex guards the maps and counters.
+      boost::asio::io_service _disk_io;
+      std::unique_ptr<boost::asio::io_service::work> _work;
+      std::thread _writer;
+      mutable std::mutex _mutex;
+      std::unordered_map<std::string, Entry> _entries;
+      std::unordered_map<std::string, Pending> _pending;
+      std::map<uint32_t, DataFile> _files;    // oldest first
+      uint64_t _bytes = 0;
+      int _write_fd = -1;
+      uint32_t _write_file = 0;
+      int _index_fd = -1;
+      bool _index_dirty = false;
+      uint64_t _stored = 0;
+      mutable uint64_t _hits = 0;
+      uint64_t _write_errors = 0;
+  };
+
+  /**
+   *  A segment served from the disk tier
+   */
+  class StoredSegment : public CacheItem {
+    public:
+      StoredSegment(const std::string& content_location, unsigned long received_at, ItemPayload payload,
+          ItemSource source, FileRegion region = {})
+        : CacheItem( content_location, received_at )
+        , _payload( std::move(payload) )
+        , _source( source )
+        , _region( std::move(region) )
+        {}
+      virtual ~StoredSegment() = default;
+
+      virtual ItemType item_type() const { return ItemType::Segment; };
+      virtual ItemPayload payload() const { return _payload; };
+      virtual uint32_t content_length() const { return _payload.length; };
+      virtual ItemSource item_source() const { return _source; };
+      virtual FileRegion file_region() const { return _region; };
+
+    private:
+      ItemPayload _payload;
+      ItemSource _source;
+      FileRegion _region;   // unset until the segment has been written
+  };
+}
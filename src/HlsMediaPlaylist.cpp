@@ -18,21 +18,21 @@
 #include "HlsMediaPlaylist.h"
 
 #include "spdlog/spdlog.h"
-#include "boost/algorithm/string.hpp"
-#include <sstream>
+#include "HlsParsing.h"
+#include <cstdio>
 
 MBMS_RT::HlsMediaPlaylist::HlsMediaPlaylist(const std::string& content)
 {
+  using namespace HlsParsing;
   spdlog::debug("Parsing HLS media playlist: {}", content);
 
-  std::istringstream iss(content);
+  std::string_view remaining(content);
+  std::string_view line;
   int idx = 0;
   int seq_nr = 0;
   double extinf = -1;
-  for (std::string line; std::getline(iss, line); idx++ )
+  for (; next_line(remaining, line); idx++ )
   {
-    boost::algorithm::trim(line);
-
     if (idx==0) {
       if ( line != "#EXTM3U") {
         throw("HLS playlist parsing failed: first line is not #EXTM3U");
@@ -41,50 +41,47 @@ MBMS_RT::HlsMediaPlaylist::HlsMediaPlaylist(const std::string& content)
       }
     }
 
-    size_t cpos = line.rfind(':');
-
-    if (line.rfind("#EXT-X-VERSION", 0) == 0) {
+    if (line.empty()) {
+      continue;
+    } else if (line[0] != '#') {
+      _segments.push_back({std::string(line), seq_nr++, extinf});
+    } else if (starts_with(line, "#EXTINF")) {
+      extinf = to_double(tag_value(line));
+    } else if (starts_with(line, "#EXT-X-MEDIA-SEQUENCE")) {
+      seq_nr = to_integer<int>(tag_value(line));
+    } else if (starts_with(line, "#EXT-X-TARGETDURATION")) {
+      _targetduration = to_integer<int>(tag_value(line));
+    } else if (starts_with(line, "#EXT-X-VERSION")) {
       if (_version != -1) {
         throw("HLS playlist parsing failed: duplicate #EXT-X-VERSION");
       }
-      if (cpos != std::string::npos) {
-        _version = atoi(line.substr(cpos+1).c_str());
-      }
-    } else if (line.rfind("#EXT-X-TARGETDURATION", 0) == 0) {
-      if (cpos != std::string::npos) {
-        _targetduration = atoi(line.substr(cpos+1).c_str());
-      }
-    } else if (line.rfind("#EXT-X-MEDIA-SEQUENCE", 0) == 0) {
-      if (cpos != std::string::npos) {
-        seq_nr = atoi(line.substr(cpos+1).c_str());
-      }
-    } else if (line.rfind("#EXTINF", 0) == 0) {
-      if (cpos != std::string::npos) {
-        extinf = atof(line.substr(cpos+1).c_str());
-      }
-    } else if (line.rfind('#', 0) == 0) {
-        spdlog::debug("HLS playlist parser ignoring unhandled line {}", line);
-    } else if (line.size() > 0) {
-        _segments.push_back({line, seq_nr++, extinf});
+      _version = to_integer<int>(tag_value(line));
+    } else {
+      spdlog::debug("HLS playlist parser ignoring unhandled line {}", line);
     }
   }
 }
 
+auto MBMS_RT::HlsMediaPlaylist::append_segment_lines(std::string& out, const Segment& segment) -> void
+{
+  // %g matches the default ostream formatting of the duration
+  char extinf[48];
+  auto len = snprintf(extinf, sizeof(extinf), "#EXTINF:%g\n/", segment.extinf);
+  out.append(extinf, len);
+  out.append(segment.uri);
+  out.push_back('\n');
+}
 
 auto MBMS_RT::HlsMediaPlaylist::to_string() const -> std::string
 {
-  std::stringstream pl;
-
-  pl << "#EXTM3U" << std::endl;
-  pl << "#EXT-X-VERSION:3" << std::endl;
+  std::string pl = "#EXTM3U\n#EXT-X-VERSION:3\n";
 
   if (_segments.size() > 0) {
-    pl << "#EXT-X-TARGETDURATION:" << _targetduration << std::endl;
-    pl << "#EXT-X-MEDIA-SEQUENCE:" << _segments[0].seq << std::endl;
+    pl += "#EXT-X-TARGETDURATION:" + std::to_string(_targetduration) + "\n";
+    pl += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(_segments[0].seq) + "\n";
   }
   for (const auto& seg : _segments) {
-    pl << "#EXTINF:" << seg.extinf << std::endl;
-    pl << "/" << seg.uri << std::endl;
+    append_segment_lines(pl, seg);
   }
-  return std::move(pl.str());
+  return pl;
 }
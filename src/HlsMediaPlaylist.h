@@ -37,12 +37,17 @@ namespace MBMS_RT {
 
       std::string to_string() const;
 
+      /**
+       *  Append the #EXTINF and URI lines for a segment, as written by to_string()
+       */
+      static void append_segment_lines(std::string& out, const Segment& segment);
+
       void set_target_duration(int duration) { _targetduration = duration; };
       int target_duration() const { return _targetduration; };
 
     private:
       int _version = -1;
-      int _targetduration;
+      int _targetduration = 0;
       std::vector<Segment> _segments = {};
   };
 }
@@ -0,0 +1,52 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "HlsMediaPlaylistWriter.h"
+
+auto MBMS_RT::HlsMediaPlaylistWriter::add_segment(const HlsMediaPlaylist::Segment& segment) -> void
+{
+  std::string lines;
+  HlsMediaPlaylist::append_segment_lines(lines, segment);
+  auto& slot = _segment_lines[segment.seq];
+  _segment_bytes -= slot.size();
+  _segment_bytes += lines.size();
+  slot = std::move(lines);
+}
+
+auto MBMS_RT::HlsMediaPlaylistWriter::remove_segment(int seq) -> void
+{
+  auto it = _segment_lines.find(seq);
+  if (it != _segment_lines.end()) {
+    _segment_bytes -= it->second.size();
+    _segment_lines.erase(it);
+  }
+}
+
+auto MBMS_RT::HlsMediaPlaylistWriter::to_string() const -> std::string
+{
+  std::string pl;
+  pl.reserve(128 + _segment_bytes);
+  pl += "#EXTM3U\n#EXT-X-VERSION:3\n";
+  if (!_segment_lines.empty()) {
+    pl += "#EXT-X-TARGETDURATION:" + std::to_string(_target_duration) + "\n";
+    pl += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(_segment_lines.begin()->first) + "\n";
+  }
+  for (const auto& lines : _segment_lines) {
+    pl += lines.second;
+  }
+  return pl;
+}
@@ -0,0 +1,57 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <map>
+#include <string>
+#include "HlsMediaPlaylist.h"
+
+namespace MBMS_RT {
+  /**
+   *  Maintains a generated HLS media playlist across updates.
+   *
+   *  The serialized lines of each segment are kept, so adding or dropping a segment only touches that
+   *  segment. to_string() concatenates the kept lines into a single preallocated string.
+   */
+  class HlsMediaPlaylistWriter {
+    public:
+      HlsMediaPlaylistWriter() = default;
+      virtual ~HlsMediaPlaylistWriter() = default;
+
+      void set_target_duration(int duration) { _target_duration = duration; };
+
+      /**
+       *  Add a segment, kept in media sequence order. A segment with an already present sequence
+       *  number replaces the existing one.
+       */
+      void add_segment(const HlsMediaPlaylist::Segment& segment);
+      void remove_segment(int seq);
+
+      size_t segment_count() const { return _segment_lines.size(); };
+
+      /**
+       *  @return The playlist, byte identical to HlsMediaPlaylist::to_string() for the same segments
+       */
+      std::string to_string() const;
+
+    private:
+      int _target_duration = 0;
+      std::map<int, std::string> _segment_lines;
+      size_t _segment_bytes = 0;
+  };
+}
@@ -0,0 +1,98 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+namespace MBMS_RT {
+  /**
+   *  Allocation free helpers for the single-pass HLS playlist parsers.
+   */
+  namespace HlsParsing {
+    inline auto trim(std::string_view sv) -> std::string_view
+    {
+      while (!sv.empty() && isspace(static_cast<unsigned char>(sv.front()))) sv.remove_prefix(1);
+      while (!sv.empty() && isspace(static_cast<unsigned char>(sv.back()))) sv.remove_suffix(1);
+      return sv;
+    }
+
+    /**
+     *  Split the next line off the front of content. Handles both LF and CRLF line endings.
+     *
+     *  @return false once content is exhausted
+     */
+    inline auto next_line(std::string_view& content, std::string_view& line) -> bool
+    {
+      if (content.empty()) {
+        return false;
+      }
+      auto pos = content.find('\n');
+      if (pos == std::string_view::npos) {
+        line = trim(content);
+        content = {};
+      } else {
+        line = trim(content.substr(0, pos));
+        content.remove_prefix(pos + 1);
+      }
+      return true;
+    }
+
+    inline auto starts_with(std::string_view sv, std::string_view prefix) -> bool
+    {
+      return sv.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    /**
+     *  @return The part of a tag line after the first ':', or an empty view if there is none
+     */
+    inline auto tag_value(std::string_view line) -> std::string_view
+    {
+      auto cpos = line.find(':');
+      return cpos == std::string_view::npos ? std::string_view() : line.substr(cpos + 1);
+    }
+
+    template <typename T>
+    inline auto to_integer(std::string_view sv) -> T
+    {
+      // from_chars takes neither blanks nor a '+' sign, which stoi accepted, e.g. "#EXT-X-MEDIA-SEQUENCE: 5"
+      sv = trim(sv);
+      if (!sv.empty() && sv.front() == '+') {
+        sv.remove_prefix(1);
+      }
+      T result = 0;
+      std::from_chars(sv.data(), sv.data() + sv.size(), result);
+      return result;
+    }
+
+    inline auto to_double(std::string_view sv) -> double
+    {
+      // Floating point from_chars is not available on all supported toolchains, so copy into a small
+      // terminated buffer for strtod
+      char buf[32];
+      auto len = std::min(sv.size(), sizeof(buf) - 1);
+      memcpy(buf, sv.data(), len);
+      buf[len] = '\0';
+      return strtod(buf, nullptr);
+    }
+  }
+}
@@ -18,25 +18,24 @@
 #include "HlsPrimaryPlaylist.h"
 
 #include "spdlog/spdlog.h"
-#include "boost/algorithm/string.hpp"
+#include "HlsParsing.h"
 #include <iomanip>
 #include <sstream>
 
 MBMS_RT::HlsPrimaryPlaylist::HlsPrimaryPlaylist(const std::string& content, const std::string& base_path)
 {
+  using namespace HlsParsing;
   spdlog::debug("Parsing HLS primary playlist: {}", content);
 
-  std::istringstream iss(content);
+  std::string_view remaining(content);
+  std::string_view line;
   int idx = 0;
-  std::string resolution = "";
-  std::string codecs = "";
+  std::string_view resolution;
+  std::string_view codecs;
   unsigned long bandwidth = 0;
   double frame_rate = 0;
-  for (std::string line; std::getline(iss, line); idx++ )
+  for (; next_line(remaining, line); idx++ )
   {
-
-    boost::algorithm::trim(line);
-
     if (idx==0) {
       if ( line != "#EXTM3U") {
         throw("HLS playlist parsing failed: first line is not #EXTM3U");
@@ -45,70 +44,62 @@ MBMS_RT::HlsPrimaryPlaylist::HlsPrimaryPlaylist(const std::string& content, cons
       }
     }
 
-    size_t cpos = line.rfind(':');
-
-    if (line.rfind("#EXT-X-VERSION", 0) == 0) {
+    if (line.empty()) {
+      continue;
+    } else if (line[0] != '#') {
+      std::string uri = base_path;
+      uri.append(line);
+      _streams.push_back({std::move(uri), std::string(resolution), std::string(codecs), bandwidth, frame_rate});
+      resolution = {}; codecs = {}; bandwidth = 0; frame_rate = 0;
+    } else if (starts_with(line, "#EXT-X-STREAM-INF")) {
+      for (const auto& param : parse_parameters(tag_value(line))) {
+        if (param.first == "BANDWIDTH") {
+          bandwidth = to_integer<unsigned long>(param.second);
+        }
+        else if (param.first == "FRAME-RATE") {
+          frame_rate = to_double(param.second);
+        }
+        else if (param.first == "RESOLUTION") {
+          resolution = param.second;
+        }
+        else if (param.first == "CODECS") {
+          codecs = param.second;
+        }
+      }
+    } else if (starts_with(line, "#EXT-X-VERSION")) {
       if (_version != -1) {
         throw("HLS playlist parsing failed: duplicate #EXT-X-VERSION");
       }
-      if (cpos != std::string::npos) {
-        _version = atoi(line.substr(cpos+1).c_str());
-      }
-    } else if (line.rfind("#EXT-X-STREAM-INF", 0) == 0) {
-      if (cpos != std::string::npos) {
-        std::string info = line.substr(cpos+1);
-        auto params = parse_parameters(info);
-        for (const auto& param : params) {
-          if (param.first == "BANDWIDTH") {
-            bandwidth = std::atoi(param.second.c_str()); 
-          }
-          else if (param.first == "FRAME-RATE") {
-            frame_rate = std::atof(param.second.c_str());
-          }
-          else if (param.first == "RESOLUTION") {
-            resolution = param.second;
-          }
-          else if (param.first == "CODECS") {
-            codecs = param.second;
-          }
-        }
-      }
-    } else if (line.rfind('#', 0) == 0) {
-        spdlog::debug("HLS playlist parser ignoring unhandled line {}", line);
-    } else if (line.size() > 0) {
-      std::string uri = base_path + line;
-      _streams.push_back({uri, resolution, codecs, bandwidth, frame_rate});
-      resolution = ""; codecs = ""; bandwidth = 0; frame_rate = 0;
+      _version = to_integer<int>(tag_value(line));
+    } else {
+      spdlog::debug("HLS playlist parser ignoring unhandled line {}", line);
     }
   }
 }
 
-auto MBMS_RT::HlsPrimaryPlaylist::parse_parameters(const std::string& line) const -> std::vector<std::pair<std::string, std::string>>
+auto MBMS_RT::HlsPrimaryPlaylist::parse_parameters(std::string_view line) -> std::vector<std::pair<std::string_view, std::string_view>>
 {
-  std::vector<std::pair<std::string, std::string>> result;
+  std::vector<std::pair<std::string_view, std::string_view>> result;
+  auto add = [&result](std::string_view param) {
+    auto eq = param.find('=');
+    auto key = param.substr(0, eq);
+    auto value = eq == std::string_view::npos ? std::string_view() : param.substr(eq + 1);
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+      value = value.substr(1, value.size() - 2);
+    }
+    result.emplace_back(key, value);
+  };
   bool quoted = false;
-  bool in_key = true;
-  std::stringstream key;
-  std::stringstream value;
-  for(const char& c : line) {
-    if (c == '"') {
+  size_t start = 0;
+  for (size_t i = 0; i < line.size(); i++) {
+    if (line[i] == '"') {
       quoted = !quoted;
-    } else if (c == ',' && !quoted) {
-      result.emplace_back(std::make_pair(key.str(), value.str()));
-      key.str(""); key.clear();
-      value.str(""); value.clear();
-      in_key = true;
-    } else if (c == '=') {
-      in_key = false;
-    } else {
-      if (in_key) {
-        key << c;
-      } else {
-        value << c;
-      }
+    } else if (line[i] == ',' && !quoted) {
+      add(line.substr(start, i - start));
+      start = i + 1;
     }
   }
-  result.emplace_back(std::make_pair(key.str(), value.str()));
+  add(line.substr(start));
   return result;
 }
 
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace MBMS_RT {
@@ -39,7 +40,7 @@ namespace MBMS_RT {
 
       std::string to_string() const;
     private:
-      std::vector<std::pair<std::string, std::string>> parse_parameters(const std::string& line) const;
+      static std::vector<std::pair<std::string_view, std::string_view>> parse_parameters(std::string_view line);
       int _version = -1;
       std::vector<Stream> _streams = {};
   };
@@ -0,0 +1,254 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "HttpCaching.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+auto MBMS_RT::HttpCaching::format_http_date(time_t time) -> std::string
+{
+  struct tm tm = {};
+  gmtime_r(&time, &tm);
+  char buf[64];
+  auto len = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return std::string(buf, len);
+}
+
+auto MBMS_RT::HttpCaching::parse_http_date(const std::string& date) -> time_t
+{
+  struct tm tm = {};
+  auto end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (end == nullptr) {
+    return 0;
+  }
+  return timegm(&tm);
+}
+
+auto MBMS_RT::HttpCaching::etag_matches(const std::string& if_none_match, const std::string& etag) -> bool
+{
+  auto strip_weak = [](const std::string& tag) {
+    return tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag;
+  };
+  auto opaque = strip_weak(etag);
+  size_t pos = 0;
+  while (pos < if_none_match.size()) {
+    auto comma = if_none_match.find(',', pos);
+    auto candidate = if_none_match.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+    auto first = candidate.find_first_not_of(" \t");
+    auto last = candidate.find_last_not_of(" \t");
+    if (first != std::string::npos) {
+      candidate = candidate.substr(first, last - first + 1);
+      if (candidate == "*" || strip_weak(candidate) == opaque) {
+        return true;
+      }
+    }
+    if (comma == std::string::npos) {
+      break;
+    }
+    pos = comma + 1;
+  }
+  return false;
+}
+
+auto MBMS_RT::HttpCaching::not_modified(const std::string& if_none_match, const std::string& if_modified_since,
+    const std::string& etag, time_t last_modified) -> bool
+{
+  if (!if_none_match.empty()) {
+    return etag_matches(if_none_match, etag);
+  }
+  if (last_modified > 0 && !if_modified_since.empty()) {
+    auto since = parse_http_date(if_modified_since);
+    return since > 0 && last_modified <= since;
+  }
+  return false;
+}
+
+auto MBMS_RT::HttpCaching::parse_range(const std::string& header, uint64_t length, ByteRange& range) -> RangeResult
+{
+  static const std::string unit = "bytes=";
+  if (header.compare(0, unit.size(), unit) != 0 || header.find(',') != std::string::npos) {
+    return RangeResult::Ignore;
+  }
+  auto spec = header.substr(unit.size());
+  auto dash = spec.find('-');
+  if (dash == std::string::npos) {
+    return RangeResult::Ignore;
+  }
+  auto first_str = spec.substr(0, dash);
+  auto last_str = spec.substr(dash + 1);
+  char* end = nullptr;
+
+  if (first_str.empty()) {
+    // Suffix range: the last N bytes
+    if (last_str.empty()) {
+      return RangeResult::Ignore;
+    }
+    auto suffix = strtoull(last_str.c_str(), &end, 10);
+    if (*end != '\0') {
+      return RangeResult::Ignore;
+    }
+    if (suffix == 0 || length == 0) {
+      return RangeResult::Unsatisfiable;
+    }
+    range.first = suffix >= length ? 0 : length - suffix;
+    range.last = length - 1;
+    return RangeResult::Satisfiable;
+  }
+
+  range.first = strtoull(first_str.c_str(), &end, 10);
+  if (*end != '\0') {
+    return RangeResult::Ignore;
+  }
+  if (last_str.empty()) {
+    range.last = length - 1;
+  } else {
+    range.last = strtoull(last_str.c_str(), &end, 10);
+    if (*end != '\0' || range.last < range.first) {
+      return RangeResult::Ignore;
+    }
+    range.last = std::min(range.last, length - 1);
+  }
+  if (range.first >= length) {
+    return RangeResult::Unsatisfiable;
+  }
+  return RangeResult::Satisfiable;
+}
+
+auto MBMS_RT::HttpCaching::cache_control(unsigned max_age) -> std::string
+{
+  return max_age == 0 ? "no-cache" : "max-age=" + std::to_string(max_age);
+}
+
+auto MBMS_RT::HttpCaching::etag_for(uint64_t version, time_t received_at, uint64_t length,
+    const std::string& coding) -> std::string
+{
+  return "\"" + (version != 0 ? std::to_string(version)
+      : std::to_string(received_at) + "-" + std::to_string(length)) + (coding.empty() ? "" : "-" + coding) + "\"";
+}
+
+auto MBMS_RT::HttpCaching::negotiate_encoding(const std::string& accept_encoding,
+    const std::vector<std::string>& available) -> std::string
+{
+  // q-values of the listed codings, "*" standing for all others (RFC 7231, 5.3.4)
+  std::vector<std::pair<std::string, double>> accepted;
+  size_t pos = 0;
+  while (pos < accept_encoding.size()) {
+    auto end = accept_encoding.find(',', pos);
+    if (end == std::string::npos) {
+      end = accept_encoding.size();
+    }
+    auto item = accept_encoding.substr(pos, end - pos);
+    pos = end + 1;
+    double q = 1;
+    auto semicolon = item.find(';');
+    if (semicolon != std::string::npos) {
+      auto q_pos = item.find("q=", semicolon);
+      if (q_pos != std::string::npos) {
+        q = strtod(item.c_str() + q_pos + 2, nullptr);
+      }
+      item.erase(semicolon);
+    }
+    item.erase(0, item.find_first_not_of(" \t"));
+    item.erase(item.find_last_not_of(" \t") + 1);
+    std::transform(item.begin(), item.end(), item.begin(), ::tolower);
+    if (!item.empty()) {
+      accepted.emplace_back(item, q);
+    }
+  }
+
+  std::string best;
+  double best_q = 0;
+  for (const auto& coding : available) {
+    double q = 0;
+    for (const auto& [name, value] : accepted) {
+      if (name == coding) {
+        q = value;
+        break;
+      }
+      if (name == "*") {
+        q = value;
+      }
+    }
+    if (q > best_q) {
+      best = coding;
+      best_q = q;
+    }
+  }
+  return best;
+}
+
+auto MBMS_RT::HttpCaching::last_modified_for(uint64_t version, time_t received_at) -> time_t
+{
+  return version != 0 ? 0 : received_at;
+}
+
+auto MBMS_RT::HttpCaching::evaluate(const RequestHeaders& request, const Representation& representation) -> Response
+{
+  Response response{200, 0, representation.length, {}};
+  auto add_cache_headers = [&]() {
+    response.headers.emplace_back("ETag", representation.etag);
+    if (representation.last_modified > 0) {
+      response.headers.emplace_back("Last-Modified", format_http_date(representation.last_modified));
+    }
+    if (representation.max_age >= 0) {
+      response.headers.emplace_back("Cache-Control", cache_control(representation.max_age));
+    }
+    if (representation.varies) {
+      response.headers.emplace_back("Vary", "Accept-Encoding");
+    }
+  };
+
+  if (not_modified(request.if_none_match, request.if_modified_since, representation.etag,
+      representation.last_modified)) {
+    response.status = 304;
+    response.length = 0;
+    add_cache_headers();
+    return response;
+  }
+
+  response.headers.emplace_back("Accept-Ranges", "bytes");
+  add_cache_headers();
+  if (!representation.content_encoding.empty()) {
+    response.headers.emplace_back("Content-Encoding", representation.content_encoding);
+  }
+
+  // A range is only honoured if If-Range, when present, still names this representation
+  if (!request.range.empty() && (request.if_range.empty() || request.if_range == representation.etag)) {
+    ByteRange range{};
+    switch (parse_range(request.range, representation.length, range)) {
+      case RangeResult::Satisfiable:
+        response.status = 206;
+        response.offset = range.first;
+        response.length = range.length();
+        response.headers.emplace_back("Content-Range", "bytes " + std::to_string(range.first) + "-" +
+            std::to_string(range.last) + "/" + std::to_string(representation.length));
+        break;
+      case RangeResult::Unsatisfiable:
+        response.status = 416;
+        response.length = 0;
+        response.headers.clear();
+        response.headers.emplace_back("Content-Range", "bytes */" + std::to_string(representation.length));
+        break;
+      case RangeResult::Ignore:
+      default:
+        break;
+    }
+  }
+  return response;
+}
@@ -0,0 +1,134 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   *  Helpers for HTTP validators, conditional requests and byte ranges (RFC 7232 / 7233), independent
+   *  of the HTTP server implementation.
+   */
+  namespace HttpCaching {
+    /**
+     *  @return time formatted as an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+     */
+    std::string format_http_date(time_t time);
+
+    /**
+     *  @return The time in an IMF-fixdate, or 0 if the date cannot be parsed
+     */
+    time_t parse_http_date(const std::string& date);
+
+    /**
+     *  @return true if an If-None-Match header value matches the entity tag (weak comparison)
+     */
+    bool etag_matches(const std::string& if_none_match, const std::string& etag);
+
+    /**
+     *  Evaluate the validators of a conditional GET, empty header values are absent. If-None-Match takes
+     *  precedence, If-Modified-Since is only evaluated without it (RFC 7232, 6) and if last_modified is set.
+     *  @return true if the request is answered with 304 Not Modified
+     */
+    bool not_modified(const std::string& if_none_match, const std::string& if_modified_since,
+        const std::string& etag, time_t last_modified);
+
+    struct ByteRange {
+      uint64_t first;
+      uint64_t last;   /**< inclusive */
+      uint64_t length() const { return last - first + 1; };
+    };
+
+    enum class RangeResult {
+      Ignore,          /**< no usable range, serve the full representation */
+      Satisfiable,
+      Unsatisfiable
+    };
+
+    /**
+     *  Evaluate a Range header against a representation of the given length. Only single ranges are
+     *  served partially; multiple ranges are answered with the full representation, as RFC 7233 allows.
+     */
+    RangeResult parse_range(const std::string& header, uint64_t length, ByteRange& range);
+
+    /**
+     *  @return A Cache-Control value for a lifetime in seconds, "no-cache" for 0
+     */
+    std::string cache_control(unsigned max_age);
+
+    /**
+     *  @return The entity tag for a cached item: its version for generated content, otherwise when it
+     *          was received and its length. Content codings other than identity get their own tag.
+     */
+    std::string etag_for(uint64_t version, time_t received_at, uint64_t length, const std::string& coding = "");
+
+    /**
+     *  Pick a content coding from available by an Accept-Encoding header, preferring the highest
+     *  q-value and the order of available on ties.
+     *
+     *  @return The coding, or an empty string for identity
+     */
+    std::string negotiate_encoding(const std::string& accept_encoding, const std::vector<std::string>& available);
+
+    /**
+     *  @return The Last-Modified time for a cached item, 0 for generated content. A playlist can be
+     *          regenerated several times within a second, which a date cannot tell apart, so generated
+     *          items are only validated by their entity tag.
+     */
+    time_t last_modified_for(uint64_t version, time_t received_at);
+
+    /**
+     *  Conditional and range request headers. Empty strings stand for absent headers.
+     */
+    struct RequestHeaders {
+      std::string if_none_match;
+      std::string if_modified_since;
+      std::string range;
+      std::string if_range;
+      std::string accept_encoding;
+    };
+
+    /**
+     *  What is known about the representation being served
+     */
+    struct Representation {
+      std::string etag;
+      time_t last_modified;   /**< 0 if unknown */
+      int max_age;            /**< -1 for no Cache-Control header */
+      uint64_t length;
+      std::string content_encoding = {};   /**< empty for identity */
+      bool varies = false;                 /**< encoded variants exist, send Vary: Accept-Encoding */
+    };
+
+    struct Response {
+      unsigned short status;
+      uint64_t offset;        /**< first body byte to send */
+      uint64_t length;        /**< body bytes to send, 0 for 304 / 416 */
+      std::vector<std::pair<std::string, std::string>> headers;
+    };
+
+    /**
+     *  Decide status, body slice and validator / caching headers for a GET of a representation
+     */
+    Response evaluate(const RequestHeaders& request, const Representation& representation);
+  }
+}
@@ -0,0 +1,37 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace MBMS_RT {
+  /**
+   *  A view of the data of a cache item. The holder keeps the data alive for as long as the
+   *  payload is in use, even if the item is replaced or evicted in the meantime.
+   */
+  struct ItemPayload {
+    std::shared_ptr<const void> holder;
+    const char* data = nullptr;
+    uint32_t length = 0;
+    uint64_t version = 0;   /**< Version of generated content, 0 if the item is not versioned */
+    std::string content_encoding = {};   /**< Content-Encoding of data, empty for identity */
+    bool varies = false;                 /**< the item has variants in other content codings */
+  };
+}
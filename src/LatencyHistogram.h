@@ -0,0 +1,54 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace MBMS_RT {
+  /**
+   *  Counts durations into fixed millisecond buckets, Prometheus style: each count includes all faster
+   *  samples. Not synchronised, the owner guards it.
+   */
+  class LatencyHistogram {
+    public:
+      static constexpr std::array<double, 11> BOUNDS_MS = { 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+
+      void record(double ms) {
+        for (size_t i = 0; i < BOUNDS_MS.size(); i++) {
+          if (ms <= BOUNDS_MS[i]) {
+            _buckets[i]++;
+          }
+        }
+        _count++;
+        _sum_ms += ms;
+      };
+
+      /**
+       *  @return Number of samples at or below BOUNDS_MS[i]
+       */
+      uint64_t bucket(size_t i) const { return _buckets[i]; };
+      uint64_t count() const { return _count; };
+      double sum_ms() const { return _sum_ms; };
+
+    private:
+      std::array<uint64_t, BOUNDS_MS.size()> _buckets = {};
+      uint64_t _count = 0;
+      double _sum_ms = 0;
+  };
+}
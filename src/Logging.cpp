@@ -0,0 +1,111 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Logging.h"
+
+#include <syslog.h>
+#include <vector>
+
+#include "spdlog/async.h"
+#include "spdlog/sinks/syslog_sink.h"
+
+namespace {
+  std::array<std::shared_ptr<spdlog::logger>, MBMS_RT::Logging::CATEGORY_COUNT> loggers;
+  unsigned messages_per_second = 20;
+}
+
+auto MBMS_RT::Logging::category_name(Category category) -> const char*
+{
+  switch (category) {
+    case Category::Flute: return "flute";
+    case Category::Stream: return "stream";
+    case Category::Cdn: return "cdn";
+    case Category::Http: return "http";
+    case Category::Cache: return "cache";
+    case Category::General:
+    default: return "general";
+  }
+}
+
+auto MBMS_RT::Logging::configure(const libconfig::Config& cfg, const std::string& ident,
+    spdlog::level::level_enum level) -> void
+{
+  unsigned queue_size = 8192;
+  cfg.lookupValue("mw.log.queue_size", queue_size);
+  cfg.lookupValue("mw.log.rate_limit", messages_per_second);
+
+  // One background thread keeps the messages in order
+  spdlog::init_thread_pool(queue_size, 1);
+  std::vector<spdlog::sink_ptr> sinks = {
+    std::make_shared<spdlog::sinks::syslog_sink_mt>(ident, LOG_PID | LOG_PERROR | LOG_CONS, LOG_USER, true) };
+
+  for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+    auto category = static_cast<Category>(i);
+    auto name = category_name(category);
+    auto logger = std::make_shared<spdlog::async_logger>(name, sinks.begin(), sinks.end(), spdlog::thread_pool(),
+        spdlog::async_overflow_policy::overrun_oldest);
+    auto category_level = level;
+    std::string level_name;
+    if (cfg.lookupValue((std::string("mw.log.levels.") + name).c_str(), level_name)) {
+      // from_str() yields off for names it does not know
+      auto parsed = spdlog::level::from_str(level_name);
+      if (parsed != spdlog::level::off || level_name == "off") {
+        category_level = parsed;
+      }
+    }
+    logger->set_level(category_level);
+    // Warnings and errors are not held back until the next flush interval
+    logger->flush_on(spdlog::level::warn);
+    loggers[i] = logger;
+    if (category == Category::General) {
+      spdlog::set_default_logger(logger);
+    } else {
+      spdlog::register_logger(logger);
+    }
+  }
+  spdlog::set_pattern("[%H:%M:%S.%f %z] [%^%l%$] [%n] [thr %t] %v");
+}
+
+auto MBMS_RT::Logging::logger(Category category) -> spdlog::logger&
+{
+  auto& logger = loggers[static_cast<size_t>(category)];
+  return logger ? *logger : *spdlog::default_logger_raw();
+}
+
+auto MBMS_RT::Logging::rate_limit() -> unsigned
+{
+  return messages_per_second;
+}
+
+auto MBMS_RT::Logging::RateLimitedLog::admit() -> int64_t
+{
+  auto limit = rate_limit();
+  if (limit == 0) {
+    return 0;
+  }
+  auto now = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  auto window = _window.load();
+  if (now != window && _window.compare_exchange_strong(window, now)) {
+    _count = 0;
+  }
+  if (_count.fetch_add(1) >= limit) {
+    _suppressed++;
+    return -1;
+  }
+  return _suppressed.exchange(0);
+}
@@ -0,0 +1,116 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <libconfig.h++>
+#include "spdlog/spdlog.h"
+
+namespace MBMS_RT {
+  /**
+   *  Log setup of the middleware: one asynchronous logger per category, writing through a bounded queue
+   *  to syslog and stderr on a background thread. When the queue is full the oldest messages are
+   *  dropped, so the receive and serve threads never wait for log I/O.
+   *
+   *  Levels can be set per category with mw.log.levels. Per-object messages go through a RateLimitedLog.
+   */
+  namespace Logging {
+    enum class Category {
+      General,    /**< everything logged through the default logger */
+      Flute,      /**< multicast reception and FLUTE decoding */
+      Stream,     /**< content streams, playlists and segments */
+      Cdn,        /**< CDN fetches */
+      Http,       /**< the HTTP servers */
+      Cache       /**< cache management */
+    };
+    static constexpr size_t CATEGORY_COUNT = 6;
+    const char* category_name(Category category);
+
+    /**
+     *  Create the loggers and make the General one the default logger.
+     *
+     *  @param level Level for categories without an entry in mw.log.levels
+     */
+    void configure(const libconfig::Config& cfg, const std::string& ident, spdlog::level::level_enum level);
+
+    /**
+     *  @return The logger of a category, the default logger if configure() has not been called
+     */
+    spdlog::logger& logger(Category category);
+
+    /**
+     *  @return Messages per second and call site admitted by RateLimitedLog, 0 for no limit
+     */
+    unsigned rate_limit();
+
+    /**
+     *  Logging for a call site that fires per received object, packet or request. Messages beyond
+     *  the rate limit within a second are counted instead of formatted, and the count is logged with
+     *  the next admitted message. Keep one per call site, usually as a function-local static.
+     */
+    class RateLimitedLog {
+      public:
+        explicit RateLimitedLog(Category category) : _category( category ) {};
+
+        template <typename... Args>
+        void log(spdlog::level::level_enum level, spdlog::format_string_t<Args...> fmt, Args&&... args) {
+          auto& log = logger(_category);
+          if (!log.should_log(level)) {
+            return;
+          }
+          auto suppressed = admit();
+          if (suppressed < 0) {
+            return;
+          }
+          log.log(level, fmt, std::forward<Args>(args)...);
+          if (suppressed > 0) {
+            log.log(level, "({} similar messages suppressed)", suppressed);
+          }
+        };
+
+        template <typename... Args>
+        void debug(spdlog::format_string_t<Args...> fmt, Args&&... args) {
+          log(spdlog::level::debug, fmt, std::forward<Args>(args)...);
+        };
+        template <typename... Args>
+        void info(spdlog::format_string_t<Args...> fmt, Args&&... args) {
+          log(spdlog::level::info, fmt, std::forward<Args>(args)...);
+        };
+        template <typename... Args>
+        void warn(spdlog::format_string_t<Args...> fmt, Args&&... args) {
+          log(spdlog::level::warn, fmt, std::forward<Args>(args)...);
+        };
+
+      private:
+        /**
+         *  @return -1 if the message is over the limit, otherwise the number suppressed since the
+         *          last admitted one
+         */
+        int64_t admit();
+
+        Category _category;
+        std::atomic<int64_t> _window = 0;       // second of the current window
+        std::atomic<unsigned> _count = 0;       // admitted in the current window
+        std::atomic<int64_t> _suppressed = 0;
+    };
+  }
+}
@@ -0,0 +1,798 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "MediaServer.h"
+#include "Logging.h"
+#include "HttpCaching.h"
+#include "Metrics.h"
+#include "SegmentTrace.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include "spdlog/spdlog.h"
+
+namespace {
+  constexpr size_t MAX_HEADER_SIZE = 16 * 1024;
+  constexpr size_t MAX_QUEUED_RESPONSES = 32;
+  constexpr int MAX_EVENTS = 256;
+
+  auto iequals(std::string_view a, std::string_view b) -> bool
+  {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+      if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) return false;
+    }
+    return true;
+  }
+
+  auto trim(std::string_view sv) -> std::string_view
+  {
+    while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t')) sv.remove_prefix(1);
+    while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t')) sv.remove_suffix(1);
+    return sv;
+  }
+
+  auto reason_phrase(unsigned short status) -> const char*
+  {
+    switch (status) {
+      case 200: return "OK";
+      case 206: return "Partial Content";
+      case 304: return "Not Modified";
+      case 400: return "Bad Request";
+      case 401: return "Unauthorized";
+      case 404: return "Not Found";
+      case 405: return "Method Not Allowed";
+      case 416: return "Range Not Satisfiable";
+      case 503: return "Service Unavailable";
+      default: return "Unknown";
+    }
+  }
+
+  /**
+   *  Fetch completions are handed from pplx threads to a worker through this queue. It outlives the
+   *  worker if a fetch is still running when the server stops.
+   */
+  struct CompletionQueue {
+    std::mutex mutex;
+    bool open = true;
+    int event_fd = -1;
+    std::vector<std::pair<int, uint64_t>> completed;   // fd, connection id
+
+    void push(int fd, uint64_t id) {
+      const std::lock_guard<std::mutex> lock(mutex);
+      if (!open) return;
+      completed.emplace_back(fd, id);
+      uint64_t one = 1;
+      auto ret = write(event_fd, &one, sizeof(one));
+      (void)ret;
+    }
+  };
+}
+
+auto MBMS_RT::MediaServer::parse_request(const std::string& buffer, Request& request, size_t& consumed) -> ParseResult
+{
+  auto end = buffer.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    return buffer.size() > MAX_HEADER_SIZE ? ParseResult::Invalid : ParseResult::Incomplete;
+  }
+  consumed = end + 4;
+  std::string_view head(buffer.data(), end + 2);
+
+  auto eol = head.find("\r\n");
+  auto line = head.substr(0, eol);
+  auto sp1 = line.find(' ');
+  auto sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+  if (sp2 == std::string_view::npos) {
+    return ParseResult::Invalid;
+  }
+  request = Request{};
+  request.method = std::string(line.substr(0, sp1));
+  request.target = std::string(line.substr(sp1 + 1, sp2 - sp1 - 1));
+  auto version = line.substr(sp2 + 1);
+  if (version != "HTTP/1.1" && version != "HTTP/1.0") {
+    return ParseResult::Invalid;
+  }
+  request.keep_alive = version == "HTTP/1.1";
+
+  head.remove_prefix(eol + 2);
+  while (!head.empty()) {
+    eol = head.find("\r\n");
+    line = head.substr(0, eol);
+    head.remove_prefix(eol + 2);
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      return ParseResult::Invalid;
+    }
+    auto name = line.substr(0, colon);
+    auto value = trim(line.substr(colon + 1));
+    if (iequals(name, "Connection")) {
+      if (iequals(value, "close")) {
+        request.keep_alive = false;
+      } else if (iequals(value, "keep-alive")) {
+        request.keep_alive = true;
+      }
+    } else if (iequals(name, "If-None-Match")) {
+      request.conditional.if_none_match = std::string(value);
+    } else if (iequals(name, "If-Modified-Since")) {
+      request.conditional.if_modified_since = std::string(value);
+    } else if (iequals(name, "Range")) {
+      request.conditional.range = std::string(value);
+    } else if (iequals(name, "If-Range")) {
+      request.conditional.if_range = std::string(value);
+    } else if (iequals(name, "Accept-Encoding")) {
+      request.conditional.accept_encoding = std::string(value);
+    } else if (iequals(name, "Authorization")) {
+      request.authorization = std::string(value);
+    } else if ((iequals(name, "Content-Length") && value != "0") || iequals(name, "Transfer-Encoding")) {
+      return ParseResult::Invalid;
+    }
+  }
+  return ParseResult::Complete;
+}
+
+class MBMS_RT::MediaServer::Worker {
+  public:
+    Worker(const CacheManagement& cache, const MediaServer& config, unsigned index)
+      : _cache( cache ), _config( config ), _index( index ) {};
+    ~Worker() { stop(); };
+
+    bool start();
+    void stop();
+
+    std::atomic<uint64_t> connections = 0;
+    std::atomic<uint64_t> requests = 0;
+    std::atomic<uint64_t> bytes_sent = 0;
+
+  private:
+    // Body of a response sent while its item is still arriving, appended to by stream_content
+    struct StreamedBody {
+      std::mutex mutex;
+      std::string data;     // reserved for the whole body up front, so appending never moves it
+      bool done = false;    // nothing more will be appended, complete or not
+    };
+    struct Output {
+      std::string head;
+      std::shared_ptr<const void> holder;   // keeps the body buffer alive until it is sent
+      const char* body;
+      size_t body_length;
+      size_t sent;
+      std::shared_ptr<SegmentTrace> trace = nullptr;
+      CacheItem::FileRegion file = {};      // body sent with sendfile from here if file.fd is set
+      std::shared_ptr<StreamedBody> stream = nullptr;   // body taken from here as it arrives if set
+    };
+    struct Connection {
+      int fd;
+      uint64_t id;
+      std::string in;
+      std::deque<Output> out;
+      bool waiting = false;      // a request is deferred until its item has been fetched
+      Request deferred;
+      std::shared_ptr<Metrics::RequestTimer> timer;   // of the request being answered, kept while it is deferred
+      bool close_after_write = false;
+      bool want_write = false;
+      time_t last_activity;
+    };
+
+    void run();
+    void accept_connections();
+    bool handle_readable(Connection& conn);
+    void process_requests(Connection& conn);
+    void handle_request(Connection& conn, const Request& request, bool allow_fetch);
+    void stream_response(Connection& conn, const Request& request, const std::shared_ptr<CacheItem>& item,
+        uint64_t length);
+    void queue_response(Connection& conn, unsigned short status,
+        const std::vector<std::pair<std::string, std::string>>& headers,
+        std::shared_ptr<const void> holder, const char* body, size_t length, bool keep_alive, bool head_only);
+    bool flush(Connection& conn);
+    void set_want_write(Connection& conn, bool want_write);
+    void close_connection(int fd);
+    void handle_completions();
+    void expire_idle_connections();
+
+    const CacheManagement& _cache;
+    const MediaServer& _config;
+    unsigned _index;
+
+    int _listen_fd = -1;
+    int _epoll_fd = -1;
+    std::shared_ptr<CompletionQueue> _completions;
+    std::atomic<bool> _running = false;
+    std::thread _thread;
+
+    std::unordered_map<int, Connection> _connections;
+    uint64_t _next_id = 1;
+    time_t _last_expiry_check = 0;
+};
+
+auto MBMS_RT::MediaServer::Worker::start() -> bool
+{
+  _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_listen_fd < 0) {
+    spdlog::error("Media server could not create socket: {}", strerror(errno));
+    return false;
+  }
+  int on = 1;
+  setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  // Every worker listens on the same port, the kernel spreads new connections across them
+  setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_config._port);
+  if (inet_pton(AF_INET, _config._address.c_str(), &addr.sin_addr) != 1) {
+    spdlog::error("Media server: invalid address {}", _config._address);
+    return false;
+  }
+  if (bind(_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(_listen_fd, SOMAXCONN) < 0) {
+    spdlog::error("Media server could not listen on {}:{}: {}", _config._address, _config._port, strerror(errno));
+    return false;
+  }
+
+  _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  _completions = std::make_shared<CompletionQueue>();
+  _completions->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_epoll_fd < 0 || _completions->event_fd < 0) {
+    spdlog::error("Media server could not set up event loop: {}", strerror(errno));
+    return false;
+  }
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = _listen_fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+  ev.data.fd = _completions->event_fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _completions->event_fd, &ev);
+
+  _running = true;
+  _thread = std::thread{[this]() { run(); }};
+  return true;
+}
+
+auto MBMS_RT::MediaServer::Worker::stop() -> void
+{
+  if (_running.exchange(false)) {
+    uint64_t one = 1;
+    auto ret = write(_completions->event_fd, &one, sizeof(one));
+    (void)ret;
+    _thread.join();
+  }
+  std::vector<int> fds;
+  for (const auto& conn : _connections) {
+    fds.push_back(conn.first);
+  }
+  for (auto fd : fds) {
+    close_connection(fd);
+  }
+  if (_completions) {
+    const std::lock_guard<std::mutex> lock(_completions->mutex);
+    _completions->open = false;
+    if (_completions->event_fd >= 0) {
+      close(_completions->event_fd);
+      _completions->event_fd = -1;
+    }
+  }
+  if (_epoll_fd >= 0) {
+    close(_epoll_fd);
+    _epoll_fd = -1;
+  }
+  if (_listen_fd >= 0) {
+    close(_listen_fd);
+    _listen_fd = -1;
+  }
+}
+
+auto MBMS_RT::MediaServer::Worker::run() -> void
+{
+  // sendfile has no MSG_NOSIGNAL, a peer that went away must not raise SIGPIPE on this thread
+  sigset_t sigpipe;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+  spdlog::debug("Media server worker {} running", _index);
+  std::array<epoll_event, MAX_EVENTS> events;
+  while (_running) {
+    auto count = epoll_wait(_epoll_fd, events.data(), MAX_EVENTS, 1000);
+    if (count < 0 && errno != EINTR) {
+      spdlog::error("Media server worker {}: epoll_wait failed: {}", _index, strerror(errno));
+      break;
+    }
+    for (int i = 0; i < count; i++) {
+      auto fd = events[i].data.fd;
+      if (fd == _listen_fd) {
+        accept_connections();
+      } else if (fd == _completions->event_fd) {
+        handle_completions();
+      } else {
+        auto it = _connections.find(fd);
+        if (it == _connections.end()) {
+          continue;
+        }
+        auto& conn = it->second;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+          close_connection(fd);
+          continue;
+        }
+        if (events[i].events & EPOLLOUT) {
+          if (!flush(conn)) {
+            continue;
+          }
+          // Output drained, continue with requests that were held back by the queue limit
+          if (!(events[i].events & EPOLLIN) && conn.out.empty() && !conn.in.empty()) {
+            process_requests(conn);
+            continue;
+          }
+        }
+        if ((events[i].events & EPOLLIN) && handle_readable(conn)) {
+          process_requests(conn);
+        }
+      }
+    }
+    expire_idle_connections();
+  }
+}
+
+auto MBMS_RT::MediaServer::Worker::accept_connections() -> void
+{
+  auto max_per_worker = std::max(_config._max_connections / _config._thread_count, 1U);
+  while (true) {
+    auto fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        static Logging::RateLimitedLog accept_log(Logging::Category::Http);
+        accept_log.warn("Media server worker {}: accept failed: {}", _index, strerror(errno));
+      }
+      return;
+    }
+    if (_connections.size() >= max_per_worker) {
+      static Logging::RateLimitedLog limit_log(Logging::Category::Http);
+      limit_log.warn("Media server worker {}: connection limit reached", _index);
+      close(fd);
+      continue;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    auto& conn = _connections[fd];
+    conn.fd = fd;
+    conn.id = _next_id++;
+    conn.last_activity = time(nullptr);
+    connections++;
+  }
+}
+
+auto MBMS_RT::MediaServer::Worker::handle_readable(Connection& conn) -> bool
+{
+  char buf[16 * 1024];
+  while (true) {
+    auto n = recv(conn.fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      conn.in.append(buf, n);
+      if (conn.in.size() > MAX_HEADER_SIZE * MAX_QUEUED_RESPONSES) {
+        close_connection(conn.fd);
+        return false;
+      }
+    } else if (n == 0) {
+      close_connection(conn.fd);
+      return false;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      close_connection(conn.fd);
+      return false;
+    }
+  }
+  conn.last_activity = time(nullptr);
+  return true;
+}
+
+auto MBMS_RT::MediaServer::Worker::process_requests(Connection& conn) -> void
+{
+  // Requests are answered in order, so pipelined requests queue behind a deferred one
+  while (!conn.waiting && !conn.close_after_write && conn.out.size() < MAX_QUEUED_RESPONSES) {
+    Request request;
+    size_t consumed = 0;
+    auto result = parse_request(conn.in, request, consumed);
+    if (result == ParseResult::Incomplete) {
+      break;
+    }
+    if (result == ParseResult::Invalid) {
+      queue_response(conn, 400, {}, nullptr, nullptr, 0, false, false);
+      break;
+    }
+    conn.in.erase(0, consumed);
+    requests++;
+    conn.timer = std::make_shared<Metrics::RequestTimer>(
+        Metrics::classify(request.target.empty() ? request.target : request.target.substr(1), ""));
+    handle_request(conn, request, true);
+    if (!conn.waiting) {
+      conn.timer.reset();
+    }
+  }
+  flush(conn);
+}
+
+auto MBMS_RT::MediaServer::Worker::handle_request(Connection& conn, const Request& request, bool allow_fetch) -> void
+{
+  bool head_only = request.method == "HEAD";
+  if (request.method != "GET" && !head_only) {
+    queue_response(conn, 405, {{"Allow", "GET, HEAD"}}, nullptr, nullptr, 0, request.keep_alive, false);
+    return;
+  }
+  if (_config._require_bearer_token &&
+      (_config._api_key.empty() || request.authorization != "Bearer " + _config._api_key)) {
+    queue_response(conn, 401, {}, nullptr, nullptr, 0, request.keep_alive, false);
+    return;
+  }
+  if (request.target.empty() || request.target[0] != '/') {
+    queue_response(conn, 400, {}, nullptr, nullptr, 0, false, false);
+    return;
+  }
+
+  auto path = request.target.substr(1);
+  if (allow_fetch && _config._demand_cb) {
+    _config._demand_cb(path);
+  }
+  auto item = _cache.find_item(path);
+  if (!item) {
+    queue_response(conn, 404, {}, nullptr, nullptr, 0, request.keep_alive, head_only);
+    return;
+  }
+  if (allow_fetch) {
+    // Not again when a response deferred for a fetch is completed
+    item->record_request();
+  }
+
+  // Pin one payload for the whole response, the item can be regenerated or evicted while it is sent
+  auto payload = item->negotiated_payload(request.conditional.accept_encoding);
+  if (payload.data == nullptr) {
+    if (!allow_fetch) {
+      queue_response(conn, 404, {}, nullptr, nullptr, 0, request.keep_alive, head_only);
+      return;
+    }
+    // An object still arriving over broadcast is sent as it arrives, ranges and revalidations wait for all of it
+    auto length = item->length_in_reception();
+    if (length > 0 && !head_only && request.conditional.range.empty() &&
+        request.conditional.if_none_match.empty() && request.conditional.if_modified_since.empty()) {
+      stream_response(conn, request, item, length);
+      return;
+    }
+    conn.waiting = true;
+    conn.deferred = request;
+    std::weak_ptr<CompletionQueue> completions = _completions;
+    item->fetch_content().then([completions, fd = conn.fd, id = conn.id](pplx::task<bool> available) {
+        try {
+          available.get();
+        } catch (const std::exception& ex) {
+          spdlog::debug("Media server: fetch failed: {}", ex.what());
+        }
+        if (auto queue = completions.lock()) {
+          queue->push(fd, id);
+        }
+      });
+    return;
+  }
+  _cache.record_served(*item);
+
+  auto received_at = static_cast<time_t>(item->received_at());
+  auto result = HttpCaching::evaluate(request.conditional, {
+      HttpCaching::etag_for(payload.version, received_at, payload.length, payload.content_encoding),
+      HttpCaching::last_modified_for(payload.version, received_at), item->max_age(), payload.length,
+      payload.content_encoding, payload.varies });
+  auto headers = std::move(result.headers);
+  if (result.status == 200 || result.status == 206) {
+    headers.emplace_back("RT-MBMS-MW-File-Origin", item->item_source_as_string());
+    headers.emplace_back("Content-Type", "application/octet-stream");
+    if (!head_only) {
+      Metrics::instance().bytes_served(item->item_source(), result.length);
+    }
+  }
+  queue_response(conn, result.status, headers, std::move(payload.holder), payload.data + result.offset,
+      result.length, request.keep_alive, head_only);
+  if ((result.status == 200 || result.status == 206) && !head_only) {
+    auto& out = conn.out.back();
+    out.trace = item->trace();
+    // Segments from the disk tier go out of the page cache with sendfile instead of through their mapping
+    if (payload.content_encoding.empty()) {
+      out.file = item->file_region();
+      out.file.offset += result.offset;
+    }
+  }
+}
+
+auto MBMS_RT::MediaServer::Worker::stream_response(Connection& conn, const Request& request,
+    const std::shared_ptr<CacheItem>& item, uint64_t length) -> void
+{
+  _cache.record_served(*item);
+  // No validators yet, they depend on when the object completes
+  std::vector<std::pair<std::string, std::string>> headers;
+  if (item->max_age() >= 0) {
+    headers.emplace_back("Cache-Control", HttpCaching::cache_control(item->max_age()));
+  }
+  headers.emplace_back("RT-MBMS-MW-File-Origin", "5G-BC");
+  headers.emplace_back("Content-Type", "application/octet-stream");
+  Metrics::instance().bytes_served(ItemSource::Broadcast, length);
+
+  auto body = std::make_shared<StreamedBody>();
+  body->data.reserve(length);
+  queue_response(conn, 200, headers, nullptr, nullptr, length, request.keep_alive, false);
+  conn.out.back().stream = body;
+  conn.out.back().trace = item->trace();
+
+  // Every chunk wakes the worker to send it, the connection may be gone by then
+  std::weak_ptr<CompletionQueue> completions = _completions;
+  auto wake = [completions, fd = conn.fd, id = conn.id]() {
+    if (auto queue = completions.lock()) {
+      queue->push(fd, id);
+    }
+  };
+  item->stream_content([body, length, wake](const char* data, size_t n) {
+      {
+        const std::lock_guard<std::mutex> lock(body->mutex);
+        body->data.append(data, std::min<uint64_t>(n, length - body->data.size()));
+      }
+      wake();
+    }).then([body, wake](pplx::task<bool> delivered) {
+      try {
+        delivered.get();
+      } catch (const std::exception& ex) {
+        spdlog::debug("Media server: streaming failed: {}", ex.what());
+      }
+      {
+        const std::lock_guard<std::mutex> lock(body->mutex);
+        body->done = true;
+      }
+      wake();
+    });
+}
+
+auto MBMS_RT::MediaServer::Worker::queue_response(Connection& conn, unsigned short status,
+    const std::vector<std::pair<std::string, std::string>>& headers,
+    std::shared_ptr<const void> holder, const char* body, size_t length, bool keep_alive, bool head_only) -> void
+{
+  std::string head;
+  head.reserve(256);
+  head += "HTTP/1.1 " + std::to_string(status) + " " + reason_phrase(status) + "\r\n";
+  if (status != 304) {
+    head += "Content-Length: " + std::to_string(length) + "\r\n";
+  }
+  for (const auto& header : headers) {
+    head += header.first + ": " + header.second + "\r\n";
+  }
+  head += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+  conn.out.push_back({std::move(head), std::move(holder), body, head_only ? 0 : length, 0});
+  if (!keep_alive) {
+    conn.close_after_write = true;
+  }
+}
+
+auto MBMS_RT::MediaServer::Worker::flush(Connection& conn) -> bool
+{
+  while (!conn.out.empty()) {
+    auto& out = conn.out.front();
+    iovec iov[2];
+    int iov_count = 0;
+    if (out.sent < out.head.size()) {
+      iov[iov_count++] = { const_cast<char*>(out.head.data()) + out.sent, out.head.size() - out.sent };
+    }
+    auto body_sent = out.sent > out.head.size() ? out.sent - out.head.size() : 0;
+    auto body_available = out.body_length;
+    if (out.stream) {
+      const std::lock_guard<std::mutex> lock(out.stream->mutex);
+      out.body = out.stream->data.data();
+      body_available = out.stream->data.size();
+      if (out.stream->done && body_available < out.body_length) {
+        // The rest of the body will not arrive, the client can only tell from the connection closing
+        close_connection(conn.fd);
+        return false;
+      }
+    }
+    if (iov_count == 0 && body_sent == body_available && out.stream) {
+      // All that has arrived is sent, handle_completions flushes again when more does
+      set_want_write(conn, false);
+      return true;
+    }
+    ssize_t n = 0;
+    if (out.file.fd >= 0 && iov_count == 0) {
+      auto offset = static_cast<off_t>(out.file.offset + body_sent);
+      n = sendfile(conn.fd, out.file.fd, &offset, out.body_length - body_sent);
+    } else {
+      if (out.file.fd < 0 && body_sent < body_available) {
+        iov[iov_count++] = { const_cast<char*>(out.body) + body_sent, body_available - body_sent };
+      }
+      msghdr msg = {};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iov_count;
+      // A head followed by a sendfile body is held back to share a segment with its start
+      n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL | (out.file.fd >= 0 && out.body_length > 0 ? MSG_MORE : 0));
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        set_want_write(conn, true);
+        return true;
+      }
+      close_connection(conn.fd);
+      return false;
+    }
+    bytes_sent += n;
+    if (out.trace && out.sent == 0) {
+      out.trace->stamp(SegmentTrace::Stage::FirstByteOut);
+    }
+    out.sent += n;
+    if (out.sent >= out.head.size() + out.body_length) {
+      if (out.trace) {
+        Tracer::instance().last_byte_out(out.trace);
+      }
+      conn.out.pop_front();
+    }
+  }
+
+  set_want_write(conn, false);
+  if (conn.close_after_write) {
+    close_connection(conn.fd);
+    return false;
+  }
+  conn.last_activity = time(nullptr);
+  return true;
+}
+
+auto MBMS_RT::MediaServer::Worker::set_want_write(Connection& conn, bool want_write) -> void
+{
+  if (conn.want_write == want_write) {
+    return;
+  }
+  epoll_event ev = {};
+  ev.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  ev.data.fd = conn.fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+  conn.want_write = want_write;
+}
+
+auto MBMS_RT::MediaServer::Worker::handle_completions() -> void
+{
+  uint64_t value = 0;
+  auto ret = read(_completions->event_fd, &value, sizeof(value));
+  (void)ret;
+  std::vector<std::pair<int, uint64_t>> completed;
+  {
+    const std::lock_guard<std::mutex> lock(_completions->mutex);
+    completed.swap(_completions->completed);
+  }
+  for (const auto& c : completed) {
+    auto it = _connections.find(c.first);
+    // The connection may have been closed, and its fd reused, while the fetch was running
+    if (it == _connections.end() || it->second.id != c.second) {
+      continue;
+    }
+    auto& conn = it->second;
+    if (!conn.waiting) {
+      // More of a streamed body arrived
+      if (flush(conn) && conn.out.empty() && !conn.in.empty()) {
+        process_requests(conn);
+      }
+      continue;
+    }
+    conn.waiting = false;
+    handle_request(conn, conn.deferred, false);
+    conn.timer.reset();
+    process_requests(conn);
+  }
+}
+
+auto MBMS_RT::MediaServer::Worker::expire_idle_connections() -> void
+{
+  auto now = time(nullptr);
+  if (now == _last_expiry_check) {
+    return;
+  }
+  _last_expiry_check = now;
+  std::vector<int> idle;
+  for (const auto& conn : _connections) {
+    if (!conn.second.waiting && conn.second.out.empty() &&
+        now - conn.second.last_activity > static_cast<time_t>(_config._keepalive_timeout)) {
+      idle.push_back(conn.first);
+    }
+  }
+  for (auto fd : idle) {
+    close_connection(fd);
+  }
+}
+
+auto MBMS_RT::MediaServer::Worker::close_connection(int fd) -> void
+{
+  if (_epoll_fd >= 0) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+  close(fd);
+  _connections.erase(fd);
+}
+
+MBMS_RT::MediaServer::MediaServer(const libconfig::Config& cfg, const CacheManagement& cache)
+  : _cache( cache )
+{
+  cfg.lookupValue("mw.media_server.address", _address);
+  cfg.lookupValue("mw.media_server.port", _port);
+  cfg.lookupValue("mw.media_server.threads", _thread_count);
+  cfg.lookupValue("mw.media_server.max_connections", _max_connections);
+  cfg.lookupValue("mw.media_server.keepalive_timeout", _keepalive_timeout);
+  _thread_count = std::max(_thread_count, 1U);
+
+  // Media requests are authorized like requests to the cpprest listener
+  cfg.lookupValue("mw.http_server.api_key.enabled", _require_bearer_token);
+  if (_require_bearer_token && (!cfg.lookupValue("mw.http_server.api_key.key", _api_key) || _api_key.empty())) {
+    spdlog::error("mw.http_server.api_key is enabled without a key, refusing all media requests");
+    _api_key.clear();
+  }
+}
+
+MBMS_RT::MediaServer::~MediaServer()
+{
+  stop();
+}
+
+auto MBMS_RT::MediaServer::start() -> void
+{
+  for (unsigned i = 0; i < _thread_count; i++) {
+    auto worker = std::make_unique<Worker>(_cache, *this, i);
+    if (!worker->start()) {
+      spdlog::error("Media server worker {} failed to start", i);
+      continue;
+    }
+    _workers.push_back(std::move(worker));
+  }
+  spdlog::info("Media server listening on {}:{} with {} workers", _address, _port, _workers.size());
+}
+
+auto MBMS_RT::MediaServer::stop() -> void
+{
+  _workers.clear();
+}
+
+auto MBMS_RT::MediaServer::stats() const -> Stats
+{
+  Stats stats = {};
+  for (const auto& worker : _workers) {
+    stats.connections += worker->connections;
+    stats.requests += worker->requests;
+    stats.bytes_sent += worker->bytes_sent;
+  }
+  return stats;
+}
@@ -0,0 +1,96 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <libconfig.h++>
+#include "CacheManagement.h"
+#include "HttpCaching.h"
+
+namespace MBMS_RT {
+  /**
+   *  Optional media delivery front end for the cache, next to the cpprest API listener.
+   *
+   *  An event driven HTTP/1.1 server: each worker thread runs its own epoll loop on a SO_REUSEPORT
+   *  listening socket, keeps connections alive and writes headers and body straight out of the cached
+   *  item buffers with scatter/gather sends. Segments from the disk tier are sent with sendfile. Only
+   *  cache paths are served, the mw-api control endpoints stay on RestHandler.
+   *
+   *  Configured in mw.media_server (enabled, address, port, threads, max_connections, keepalive_timeout).
+   */
+  class MediaServer {
+    public:
+      MediaServer(const libconfig::Config& cfg, const CacheManagement& cache);
+      virtual ~MediaServer();
+
+      void start();
+      void stop();
+
+      typedef std::function<void(const std::string&)> demand_callback_t;
+      /**
+       *  Called with the path of every request before it is looked up in the cache. Set before start().
+       */
+      void set_demand_callback(demand_callback_t cb) { _demand_cb = std::move(cb); };
+
+      struct Stats {
+        uint64_t connections;
+        uint64_t requests;
+        uint64_t bytes_sent;
+      };
+      Stats stats() const;
+
+      /**
+       *  A request head, as far as the media server looks at it
+       */
+      struct Request {
+        std::string method;
+        std::string target;
+        std::string authorization;
+        HttpCaching::RequestHeaders conditional;
+        bool keep_alive = true;
+      };
+
+      enum class ParseResult { Incomplete, Complete, Invalid };
+
+      /**
+       *  Parse one request head from the front of buffer. Request bodies are not supported.
+       *  @param consumed  Set to the length of the head when it is complete
+       */
+      static ParseResult parse_request(const std::string& buffer, Request& request, size_t& consumed);
+
+    private:
+      class Worker;
+
+      const CacheManagement& _cache;
+      std::string _address = "0.0.0.0";
+      unsigned _port = 3021;
+      unsigned _thread_count = 2;
+      unsigned _max_connections = 4096;
+      unsigned _keepalive_timeout = 30;
+      bool _require_bearer_token = false;
+      std::string _api_key;
+      demand_callback_t _demand_cb = nullptr;
+
+      std::vector<std::unique_ptr<Worker>> _workers;
+  };
+}
@@ -0,0 +1,233 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Metrics.h"
+#include "CacheManagement.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static constexpr std::array<const char*, 4> SOURCE_LABELS = { "broadcast", "cdn", "generated", "unavailable" };
+static constexpr std::array<const char*, 4> PATH_CLASS_LABELS = { "api", "manifest", "segment", "metrics" };
+static constexpr std::array<const char*, 3> EVICTION_REASON_LABELS = { "source_size_limit", "cache_size_limit", "expired" };
+
+static auto format_value(double value) -> std::string {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.6g", value);
+  return buf;
+}
+
+static auto header(std::string& out, const char* name, const char* type, const char* help) -> void {
+  out += "# HELP ";
+  out += name;
+  out += " ";
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += " ";
+  out += type;
+  out += "\n";
+}
+
+static auto sample(std::string& out, const std::string& name, const std::string& labels, uint64_t value) -> void {
+  out += name;
+  if (!labels.empty()) {
+    out += "{" + labels + "}";
+  }
+  out += " " + std::to_string(value) + "\n";
+}
+
+auto MBMS_RT::AtomicHistogram::record(double ms) -> void
+{
+  const auto& bounds = LatencyHistogram::BOUNDS_MS;
+  auto idx = std::lower_bound(bounds.begin(), bounds.end(), ms) - bounds.begin();
+  _buckets[idx].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+  _sum_us.fetch_add(static_cast<uint64_t>(std::max(ms, 0.0) * 1000), std::memory_order_relaxed);
+}
+
+auto MBMS_RT::AtomicHistogram::render(std::string& out, const std::string& name, const std::string& labels) const -> void
+{
+  auto prefix = labels.empty() ? std::string() : labels + ",";
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < LatencyHistogram::BOUNDS_MS.size(); i++) {
+    cumulative += _buckets[i].load(std::memory_order_relaxed);
+    sample(out, name + "_bucket", prefix + "le=\"" + format_value(LatencyHistogram::BOUNDS_MS[i] / 1000) + "\"",
+        cumulative);
+  }
+  cumulative += _buckets.back().load(std::memory_order_relaxed);
+  sample(out, name + "_bucket", prefix + "le=\"+Inf\"", cumulative);
+  out += name + "_sum" + (labels.empty() ? "" : "{" + labels + "}") + " " +
+    format_value(_sum_us.load(std::memory_order_relaxed) / 1e6) + "\n";
+  // The count matches the +Inf bucket even if a sample lands between the loads above
+  sample(out, name + "_count", labels, cumulative);
+}
+
+MBMS_RT::Metrics::RequestTimer::~RequestTimer()
+{
+  Metrics::instance().http_request(_path_class,
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _started_at).count());
+}
+
+auto MBMS_RT::Metrics::instance() -> Metrics&
+{
+  static Metrics metrics;
+  return metrics;
+}
+
+auto MBMS_RT::Metrics::flute_session(uint64_t tsi) -> std::shared_ptr<FluteCounters>
+{
+  const std::lock_guard<std::mutex> lock(_flute_mutex);
+  auto& counters = _flute_sessions[tsi];
+  if (!counters) {
+    counters = std::make_shared<FluteCounters>();
+  }
+  return counters;
+}
+
+auto MBMS_RT::Metrics::cache_lookup(bool hit, ItemSource source, bool disk) -> void
+{
+  if (!hit) {
+    _misses.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    (disk ? _disk_hits : _memory_hits)[static_cast<size_t>(source)].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+auto MBMS_RT::Metrics::bytes_served(ItemSource source, uint64_t bytes) -> void
+{
+  _bytes_served[static_cast<size_t>(source)].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+auto MBMS_RT::Metrics::eviction(EvictionReason reason) -> void
+{
+  _evictions[static_cast<size_t>(reason)].fetch_add(1, std::memory_order_relaxed);
+}
+
+auto MBMS_RT::Metrics::http_request(PathClass path_class, double ms) -> void
+{
+  _http_latency[static_cast<size_t>(path_class)].record(ms);
+}
+
+auto MBMS_RT::Metrics::cdn_fetch(double ms, bool success) -> void
+{
+  _cdn_latency.record(ms);
+  if (!success) {
+    _cdn_failures.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+auto MBMS_RT::Metrics::reactor_lag(double ms) -> void
+{
+  _reactor_lag.record(ms);
+}
+
+auto MBMS_RT::Metrics::classify(const std::string& path, const std::string& api_path) -> PathClass
+{
+  if (path == "metrics") {
+    return PathClass::Metrics;
+  }
+  if (!api_path.empty() && path.rfind(api_path, 0) == 0) {
+    return PathClass::Api;
+  }
+  auto query = path.find('?');
+  auto name = path.substr(0, query);
+  for (const auto* suffix : { ".m3u8", ".mpd" }) {
+    auto length = strlen(suffix);
+    if (name.size() >= length && name.compare(name.size() - length, length, suffix) == 0) {
+      return PathClass::Manifest;
+    }
+  }
+  return PathClass::Segment;
+}
+
+auto MBMS_RT::Metrics::render(const CacheManagement& cache) const -> std::string
+{
+  std::string out;
+  out.reserve(8192);
+
+  header(out, "mw_cache_size_bytes", "gauge", "Bytes held in the memory cache by source");
+  for (auto source : { ItemSource::Broadcast, ItemSource::CDN, ItemSource::Generated }) {
+    sample(out, "mw_cache_size_bytes", std::string("source=\"") + SOURCE_LABELS[static_cast<size_t>(source)] + "\"",
+        cache.size_by_source(source));
+  }
+  header(out, "mw_cache_max_size_bytes", "gauge", "Memory cache budget");
+  sample(out, "mw_cache_max_size_bytes", "", cache.max_total_size());
+  header(out, "mw_cache_items", "gauge", "Items in the memory cache index");
+  sample(out, "mw_cache_items", "", cache.item_count());
+  if (cache.first_segment_served_ms() >= 0) {
+    header(out, "mw_first_segment_served_seconds", "gauge", "Time from startup until the first media segment was served");
+    out += "mw_first_segment_served_seconds " + format_value(cache.first_segment_served_ms() / 1000.0) + "\n";
+  }
+
+  header(out, "mw_cache_lookups_total", "counter", "Cache lookups by result, tier and source of the item found");
+  for (size_t i = 0; i < SOURCE_COUNT; i++) {
+    sample(out, "mw_cache_lookups_total", std::string("result=\"hit\",tier=\"memory\",source=\"") +
+        SOURCE_LABELS[i] + "\"", _memory_hits[i].load(std::memory_order_relaxed));
+    sample(out, "mw_cache_lookups_total", std::string("result=\"hit\",tier=\"disk\",source=\"") +
+        SOURCE_LABELS[i] + "\"", _disk_hits[i].load(std::memory_order_relaxed));
+  }
+  sample(out, "mw_cache_lookups_total", "result=\"miss\"", _misses.load(std::memory_order_relaxed));
+
+  header(out, "mw_served_bytes_total", "counter", "Response body bytes served by source");
+  for (size_t i = 0; i < SOURCE_COUNT; i++) {
+    sample(out, "mw_served_bytes_total", std::string("source=\"") + SOURCE_LABELS[i] + "\"",
+        _bytes_served[i].load(std::memory_order_relaxed));
+  }
+
+  header(out, "mw_cache_evictions_total", "counter", "Items evicted from the memory cache by reason");
+  for (size_t i = 0; i < EVICTION_REASON_COUNT; i++) {
+    sample(out, "mw_cache_evictions_total", std::string("reason=\"") + EVICTION_REASON_LABELS[i] + "\"",
+        _evictions[i].load(std::memory_order_relaxed));
+  }
+
+  {
+    const std::lock_guard<std::mutex> lock(_flute_mutex);
+    const std::array<std::pair<const char*, const char*>, 5> flute_metrics = {{
+      { "mw_flute_packets_total", "ALC packets received per TSI" },
+      { "mw_flute_decode_errors_total", "ALC packets that could not be decoded per TSI" },
+      { "mw_flute_objects_completed_total", "FLUTE objects received completely per TSI" },
+      { "mw_flute_completed_bytes_total", "Bytes of completely received FLUTE objects per TSI" },
+      { "mw_flute_objects_lost_total", "FLUTE objects replaced or expired before completion per TSI" },
+    }};
+    for (size_t m = 0; m < flute_metrics.size(); m++) {
+      header(out, flute_metrics[m].first, "counter", flute_metrics[m].second);
+      for (const auto& [tsi, counters] : _flute_sessions) {
+        const std::array<const std::atomic<uint64_t>*, 5> values = { &counters->packets, &counters->decode_errors,
+          &counters->completed, &counters->completed_bytes, &counters->lost };
+        sample(out, flute_metrics[m].first, "tsi=\"" + std::to_string(tsi) + "\"",
+            values[m]->load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+  header(out, "mw_cdn_fetch_duration_seconds", "histogram", "Duration of CDN requests, per attempt");
+  _cdn_latency.render(out, "mw_cdn_fetch_duration_seconds");
+  header(out, "mw_cdn_fetch_failures_total", "counter", "CDN request attempts that failed");
+  sample(out, "mw_cdn_fetch_failures_total", "", _cdn_failures.load(std::memory_order_relaxed));
+
+  header(out, "mw_http_request_duration_seconds", "histogram", "Time to respond to HTTP requests by path class");
+  for (size_t i = 0; i < PATH_CLASS_COUNT; i++) {
+    _http_latency[i].render(out, "mw_http_request_duration_seconds",
+        std::string("class=\"") + PATH_CLASS_LABELS[i] + "\"");
+  }
+
+  header(out, "mw_reactor_lag_seconds", "histogram", "Delay of io_service timer handlers behind their deadline");
+  _reactor_lag.render(out, "mw_reactor_lag_seconds");
+  return out;
+}
@@ -0,0 +1,154 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "ItemSource.h"
+#include "LatencyHistogram.h"
+
+namespace MBMS_RT {
+  class CacheManagement;
+
+  /**
+   *  Lock-free variant of LatencyHistogram for hot paths. A sample increments only its own bucket, the
+   *  cumulative counts are formed when the histogram is rendered.
+   */
+  class AtomicHistogram {
+    public:
+      void record(double ms);
+
+      /**
+       *  Append the histogram in Prometheus text format, with bounds in seconds
+       */
+      void render(std::string& out, const std::string& name, const std::string& labels = "") const;
+
+    private:
+      std::array<std::atomic<uint64_t>, LatencyHistogram::BOUNDS_MS.size() + 1> _buckets = {};  // last is +Inf
+      std::atomic<uint64_t> _count = 0;
+      std::atomic<uint64_t> _sum_us = 0;
+  };
+
+  /**
+   *  Process wide counters and histograms of the cache, broadcast reception, CDN and HTTP paths,
+   *  exported in the Prometheus text format at /metrics.
+   *
+   *  Updates are relaxed atomic increments, so they can be called from any thread without a lock.
+   */
+  class Metrics {
+    public:
+      static Metrics& instance();
+
+      enum class PathClass {
+        Api,
+        Manifest,
+        Segment,
+        Metrics,
+        Count
+      };
+
+      /**
+       *  Records the time from its construction until the last reference is released as the latency
+       *  of one HTTP request. Shared with deferred handlers that send the response later.
+       */
+      class RequestTimer {
+        public:
+          explicit RequestTimer(PathClass path_class) : _path_class( path_class ) {};
+          ~RequestTimer();
+          RequestTimer(const RequestTimer&) = delete;
+          RequestTimer& operator=(const RequestTimer&) = delete;
+
+        private:
+          PathClass _path_class;
+          std::chrono::steady_clock::time_point _started_at = std::chrono::steady_clock::now();
+      };
+
+      enum class EvictionReason {
+        SourceSizeLimit,
+        CacheSizeLimit,
+        Expired,
+        Count
+      };
+
+      /**
+       *  Counters of one FLUTE session. Held by its decoder, which updates them directly.
+       */
+      struct FluteCounters {
+        std::atomic<uint64_t> packets = 0;
+        std::atomic<uint64_t> decode_errors = 0;
+        std::atomic<uint64_t> completed = 0;
+        std::atomic<uint64_t> completed_bytes = 0;
+        std::atomic<uint64_t> lost = 0;             // replaced by a newer version or expired before completion
+      };
+
+      /**
+       *  @return The counters for a TSI, shared by all decoders of that TSI over the process lifetime
+       */
+      std::shared_ptr<FluteCounters> flute_session(uint64_t tsi);
+
+      /**
+       *  @param hit     An item exists at the location
+       *  @param source  Where its data comes from, if it exists
+       *  @param disk    Served from the disk tier
+       */
+      void cache_lookup(bool hit, ItemSource source = ItemSource::Unavailable, bool disk = false);
+      void bytes_served(ItemSource source, uint64_t bytes);
+      void eviction(EvictionReason reason);
+      void http_request(PathClass path_class, double ms);
+      void cdn_fetch(double ms, bool success);
+
+      /**
+       *  Delay of a timer handler on the io_service behind its deadline
+       */
+      void reactor_lag(double ms);
+
+      /**
+       *  @return All metrics plus gauges of the cache state in the Prometheus text exposition format,
+       *          version 0.0.4
+       */
+      std::string render(const CacheManagement& cache) const;
+
+      static PathClass classify(const std::string& path, const std::string& api_path);
+
+    private:
+      Metrics() = default;
+
+      static constexpr size_t SOURCE_COUNT = 4;
+      static constexpr size_t PATH_CLASS_COUNT = static_cast<size_t>(PathClass::Count);
+      static constexpr size_t EVICTION_REASON_COUNT = static_cast<size_t>(EvictionReason::Count);
+
+      std::array<std::atomic<uint64_t>, SOURCE_COUNT> _memory_hits = {};
+      std::array<std::atomic<uint64_t>, SOURCE_COUNT> _disk_hits = {};
+      std::atomic<uint64_t> _misses = 0;
+      std::array<std::atomic<uint64_t>, SOURCE_COUNT> _bytes_served = {};
+      std::array<std::atomic<uint64_t>, EVICTION_REASON_COUNT> _evictions = {};
+      std::array<AtomicHistogram, PATH_CLASS_COUNT> _http_latency;
+      AtomicHistogram _cdn_latency;
+      std::atomic<uint64_t> _cdn_failures = 0;
+      AtomicHistogram _reactor_lag;
+
+      mutable std::mutex _flute_mutex;
+      std::map<uint64_t, std::shared_ptr<FluteCounters>> _flute_sessions;
+  };
+}
@@ -15,8 +15,13 @@
 // under the License.
 //
 #include "Middleware.h"
+#include "Metrics.h"
+#include "SegmentTrace.h"
 #include "spdlog/spdlog.h"
 
+// Ticks between saves of the service / stream topology for a warm restart
+static constexpr unsigned TOPOLOGY_SAVE_INTERVAL = 10;
+
 /**
  *
  * @param io_service
@@ -27,12 +32,29 @@
 MBMS_RT::Middleware::Middleware(boost::asio::io_service &io_service, const libconfig::Config &cfg,
                                 const std::string &api_url,
                                 const std::string &iface)
-    : _rp(cfg), _control(cfg), _cache(cfg, io_service), _api(cfg, api_url, _cache, &_service_announcement, _services),
-      _tick_interval(1), _timer(io_service, _tick_interval), _control_timer(io_service, _control_tick_interval),
-      _cfg(cfg), _interface(iface), _io_service(io_service) {
+    : _rp(std::make_shared<RpRestClient>(cfg, io_service)),
+      _prefetch(std::make_shared<PrefetchScheduler>(cfg)),
+      _retention(std::make_shared<RetentionBudget>(cfg)),
+      _control(cfg),
+      _cache(cfg, io_service),
+      _api(cfg, api_url, _cache, &_service_announcement, [this]() { return services(); }, &_fetch_engine,
+           [this](const std::string& path) { handle_demand(path); }),
+      _warm_start(cfg),
+      _tick_interval(1),
+      _timer(io_service, _tick_interval),
+      _control_timer(io_service, _control_tick_interval),
+      _cfg(cfg),
+      _interface(iface),
+      _io_service(io_service),
+      _strand(io_service) {
+  Tracer::instance().configure(cfg);
+  if (Tracer::instance().enabled()) {
+    spdlog::info("Segment latency tracing enabled");
+  }
   cfg.lookupValue("mw.seamless_switching.enabled", _seamless);
   if (_seamless) {
     spdlog::info("Seamless switching mode enabled");
+    _fetch_engine = std::make_shared<FetchEngine>(cfg);
   }
   cfg.lookupValue("mw.control_system.enabled", _control_system);
   if (_control_system) {
@@ -42,9 +64,63 @@ MBMS_RT::Middleware::Middleware(boost::asio::io_service &io_service, const libco
     spdlog::info("Control System API enabled");
   }
 
-  _handle_local_service_announcement();
-  _timer.async_wait(boost::bind(&Middleware::tick_handler, this)); //NOLINT
-  _control_timer.async_wait(boost::bind(&Middleware::control_tick_handler, this)); //NOLINT
+  cfg.lookupValue("mw.lazy_join.enabled", _lazy_join);
+  if (_lazy_join) {
+    cfg.lookupValue("mw.lazy_join.idle_timeout", _lazy_join_idle_timeout);
+    spdlog::info("Lazy join enabled, streams are received once requested and left after {} s idle",
+                 _lazy_join_idle_timeout);
+  }
+
+  bool media_server = false;
+  cfg.lookupValue("mw.media_server.enabled", media_server);
+  if (media_server) {
+    _media_server = std::make_unique<MBMS_RT::MediaServer>(cfg, _cache);
+    if (_lazy_join) {
+      _media_server->set_demand_callback(boost::bind(&Middleware::handle_demand, this, _1)); //NOLINT
+    }
+    _media_server->start();
+  }
+
+  if (!_handle_local_service_announcement()) {
+    // Offer the services of the last run right away, the modem confirms or replaces the SA later
+    _restore_warm_state();
+  }
+  if (_rp->push_enabled()) {
+    spdlog::info("Receiving MCH info changes by long-polling the modem");
+    _rp->watch_mch_info([this](web::json::value mchs) { // NOLINT
+        _strand.post([this, mchs]() { handle_mch_info(mchs); });
+    });
+  }
+  // Have the mw-api status documents ready before the first tick
+  _strand.post([this]() { _api.refresh_status(); });
+  _timer.async_wait(_strand.wrap(boost::bind(&Middleware::tick_handler, this))); //NOLINT
+  _control_timer.async_wait(_strand.wrap(boost::bind(&Middleware::control_tick_handler, this))); //NOLINT
+
+  // Content streams and the service announcement serialise their handlers on per-object strands,
+  // so the io_service can be run from a pool of threads
+  int io_threads = 1;
+  cfg.lookupValue("mw.io_threads", io_threads);
+  for (int i = 1; i < io_threads; i++) {
+    _io_threads.emplace_back([&]() {
+      try {
+        _io_service.run();
+      } catch (const std::exception& ex) {
+        spdlog::error("io_service thread terminated: {}", ex.what());
+      }
+    });
+  }
+  if (io_threads > 1) {
+    spdlog::info("Running the io_service on {} threads", io_threads);
+  }
+}
+
+MBMS_RT::Middleware::~Middleware() {
+  _io_service.stop();
+  for (auto& thread : _io_threads) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
 }
 
 /**
@@ -70,7 +146,8 @@ auto MBMS_RT::Middleware::_handle_local_service_announcement() -> bool {
       _cfg.lookupValue("mw.local_service.mcast_address", mcast_address);
 
       _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, tmgi, mcast_address, 0, _interface,
-                                                                             _io_service, _cache, _seamless,
+                                                                             _io_service, _cache, _seamless, _prefetch, _fetch_engine,
+                                                                             _retention,
                                                                              boost::bind(&Middleware::get_service, this,
                                                                                          _1),  //NOLINT
                                                                              boost::bind(&Middleware::set_service, this,
@@ -86,59 +163,187 @@ auto MBMS_RT::Middleware::_handle_local_service_announcement() -> bool {
 }
 
 /**
- *
+ * Restore the service announcement saved by the previous run. Its services are set up right away, so
+ * content streams start their FLUTE reception and CDN polling without waiting for the modem and the
+ * next SA carousel.
+ * @return {bool} Whether a saved service announcement was restored
  */
-void MBMS_RT::Middleware::tick_handler() {
-  auto mchs = _rp.getMchInfo();
-  for (auto const &mch: mchs.as_array()) {
-    for (auto const &mtch: mch.at("mtchs").as_array()) {
-      auto tmgi = mtch.at("tmgi").as_string();
-      auto dest = mtch.at("dest").as_string();
-      unsigned tsi = 0;
-      _cfg.lookupValue("mw.service_announcement_tsi", tsi);
-      auto is_service_announcement = std::stoul(tmgi.substr(0, 6), nullptr, 16) < 0xF;
-      if (!dest.empty() && is_service_announcement && !_service_announcement) {
-        // automatically start receiving the service announcement
-        // 26.346 5.2.3.1.1 : the pre-defined TSI value shall be "0". 
-        _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, tmgi, dest, tsi, _interface,
-                                                                               _io_service,
-                                                                               _cache, _seamless,
-                                                                               boost::bind(&Middleware::get_service,
-                                                                                           this, _1),
-                                                                               boost::bind(&Middleware::set_service,
-                                                                                           this, _1, _2)); //NOLINT
-        _service_announcement->start_flute_receiver(dest);
+auto MBMS_RT::Middleware::_restore_warm_state() -> bool {
+  WarmStart::ServiceAnnouncementState state;
+  if (!_warm_start.load_service_announcement(state)) {
+    return false;
+  }
+  spdlog::info("Warm restart: restoring the service announcement of TMGI {} saved {} s ago",
+               state.tmgi, time(nullptr) - state.saved_at);
+  _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, state.tmgi, state.mcast, state.tsi,
+                                                                         _interface, _io_service, _cache, _seamless,
+                                                                         _prefetch, _fetch_engine, _retention,
+                                                                         boost::bind(&Middleware::get_service, this,
+                                                                                     _1),  //NOLINT
+                                                                         boost::bind(&Middleware::set_service, this,
+                                                                                     _1, _2)); //NOLINT
+  _service_announcement->parse_bootstrap(state.content);
+  _persist_bootstrap_updates();
+  if (!state.mcast.empty()) {
+    _service_announcement->start_flute_receiver(state.mcast);
+  }
+  _sa_restored = true;
+
+  // With lazy join, rejoin what players were watching instead of waiting for their next request
+  size_t rejoined = 0;
+  if (_lazy_join) {
+    auto joined = _warm_start.load_joined_streams();
+    for (const auto &service: services()) {
+      for (const auto &stream: service.second->content_streams()) {
+        if (joined.count(WarmStart::stream_key(service.first, stream.second->base()))) {
+          stream.second->touch();
+          rejoined++;
+        }
       }
     }
   }
+  spdlog::info("Warm restart: restored {} services, rejoined {} streams", services().size(), rejoined);
+  return true;
+}
+
+auto MBMS_RT::Middleware::_persist_bootstrap_updates() -> void {
+  if (!_warm_start.enabled() || !_service_announcement) {
+    return;
+  }
+  auto *sa = _service_announcement.get();
+  sa->set_bootstrap_callback([this, sa]() {
+      _warm_start.save_service_announcement({sa->tmgi(), sa->multicast_address(), sa->tsi(), sa->content()});
+  });
+}
+
+/**
+ *
+ */
+void MBMS_RT::Middleware::tick_handler() {
+  Metrics::instance().reactor_lag(
+      (boost::posix_time::microsec_clock::universal_time() - _timer.expires_at()).total_microseconds() / 1000.0);
+  // The modem is asked asynchronously, so a slow modem does not hold up the timers and cache eviction
+  if (!_rp->push_enabled() && !_mch_info_in_flight.exchange(true)) {
+    _rp->mch_info().then([this](web::json::value mchs) { // NOLINT
+        _strand.post([this, mchs]() {
+          handle_mch_info(mchs);
+          _mch_info_in_flight = false;
+        });
+    });
+  }
+
+  // Seamless switching streams prefetch from the CDN ahead of a CINR drop, so follow it closely
+  if (_seamless && _prefetch->enabled() && !_cinr_in_flight.exchange(true)) {
+    _rp->status().then([this](web::json::value status) { // NOLINT
+        try {
+          _prefetch->update_cinr(status.at("cinr_db").as_double());
+        } catch (...) {}
+        _cinr_in_flight = false;
+    });
+  }
 
   _cache.check_file_expiry_and_cache_size();
+  Tracer::instance().expire();
+  _api.refresh_status();
+
+  if (_warm_start.enabled() && ++_ticks_since_topology_save >= TOPOLOGY_SAVE_INTERVAL) {
+    _warm_start.save_topology(services());
+    _ticks_since_topology_save = 0;
+  }
+
+  if (_lazy_join) {
+    for (const auto &service: services()) {
+      for (const auto &stream: service.second->content_streams()) {
+        stream.second->leave_if_idle(_lazy_join_idle_timeout);
+      }
+    }
+  }
 
   _timer.expires_at(_timer.expires_at() + _tick_interval);
-  _timer.async_wait(boost::bind(&Middleware::tick_handler, this)); //NOLINT
+  _timer.async_wait(_strand.wrap(boost::bind(&Middleware::tick_handler, this))); //NOLINT
+}
+
+/**
+ * Start receiving the service announcement once the modem reports its MTCH
+ * @param mchs MCH info as received from the modem
+ */
+void MBMS_RT::Middleware::handle_mch_info(const web::json::value &mchs) {
+  try {
+    for (auto const &mch: mchs.as_array()) {
+      for (auto const &mtch: mch.at("mtchs").as_array()) {
+        auto tmgi = mtch.at("tmgi").as_string();
+        auto dest = mtch.at("dest").as_string();
+        unsigned tsi = 0;
+        _cfg.lookupValue("mw.service_announcement_tsi", tsi);
+        auto is_service_announcement = std::stoul(tmgi.substr(0, 6), nullptr, 16) < 0xF;
+        if (!dest.empty() && is_service_announcement && _sa_restored) {
+          // The modem confirms the service announcement restored on startup, or it has moved
+          _sa_restored = false;
+          if (_service_announcement->tmgi() != tmgi || _service_announcement->multicast_address() != dest) {
+            spdlog::info("Service announcement moved to TMGI {} at {}, replacing the restored one", tmgi, dest);
+            _service_announcement.reset();
+          }
+        }
+        if (!dest.empty() && is_service_announcement && !_service_announcement) {
+          // automatically start receiving the service announcement
+          // 26.346 5.2.3.1.1 : the pre-defined TSI value shall be "0". 
+          _service_announcement = std::make_unique<MBMS_RT::ServiceAnnouncement>(_cfg, tmgi, dest, tsi, _interface,
+                                                                                 _io_service,
+                                                                                 _cache, _seamless, _prefetch, _fetch_engine,
+                                                                                 _retention,
+                                                                                 boost::bind(&Middleware::get_service,
+                                                                                             this, _1),
+                                                                                 boost::bind(&Middleware::set_service,
+                                                                                             this, _1, _2)); //NOLINT
+          _persist_bootstrap_updates();
+          _service_announcement->start_flute_receiver(dest);
+        }
+      }
+    }
+  } catch (const std::exception &ex) {
+    spdlog::warn("Invalid MCH info from modem: {}", ex.what());
+  }
 }
 
 /**
  *
  */
 void MBMS_RT::Middleware::control_tick_handler() {
-  if (_control_system) {
-    try {
-      auto status = _rp.getStatus();
-      auto cinr = status.at("cinr_db").as_double();
-      spdlog::debug("CINR ist {}", cinr);
-
-      std::vector<std::string> tmgis;
-      auto services = _control.sendHello(cinr, tmgis);
-      for (const auto &ctrl_service: services.as_array()) {
-        spdlog::debug("control system sent service: {}", ctrl_service.serialize());
-      }
-    } catch (...) {}
+  if (_control_system && !_status_in_flight.exchange(true)) {
+    // The control system is contacted from the continuation, off the io_service
+    _rp->status().then([this](web::json::value status) { // NOLINT
+        try {
+          auto cinr = status.at("cinr_db").as_double();
+          spdlog::debug("CINR ist {}", cinr);
+
+          std::vector<std::string> tmgis;
+          auto services = _control.sendHello(cinr, tmgis);
+          for (const auto &ctrl_service: services.as_array()) {
+            spdlog::debug("control system sent service: {}", ctrl_service.serialize());
+          }
+        } catch (...) {}
+        _status_in_flight = false;
+    });
   }
 
 
   _control_timer.expires_at(_control_timer.expires_at() + _control_tick_interval);
-  _control_timer.async_wait(boost::bind(&Middleware::control_tick_handler, this)); //NOLINT
+  _control_timer.async_wait(_strand.wrap(boost::bind(&Middleware::control_tick_handler, this))); //NOLINT
+}
+
+/**
+ * Lazy join: forward a client request to the service it belongs to. Called from the HTTP threads, the
+ * streams are joined on the strand that also leaves idle ones.
+ * @param {string} path
+ */
+void MBMS_RT::Middleware::handle_demand(const std::string &path) {
+  _strand.post([this, path]() {
+    for (const auto &service: services()) {
+      if (service.second->handle_demand(path)) {
+        return;
+      }
+    }
+  });
 }
 
 /**
@@ -147,9 +352,21 @@ void MBMS_RT::Middleware::control_tick_handler() {
  * @return
  */
 auto MBMS_RT::Middleware::get_service(const std::string &service_id) -> std::shared_ptr<Service> {
-  if (_services.find(service_id) != _services.end()) {
-    return _services[service_id];
+  const std::lock_guard<std::mutex> lock(_services_mutex);
+  auto it = _services.find(service_id);
+  if (it != _services.end()) {
+    return it->second;
   } else {
     return nullptr;
   }
 }
+
+auto MBMS_RT::Middleware::set_service(const std::string &service_id, std::shared_ptr<Service> service) -> void {
+  const std::lock_guard<std::mutex> lock(_services_mutex);
+  _services[service_id] = std::move(service);
+}
+
+auto MBMS_RT::Middleware::services() -> std::map<std::string, std::shared_ptr<Service>> {
+  const std::lock_guard<std::mutex> lock(_services_mutex);
+  return _services;
+}
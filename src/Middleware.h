@@ -16,7 +16,12 @@
 //
 #pragma once
 
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <filesystem>
 #include <libconfig.h++>
 #include <boost/asio.hpp>
@@ -26,6 +31,8 @@
 #include "File.h"
 #include "RestHandler.h"
 #include "CacheManagement.h"
+#include "MediaServer.h"
+#include "WarmStart.h"
 #include "Service.h"
 #include "on_demand/ControlSystemRestClient.h"
 
@@ -33,19 +40,40 @@ namespace MBMS_RT {
   class Middleware {
     public:
       Middleware( boost::asio::io_service& io_service, const libconfig::Config& cfg, const std::string& api_url, const std::string& iface);
+      virtual ~Middleware();
 
+      /**
+       *  Look up and add services. Called from the service announcement's strand, while the tick and
+       *  the HTTP servers read the map on other threads.
+       */
       std::shared_ptr<Service> get_service(const std::string& service_id);
-      void set_service(const std::string& service_id, std::shared_ptr<Service> service) { _services[service_id] = service; };
+      void set_service(const std::string& service_id, std::shared_ptr<Service> service);
 
     private:
       void tick_handler();
+      void handle_demand(const std::string& path);
+      void handle_mch_info(const web::json::value& mchs);
+
+      /**
+       *  @return A copy of the service map, to iterate without holding its lock
+       */
+      std::map<std::string, std::shared_ptr<Service>> services();
 
       bool _seamless = false;
+      bool _lazy_join = false;
+      unsigned _lazy_join_idle_timeout = 60;
 
 
-      MBMS_RT::RpRestClient _rp;
+      std::shared_ptr<MBMS_RT::RpRestClient> _rp;
+      std::atomic<bool> _mch_info_in_flight = {false};
+      std::atomic<bool> _status_in_flight = {false};
+      std::shared_ptr<MBMS_RT::PrefetchScheduler> _prefetch;
+      std::shared_ptr<MBMS_RT::RetentionBudget> _retention;
+      std::atomic<bool> _cinr_in_flight = {false};
+      std::shared_ptr<MBMS_RT::FetchEngine> _fetch_engine;
       MBMS_RT::RestHandler _api;
       MBMS_RT::CacheManagement _cache;
+      std::unique_ptr<MBMS_RT::MediaServer> _media_server;
 
       bool _control_system = false;
       MBMS_RT::ControlSystemRestClient _control;
@@ -54,6 +82,10 @@ namespace MBMS_RT {
       void control_tick_handler();
 
       std::unique_ptr<MBMS_RT::ServiceAnnouncement> _service_announcement = {nullptr};
+      MBMS_RT::WarmStart _warm_start;
+      bool _sa_restored = false;            // until the modem confirms the restored service announcement
+      unsigned _ticks_since_topology_save = 0;
+      std::mutex _services_mutex;
       std::map<std::string, std::shared_ptr<Service>> _services;
 
       boost::posix_time::seconds _tick_interval;
@@ -62,7 +94,21 @@ namespace MBMS_RT {
       const libconfig::Config& _cfg;
       const std::string& _interface;
       boost::asio::io_service& _io_service;
+      // Keeps the middleware's own timers serialised when the io_service runs on several threads
+      boost::asio::io_service::strand _strand;
+      // Additional threads running the io_service, besides the one that calls run() in main
+      std::vector<std::thread> _io_threads;
 
       bool _handle_local_service_announcement();
+
+      /**
+       *  Restore the service announcement and joined streams saved by a previous run
+       */
+      bool _restore_warm_state();
+
+      /**
+       *  Save every bootstrap update of the current service announcement for the next warm restart
+       */
+      void _persist_bootstrap_updates();
     };
 };
@@ -17,7 +17,11 @@
 
 #include "RestHandler.h"
 #include "seamless/SeamlessContentStream.h"
+#include "seamless/DashSeamlessContentStream.h"
+#include "HttpCaching.h"
+#include "SegmentTrace.h"
 
+#include <algorithm>
 #include <memory>
 #include <utility>
 
@@ -29,16 +33,35 @@ using web::http::methods;
 using web::http::uri;
 using web::http::http_request;
 using web::http::status_codes;
+using web::http::header_names;
 using web::http::experimental::listener::http_listener;
 using web::http::experimental::listener::http_listener_config;
 
+static auto histogram_to_json(const MBMS_RT::LatencyHistogram& histogram) -> value {
+  std::vector<value> buckets;
+  for (size_t i = 0; i < MBMS_RT::LatencyHistogram::BOUNDS_MS.size(); i++) {
+    value b;
+    b["le_ms"] = value(MBMS_RT::LatencyHistogram::BOUNDS_MS[i]);
+    b["count"] = value(histogram.bucket(i));
+    buckets.push_back(b);
+  }
+  value h;
+  h["buckets"] = value::array(buckets);
+  h["count"] = value(histogram.count());
+  h["sum_ms"] = value(histogram.sum_ms());
+  return h;
+}
+
 MBMS_RT::RestHandler::RestHandler(const libconfig::Config& cfg, const std::string& url, const CacheManagement& cache,
     const std::unique_ptr<MBMS_RT::ServiceAnnouncement>* service_announcement,
-    const std::map<std::string, std::shared_ptr<Service>>& services )
+    services_snapshot_t services,
+    const std::shared_ptr<FetchEngine>* fetch_engine,
+    demand_callback_t demand_cb )
     : _cfg(cfg)
-    , _services(services) 
+    , _services(std::move(services))
     , _cache(cache)
     , _service_announcement_h(service_announcement)
+    , _fetch_engine_h(fetch_engine)
 {
   http_listener_config server_config;
   if (url.rfind("https", 0) == 0) {
@@ -57,9 +80,16 @@ MBMS_RT::RestHandler::RestHandler(const libconfig::Config& cfg, const std::strin
   }
 
   cfg.lookupValue("mw.http_server.api_key.enabled", _require_bearer_token);
-  if (_require_bearer_token) {
-    _api_key = "106cd60-76c8-4c37-944c-df21aa690c1e";
-    cfg.lookupValue("mw.http_server.api_key.key", _api_key);
+  if (_require_bearer_token && (!cfg.lookupValue("mw.http_server.api_key.key", _api_key) || _api_key.empty())) {
+    // There is no default key, the API stays closed rather than open to a well-known one
+    spdlog::error("mw.http_server.api_key is enabled without a key, refusing all API requests");
+    _api_key.clear();
+  }
+
+  bool lazy_join = false;
+  cfg.lookupValue("mw.lazy_join.enabled", lazy_join);
+  if (lazy_join) {
+    _demand_cb = std::move(demand_cb);
   }
 
   _api_path = "mw-api";
@@ -80,8 +110,10 @@ void MBMS_RT::RestHandler::get(http_request message) {
   auto uri = message.relative_uri();
         spdlog::debug("request for  {}", uri.to_string() );
   auto paths = uri::split_path(uri::decode(message.relative_uri().path()));
+  auto timer = std::make_shared<Metrics::RequestTimer>(
+      Metrics::classify(paths.empty() ? "" : uri.to_string().erase(0,1), _api_path));
   if (_require_bearer_token &&
-    (message.headers()["Authorization"] != "Bearer " + _api_key)) {
+    (_api_key.empty() || message.headers()["Authorization"] != "Bearer " + _api_key)) {
     message.reply(status_codes::Unauthorized);
     return;
   }
@@ -89,89 +121,141 @@ void MBMS_RT::RestHandler::get(http_request message) {
   if (paths.empty()) {
     message.reply(status_codes::NotFound);
   } else {
-    if (paths[0] == _api_path) {
+    if (paths.size() == 1 && paths[0] == "metrics") {
+      message.reply(status_codes::OK, Metrics::instance().render(_cache), "text/plain; version=0.0.4");
+      return;
+    } else if (paths[0] == _api_path) {
       if (paths[1] == "service_announcement") {
-        if (*_service_announcement_h) {
-          std::vector<value> items;
-          for (const auto& item : (*_service_announcement_h)->items()) {
-            if (item.content_type != "application/mbms-envelope+xml") {
-              value i;
-              i["location"] = value(item.uri);
-              i["type"] = value(item.content_type);
-              i["valid_from"] = value(item.valid_from);
-              i["valid_until"] = value(item.valid_until);
-              i["version"] = value(item.version);
-              i["content"] = value(item.content);
-              items.push_back(i);
+        reply_snapshot(message, _service_announcement_doc, [](const http_request& /*message*/, const std::string& doc,
+              web::http::http_response& response) {
+            if (doc.empty()) {
+              response.set_status_code(status_codes::NotFound);
+            } else {
+              response.set_body(doc, "application/json");
             }
-          }
-          value sa;
-          sa["id"] = value((*_service_announcement_h)->toi());
-          sa["content"] = value((*_service_announcement_h)->content());
-          sa["items"] = value::array(items);
-          message.reply(status_codes::OK, sa);
+        });
+        return;
+      } else if (paths[1] == "files") {
+        reply_snapshot(message, _files_doc, [](const http_request& message, const std::vector<FileRow>& rows,
+              web::http::http_response& response) {
+            reply_files(message, rows, response);
+        });
+        return;
+      } else if (paths[1] == "cache") {
+        value c;
+        c["item_count"] = value(static_cast<uint64_t>(_cache.item_count()));
+        c["total_size"] = value(_cache.total_size());
+        c["max_total_size"] = value(_cache.max_total_size());
+        c["broadcast_size"] = value(_cache.size_by_source(ItemSource::Broadcast));
+        c["cdn_size"] = value(_cache.size_by_source(ItemSource::CDN));
+        c["generated_size"] = value(_cache.size_by_source(ItemSource::Generated));
+        c["external_size"] = value(_cache.external_size());
+        c["first_segment_served_ms"] = value(_cache.first_segment_served_ms());
+
+        auto stats = _cache.buffer_pool()->stats();
+        value pool;
+        pool["in_use_bytes"] = value(stats.in_use_bytes);
+        pool["requested_bytes"] = value(stats.requested_bytes);
+        pool["free_bytes"] = value(stats.free_bytes);
+        pool["buffers_in_use"] = value(stats.buffers_in_use);
+        pool["buffers_free"] = value(stats.buffers_free);
+        pool["hits"] = value(stats.hits);
+        pool["misses"] = value(stats.misses);
+        pool["fragmentation"] = value(stats.fragmentation);
+        c["buffer_pool"] = pool;
+        if (_cache.disk_enabled()) {
+          auto disk_stats = _cache.disk_stats();
+          value disk;
+          disk["items"] = value(static_cast<uint64_t>(disk_stats.items));
+          disk["files"] = value(static_cast<uint64_t>(disk_stats.files));
+          disk["bytes"] = value(disk_stats.bytes);
+          disk["stored"] = value(disk_stats.stored);
+          disk["hits"] = value(disk_stats.hits);
+          disk["write_errors"] = value(disk_stats.write_errors);
+          disk["dvr_window"] = value(_cache.dvr_window());
+          c["disk"] = disk;
+        }
+        message.reply(status_codes::OK, c);
+        return;
+      } else if (paths[1] == "cdn_fetch") {
+        if (!*_fetch_engine_h) {
+          message.reply(status_codes::NotFound);
           return;
-        } else {
+        }
+        auto stats = (*_fetch_engine_h)->stats();
+        value f;
+        f["origins"] = value(static_cast<uint64_t>(stats.origins));
+        f["queued"] = value(static_cast<uint64_t>(stats.queued));
+        f["active"] = value(static_cast<uint64_t>(stats.active));
+        f["completed"] = value(stats.completed);
+        f["queue_wait"] = histogram_to_json(stats.queue_wait);
+        f["fetch_latency"] = histogram_to_json(stats.fetch_latency);
+        message.reply(status_codes::OK, f);
+        return;
+      } else if (paths[1] == "traces") {
+        auto& tracer = Tracer::instance();
+        if (!tracer.enabled()) {
           message.reply(status_codes::NotFound);
           return;
         }
-      } else if (paths[1] == "files") {
-        std::vector<value> files;
-        for (const auto& item : _cache.item_map()) {
-          value f;
-          f["source"] = value(item.second->item_source_as_string());
-          f["location"] = value(item.second->content_location());
-          f["content_length"] = value(item.second->content_length());
-          f["received_at"] = value(item.second->received_at());
-          if (item.second->received_at() == 0) {
-            f["age"] = value(10000);
-          } else {
-            f["age"] = value(time(nullptr) - item.second->received_at());
+        if (paths.size() > 2 && paths[2] == "summary") {
+          value summary;
+          for (const auto& [stream, stages] : tracer.summary()) {
+            value s;
+            s["traces"] = value(stages.traces);
+            for (size_t i = 0; i < SegmentTrace::STAGE_COUNT; i++) {
+              if (stages.stages[i].count() > 0) {
+                s[SegmentTrace::stage_name(static_cast<SegmentTrace::Stage>(i))] = histogram_to_json(stages.stages[i]);
+              }
+            }
+            summary[stream] = s;
           }
-          files.push_back(f);
+          message.reply(status_codes::OK, summary);
+          return;
         }
-        message.reply(status_codes::OK, value::array(files));
-        return;
-      } else if (paths[1] == "services") {
-        std::vector<value> services;
-        for (const auto& service : _services) {
-          auto s = service.second;
-          value ser;
-
-          std::vector<value> names;
-          for (const auto& name : s->names()) {
-            value n;
-            n["lang"] = value(name.first);
-            n["name"] = value(name.second);
-            names.push_back(n);
-          }
-          ser["names"] = value::array(names);
-          ser["protocol"] = value(s->delivery_protocol_string());
-          ser["manifest_path"] = value(s->manifest_path());
-
-          std::vector<value> streams;
-          for (const auto& stream : s->content_streams()) {
-            value s;
-            s["base"] = value(stream.second->base());
-            s["type"] = value(stream.second->stream_type_string());
-            s["flute_info"] = value(stream.second->flute_info());
-            s["resolution"] = value(stream.second->resolution());
-            s["codecs"] = value(stream.second->codecs());
-            s["bandwidth"] = value(stream.second->bandwidth());
-            s["frame_rate"] = value(stream.second->frame_rate());
-            s["playlist_path"] = value(stream.second->playlist_path());
-            if (stream.second->stream_type() == ContentStream::StreamType::SeamlessSwitching) {
-              s["cdn_ept"] = value(std::dynamic_pointer_cast<SeamlessContentStream>(stream.second)->cdn_endpoint());
-            } else {
-              s["cdn_ept"] = value("n/a");
+        // Trace Event Format, as read by chrome://tracing and Perfetto: one track per segment with a
+        // span for the whole trace and one for every stage, ending when the stage was reached
+        std::vector<value> events;
+        uint64_t tid = 0;
+        for (const auto& record : tracer.records()) {
+          tid++;
+          std::vector<std::pair<uint64_t, size_t>> stamps;
+          for (size_t i = 0; i < record.stamps.size(); i++) {
+            if (record.stamps[i] > 0) {
+              stamps.emplace_back(record.stamps[i], i);
             }
-            streams.push_back(s);
           }
-          ser["streams"] = value::array(streams);
-
-          services.push_back(ser);
+          if (stamps.empty()) {
+            continue;
+          }
+          std::sort(stamps.begin(), stamps.end());
+          auto span = [&](const std::string& name, uint64_t begin, uint64_t end) {
+            value e;
+            e["name"] = value(name);
+            e["cat"] = value(record.stream);
+            e["ph"] = value("X");
+            e["ts"] = value(begin);
+            e["dur"] = value(end - begin);
+            e["pid"] = value(1);
+            e["tid"] = value(tid);
+            events.push_back(e);
+          };
+          span(record.location, stamps.front().first, stamps.back().first);
+          for (size_t i = 1; i < stamps.size(); i++) {
+            span(SegmentTrace::stage_name(static_cast<SegmentTrace::Stage>(stamps[i].second)),
+                stamps[i - 1].first, stamps[i].first);
+          }
         }
-        message.reply(status_codes::OK, value::array(services));
+        value trace;
+        trace["traceEvents"] = value::array(events);
+        trace["displayTimeUnit"] = value("ms");
+        message.reply(status_codes::OK, trace);
+        return;
+      } else if (paths[1] == "services") {
+        reply_snapshot(message, _services_doc, [](const http_request& /*message*/, const std::string& doc,
+              web::http::http_response& response) {
+            response.set_body(doc, "application/json");
+        });
         return;
       } else {
         message.reply(status_codes::NotFound);
@@ -181,17 +265,14 @@ void MBMS_RT::RestHandler::get(http_request message) {
       auto path = uri.to_string().erase(0,1); // remove leading /
       spdlog::debug("checking for file at path {}", path );
 
-      auto it = _cache.item_map().find(path);
-      if (it != _cache.item_map().cend()) {
-        if (it->second->buffer() != nullptr) {
-          web::http::http_response response(status_codes::OK);
-          response.headers().add(U("RT-MBMS-MW-File-Origin"), it->second->item_source_as_string());
-          auto instream = Concurrency::streams::rawptr_stream<uint8_t>::open_istream((uint8_t*)it->second->buffer(), it->second->content_length());
-          response.set_body(instream);
-          message.reply(response);
-        } else {
-          message.reply(status_codes::NotFound);
-        }
+      if (_demand_cb) {
+        _demand_cb(path);
+      }
+
+      auto item = _cache.find_item(path);
+      if (item) {
+        item->record_request();
+        serve_item(message, item, timer);
       } else {
         message.reply(status_codes::NotFound);
       }
@@ -199,9 +280,422 @@ void MBMS_RT::RestHandler::get(http_request message) {
   }
 }
 
+auto MBMS_RT::RestHandler::refresh_status() -> void {
+  auto services_changed = _services_doc.update(build_services_json());
+
+  // File rows name their service, so they are rebuilt for a changed service list too
+  auto cache_version = _cache.version();
+  if (cache_version != _files_cache_version || services_changed) {
+    _files_cache_version = cache_version;
+    _files_doc.update(build_file_rows());
+  }
+
+  // Serialising the SA is the expensive part, so only do it for a new bootstrap version
+  const auto& sa = *_service_announcement_h;
+  auto sa_key = sa ? std::make_tuple(sa.get(), sa->toi(), sa->update_stats().updates)
+                   : std::make_tuple(static_cast<const ServiceAnnouncement*>(nullptr), 0U, uint64_t{0});
+  if (sa_key != _service_announcement_key || !_service_announcement_doc.view().doc) {
+    _service_announcement_key = sa_key;
+    _service_announcement_doc.update(build_service_announcement_json());
+  }
+
+  _services_doc.notify();
+  _files_doc.notify();
+  _service_announcement_doc.notify();
+}
+
+auto MBMS_RT::RestHandler::build_service_announcement_json() const -> std::string {
+  if (!*_service_announcement_h) {
+    return "";
+  }
+  std::vector<value> items;
+  for (const auto& item : (*_service_announcement_h)->items()) {
+    if (item.content_type != "application/mbms-envelope+xml") {
+      value i;
+      i["location"] = value(item.uri);
+      i["type"] = value(item.content_type);
+      i["valid_from"] = value(item.valid_from);
+      i["valid_until"] = value(item.valid_until);
+      i["version"] = value(item.version);
+      i["content"] = value(item.content);
+      items.push_back(i);
+    }
+  }
+  value sa;
+  sa["id"] = value((*_service_announcement_h)->toi());
+  sa["content"] = value((*_service_announcement_h)->content());
+  sa["items"] = value::array(items);
+  const auto& stats = (*_service_announcement_h)->update_stats();
+  value update;
+  update["updates"] = value(stats.updates);
+  update["changed_items"] = value(stats.changed_items);
+  update["services_processed"] = value(stats.services_processed);
+  update["services_unchanged"] = value(stats.services_unchanged);
+  update["latency_ms"] = value(stats.latency_ms);
+  sa["update"] = update;
+  return sa.serialize();
+}
+
+auto MBMS_RT::RestHandler::build_services_json() const -> std::string {
+  std::vector<value> services;
+  for (const auto& service : _services()) {
+    auto s = service.second;
+    value ser;
+
+    std::vector<value> names;
+    for (const auto& name : s->names()) {
+      value n;
+      n["lang"] = value(name.first);
+      n["name"] = value(name.second);
+      names.push_back(n);
+    }
+    ser["names"] = value::array(names);
+    ser["protocol"] = value(s->delivery_protocol_string());
+    ser["manifest_path"] = value(s->manifest_path());
+
+    std::vector<value> streams;
+    for (const auto& stream : s->content_streams()) {
+      value s;
+      s["base"] = value(stream.second->base());
+      s["type"] = value(stream.second->stream_type_string());
+      s["flute_info"] = value(stream.second->flute_info());
+      s["resolution"] = value(stream.second->resolution());
+      s["codecs"] = value(stream.second->codecs());
+      s["bandwidth"] = value(stream.second->bandwidth());
+      s["frame_rate"] = value(stream.second->frame_rate());
+      s["playlist_path"] = value(stream.second->playlist_path());
+      s["joined"] = value(stream.second->joined());
+      s["join_delay_ms"] = value(stream.second->join_delay_ms());
+      if (auto relay = stream.second->rtp_relay()) {
+        auto stats = relay->stats();
+        value r;
+        r["destinations"] = value(relay->destinations());
+        r["packets"] = value(stats.packets);
+        r["bytes"] = value(stats.bytes);
+        r["lost"] = value(stats.lost);
+        r["invalid"] = value(stats.invalid);
+        r["forwarded"] = value(stats.forwarded);
+        r["send_dropped"] = value(stats.send_dropped);
+        s["rtp_relay"] = r;
+      }
+      if (stream.second->stream_type() == ContentStream::StreamType::SeamlessSwitching) {
+        auto seamless = std::dynamic_pointer_cast<SeamlessContentStream>(stream.second);
+        s["cdn_ept"] = value(seamless->cdn_endpoint());
+        auto pending = seamless->pending_file_stats();
+        value p;
+        p["count"] = value(static_cast<uint64_t>(pending.count));
+        p["bytes"] = value(pending.bytes);
+        p["hits"] = value(pending.hits);
+        p["misses"] = value(pending.misses);
+        p["dropped"] = value(pending.dropped);
+        s["pending_files"] = p;
+        std::vector<value> origins;
+        for (const auto& origin : seamless->cdn_origin_stats()) {
+          value o;
+          o["base"] = value(origin.base_url);
+          o["state"] = value(origin.state);
+          o["rtt_ms"] = value(origin.rtt_ms);
+          o["rtt_var_ms"] = value(origin.rtt_var_ms);
+          o["throughput"] = value(origin.throughput);
+          o["error_rate"] = value(origin.error_rate);
+          o["requests"] = value(origin.requests);
+          o["errors"] = value(origin.errors);
+          o["hedged"] = value(origin.hedged);
+          o["hedge_wins"] = value(origin.hedge_wins);
+          origins.push_back(o);
+        }
+        s["cdn_origins"] = value::array(origins);
+        s["broadcast_loss"] = value(seamless->broadcast_loss());
+        if (auto scheduler = seamless->prefetch_scheduler(); scheduler && scheduler->enabled()) {
+          auto prefetch = seamless->prefetch_stats();
+          auto budget = scheduler->stats();
+          value pf;
+          pf["started"] = value(prefetch.started);
+          pf["completed"] = value(prefetch.completed);
+          pf["cancelled"] = value(prefetch.cancelled);
+          pf["failed"] = value(prefetch.failed);
+          pf["bytes"] = value(prefetch.bytes);
+          pf["depth"] = value(scheduler->depth(seamless->broadcast_loss()));
+          if (budget.cinr_known) {
+            pf["cinr_db"] = value(budget.cinr_db);
+            pf["cinr_slope"] = value(budget.cinr_slope);
+          }
+          pf["budget_bytes"] = value(budget.budget_bytes);
+          pf["rejected"] = value(budget.rejected);
+          s["prefetch"] = pf;
+        }
+        RetentionBudget::StreamStats retention;
+        if (seamless->retention_stats(retention)) {
+          value r;
+          r["request_rate"] = value(retention.request_rate);
+          r["idle"] = value(retention.idle);
+          r["budget_bytes"] = value(retention.budget_bytes);
+          r["segments"] = value(retention.segments);
+          s["retention"] = r;
+        }
+        if (auto dash = std::dynamic_pointer_cast<DashSeamlessContentStream>(seamless)) {
+          auto mpd = dash->mpd_stats();
+          value m;
+          m["representations"] = value(static_cast<uint64_t>(mpd.representations));
+          m["segments"] = value(static_cast<uint64_t>(mpd.segments));
+          m["updates"] = value(mpd.updates);
+          m["merged_segments"] = value(mpd.merged_segments);
+          s["mpd"] = m;
+        }
+      } else {
+        s["cdn_ept"] = value("n/a");
+      }
+      streams.push_back(s);
+    }
+    ser["streams"] = value::array(streams);
+
+    services.push_back(ser);
+  }
+  return value::array(services).serialize();
+}
+
+auto MBMS_RT::RestHandler::build_file_rows() const -> std::vector<FileRow> {
+  // Items belong to the service whose manifest or stream playlist directory is the longest prefix of
+  // their location
+  std::vector<std::pair<std::string, std::string>> prefixes;
+  for (const auto& service : _services()) {
+    prefixes.emplace_back(service.second->manifest_path(), service.first);
+    for (const auto& stream : service.second->content_streams()) {
+      const auto& playlist = stream.second->playlist_path();
+      auto dir = playlist.substr(0, playlist.rfind('/') + 1);
+      prefixes.emplace_back(dir.empty() ? playlist : dir, service.first);
+    }
+  }
+
+  std::vector<FileRow> rows;
+  _cache.for_each_item([&rows, &prefixes](const std::shared_ptr<CacheItem>& item) {
+    FileRow row;
+    row.source = item->item_source_as_string();
+    row.received_at = item->received_at();
+    const auto& location = item->content_location();
+    size_t matched = 0;
+    for (const auto& [prefix, service] : prefixes) {
+      if (!prefix.empty() && prefix.size() > matched && location.compare(0, prefix.size(), prefix) == 0) {
+        row.service = service;
+        matched = prefix.size();
+      }
+    }
+    value f;
+    f["source"] = value(row.source);
+    f["location"] = value(location);
+    f["content_length"] = value(item->content_length());
+    f["received_at"] = value(item->received_at());
+    if (!row.service.empty()) {
+      f["service"] = value(row.service);
+    }
+    // The age is appended for every request, it changes without the cache changing
+    row.json = f.serialize();
+    row.json.back() = ',';
+    row.json += "\"age\":";
+    rows.push_back(std::move(row));
+  });
+  return rows;
+}
+
+auto MBMS_RT::RestHandler::reply_files(const http_request& message, const std::vector<FileRow>& rows,
+    web::http::http_response& response) -> void {
+  auto query = uri::split_query(uri::decode(message.relative_uri().query()));
+  auto param = [&query](const std::string& name) {
+    auto it = query.find(name);
+    return it == query.end() ? std::string() : it->second;
+  };
+  auto service = param("service");
+  auto source = param("source");
+  size_t offset = param("offset").empty() ? 0 : strtoull(param("offset").c_str(), nullptr, 10);
+  size_t limit = param("limit").empty() ? SIZE_MAX : strtoull(param("limit").c_str(), nullptr, 10);
+
+  auto now = time(nullptr);
+  std::string body = "[";
+  size_t total = 0;
+  size_t written = 0;
+  for (const auto& row : rows) {
+    if ((!service.empty() && row.service != service) || (!source.empty() && row.source != source)) {
+      continue;
+    }
+    if (total++ < offset || written >= limit) {
+      continue;
+    }
+    if (written++ > 0) {
+      body.push_back(',');
+    }
+    body += row.json;
+    body += std::to_string(row.received_at == 0 ? 10000 : now - static_cast<time_t>(row.received_at));
+    body.push_back('}');
+  }
+  body.push_back(']');
+  response.headers().add(U("X-Total-Count"), std::to_string(total));
+  response.set_body(body, "application/json");
+}
+
+template <typename Doc, typename Render>
+void MBMS_RT::RestHandler::reply_snapshot(const http_request& message, StatusSnapshot<Doc>& snapshot, Render render) {
+  auto respond = [message, render](const typename StatusSnapshot<Doc>::View& view, bool changed) {
+    web::http::http_response response(changed ? status_codes::OK : status_codes::NotModified);
+    response.headers().add(header_names::etag, "\"" + std::to_string(view.version) + "\"");
+    response.headers().add(header_names::cache_control, "no-cache");
+    if (!view.doc) {
+      response.set_status_code(status_codes::ServiceUnavailable);
+    } else if (changed) {
+      render(message, *view.doc, response);
+    }
+    message.reply(response);
+  };
+
+  // The version the client has, from ?version= or a previous ETag
+  auto query = uri::split_query(uri::decode(message.relative_uri().query()));
+  std::string known;
+  if (auto it = query.find("version"); it != query.end()) {
+    known = it->second;
+  } else if (message.headers().match(header_names::if_none_match, known)) {
+    known.erase(std::remove(known.begin(), known.end(), '"'), known.end());
+  }
+  auto view = snapshot.view();
+  if (known.empty() || strtoull(known.c_str(), nullptr, 10) != view.version) {
+    respond(view, true);
+    return;
+  }
+
+  // Long-poll: hold the request until the next version, or answer 304 after wait seconds
+  unsigned wait = 0;
+  if (auto it = query.find("wait"); it != query.end()) {
+    wait = std::min(static_cast<unsigned>(strtoul(it->second.c_str(), nullptr, 10)), MAX_LONG_POLL_WAIT);
+  }
+  if (wait == 0) {
+    respond(view, false);
+    return;
+  }
+  snapshot.wait(view.version, std::chrono::steady_clock::now() + std::chrono::seconds(wait), respond);
+}
+
+void MBMS_RT::RestHandler::stream_item(const http_request& message, const std::shared_ptr<CacheItem>& item,
+    uint64_t length, const std::shared_ptr<Metrics::RequestTimer>& timer) {
+  _cache.record_served(*item);
+  // No validators yet, they depend on when the object completes
+  web::http::http_response response(status_codes::OK);
+  if (item->max_age() >= 0) {
+    response.headers().add(header_names::cache_control, HttpCaching::cache_control(item->max_age()));
+  }
+  response.headers().add(U("RT-MBMS-MW-File-Origin"), U("5G-BC"));
+  Metrics::instance().bytes_served(ItemSource::Broadcast, length);
+  auto trace = item->trace();
+  if (trace) {
+    trace->stamp(SegmentTrace::Stage::FirstByteOut);
+  }
+
+  // The listener sends whatever has been written to the buffer, the length is known from the FDT
+  Concurrency::streams::producer_consumer_buffer<uint8_t> body;
+  response.set_body(body.create_istream(), length);
+  message.reply(response).then([timer](pplx::task<void> t) {
+      try {
+        t.get();
+      } catch (const std::exception& ex) {
+        spdlog::debug("Sending response failed: {}", ex.what());
+      }
+  });
+  item->stream_content([body](const char* data, size_t n) mutable {
+      body.putn_nocopy(reinterpret_cast<const uint8_t*>(data), n).wait();
+    }).then([body, item, trace](pplx::task<bool> delivered) mutable {
+      bool complete = false;
+      try {
+        complete = delivered.get();
+      } catch (const std::exception& ex) {
+        spdlog::debug("Streaming {} failed: {}", item->content_location(), ex.what());
+      }
+      if (!complete) {
+        // Ends the body short of its Content-Length, the client sees the transfer fail
+        spdlog::debug("Streaming {} ended before the last byte", item->content_location());
+      } else if (trace) {
+        Tracer::instance().last_byte_out(trace);
+      }
+      body.close(std::ios_base::out).wait();
+    });
+}
+
+void MBMS_RT::RestHandler::serve_item(const http_request& message, const std::shared_ptr<CacheItem>& item,
+    const std::shared_ptr<Metrics::RequestTimer>& timer, bool allow_fetch) {
+  // Pin one payload for the whole response, the item can be regenerated or evicted while it is sent
+  std::string accept_encoding;
+  message.headers().match(header_names::accept_encoding, accept_encoding);
+  auto payload = item->negotiated_payload(accept_encoding);
+  if (payload.data == nullptr) {
+    if (!allow_fetch) {
+      message.reply(status_codes::NotFound);
+      return;
+    }
+    // An object still arriving over broadcast is sent as it arrives, ranges and revalidations wait for all of it
+    auto length = item->length_in_reception();
+    if (length > 0 && !message.headers().has(header_names::range) &&
+        !message.headers().has(header_names::if_none_match) &&
+        !message.headers().has(header_names::if_modified_since)) {
+      stream_item(message, item, length, timer);
+      return;
+    }
+    // Hold the response until the (shared) fetch completes, without blocking this thread
+    item->fetch_content().then([this, message, item, timer](pplx::task<bool> available) {
+        bool has_data = false;
+        try {
+          has_data = available.get();
+        } catch (const std::exception& ex) {
+          spdlog::debug("Fetching {} failed: {}", item->content_location(), ex.what());
+        }
+        if (has_data) {
+          serve_item(message, item, timer, false);
+        } else {
+          message.reply(status_codes::NotFound);
+        }
+    });
+    return;
+  }
+  _cache.record_served(*item);
+
+  HttpCaching::RequestHeaders request;
+  message.headers().match(header_names::if_none_match, request.if_none_match);
+  message.headers().match(header_names::if_modified_since, request.if_modified_since);
+  message.headers().match(header_names::range, request.range);
+  message.headers().match(U("If-Range"), request.if_range);
+  auto received_at = static_cast<time_t>(item->received_at());
+  auto result = HttpCaching::evaluate(request, {
+      HttpCaching::etag_for(payload.version, received_at, payload.length, payload.content_encoding),
+      HttpCaching::last_modified_for(payload.version, received_at), item->max_age(), payload.length,
+      payload.content_encoding, payload.varies });
+
+  web::http::http_response response(result.status);
+  for (const auto& header : result.headers) {
+    response.headers().add(header.first, header.second);
+  }
+  if (result.status != status_codes::OK && result.status != status_codes::PartialContent) {
+    message.reply(response);
+    return;
+  }
+  Metrics::instance().bytes_served(item->item_source(), result.length);
+  auto trace = item->trace();
+  if (trace) {
+    trace->stamp(SegmentTrace::Stage::FirstByteOut);
+  }
+  response.headers().add(U("RT-MBMS-MW-File-Origin"), item->item_source_as_string());
+  auto instream = Concurrency::streams::rawptr_stream<uint8_t>::open_istream(
+      reinterpret_cast<const uint8_t*>(payload.data) + result.offset, result.length);
+  response.set_body(instream, result.length);
+  message.reply(response).then([holder = std::move(payload.holder), timer, trace](pplx::task<void> t) {
+      try {
+        t.get();
+        if (trace) {
+          Tracer::instance().last_byte_out(trace);
+        }
+      } catch (const std::exception& ex) {
+        spdlog::debug("Sending response failed: {}", ex.what());
+      }
+  });
+}
+
 void MBMS_RT::RestHandler::put(http_request message) {
   if (_require_bearer_token &&
-    (message.headers()["Authorization"] != "Bearer " + _api_key)) {
+    (_api_key.empty() || message.headers()["Authorization"] != "Bearer " + _api_key)) {
     message.reply(status_codes::Unauthorized);
     return;
   }
@@ -15,10 +15,12 @@
 // under the License.
 //
 #pragma once
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
+#include <tuple>
 #include <libconfig.h++>
 
 #include "cpprest/json.h"
@@ -34,6 +36,9 @@
 #include "Service.h"
 #include "ServiceAnnouncement.h"
 #include "CacheManagement.h"
+#include "Metrics.h"
+#include "StatusSnapshot.h"
+#include "seamless/FetchEngine.h"
 
 namespace MBMS_RT {
   /**
@@ -41,34 +46,90 @@ namespace MBMS_RT {
    */
   class RestHandler {
     public:
+      /**
+       *  Returns a copy of the service map, taken under the lock of its owner
+       */
+      typedef std::function<std::map<std::string, std::shared_ptr<MBMS_RT::Service>>()> services_snapshot_t;
+
+      /**
+       *  Called on the HTTP thread with the path of every request for a cache item, must not block
+       */
+      typedef std::function<void(const std::string&)> demand_callback_t;
+
       /**
        *  Default constructor.
        *
        *  @param cfg Config singleton reference
        *  @param url URL to open the server on
+       *  @param demand_cb Lazy join: where requests are signalled, only used if mw.lazy_join.enabled is set
        */
       RestHandler(const libconfig::Config& cfg, const std::string& url, const CacheManagement& cache,
           const std::unique_ptr<MBMS_RT::ServiceAnnouncement>* service_announcement,
-          const std::map<std::string, std::shared_ptr<MBMS_RT::Service>>& services );
+          services_snapshot_t services,
+          const std::shared_ptr<MBMS_RT::FetchEngine>* fetch_engine,
+          demand_callback_t demand_cb = nullptr );
       /**
        *  Default destructor.
        */
       virtual ~RestHandler();
 
+      /**
+       *  Rebuild the status documents of mw-api/services, files and service_announcement where their
+       *  inputs changed, and answer long-polling clients. Called from the middleware tick, which also
+       *  owns the service map.
+       */
+      void refresh_status();
+
     private:
+      // Longest a status request may be held with ?wait=, in seconds
+      static constexpr unsigned MAX_LONG_POLL_WAIT = 60;
+
+      /**
+       *  A pre-serialised mw-api/files entry, its age is appended per request
+       */
+      struct FileRow {
+        std::string service;
+        std::string source;
+        uint64_t received_at;
+        std::string json;       /**< the entry up to and including "age": */
+        bool operator==(const FileRow& other) const { return json == other.json; };
+      };
 
       const CacheManagement& _cache;
       void get(web::http::http_request message);
       void put(web::http::http_request message);
+      void serve_item(const web::http::http_request& message, const std::shared_ptr<CacheItem>& item,
+          const std::shared_ptr<Metrics::RequestTimer>& timer, bool allow_fetch = true);
+      void stream_item(const web::http::http_request& message, const std::shared_ptr<CacheItem>& item,
+          uint64_t length, const std::shared_ptr<Metrics::RequestTimer>& timer);
       const libconfig::Config& _cfg;
    //   const std::map<std::string, LibFlute::File>& _files;
-      const std::map<std::string, std::shared_ptr<Service>>& _services;
+      services_snapshot_t _services;
       const std::unique_ptr<MBMS_RT::ServiceAnnouncement>* _service_announcement_h = {};
+      const std::shared_ptr<MBMS_RT::FetchEngine>* _fetch_engine_h = {};
       unsigned _total_cache_size;
 
       std::unique_ptr<web::http::experimental::listener::http_listener> _listener;
       bool _require_bearer_token = false;
       std::string _api_key;
       std::string _api_path;
+      demand_callback_t _demand_cb = nullptr;
+
+      std::string build_services_json() const;
+      std::string build_service_announcement_json() const;
+      std::vector<FileRow> build_file_rows() const;
+      static void reply_files(const web::http::http_request& message, const std::vector<FileRow>& rows,
+          web::http::http_response& response);
+      /**
+       *  Reply with a status document, or hold a long-poll. render(message, doc, response) sets the body.
+       */
+      template <typename Doc, typename Render>
+      void reply_snapshot(const web::http::http_request& message, StatusSnapshot<Doc>& snapshot, Render render);
+
+      StatusSnapshot<std::string> _services_doc;
+      StatusSnapshot<std::vector<FileRow>> _files_doc;
+      StatusSnapshot<std::string> _service_announcement_doc;
+      uint64_t _files_cache_version = UINT64_MAX;
+      std::tuple<const ServiceAnnouncement*, uint32_t, uint64_t> _service_announcement_key = {};
   };
 };
@@ -20,41 +20,180 @@
 #include "spdlog/spdlog.h"
 
 using web::http::client::http_client;
+using web::http::client::http_client_config;
 using web::http::status_codes;
 using web::http::methods;
+using web::http::header_names;
+using web::http::http_request;
 using web::http::http_response;
 
-MBMS_RT::RpRestClient::RpRestClient(const libconfig::Config& cfg)
+namespace {
+  auto breaker_from_config(const libconfig::Config& cfg) -> MBMS_RT::CircuitBreaker
+  {
+    unsigned failure_threshold = 3;
+    cfg.lookupValue("mw.modem_client.failure_threshold", failure_threshold);
+    unsigned retry_interval = 5;
+    cfg.lookupValue("mw.modem_client.retry_interval", retry_interval);
+    unsigned max_retry_interval = 60;
+    cfg.lookupValue("mw.modem_client.max_retry_interval", max_retry_interval);
+    return MBMS_RT::CircuitBreaker("Modem API", failure_threshold, std::chrono::seconds(retry_interval),
+        std::chrono::seconds(max_retry_interval));
+  }
+}
+
+MBMS_RT::RpRestClient::RpRestClient(const libconfig::Config& cfg, boost::asio::io_service& io_service)
+  : _breaker(breaker_from_config(cfg))
+  , _long_poll_timer(io_service)
 {
   std::string url = "http://localhost:3010/modem-api/";
   cfg.lookupValue("modem.restful_api.uri", url);
-  _client = std::make_unique<http_client>(url);
+
+  unsigned timeout_ms = 2000;
+  cfg.lookupValue("mw.modem_client.timeout_ms", timeout_ms);
+  http_client_config config;
+  config.set_timeout(std::chrono::milliseconds(timeout_ms));
+  _client = std::make_unique<http_client>(url, config);
+
+  cfg.lookupValue("mw.modem_client.long_poll", _long_poll);
+  if (_long_poll) {
+    cfg.lookupValue("mw.modem_client.long_poll_timeout", _long_poll_timeout);
+    http_client_config long_poll_config;
+    long_poll_config.set_timeout(std::chrono::seconds(_long_poll_timeout) + std::chrono::milliseconds(timeout_ms));
+    _long_poll_client = std::make_unique<http_client>(url, long_poll_config);
+  }
+}
+
+MBMS_RT::RpRestClient::~RpRestClient()
+{
+  _stopped = true;
+  _cts.cancel();
+  boost::system::error_code ec;
+  _long_poll_timer.cancel(ec);
+}
+
+auto MBMS_RT::RpRestClient::mch_info() -> pplx::task<web::json::value>
+{
+  return get("mch_info");
 }
 
-auto MBMS_RT::RpRestClient::getMchInfo() -> web::json::value
+auto MBMS_RT::RpRestClient::status() -> pplx::task<web::json::value>
 {
-  auto res = web::json::value::array();
-  try {
-    _client->request(methods::GET, "mch_info")
-      .then([&res](http_response response) { // NOLINT
+  return get("status");
+}
+
+auto MBMS_RT::RpRestClient::get(const std::string& path) -> pplx::task<web::json::value>
+{
+  if (!_breaker.allow()) {
+    return pplx::task_from_result(web::json::value::array());
+  }
+  std::weak_ptr<RpRestClient> weak_self = shared_from_this();
+  return _client->request(methods::GET, path, _cts.get_token())
+    .then([weak_self, path](pplx::task<http_response> request) { // NOLINT
+        auto self = weak_self.lock();
+        if (!self) {
+          return pplx::task_from_result(web::json::value::array());
+        }
+        try {
+          auto response = request.get();
           if (response.status_code() == status_codes::OK) {
-            res = response.extract_json().get();
+            self->_breaker.record_success();
+            return response.extract_json();
           }
-        }).wait();
-  } catch (web::http::http_exception ex) { }
-  return res;
+          spdlog::debug("Modem API returned {} for {}", response.status_code(), path);
+        } catch (const std::exception& ex) {
+          spdlog::debug("Modem API request for {} failed: {}", path, ex.what());
+        }
+        self->_breaker.record_failure();
+        return pplx::task_from_result(web::json::value::array());
+      })
+    .then([path](pplx::task<web::json::value> json) { // NOLINT
+        try {
+          return json.get();
+        } catch (const std::exception& ex) {
+          spdlog::debug("Invalid response from modem API for {}: {}", path, ex.what());
+          return web::json::value::array();
+        }
+      });
+}
+
+auto MBMS_RT::RpRestClient::watch_mch_info(mch_info_callback_t cb) -> void
+{
+  if (!_long_poll) {
+    return;
+  }
+  _mch_info_cb = std::move(cb);
+  long_poll();
 }
 
-auto MBMS_RT::RpRestClient::getStatus() -> web::json::value
+auto MBMS_RT::RpRestClient::long_poll() -> void
 {
-  auto res = web::json::value::array();
-  try {
-    _client->request(methods::GET, "status")
-      .then([&res](http_response response) { // NOLINT
+  if (_stopped) {
+    return;
+  }
+  if (!_breaker.allow()) {
+    schedule_long_poll(_min_poll_interval);
+    return;
+  }
+
+  // The modem holds the request until the MCH info differs from the ETag we have, or the wait expires
+  http_request request(methods::GET);
+  request.set_request_uri("mch_info?wait=" + std::to_string(_long_poll_timeout));
+  if (!_mch_info_etag.empty()) {
+    request.headers().add(header_names::if_none_match, _mch_info_etag);
+  }
+  auto started = std::chrono::steady_clock::now();
+  std::weak_ptr<RpRestClient> weak_self = shared_from_this();
+  _long_poll_client->request(request, _cts.get_token())
+    .then([weak_self, started](pplx::task<http_response> request) { // NOLINT
+        auto self = weak_self.lock();
+        if (!self || self->_stopped) {
+          return;
+        }
+        bool ok = false;
+        try {
+          auto response = request.get();
           if (response.status_code() == status_codes::OK) {
-            res = response.extract_json().get();
+            response.headers().match(header_names::etag, self->_mch_info_etag);
+            auto mch_info = response.extract_json().get();
+            ok = true;
+            if (self->_mch_info_cb) {
+              self->_mch_info_cb(std::move(mch_info));
+            }
+          } else if (response.status_code() == status_codes::NotModified) {
+            ok = true;
           }
-        }).wait();
-  } catch (web::http::http_exception ex) { }
-  return res;
+        } catch (const pplx::task_canceled&) {
+          return;
+        } catch (const std::exception& ex) {
+          spdlog::debug("Modem API long-poll failed: {}", ex.what());
+        }
+        if (ok) {
+          self->_breaker.record_success();
+        } else {
+          self->_breaker.record_failure();
+        }
+        // A modem without long-poll support answers at once: never ask more often than it was polled before
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+        self->schedule_long_poll(elapsed < self->_min_poll_interval ?
+            self->_min_poll_interval - elapsed : std::chrono::milliseconds(0));
+      });
+}
+
+auto MBMS_RT::RpRestClient::schedule_long_poll(std::chrono::milliseconds delay) -> void
+{
+  if (_stopped) {
+    return;
+  }
+  if (delay.count() == 0) {
+    long_poll();
+    return;
+  }
+  _long_poll_timer.expires_from_now(boost::posix_time::milliseconds(delay.count()));
+  std::weak_ptr<RpRestClient> weak_self = shared_from_this();
+  _long_poll_timer.async_wait([weak_self](const boost::system::error_code& ec) {
+      auto self = weak_self.lock();
+      if (!ec && self) {
+        self->long_poll();
+      }
+  });
 }
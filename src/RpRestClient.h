@@ -14,23 +14,75 @@
 // See the License for the specific language governing permissions and limitations
 // under the License.
 //
+
+
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
 #include <libconfig.h++>
+#include <boost/asio.hpp>
 #include "cpprest/http_client.h"
+#include "CircuitBreaker.h"
 
 namespace MBMS_RT {
-  class RpRestClient {
+  /**
+   *  Asynchronous client for the modem's REST API.
+   *
+   *  Requests time out after mw.modem_client.timeout_ms and go through a circuit breaker, so a slow or
+   *  dead modem costs the caller nothing but an empty result. Optionally MCH info is pushed through a
+   *  long-poll on mch_info instead of being polled. Must be owned by a shared_ptr: requests still in
+   *  flight when the client is destroyed complete without touching it.
+   */
+  class RpRestClient : public std::enable_shared_from_this<RpRestClient> {
     public:
-      RpRestClient(const libconfig::Config& cfg);
+      RpRestClient(const libconfig::Config& cfg, boost::asio::io_service& io_service);
+
+      virtual ~RpRestClient();
+
+      /**
+       *  @return A task yielding the MCH info, or an empty array if the modem could not be asked
+       */
+      pplx::task<web::json::value> mch_info();
+
+      /**
+       *  @return A task yielding the modem status, or an empty array if the modem could not be asked
+       */
+      pplx::task<web::json::value> status();
 
-      virtual ~RpRestClient() {};
+      typedef std::function<void(web::json::value)> mch_info_callback_t;
 
-      web::json::value getMchInfo();
-      web::json::value getStatus();
+      /**
+       *  Whether mw.modem_client.long_poll is configured. If so, MCH info changes are delivered through
+       *  watch_mch_info() and need not be polled.
+       */
+      bool push_enabled() const { return _long_poll; };
+
+      /**
+       *  Start the long-poll loop. cb is called, from a pplx thread, with every new MCH info.
+       */
+      void watch_mch_info(mch_info_callback_t cb);
+
+      const CircuitBreaker& circuit_breaker() const { return _breaker; };
 
     private:
+      pplx::task<web::json::value> get(const std::string& path);
+      void long_poll();
+      void schedule_long_poll(std::chrono::milliseconds delay);
+
       std::unique_ptr<web::http::client::http_client> _client;
+      std::unique_ptr<web::http::client::http_client> _long_poll_client;
+      pplx::cancellation_token_source _cts;
+      CircuitBreaker _breaker;
+
+      bool _long_poll = false;
+      unsigned _long_poll_timeout = 30;
+      std::chrono::milliseconds _min_poll_interval = std::chrono::milliseconds(1000);
+      mch_info_callback_t _mch_info_cb;
+      utility::string_t _mch_info_etag;
+      boost::asio::deadline_timer _long_poll_timer;
+      std::atomic<bool> _stopped = {false};
   };
 }
@@ -0,0 +1,194 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "SegmentTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+static auto now_us() -> uint64_t {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+MBMS_RT::SegmentTrace::SegmentTrace(std::string location)
+  : _location( std::move(location) )
+  , _created_at( now_us() )
+{
+}
+
+auto MBMS_RT::SegmentTrace::stage_name(Stage stage) -> const char*
+{
+  switch (stage) {
+    case Stage::FirstPacket: return "first_packet";
+    case Stage::FluteComplete: return "flute_complete";
+    case Stage::PlaylistMatched: return "playlist_matched";
+    case Stage::CdnRequested: return "cdn_requested";
+    case Stage::CdnCompleted: return "cdn_completed";
+    case Stage::FirstByteOut: return "first_byte_out";
+    case Stage::LastByteOut: return "last_byte_out";
+    default: return "unknown";
+  }
+}
+
+auto MBMS_RT::SegmentTrace::stamp(Stage stage) -> void
+{
+  uint64_t unset = 0;
+  _stamps[static_cast<size_t>(stage)].compare_exchange_strong(unset, now_us(), std::memory_order_relaxed);
+}
+
+auto MBMS_RT::SegmentTrace::matched(const std::string& stream) -> void
+{
+  set_stream(stream);
+  stamp(Stage::PlaylistMatched);
+}
+
+auto MBMS_RT::SegmentTrace::set_stream(const std::string& stream) -> void
+{
+  const std::lock_guard<std::mutex> lock(_stream_mutex);
+  if (_stream.empty()) {
+    _stream = stream;
+  }
+}
+
+auto MBMS_RT::SegmentTrace::stream() const -> std::string
+{
+  const std::lock_guard<std::mutex> lock(_stream_mutex);
+  return _stream;
+}
+
+auto MBMS_RT::Tracer::instance() -> Tracer&
+{
+  static Tracer tracer;
+  return tracer;
+}
+
+auto MBMS_RT::Tracer::configure(const libconfig::Config& cfg) -> void
+{
+  bool enabled = false;
+  cfg.lookupValue("mw.tracing.enabled", enabled);
+  cfg.lookupValue("mw.tracing.sample_interval", _sample_interval);
+  _sample_interval = std::max(_sample_interval, 1U);
+  unsigned max_traces = _max_traces;
+  cfg.lookupValue("mw.tracing.max_traces", max_traces);
+  _max_traces = max_traces;
+  cfg.lookupValue("mw.tracing.max_age", _max_age);
+  _enabled = enabled;
+}
+
+auto MBMS_RT::Tracer::sampled(const std::string& location) const -> bool
+{
+  return enabled() && std::hash<std::string>{}(location) % _sample_interval == 0;
+}
+
+auto MBMS_RT::Tracer::begin(const std::string& location) -> std::shared_ptr<SegmentTrace>
+{
+  if (!sampled(location)) {
+    return nullptr;
+  }
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _running.find(location);
+  if (it != _running.end()) {
+    return it->second;
+  }
+  if (_running.size() >= MAX_RUNNING) {
+    return nullptr;
+  }
+  auto trace = std::make_shared<SegmentTrace>(location);
+  _running.emplace(location, trace);
+  return trace;
+}
+
+auto MBMS_RT::Tracer::find(const std::string& location) -> std::shared_ptr<SegmentTrace>
+{
+  if (!sampled(location)) {
+    return nullptr;
+  }
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _running.find(location);
+  return it == _running.end() ? nullptr : it->second;
+}
+
+auto MBMS_RT::Tracer::last_byte_out(const std::shared_ptr<SegmentTrace>& trace) -> void
+{
+  trace->stamp(SegmentTrace::Stage::LastByteOut);
+  const std::lock_guard<std::mutex> lock(_mutex);
+  finish(trace);
+}
+
+auto MBMS_RT::Tracer::expire() -> void
+{
+  if (!enabled()) {
+    return;
+  }
+  auto oldest = now_us() - static_cast<uint64_t>(_max_age) * 1000000;
+  const std::lock_guard<std::mutex> lock(_mutex);
+  for (auto it = _running.begin(); it != _running.end();) {
+    auto trace = it++->second;
+    if (trace->_created_at < oldest) {
+      finish(trace);
+    }
+  }
+}
+
+auto MBMS_RT::Tracer::finish(const std::shared_ptr<SegmentTrace>& trace) -> void
+{
+  if (trace->_finished.exchange(true)) {
+    return;
+  }
+  auto it = _running.find(trace->location());
+  if (it != _running.end() && it->second == trace) {
+    _running.erase(it);
+  }
+  // Playlists, manifests and init files nobody listed carry no useful breakdown
+  if (trace->at(SegmentTrace::Stage::PlaylistMatched) == 0 && trace->stream().empty()) {
+    return;
+  }
+
+  Record record{ trace->location(), trace->stream(), {} };
+  uint64_t first = 0;
+  for (size_t i = 0; i < SegmentTrace::STAGE_COUNT; i++) {
+    record.stamps[i] = trace->_stamps[i].load(std::memory_order_relaxed);
+    if (record.stamps[i] > 0 && (first == 0 || record.stamps[i] < first)) {
+      first = record.stamps[i];
+    }
+  }
+  auto& summary = _summary[record.stream];
+  summary.traces++;
+  for (size_t i = 0; i < SegmentTrace::STAGE_COUNT; i++) {
+    if (record.stamps[i] > 0) {
+      summary.stages[i].record(static_cast<double>(record.stamps[i] - first) / 1000);
+    }
+  }
+  _records.push_back(std::move(record));
+  while (_records.size() > _max_traces) {
+    _records.pop_front();
+  }
+}
+
+auto MBMS_RT::Tracer::records() const -> std::vector<Record>
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return { _records.begin(), _records.end() };
+}
+
+auto MBMS_RT::Tracer::summary() const -> std::map<std::string, StageSummary>
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _summary;
+}
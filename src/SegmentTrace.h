@@ -0,0 +1,160 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <libconfig.h++>
+#include "LatencyHistogram.h"
+
+namespace MBMS_RT {
+  /**
+   *  Timestamps of one segment on its way from reception to the first HTTP client that got it.
+   *
+   *  Every stage keeps the time it was first reached, later stamps are ignored. Stamps are atomic, so
+   *  the FLUTE, CDN and HTTP threads set them without a lock.
+   */
+  class SegmentTrace {
+    public:
+      enum class Stage {
+        FirstPacket,
+        FluteComplete,
+        PlaylistMatched,
+        CdnRequested,
+        CdnCompleted,
+        FirstByteOut,
+        LastByteOut,
+        Count
+      };
+      static constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::Count);
+      static const char* stage_name(Stage stage);
+
+      explicit SegmentTrace(std::string location);
+
+      void stamp(Stage stage);
+
+      /**
+       *  Stamp PlaylistMatched and assign the trace to the stream whose playlist listed the segment
+       */
+      void matched(const std::string& stream);
+      void set_stream(const std::string& stream);
+
+      const std::string& location() const { return _location; };
+      std::string stream() const;
+
+      /**
+       *  @return Microseconds since the epoch at which a stage was reached, 0 if it was not
+       */
+      uint64_t at(Stage stage) const { return _stamps[static_cast<size_t>(stage)].load(std::memory_order_relaxed); };
+
+    private:
+      friend class Tracer;
+
+      std::string _location;
+      std::array<std::atomic<uint64_t>, STAGE_COUNT> _stamps = {};
+      std::atomic<bool> _finished = false;
+      uint64_t _created_at;
+
+      mutable std::mutex _stream_mutex;
+      std::string _stream;
+  };
+
+  /**
+   *  Samples segments for tracing and collects the finished traces.
+   *
+   *  The sampling decision is a hash of the content location, so the FLUTE decoder, the stream that
+   *  matches the playlist entry and the HTTP servers agree on it without sharing state. Unsampled
+   *  segments cost one hash on the stages that look their trace up by location, nothing on the others.
+   *
+   *  A trace finishes when the last byte of its first response is sent, or after max_age seconds.
+   *  Finished traces of segments that were listed in a playlist are kept for export, up to max_traces,
+   *  and their stage offsets are added to the per stream summary.
+   */
+  class Tracer {
+    public:
+      static Tracer& instance();
+
+      /**
+       *  Read mw.tracing. Tracing stays off unless it is enabled there.
+       */
+      void configure(const libconfig::Config& cfg);
+      bool enabled() const { return _enabled.load(std::memory_order_relaxed); };
+
+      /**
+       *  @return The trace of a sampled location, created if it is new. nullptr if tracing is off, the
+       *          location is not sampled, or too many traces are running.
+       */
+      std::shared_ptr<SegmentTrace> begin(const std::string& location);
+
+      /**
+       *  @return The running trace of a location, nullptr if there is none
+       */
+      std::shared_ptr<SegmentTrace> find(const std::string& location);
+
+      /**
+       *  Stamp LastByteOut and finish the trace. Later calls for the same trace do nothing.
+       */
+      void last_byte_out(const std::shared_ptr<SegmentTrace>& trace);
+
+      /**
+       *  Finish traces running longer than max_age
+       */
+      void expire();
+
+      struct Record {
+        std::string location;
+        std::string stream;
+        std::array<uint64_t, SegmentTrace::STAGE_COUNT> stamps;
+      };
+      std::vector<Record> records() const;
+
+      /**
+       *  Per stage histograms of the time from the first stamp of a trace until the stage was reached
+       */
+      struct StageSummary {
+        std::array<LatencyHistogram, SegmentTrace::STAGE_COUNT> stages;
+        uint64_t traces = 0;
+      };
+      std::map<std::string, StageSummary> summary() const;
+
+    private:
+      Tracer() = default;
+      bool sampled(const std::string& location) const;
+      void finish(const std::shared_ptr<SegmentTrace>& trace);
+
+      static constexpr size_t MAX_RUNNING = 4096;
+
+      std::atomic<bool> _enabled = false;
+      unsigned _sample_interval = 100;
+      size_t _max_traces = 1000;
+      unsigned _max_age = 120;
+
+      mutable std::mutex _mutex;
+      std::unordered_map<std::string, std::shared_ptr<SegmentTrace>> _running;
+      std::deque<Record> _records;
+      std::map<std::string, StageSummary> _summary;
+  };
+}
@@ -42,15 +42,11 @@ auto MBMS_RT::Service::read_master_manifest(const std::string &manifest, const s
   }
 
   _manifest_path =
-      _delivery_protocol == DeliveryProtocol::HLS ? base_path + "manifest.m3u8" : base_path + "manifest.mpd",
-      _cache.add_item(std::make_shared<CachedPlaylist>(
-          _manifest_path,
-          0,
-          [&]() -> const std::string & {
-            spdlog::debug("Service: master manifest requested");
-            return _manifest;
-          }
-      ));
+      _delivery_protocol == DeliveryProtocol::HLS ? base_path + "manifest.m3u8" : base_path + "manifest.mpd";
+  auto item = std::make_shared<CachedManifest>(_manifest_path, 0, _manifest);
+  // The manifest changes whenever streams are added, so caches must revalidate it
+  item->set_max_age(0);
+  _cache.add_item(item);
 }
 
 auto MBMS_RT::Service::add_and_start_content_stream(std::shared_ptr<ContentStream> s) -> void // NOLINT
@@ -67,13 +63,19 @@ auto MBMS_RT::Service::add_and_start_content_stream(std::shared_ptr<ContentStrea
       }
     }
   }
-  _content_streams[s->playlist_path()] = s;
+  std::map<std::string, std::shared_ptr<ContentStream>> streams;
+  {
+    const std::lock_guard<std::mutex> lock(_content_streams_mutex);
+    _content_streams[s->playlist_path()] = s;
+    streams = _content_streams;
+  }
   s->start();
 
+  bool published = false;
   if (_delivery_protocol == DeliveryProtocol::HLS) {
     // recreate the manifest
     HlsPrimaryPlaylist pl;
-    for (const auto &stream: _content_streams) {
+    for (const auto &stream: streams) {
       HlsPrimaryPlaylist::Stream s{
           "/" + stream.second->playlist_path(),
           stream.second->resolution(),
@@ -83,10 +85,37 @@ auto MBMS_RT::Service::add_and_start_content_stream(std::shared_ptr<ContentStrea
       };
       pl.add_stream(s);
     }
-    _manifest = pl.to_string();
+    published = _manifest->publish(pl.to_string());
   } else if(_delivery_protocol == DeliveryProtocol::DASH) {
-    _manifest = _dash_manifest.content;
+    published = _manifest->publish(_dash_manifest.content);
+  }
+  if (published) {
+    _cache.item_changed(_manifest_path);
+  }
+}
+
+auto MBMS_RT::Service::content_streams() const -> std::map<std::string, std::shared_ptr<ContentStream>> {
+  const std::lock_guard<std::mutex> lock(_content_streams_mutex);
+  return _content_streams;
+}
+
+auto MBMS_RT::Service::handle_demand(const std::string &path) -> bool {
+  auto streams = content_streams();
+  if (path == _manifest_path) {
+    for (const auto &stream: streams) {
+      stream.second->touch();
+    }
+    return true;
+  }
+  bool found = false;
+  for (const auto &stream: streams) {
+    auto base_path = stream.second->base_path();
+    if (path == stream.second->playlist_path() || (!base_path.empty() && path.rfind(base_path, 0) == 0)) {
+      stream.second->touch();
+      found = true;
+    }
   }
+  return found;
 }
 
 auto MBMS_RT::Service::set_delivery_protocol_from_mime_type(const std::string &mime_type) -> void {
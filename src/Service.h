@@ -16,6 +16,7 @@
 //
 #pragma once
 
+#include <mutex>
 #include <string>
 #include <thread>
 #include <libconfig.h++>
@@ -25,12 +26,14 @@
 #include "Receiver.h"
 #include "ContentStream.h"
 #include "DeliveryProtocols.h"
+#include "ContentSnapshot.h"
 
 namespace MBMS_RT {
   class Service {
     public:
       Service(CacheManagement& cache)
-        : _cache(cache) {};
+        : _cache(cache)
+        , _manifest(std::make_shared<SnapshotPublisher>()) {};
       virtual ~Service() = default;
 
       void add_name(const std::string& name, const std::string& lang);
@@ -38,7 +41,11 @@ namespace MBMS_RT {
       void read_master_manifest(const std::string& manifest, const std::string& base_path);
 
       const std::map<std::string, std::string>& names() const { return _names; };
-      const std::map<std::string, std::shared_ptr<ContentStream>>& content_streams() const { return _content_streams; };
+      /**
+       *  @return A copy of the stream map. Streams are added from the service announcement's strand
+       *          while the tick and the HTTP servers read them.
+       */
+      std::map<std::string, std::shared_ptr<ContentStream>> content_streams() const;
 
       DeliveryProtocol delivery_protocol() const { return _delivery_protocol; };
       std::string delivery_protocol_string() const { return _delivery_protocol == DeliveryProtocol::HLS ? "HLS" :
@@ -47,15 +54,24 @@ namespace MBMS_RT {
 
       const std::string& manifest_path() const { return  _manifest_path; };
 
+      /**
+       *  Touch the streams a client request for path belongs to: all of them for the manifest, otherwise
+       *  the stream with this playlist or base path.
+       *
+       *  @return true if path belongs to this service
+       */
+      bool handle_demand(const std::string& path);
+
     private:
       CacheManagement& _cache;
       DeliveryProtocol _delivery_protocol;
+      mutable std::mutex _content_streams_mutex;
       std::map<std::string, std::shared_ptr<ContentStream>> _content_streams;
       std::map<std::string, std::string> _names;
 
       HlsPrimaryPlaylist _hls_primary_playlist;
       DashManifest _dash_manifest;
-      std::string _manifest;
+      std::shared_ptr<SnapshotPublisher> _manifest;
       std::string _manifest_path;
   };
 }
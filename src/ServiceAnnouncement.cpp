@@ -20,10 +20,11 @@
 #include <iomanip>      // std::get_time
 #include <ctime>        // struct std::tm
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/functional/hash.hpp>
 #include "ServiceAnnouncement.h"
 #include "Service.h"
-#include "Receiver.h"
 #include "seamless/SeamlessContentStream.h"
+#include "seamless/DashSeamlessContentStream.h"
 #include "Constants.h"
 
 #include "spdlog/spdlog.h"
@@ -31,6 +32,7 @@
 #include "tinyxml2.h"
 #include "cpprest/base_uri.h"
 #include <gzip/decompress.hpp>
+#include "File.h"
 
 
 MBMS_RT::ServiceAnnouncement::ServiceAnnouncement(const libconfig::Config &cfg, std::string tmgi,
@@ -38,18 +40,20 @@ MBMS_RT::ServiceAnnouncement::ServiceAnnouncement(const libconfig::Config &cfg,
                                                   unsigned long long tsi, std::string iface,
                                                   boost::asio::io_service &io_service, CacheManagement &cache,
                                                   bool seamless_switching,
+                                                  std::shared_ptr<PrefetchScheduler> prefetch,
+                                                  std::shared_ptr<FetchEngine> fetch_engine,
+                                                  std::shared_ptr<RetentionBudget> retention,
                                                   get_service_callback_t get_service,
                                                   set_service_callback_t set_service)
-    : _cfg(cfg), _tmgi(std::move(tmgi)), _tsi(tsi), _iface(std::move(iface)), _io_service(io_service), _cache(cache),
-      _flute_thread{}, _seamless(seamless_switching), _get_service(std::move(get_service)),
-      _set_service(std::move(set_service)) {
+    : _cfg(cfg), _tmgi(std::move(tmgi)), _tsi(tsi), _iface(std::move(iface)), _io_service(io_service), _strand(io_service),
+      _cache(cache), _prefetch(std::move(prefetch)), _fetch_engine(std::move(fetch_engine)), _seamless(seamless_switching), _get_service(std::move(get_service)),
+      _set_service(std::move(set_service)), _retention(std::move(retention)) {
 }
 
 MBMS_RT::ServiceAnnouncement::~ServiceAnnouncement() {
   spdlog::info("Closing service announcement session with TMGI {}", _tmgi);
-  _flute_receiver.reset();
-  if (_flute_thread.joinable()) {
-    _flute_thread.join();
+  if (_multicast_receiver) {
+    _multicast_receiver->remove_session(_flute_session);
   }
 }
 
@@ -67,24 +71,29 @@ auto MBMS_RT::ServiceAnnouncement::start_flute_receiver(const std::string &mcast
   _mcast_addr = mcast_address.substr(0, delim);
   _mcast_port = mcast_address.substr(delim + 1);
   spdlog::info("Starting FLUTE receiver on {}:{} for TSI {}", _mcast_addr, _mcast_port, _tsi);
-  _flute_thread = std::thread{[&]() {
-    _flute_receiver = std::make_unique<LibFlute::Receiver>(_iface, _mcast_addr, atoi(_mcast_port.c_str()), _tsi,
-                                                           _io_service);
-    _flute_receiver->register_completion_callback(
-        [&](std::shared_ptr<LibFlute::File> file) { //NOLINT
+  _flute_session = std::make_shared<FluteSessionDecoder>(_tsi);
+  _flute_session->register_completion_callback(
+      [&](std::shared_ptr<LibFlute::File> file) { //NOLINT
+        auto received_at = std::chrono::steady_clock::now();
+        _strand.post([this, file, received_at]() {
           spdlog::info("{} (TOI {}) has been received",
                        file->meta().content_location, file->meta().toi);
           if (!_bootstrapped || _toi != file->meta().toi) {
             _toi = file->meta().toi;
-            if (file->meta().content_type == "application/x-gzip") {
-              _raw_content = gzip::decompress(file->buffer(), file->length());
-            } else {
-              _raw_content = std::string(file->buffer());
+            parse_bootstrap(file, received_at);
+            _bootstrapped = true;
+            if (_bootstrap_cb) {
+              _bootstrap_cb();
             }
-            parse_bootstrap(file->buffer());
           }
         });
-  }};
+      });
+  try {
+    _multicast_receiver = MulticastReceiver::acquire(_iface, _mcast_addr, atoi(_mcast_port.c_str()), _io_service);
+    _multicast_receiver->add_session(_flute_session);
+  } catch (const std::exception& ex) {
+    spdlog::error("Failed to start FLUTE reception on {}: {}", mcast_address, ex.what());
+  }
 }
 
 /**
@@ -92,12 +101,79 @@ auto MBMS_RT::ServiceAnnouncement::start_flute_receiver(const std::string &mcast
  * @param str
  */
 auto
-MBMS_RT::ServiceAnnouncement::parse_bootstrap(const std::string &str) -> void {
+MBMS_RT::ServiceAnnouncement::parse_bootstrap(const std::string &str,
+                                              std::chrono::steady_clock::time_point received_at) -> void {
+  {
+    const std::lock_guard<std::mutex> lock(_raw_content_mutex);
+    _bootstrap_file.reset();
+    _raw_content = str;
+    _raw_content_valid = true;
+  }
+
+  g_mime_init();
+  auto stream = g_mime_stream_mem_new_with_buffer(str.c_str(), str.length());
+  _parseBootstrap(stream, received_at);
+  g_object_unref(stream);
+}
+
+auto
+MBMS_RT::ServiceAnnouncement::parse_bootstrap(const std::shared_ptr<LibFlute::File> &file,
+                                              std::chrono::steady_clock::time_point received_at) -> void {
+  {
+    const std::lock_guard<std::mutex> lock(_raw_content_mutex);
+    _bootstrap_file = file;
+    _raw_content_valid = false;
+  }
+
+  // Let gmime read the FLUTE buffer in place. The byte array only borrows the data.
+  g_mime_init();
+  auto array = g_byte_array_new_take(reinterpret_cast<guint8 *>(file->buffer()), file->length());
+  auto mem = g_mime_stream_mem_new_with_byte_array(array);
+  g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+
+  if (file->meta().content_type == "application/x-gzip") {
+    // Inflate while the parser reads, without materialising the decompressed bootstrap
+    auto inflated = g_mime_stream_filter_new(mem);
+    auto gunzip = g_mime_filter_gzip_new(GMIME_FILTER_GZIP_MODE_UNZIP, 0);
+    g_mime_stream_filter_add(GMIME_STREAM_FILTER(inflated), gunzip);
+    g_object_unref(gunzip);
+    _parseBootstrap(inflated, received_at);
+    g_object_unref(inflated);
+  } else {
+    _parseBootstrap(mem, received_at);
+  }
+  g_object_unref(mem);
+  g_byte_array_free(array, FALSE);
+}
+
+auto MBMS_RT::ServiceAnnouncement::content() const -> std::string {
+  const std::lock_guard<std::mutex> lock(_raw_content_mutex);
+  if (!_raw_content_valid && _bootstrap_file) {
+    try {
+      if (_bootstrap_file->meta().content_type == "application/x-gzip") {
+        _raw_content = gzip::decompress(_bootstrap_file->buffer(), _bootstrap_file->length());
+      } else {
+        _raw_content = std::string(_bootstrap_file->buffer(), _bootstrap_file->length());
+      }
+    } catch (const std::exception &ex) {
+      spdlog::warn("Could not decompress service announcement: {}", ex.what());
+      _raw_content.clear();
+    }
+    _raw_content_valid = true;
+  }
+  return _raw_content;
+}
+
+auto
+MBMS_RT::ServiceAnnouncement::_parseBootstrap(GMimeStream *stream,
+                                              std::chrono::steady_clock::time_point received_at) -> void {
   std::string bootstrap_format = ServiceAnnouncementFormatConstants::DEFAULT;
   _cfg.lookupValue("mw.bootstrap_format", bootstrap_format);
 
-  // Add all the SA items including their content to _items
-  _addServiceAnnouncementItems(str);
+  // Update the item table from the SA parts
+  _update_stats.changed_items = _addServiceAnnouncementItems(stream);
+  _update_stats.services_processed = 0;
+  _update_stats.services_unchanged = 0;
 
   // Parse MBMS envelope: <metadataEnvelope>
   for (const auto &item: _items) {
@@ -112,25 +188,44 @@ MBMS_RT::ServiceAnnouncement::parse_bootstrap(const std::string &str) -> void {
       _handleMbmbsUserServiceDescriptionBundle(item, bootstrap_format);
     }
   }
+
+  _update_stats.updates++;
+  _update_stats.latency_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - received_at).count();
+  spdlog::info("Service announcement update: {} items changed, {} services set up, {} unchanged, {} ms",
+               _update_stats.changed_items, _update_stats.services_processed, _update_stats.services_unchanged,
+               _update_stats.latency_ms);
 }
 
 /**
- * Iterates through the service announcement file and adds the different sections/items to the the list of _items
+ * @param {std::string} uri
+ * @return The SA item with this Content-Location, nullptr if there is none
+ */
+auto MBMS_RT::ServiceAnnouncement::_findItem(const std::string &uri) const -> const Item * {
+  auto it = _item_index.find(uri);
+  return it == _item_index.end() ? nullptr : &_items[it->second];
+}
+
+/**
+ * Iterates through the service announcement file and replaces _items with its sections/items. Envelope
+ * metadata of items that are still present is kept until the new envelope is parsed.
  * @param {std::string} str
+ * @return The number of items that were added, removed or changed
  */
-void MBMS_RT::ServiceAnnouncement::_addServiceAnnouncementItems(const std::string &str) {
-  g_mime_init();
-  auto stream = g_mime_stream_mem_new_with_buffer(str.c_str(), str.length());
+unsigned MBMS_RT::ServiceAnnouncement::_addServiceAnnouncementItems(GMimeStream *stream) {
   auto parser = g_mime_parser_new_with_stream(stream);
-  g_object_unref(stream);
-
   auto mpart = g_mime_parser_construct_part(parser, nullptr);
   g_object_unref(parser);
+  if (mpart == nullptr) {
+    spdlog::warn("Service announcement is not a valid multipart");
+    return 0;
+  }
 
+  std::vector<Item> items;
+  unsigned changed = 0;
   auto iter = g_mime_part_iter_new(mpart);
   do {
     GMimeObject *current = g_mime_part_iter_get_current(iter);
-    GMimeObject *parent = g_mime_part_iter_get_parent(iter);
 
     if (GMIME_IS_PART (current)) {
       auto type = std::string(g_mime_content_type_get_mime_type(g_mime_object_get_content_type(current)));
@@ -138,24 +233,47 @@ void MBMS_RT::ServiceAnnouncement::_addServiceAnnouncementItems(const std::strin
       if (g_mime_object_get_header(current, "Content-Location")) {
         location = std::string(g_mime_object_get_header(current, "Content-Location"));
       }
-      auto options = g_mime_format_options_new();
-      g_mime_format_options_add_hidden_header(options, "Content-Type");
-      g_mime_format_options_add_hidden_header(options, "Content-Transfer-Encoding");
-      g_mime_format_options_add_hidden_header(options, "Content-Location");
-      std::string content = g_mime_object_to_string(current, options);
-      boost::algorithm::trim_left(content);
-
-      if (location != "") {
-        _items.emplace_back(Item{
-            type,
-            location,
-            0, 0, 0,
-            content
-        });
+
+      auto wrapper = g_mime_part_get_content(GMIME_PART(current));
+      if (location != "" && wrapper != nullptr) {
+        // Decode the part body (transfer encoding included) into one buffer and take it over as the item content
+        auto body = g_mime_stream_mem_new();
+        g_mime_data_wrapper_write_to_stream(wrapper, body);
+        auto bytes = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(body));
+        std::string content(reinterpret_cast<const char *>(bytes->data), bytes->len);
+        g_object_unref(body);
+        boost::algorithm::trim_left(content);
+
+        Item item{type, location, 0, 0, 0, std::move(content), 0};
+        item.content_hash = std::hash<std::string>{}(item.content);
+        auto known = _findItem(location);
+        if (known) {
+          item.valid_from = known->valid_from;
+          item.valid_until = known->valid_until;
+          item.version = known->version;
+        }
+        if (!known || known->content_hash != item.content_hash || known->content_type != item.content_type) {
+          changed++;
+        }
+        items.push_back(std::move(item));
       }
     }
   } while (g_mime_part_iter_next(iter));
+  g_mime_part_iter_free(iter);
+  g_object_unref(mpart);
 
+  std::unordered_map<std::string, size_t> index;
+  for (size_t i = 0; i < items.size(); i++) {
+    index[items[i].uri] = i;
+  }
+  for (const auto &item: _items) {
+    if (index.find(item.uri) == index.end()) {
+      changed++;
+    }
+  }
+  _items = std::move(items);
+  _item_index = std::move(index);
+  return changed;
 }
 
 /**
@@ -167,28 +285,96 @@ void MBMS_RT::ServiceAnnouncement::_handleMbmsEnvelope(const MBMS_RT::ServiceAnn
     tinyxml2::XMLDocument doc;
     doc.Parse(item.content.c_str());
     auto envelope = doc.FirstChildElement(ServiceAnnouncementXmlElements::METADATA_ENVELOPE);
+    if (envelope == nullptr) {
+      spdlog::warn("MBMS envelope {} has no metadataEnvelope element", item.uri);
+      return;
+    }
     for (auto *i = envelope->FirstChildElement(ServiceAnnouncementXmlElements::ITEM);
          i != nullptr; i = i->NextSiblingElement(ServiceAnnouncementXmlElements::ITEM)) {
-      spdlog::debug("uri: {}", i->Attribute(ServiceAnnouncementXmlElements::METADATA_URI));
-      for (auto &ir: _items) {
-        if (ir.uri == i->Attribute(ServiceAnnouncementXmlElements::METADATA_URI)) {
-          std::stringstream ss_from(i->Attribute(ServiceAnnouncementXmlElements::VALID_FROM));
-          struct std::tm from;
-          ss_from >> std::get_time(&from, "%Y-%m-%dT%H:%M:%S.%fZ");
-          ir.valid_from = mktime(&from);
-          std::stringstream ss_until(i->Attribute(ServiceAnnouncementXmlElements::VALID_UNTIL));
-          struct std::tm until;
-          ss_until >> std::get_time(&until, "%Y-%m-%dT%H:%M:%S.%fZ");
-          ir.valid_until = mktime(&until);
-          ir.version = atoi(i->Attribute(ServiceAnnouncementXmlElements::VERSION));
-        }
+      auto metadata_uri = i->Attribute(ServiceAnnouncementXmlElements::METADATA_URI);
+      if (metadata_uri == nullptr) {
+        continue;
+      }
+      spdlog::debug("uri: {}", metadata_uri);
+      auto it = _item_index.find(metadata_uri);
+      if (it == _item_index.end()) {
+        continue;
+      }
+      auto &ir = _items[it->second];
+      if (auto valid_from = i->Attribute(ServiceAnnouncementXmlElements::VALID_FROM)) {
+        std::stringstream ss_from(valid_from);
+        struct std::tm from = {};
+        ss_from >> std::get_time(&from, "%Y-%m-%dT%H:%M:%S.%fZ");
+        ir.valid_from = mktime(&from);
       }
+      if (auto valid_until = i->Attribute(ServiceAnnouncementXmlElements::VALID_UNTIL)) {
+        std::stringstream ss_until(valid_until);
+        struct std::tm until = {};
+        ss_until >> std::get_time(&until, "%Y-%m-%dT%H:%M:%S.%fZ");
+        ir.valid_until = mktime(&until);
+      }
+      ir.version = i->UnsignedAttribute(ServiceAnnouncementXmlElements::VERSION);
     }
   } catch (std::exception e) {
     spdlog::warn("MBMS envelope parsing failed: {}", e.what());
   }
 }
 
+/**
+ * Fingerprint of a USD and the version and content of every SA fragment it references, so
+ * unchanged services can be skipped when a new SA version arrives
+ * @param usd
+ * @return
+ */
+auto MBMS_RT::ServiceAnnouncement::_usdFingerprint(tinyxml2::XMLElement *usd) const -> size_t {
+  tinyxml2::XMLPrinter printer(nullptr, true);
+  usd->Accept(&printer);
+  size_t fingerprint = std::hash<std::string>{}(printer.CStr());
+
+  std::set<std::string> references;
+  _collectReferences(usd, references);
+  for (const auto &uri: references) {
+    auto item = _findItem(uri);
+    boost::hash_combine(fingerprint, uri);
+    boost::hash_combine(fingerprint, item ? item->content_hash : 0);
+    boost::hash_combine(fingerprint, item ? item->version : 0);
+  }
+  return fingerprint;
+}
+
+/**
+ * Collects the attribute values and texts below element that name SA items. Session descriptions
+ * are also taken to reference the manifest next to them, as the setup functions assume.
+ * @param element
+ * @param uris
+ */
+void MBMS_RT::ServiceAnnouncement::_collectReferences(const tinyxml2::XMLElement *element,
+                                                      std::set<std::string> &uris) const {
+  auto add = [&](const std::string &value) {
+    if (_findItem(value)) {
+      uris.insert(value);
+    }
+    auto ext = value.rfind(".sdp");
+    if (ext != std::string::npos && ext + 4 == value.size()) {
+      for (const auto &manifest: {".m3u8", ".mpd"}) {
+        auto manifest_url = value.substr(0, ext) + manifest;
+        if (_findItem(manifest_url)) {
+          uris.insert(manifest_url);
+        }
+      }
+    }
+  };
+  for (auto attribute = element->FirstAttribute(); attribute != nullptr; attribute = attribute->Next()) {
+    add(attribute->Value());
+  }
+  if (element->GetText()) {
+    add(element->GetText());
+  }
+  for (auto child = element->FirstChildElement(); child != nullptr; child = child->NextSiblingElement()) {
+    _collectReferences(child, uris);
+  }
+}
+
 /**
  * Parses the MBMS USD
  * @param {MBMS_RT::ServiceAnnouncement::Item} item
@@ -205,8 +391,22 @@ MBMS_RT::ServiceAnnouncement::_handleMbmbsUserServiceDescriptionBundle(const MBM
          usd != nullptr;
          usd = usd->NextSiblingElement(ServiceAnnouncementXmlElements::USER_SERVICE_DESCRIPTION)) {
 
-      // Create a new service
       auto service_id = usd->Attribute(ServiceAnnouncementXmlElements::SERVICE_ID);
+      if (service_id == nullptr) {
+        continue;
+      }
+
+      // Leave services alone, streams included, if neither their USD nor any fragment it refers to changed
+      auto fingerprint = _usdFingerprint(usd);
+      auto known = _service_fingerprints.find(service_id);
+      if (known != _service_fingerprints.end() && known->second == fingerprint && _get_service(service_id)) {
+        _update_stats.services_unchanged++;
+        continue;
+      }
+      _service_fingerprints[service_id] = fingerprint;
+      _update_stats.services_processed++;
+
+      // Create a new service
       auto[service, is_new_service] = _registerService(usd, service_id);
 
       // Handle the app service element. Will read the master manifest as provided in the SA
@@ -276,24 +476,37 @@ void MBMS_RT::ServiceAnnouncement::_handleAppService(tinyxml2::XMLElement *app_s
 
   // Now search for the content that corresponds to appServiceDescriptionURI. For instance appServiceDescriptionURI="http://localhost/watchfolder/manifest.m3u8"
   // The attribute appServiceDescriptionURI of r12:appService references an Application Service Description which may be a Media Presentation Description fragment corresponding to a unified MPD.
-  for (const auto &item: _items) {
-    // item.uri is derived from the Content-Location of each entry in the bootstrap file. For HLS we are looking for the content of the master manifest in the bootstrap file:
-    if (item.uri == app_service->Attribute(ServiceAnnouncementXmlElements::APP_SERVICE_DESCRIPTION_URI)) {
-      web::uri uri(item.uri);
-
-      // remove file, leave only dir
-      const std::string &path = uri.path();
-      size_t spos = path.rfind('/');
-      auto base_path = path.substr(0, spos + 1);
-
-      // make relative path: remove leading /
-      if (base_path[0] == '/') {
-        base_path.erase(0, 1);
-      }
-      service->read_master_manifest(item.content, base_path);
-      _base_path = base_path;
+  // item.uri is derived from the Content-Location of each entry in the bootstrap file. For HLS we are looking for the content of the master manifest in the bootstrap file:
+  auto description_uri = app_service->Attribute(ServiceAnnouncementXmlElements::APP_SERVICE_DESCRIPTION_URI);
+  auto item = description_uri ? _findItem(description_uri) : nullptr;
+  if (item != nullptr) {
+    web::uri uri(item->uri);
+
+    // remove file, leave only dir
+    const std::string &path = uri.path();
+    size_t spos = path.rfind('/');
+    auto base_path = path.substr(0, spos + 1);
+
+    // make relative path: remove leading /
+    if (base_path[0] == '/') {
+      base_path.erase(0, 1);
     }
+    service->read_master_manifest(item->content, base_path);
+    _base_path = base_path;
+  }
+}
+
+std::shared_ptr<MBMS_RT::SeamlessContentStream>
+MBMS_RT::ServiceAnnouncement::_createSeamlessContentStream(const std::string &base,
+                                                           const std::shared_ptr<MBMS_RT::Service> &service) {
+  if (service->delivery_protocol() == DeliveryProtocol::DASH) {
+    return std::make_shared<DashSeamlessContentStream>(base, _iface, _io_service, _cache,
+                                                       service->delivery_protocol(), _cfg, _prefetch, _fetch_engine,
+                                                       _retention);
   }
+  return std::make_shared<SeamlessContentStream>(base, _iface, _io_service, _cache,
+                                                 service->delivery_protocol(), _cfg, _prefetch, _fetch_engine,
+                                                 _retention);
 }
 
 void MBMS_RT::ServiceAnnouncement::_setupBy5GMagConfig(tinyxml2::XMLElement *app_service,
@@ -322,21 +535,18 @@ void MBMS_RT::ServiceAnnouncement::_setupBy5GMagConfig(tinyxml2::XMLElement *app
         // create a content stream
         std::shared_ptr<ContentStream> cs;
         if (_seamless) {
-          cs = std::make_shared<SeamlessContentStream>(broadcast_url, _iface, _io_service, _cache,
-                                                       service->delivery_protocol(), _cfg);
+          cs = _createSeamlessContentStream(broadcast_url, service);
         } else {
           cs = std::make_shared<ContentStream>(broadcast_url, _iface, _io_service, _cache, service->delivery_protocol(),
                                                _cfg);
         }
 
-        for (const auto &item: _items) {
-          if (item.uri == manifest_url) {
-            cs->read_master_manifest(item.content);
-          }
-          if (item.content_type == ContentTypeConstants::SDP &&
-              item.uri == sdp_uri) {
-            cs->configure_5gbc_delivery_from_sdp(item.content);
-          }
+        if (auto manifest = _findItem(manifest_url)) {
+          cs->read_master_manifest(manifest->content);
+        }
+        auto sdp = _findItem(sdp_uri);
+        if (sdp && sdp->content_type == ContentTypeConstants::SDP) {
+          cs->configure_5gbc_delivery_from_sdp(sdp->content);
         }
 
         broadcastContentStreams.push_back(cs);
@@ -383,12 +593,9 @@ void MBMS_RT::ServiceAnnouncement::_setupBy5GMagConfig(tinyxml2::XMLElement *app
             }
             // If we found a matching broadcast stream we add the CDN url to this one. Otherwise, we create a new SeamlessContentStream element
             if (broadcast_content_stream != nullptr && found_identical_element) {
-              broadcast_content_stream->set_cdn_endpoint(unicast_url);
+              broadcast_content_stream->add_cdn_endpoint(unicast_url);
             } else {
-              std::shared_ptr<SeamlessContentStream> cs = std::make_shared<SeamlessContentStream>(manifest_url, _iface,
-                                                                                                  _io_service, _cache,
-                                                                                                  service->delivery_protocol(),
-                                                                                                  _cfg);
+              std::shared_ptr<SeamlessContentStream> cs = _createSeamlessContentStream(manifest_url, service);
               cs->set_cdn_endpoint(unicast_url);
               unicastContentStreams.push_back(cs);
             }
@@ -440,21 +647,20 @@ void MBMS_RT::ServiceAnnouncement::_setupBy5GMagLegacyFormat(tinyxml2::XMLElemen
         std::string broadcast_url = base_pattern->GetText();
 
         // create a content stream if this is not a base pattern that points to file://
-        if (service->delivery_protocol() == DeliveryProtocol::DASH || (service->delivery_protocol() == DeliveryProtocol::HLS && broadcast_url.find("file://") == std::string::npos)) {
+        if (service->delivery_protocol() != DeliveryProtocol::HLS || broadcast_url.find("file://") == std::string::npos) {
 
           std::shared_ptr<ContentStream> cs;
           cs = std::make_shared<ContentStream>(broadcast_url, _iface, _io_service, _cache, service->delivery_protocol(),
                                                _cfg);
 
           cs->set_base_path(_base_path);
-          for (const auto &item: _items) {
-            if (item.uri == manifest_url && service->delivery_protocol() == DeliveryProtocol::HLS) {
-              cs->read_master_manifest(item.content);
-            }
-            if (item.content_type == ContentTypeConstants::SDP &&
-                item.uri == sdp_uri) {
-              cs->configure_5gbc_delivery_from_sdp(item.content);
-            }
+          auto manifest = _findItem(manifest_url);
+          if (manifest && service->delivery_protocol() == DeliveryProtocol::HLS) {
+            cs->read_master_manifest(manifest->content);
+          }
+          auto sdp = _findItem(sdp_uri);
+          if (sdp && sdp->content_type == ContentTypeConstants::SDP) {
+            cs->configure_5gbc_delivery_from_sdp(sdp->content);
           }
 
           broadcastContentStreams.push_back(cs);
@@ -491,8 +697,7 @@ void MBMS_RT::ServiceAnnouncement::_setupByAlternativeContentElement(tinyxml2::X
       // create a content stream
       std::shared_ptr<ContentStream> cs;
       if (_seamless) {
-        cs = std::make_shared<SeamlessContentStream>(base, _iface, _io_service, _cache,
-                                                     service->delivery_protocol(), _cfg);
+        cs = _createSeamlessContentStream(base, service);
       } else {
         cs = std::make_shared<ContentStream>(base, _iface, _io_service, _cache, service->delivery_protocol(),
                                              _cfg);
@@ -511,14 +716,12 @@ void MBMS_RT::ServiceAnnouncement::_setupByAlternativeContentElement(tinyxml2::X
             ServiceAnnouncementXmlElements::BASE_PATTERN)->GetText();
 
         if (broadcast_base_pattern == base) {
-          for (const auto &item: _items) {
-            if (item.uri == broadcast_base_pattern) {
-              cs->read_master_manifest(item.content);
-            }
-            if (item.content_type == ContentTypeConstants::SDP &&
-                item.uri == sdp_uri) {
-              broadcast_delivery_available = cs->configure_5gbc_delivery_from_sdp(item.content);
-            }
+          if (auto manifest = _findItem(broadcast_base_pattern)) {
+            cs->read_master_manifest(manifest->content);
+          }
+          auto sdp = _findItem(sdp_uri);
+          if (sdp && sdp->content_type == ContentTypeConstants::SDP) {
+            broadcast_delivery_available = cs->configure_5gbc_delivery_from_sdp(sdp->content);
           }
         }
       }
@@ -539,7 +742,7 @@ void MBMS_RT::ServiceAnnouncement::_setupByAlternativeContentElement(tinyxml2::X
                    ServiceAnnouncementXmlElements::IDENTICAL_CONTENT)) {
 
             bool base_matched = false;
-            std::string found_identical_base;
+            std::vector<std::string> found_identical_bases;
             for (auto *base_pattern = identical_content->FirstChildElement(
                 ServiceAnnouncementXmlElements::BASE_PATTERN);
                  base_pattern != nullptr;
@@ -548,12 +751,15 @@ void MBMS_RT::ServiceAnnouncement::_setupByAlternativeContentElement(tinyxml2::X
               if (base == identical_base) {
                 base_matched = true;
               } else {
-                found_identical_base = identical_base;
+                found_identical_bases.push_back(identical_base);
               }
             }
 
-            if (base_matched && found_identical_base.length()) {
-              std::dynamic_pointer_cast<SeamlessContentStream>(cs)->set_cdn_endpoint(found_identical_base);
+            if (base_matched) {
+              // Every other base pattern is an identical unicast copy, usable as an alternative origin
+              for (const auto& identical_base : found_identical_bases) {
+                std::dynamic_pointer_cast<SeamlessContentStream>(cs)->add_cdn_endpoint(identical_base);
+              }
             }
           }
         }
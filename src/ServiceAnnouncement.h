@@ -17,18 +17,30 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <libconfig.h++>
 #include <tinyxml2.h>
+#include "gmime/gmime.h"
 #include "cpprest/http_client.h"
 #include "File.h"
-#include "Receiver.h"
+#include "multicast/MulticastReceiver.h"
 #include "Service.h"
 #include "CacheManagement.h"
+#include "seamless/PrefetchScheduler.h"
+#include "seamless/FetchEngine.h"
+#include "seamless/RetentionBudget.h"
 #include "Constants.h"
 
 namespace MBMS_RT {
+  class SeamlessContentStream;
+
   class ServiceAnnouncement {
   public:
     typedef std::function<std::shared_ptr<Service>(const std::string &service_id)> get_service_callback_t;
@@ -37,7 +49,8 @@ namespace MBMS_RT {
     ServiceAnnouncement(const libconfig::Config &cfg, std::string tmgi, const std::string &mcast,
                         unsigned long long tsi,
                         std::string iface, boost::asio::io_service &io_service, CacheManagement &cache,
-                        bool seamless_switching,
+                        bool seamless_switching, std::shared_ptr<PrefetchScheduler> prefetch,
+                        std::shared_ptr<FetchEngine> fetch_engine, std::shared_ptr<RetentionBudget> retention,
                         get_service_callback_t get_service, set_service_callback_t set_service);
 
     virtual ~ServiceAnnouncement();
@@ -49,46 +62,108 @@ namespace MBMS_RT {
       time_t valid_until;
       unsigned version;
       std::string content;
+      size_t content_hash;
     };
 
     const std::vector<Item> &items() const { return _items; };
 
-    const std::string &content() const { return _raw_content; };
+    struct UpdateStats {
+      uint64_t updates;                 // bootstrap versions processed
+      unsigned changed_items;           // items added, removed or changed by the last update
+      unsigned services_processed;      // services (re)configured by the last update
+      unsigned services_unchanged;      // services skipped by the last update
+      int64_t latency_ms;               // from reception to completion of the last update
+    };
+    const UpdateStats &update_stats() const { return _update_stats; };
+
+    /**
+     * @return The (decompressed) bootstrap that was last parsed, received over FLUTE or passed in as a string
+     */
+    std::string content() const;
 
     uint32_t toi() const { return _toi; };
 
-    void parse_bootstrap(const std::string &str);
+    /**
+     * Parse a (new version of the) bootstrap multipart. Only services whose USD or referenced fragments
+     * changed since the last version are set up again.
+     * @param str
+     * @param received_at When the bootstrap was received, for the update latency
+     */
+    void parse_bootstrap(const std::string &str,
+                         std::chrono::steady_clock::time_point received_at = std::chrono::steady_clock::now());
+
+    /**
+     * Parse a bootstrap received over FLUTE straight from the file buffer, inflating gzip content on the fly
+     * @param file
+     * @param received_at When the bootstrap was received, for the update latency
+     */
+    void parse_bootstrap(const std::shared_ptr<LibFlute::File> &file,
+                         std::chrono::steady_clock::time_point received_at);
 
     void start_flute_receiver(const std::string &mcast_address);
 
+    /**
+     * Register a callback that is called after a bootstrap received over FLUTE has been parsed
+     */
+    void set_bootstrap_callback(std::function<void()> cb) { _bootstrap_cb = std::move(cb); };
+
+    const std::string &tmgi() const { return _tmgi; };
+
+    unsigned long long tsi() const { return _tsi; };
+
+    /**
+     * @return address:port of the FLUTE session, empty if no receiver was started
+     */
+    std::string multicast_address() const { return _mcast_addr.empty() ? "" : _mcast_addr + ":" + _mcast_port; };
+
   private:
 
     get_service_callback_t _get_service;
     set_service_callback_t _set_service;
+    std::function<void()> _bootstrap_cb;
 
     bool _seamless = false;
 
     std::vector<Item> _items;
+    std::unordered_map<std::string, size_t> _item_index;    // uri -> position in _items
+    std::map<std::string, size_t> _service_fingerprints;    // service id -> USD and referenced fragments
+    UpdateStats _update_stats = {};
 
     const libconfig::Config &_cfg;
 
     bool _bootstrapped = false;
 
     uint32_t _toi = {};
-    std::string _raw_content;
+    std::shared_ptr<LibFlute::File> _bootstrap_file;
+    mutable std::mutex _raw_content_mutex;
+    mutable std::string _raw_content;     // inflated on demand from _bootstrap_file, if set
+    mutable bool _raw_content_valid = false;
     std::string _iface;
     std::string _tmgi;
     std::string _mcast_addr;
     std::string _mcast_port;
     std::string _base_path;
     unsigned long long _tsi = 0;
-    std::thread _flute_thread;
-    std::unique_ptr<LibFlute::Receiver> _flute_receiver;
+    std::shared_ptr<MulticastReceiver> _multicast_receiver;
+    std::shared_ptr<FluteSessionDecoder> _flute_session;
 
     boost::asio::io_service &_io_service;
+    // Bootstrap updates are parsed on this strand, ordered with respect to each other
+    boost::asio::io_service::strand _strand;
     CacheManagement &_cache;
+    std::shared_ptr<PrefetchScheduler> _prefetch;
+    std::shared_ptr<FetchEngine> _fetch_engine;
+    std::shared_ptr<RetentionBudget> _retention;
+
+    const Item *_findItem(const std::string &uri) const;
+
+    void _parseBootstrap(GMimeStream *stream, std::chrono::steady_clock::time_point received_at);
 
-    void _addServiceAnnouncementItems(const std::string &str);
+    unsigned _addServiceAnnouncementItems(GMimeStream *stream);
+
+    size_t _usdFingerprint(tinyxml2::XMLElement *usd) const;
+
+    void _collectReferences(const tinyxml2::XMLElement *element, std::set<std::string> &uris) const;
 
     void _handleMbmsEnvelope(const Item &item);
 
@@ -101,6 +176,12 @@ namespace MBMS_RT {
 
     bool _setupBroadcastDelivery(tinyxml2::XMLElement *usd, std::string base, std::shared_ptr<ContentStream> cs);
 
+    /**
+     *  Create the seamless switching stream matching the delivery protocol of the service
+     */
+    std::shared_ptr<SeamlessContentStream> _createSeamlessContentStream(const std::string &base,
+                                                                        const std::shared_ptr<Service> &service);
+
     void
     _setupByAlternativeContentElement(tinyxml2::XMLElement *app_service,
                                       const std::shared_ptr<MBMS_RT::Service> &service,
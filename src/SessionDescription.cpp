@@ -0,0 +1,132 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "SessionDescription.h"
+#include "HlsParsing.h"
+
+using namespace MBMS_RT::HlsParsing;
+
+namespace {
+  /**
+   *  Split the next space separated token off the front of sv
+   */
+  auto next_token(std::string_view& sv) -> std::string_view
+  {
+    sv = trim(sv);
+    auto pos = sv.find(' ');
+    auto token = sv.substr(0, pos);
+    sv.remove_prefix(pos == std::string_view::npos ? sv.size() : pos + 1);
+    return token;
+  }
+
+  /**
+   *  Strip a "/ttl" or "/count" suffix
+   */
+  auto before_slash(std::string_view sv) -> std::string_view
+  {
+    return sv.substr(0, sv.find('/'));
+  }
+}
+
+MBMS_RT::SessionDescription::SessionDescription(std::string_view sdp)
+{
+  std::string_view line;
+  while (next_line(sdp, line)) {
+    if (line.size() < 2 || line[1] != '=') {
+      continue;
+    }
+    auto value = line.substr(2);
+    switch (line[0]) {
+      case 'c': parse_connection(value); break;
+      case 'm': parse_media(value); break;
+      case 'a': parse_attribute(value); break;
+      case 'b':
+        if (starts_with(value, "AS:")) {
+          _bandwidth_kbps = to_integer<unsigned>(value.substr(3));
+        }
+        break;
+      default: break;
+    }
+  }
+}
+
+auto MBMS_RT::SessionDescription::parse_connection(std::string_view value) -> void
+{
+  // c=IN IP4 233.252.0.1/64
+  if (next_token(value) != "IN" || next_token(value) != "IP4") {
+    return;
+  }
+  auto address = before_slash(next_token(value));
+  if (!address.empty()) {
+    _connection_address = std::string(address);
+  }
+}
+
+auto MBMS_RT::SessionDescription::parse_media(std::string_view value) -> void
+{
+  // m=application 40085 FLUTE/UDP 0
+  // m=video 5004 RTP/AVP 33
+  auto media = next_token(value);
+  auto port = to_integer<unsigned short>(before_slash(next_token(value)));
+  auto protocol = next_token(value);
+  if (media != "application" && protocol.substr(0, 4) != "RTP/") {
+    return;
+  }
+  if (protocol.substr(0, 4) == "RTP/" && _protocol.rfind("RTP/", 0) == 0) {
+    return;   // only the first RTP media stream is relayed
+  }
+  _port = port;
+  _protocol = std::string(protocol);
+}
+
+auto MBMS_RT::SessionDescription::parse_attribute(std::string_view value) -> void
+{
+  auto name = value.substr(0, value.find(':'));
+  auto attr = tag_value(value);
+  if (name == "flute-tsi") {
+    _flute_tsi = to_integer<uint64_t>(trim(attr));
+  } else if (name == "source-filter") {
+    // a=source-filter: incl IN IP4 <destination> <source>
+    if (next_token(attr) == "incl" && next_token(attr) == "IN" && next_token(attr) == "IP4") {
+      next_token(attr);
+      _source_address = std::string(next_token(attr));
+    }
+  } else if (name == "FEC-declaration") {
+    // a=FEC-declaration:0 encoding-id=1; instance-id=0
+    FecDeclaration fec{to_integer<unsigned>(next_token(attr)), 0, 0};
+    while (!attr.empty()) {
+      auto semicolon = attr.find(';');
+      auto param = trim(attr.substr(0, semicolon));
+      attr.remove_prefix(semicolon == std::string_view::npos ? attr.size() : semicolon + 1);
+      auto eq = param.find('=');
+      if (eq == std::string_view::npos) {
+        continue;
+      }
+      auto key = param.substr(0, eq);
+      auto val = param.substr(eq + 1);
+      if (key == "encoding-id") {
+        fec.encoding_id = to_integer<unsigned>(val);
+      } else if (key == "instance-id" || key == "fec-inst-id") {
+        fec.instance_id = to_integer<unsigned>(val);
+      }
+    }
+    _fec_declarations.push_back(fec);
+  } else if (name == "FEC" || name == "FEC-declaration-ref") {
+    _fec_reference = to_integer<int>(trim(attr));
+  }
+}
@@ -0,0 +1,71 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   *  The parts of an SDP (RFC 4566, TS 26.346 7.3) needed to receive a FLUTE or RTP session, parsed
+   *  in a single pass without regular expressions.
+   */
+  class SessionDescription {
+    public:
+      SessionDescription(std::string_view sdp);
+      SessionDescription() = default;
+      ~SessionDescription() = default;
+
+      struct FecDeclaration {
+        unsigned reference;       // the number referred to by a=FEC
+        unsigned encoding_id;
+        unsigned instance_id;
+      };
+
+      /**
+       *  @return true if the description contains a connection address and a media port
+       */
+      bool complete() const { return !_connection_address.empty() && _port != 0; };
+
+      const std::string& connection_address() const { return _connection_address; };
+      const std::string& source_address() const { return _source_address; };
+      unsigned short port() const { return _port; };
+      const std::string& protocol() const { return _protocol; };
+      uint64_t flute_tsi() const { return _flute_tsi; };
+      unsigned bandwidth_kbps() const { return _bandwidth_kbps; };
+      const std::vector<FecDeclaration>& fec_declarations() const { return _fec_declarations; };
+      int fec_reference() const { return _fec_reference; };
+
+    private:
+      void parse_connection(std::string_view value);
+      void parse_media(std::string_view value);
+      void parse_attribute(std::string_view value);
+
+      std::string _connection_address;
+      std::string _source_address;
+      unsigned short _port = 0;
+      std::string _protocol;
+      uint64_t _flute_tsi = 0;
+      unsigned _bandwidth_kbps = 0;
+      std::vector<FecDeclaration> _fec_declarations;
+      int _fec_reference = -1;
+  };
+}
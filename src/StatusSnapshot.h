@@ -0,0 +1,126 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   *  A pre-serialised status document of the HTTP API with a version that only changes with its content.
+   *
+   *  The document is rebuilt by the middleware tick and read by the HTTP worker threads, which can also
+   *  wait for the next version (long-polling). Waiters are completed from notify().
+   *
+   *  Doc must be comparable with ==, so rebuilding an unchanged document keeps its version.
+   */
+  template <typename Doc>
+  class StatusSnapshot {
+    public:
+      struct View {
+        std::shared_ptr<const Doc> doc;   /**< nullptr until the first update */
+        uint64_t version;
+      };
+
+      /**
+       *  Called with the current view, and whether its version differs from the one waited on
+       */
+      using Waiter = std::function<void(const View& view, bool changed)>;
+
+      View view() const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        return { _doc, _version };
+      };
+
+      /**
+       *  Replace the document. The version is bumped if the content differs.
+       *
+       *  @return Whether the document changed
+       */
+      bool update(Doc doc) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        if (_doc && *_doc == doc) {
+          return false;
+        }
+        _doc = std::make_shared<const Doc>(std::move(doc));
+        _version++;
+        return true;
+      };
+
+      /**
+       *  Call waiter from notify() once the version differs from version or the deadline has passed,
+       *  or right away if it already differs.
+       */
+      void wait(uint64_t version, std::chrono::steady_clock::time_point deadline, Waiter waiter) {
+        View current;
+        {
+          const std::lock_guard<std::mutex> lock(_mutex);
+          if (version == _version) {
+            _waiters.push_back({ version, deadline, std::move(waiter) });
+            return;
+          }
+          current = { _doc, _version };
+        }
+        waiter(current, true);
+      };
+
+      void notify() {
+        std::vector<std::pair<Waiter, bool>> ready;
+        View current;
+        auto now = std::chrono::steady_clock::now();
+        {
+          const std::lock_guard<std::mutex> lock(_mutex);
+          current = { _doc, _version };
+          for (auto it = _waiters.begin(); it != _waiters.end();) {
+            bool changed = it->version != _version;
+            if (changed || it->deadline <= now) {
+              ready.emplace_back(std::move(it->waiter), changed);
+              it = _waiters.erase(it);
+            } else {
+              ++it;
+            }
+          }
+        }
+        // Replies are sent outside the lock, a waiter may queue itself again
+        for (auto& [waiter, changed] : ready) {
+          waiter(current, changed);
+        }
+      };
+
+      size_t waiting() const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        return _waiters.size();
+      };
+
+    private:
+      struct Waiting {
+        uint64_t version;
+        std::chrono::steady_clock::time_point deadline;
+        Waiter waiter;
+      };
+
+      mutable std::mutex _mutex;
+      std::shared_ptr<const Doc> _doc;
+      uint64_t _version = 0;
+      std::vector<Waiting> _waiters;
+  };
+}
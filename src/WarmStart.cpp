@@ -0,0 +1,168 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "WarmStart.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cpprest/json.h"
+#include "spdlog/spdlog.h"
+
+static constexpr const char* SERVICE_ANNOUNCEMENT_FILE = "service_announcement";
+static constexpr const char* TOPOLOGY_FILE = "topology.json";
+
+MBMS_RT::WarmStart::WarmStart(const libconfig::Config& cfg)
+{
+  cfg.lookupValue("mw.warm_restart.enabled", _enabled);
+  if (!_enabled) {
+    return;
+  }
+  cfg.lookupValue("mw.warm_restart.path", _path);
+  cfg.lookupValue("mw.warm_restart.max_age", _max_age);
+  std::error_code ec;
+  std::filesystem::create_directories(_path, ec);
+  if (ec) {
+    spdlog::error("Warm restart disabled, cannot create {}: {}", _path, ec.message());
+    _enabled = false;
+  }
+}
+
+auto MBMS_RT::WarmStart::write_atomically(const std::string& name, const std::string& content) const -> bool
+{
+  // A crash while saving leaves the previous version in place
+  auto path = _path + "/" + name;
+  auto tmp_path = path + ".tmp";
+  auto fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    spdlog::warn("Warm restart cannot write {}", tmp_path);
+    return false;
+  }
+  bool written = write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()) &&
+    fsync(fd) == 0;
+  close(fd);
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    spdlog::warn("Warm restart cannot write {}", path);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+auto MBMS_RT::WarmStart::expired(const std::string& name) const -> bool
+{
+  std::error_code ec;
+  auto modified = std::filesystem::last_write_time(_path + "/" + name, ec);
+  if (ec) {
+    return true;
+  }
+  return std::filesystem::file_time_type::clock::now() - modified > std::chrono::seconds(_max_age);
+}
+
+auto MBMS_RT::WarmStart::save_service_announcement(const ServiceAnnouncementState& state) -> void
+{
+  if (!_enabled || state.content.empty()) {
+    return;
+  }
+  // One header line, then the bootstrap as received
+  std::string content = state.tmgi + " " + (state.mcast.empty() ? "-" : state.mcast) + " " +
+    std::to_string(state.tsi) + " " + std::to_string(time(nullptr)) + "\n";
+  content += state.content;
+  if (write_atomically(SERVICE_ANNOUNCEMENT_FILE, content)) {
+    spdlog::debug("Warm restart saved the service announcement of TMGI {}", state.tmgi);
+  }
+}
+
+auto MBMS_RT::WarmStart::load_service_announcement(ServiceAnnouncementState& state) const -> bool
+{
+  if (!_enabled || expired(SERVICE_ANNOUNCEMENT_FILE)) {
+    return false;
+  }
+  std::ifstream ifs(_path + "/" + SERVICE_ANNOUNCEMENT_FILE, std::ios::binary);
+  std::string header;
+  if (!std::getline(ifs, header)) {
+    return false;
+  }
+  std::istringstream fields(header);
+  if (!(fields >> state.tmgi >> state.mcast >> state.tsi >> state.saved_at)) {
+    spdlog::warn("Warm restart ignoring damaged service announcement state");
+    return false;
+  }
+  if (state.mcast == "-") {
+    state.mcast.clear();
+  }
+  state.content.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  return !state.content.empty();
+}
+
+auto MBMS_RT::WarmStart::save_topology(const std::map<std::string, std::shared_ptr<Service>>& services) -> void
+{
+  if (!_enabled) {
+    return;
+  }
+  using web::json::value;
+  std::vector<value> service_list;
+  for (const auto& [id, service] : services) {
+    value s;
+    s["id"] = value(id);
+    s["protocol"] = value(service->delivery_protocol_string());
+    std::vector<value> streams;
+    for (const auto& stream : service->content_streams()) {
+      value cs;
+      cs["base"] = value(stream.second->base());
+      cs["type"] = value(stream.second->stream_type_string());
+      cs["playlist_path"] = value(stream.second->playlist_path());
+      cs["joined"] = value(stream.second->joined());
+      streams.push_back(cs);
+    }
+    s["streams"] = value::array(streams);
+    service_list.push_back(s);
+  }
+  value topology;
+  topology["services"] = value::array(service_list);
+  auto content = topology.serialize();
+  if (content != _last_topology && write_atomically(TOPOLOGY_FILE, content)) {
+    _last_topology = std::move(content);
+  }
+}
+
+auto MBMS_RT::WarmStart::load_joined_streams() const -> std::set<std::string>
+{
+  std::set<std::string> joined;
+  if (!_enabled || expired(TOPOLOGY_FILE)) {
+    return joined;
+  }
+  try {
+    std::ifstream ifs(_path + "/" + TOPOLOGY_FILE);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    auto topology = web::json::value::parse(content);
+    for (const auto& service : topology.at("services").as_array()) {
+      for (const auto& stream : service.at("streams").as_array()) {
+        if (stream.at("joined").as_bool()) {
+          joined.insert(stream_key(service.at("id").as_string(), stream.at("base").as_string()));
+        }
+      }
+    }
+  } catch (const std::exception& ex) {
+    spdlog::warn("Warm restart ignoring damaged topology state: {}", ex.what());
+  }
+  return joined;
+}
@@ -0,0 +1,81 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <libconfig.h++>
+#include "Service.h"
+
+namespace MBMS_RT {
+  /**
+   *  State persisted across restarts, so services can be offered again before the modem reports the
+   *  service announcement and its next carousel arrives.
+   *
+   *  Keeps the last bootstrap received over FLUTE with the TMGI, multicast address and TSI it came
+   *  from, and the service / stream topology it produced. State older than max_age is ignored on boot.
+   *  The disk tier of the cache keeps its own index next to its data (mw.cache.disk). Configured in
+   *  mw.warm_restart.
+   */
+  class WarmStart {
+    public:
+      WarmStart(const libconfig::Config& cfg);
+      virtual ~WarmStart() = default;
+
+      bool enabled() const { return _enabled; };
+
+      struct ServiceAnnouncementState {
+        std::string tmgi;
+        std::string mcast;        // address:port, empty if the bootstrap was not received over FLUTE
+        unsigned long long tsi = 0;
+        std::string content;
+        time_t saved_at = 0;
+      };
+
+      /**
+       *  @return false if there is no service announcement, or it is older than max_age
+       */
+      bool load_service_announcement(ServiceAnnouncementState& state) const;
+      void save_service_announcement(const ServiceAnnouncementState& state);
+
+      /**
+       *  Save the topology if it changed since it was last saved
+       */
+      void save_topology(const std::map<std::string, std::shared_ptr<Service>>& services);
+
+      /**
+       *  @return "<service id> <stream base>" of every stream that was receiving when the topology was saved
+       */
+      std::set<std::string> load_joined_streams() const;
+
+      static std::string stream_key(const std::string& service_id, const std::string& base) {
+        return service_id + " " + base;
+      };
+
+    private:
+      bool write_atomically(const std::string& name, const std::string& content) const;
+      bool expired(const std::string& name) const;
+
+      bool _enabled = false;
+      std::string _path = "/var/lib/5gmag-rt";
+      unsigned _max_age = 3600;
+      std::string _last_topology;
+  };
+}
@@ -36,6 +36,7 @@
 
 #include "CasFrameProcessor.h"
 #include "Gw.h"
+#include "Logging.h"
 #include "SdrReader.h"
 #include "MbsfnFrameProcessor.h"
 #include "MeasurementFileWriter.h"
@@ -45,7 +46,6 @@
 #include "Version.h"
 #include "spdlog/async.h"
 #include "spdlog/spdlog.h"
-#include "spdlog/sinks/syslog_sink.h"
 #include "srsran/srsran.h"
 #include "srsran/upper/pdcp.h"
 #include "srsran/rlc/rlc.h"
@@ -270,13 +270,7 @@ auto main(int argc, char **argv) -> int {
 
   // Set up logging
   std::string ident = "modem";
-  auto syslog_logger = spdlog::syslog_logger_mt("syslog", ident, LOG_PID | LOG_PERROR | LOG_CONS );
-
-  spdlog::set_level(
-      static_cast<spdlog::level::level_enum>(arguments.log_level));
-  spdlog::set_pattern("[%H:%M:%S.%f %z] [%^%l%$] [thr %t] %v");
-
-  spdlog::set_default_logger(syslog_logger);
+  MBMS_RT::Logging::configure(cfg, ident, static_cast<spdlog::level::level_enum>(arguments.log_level));
   spdlog::info("5g-mag-rt modem v{}.{}.{} starting up", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
 
   // Init and tune the SDR
@@ -726,5 +720,7 @@ auto main(int argc, char **argv) -> int {
     delete( mbsfn_processors[i] );
   }
 exit:
+  // Write out what is still queued in the asynchronous loggers
+  spdlog::shutdown();
   return 0;
 }
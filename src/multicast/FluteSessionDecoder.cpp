@@ -0,0 +1,216 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "multicast/FluteSessionDecoder.h"
+#include "Logging.h"
+#include "AlcPacket.h"
+#include "EncodingSymbol.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "spdlog/spdlog.h"
+
+auto MBMS_RT::FluteSessionDecoder::handle_packet(char* data, size_t length) -> void {
+  std::shared_ptr<LibFlute::File> completed;
+  try {
+    auto alc = LibFlute::AlcPacket(data, length);
+    if (alc.tsi() != _tsi) {
+      return;
+    }
+    _counters->packets.fetch_add(1, std::memory_order_relaxed);
+
+    const std::lock_guard<std::mutex> lock(_files_mutex);
+    auto toi = alc.toi();
+    if (toi == 0 && (!_fdt || _fdt->instance_id() != alc.fdt_instance_id()) && _files.find(toi) == _files.end()) {
+      LibFlute::FileDeliveryTable::FileEntry fe{0, "", static_cast<uint32_t>(alc.fec_oti().transfer_length), "", "",
+                                                0, alc.fec_oti()};
+      _files.emplace(toi, std::make_shared<LibFlute::File>(fe));
+    }
+
+    auto it = _files.find(toi);
+    if (it == _files.end() || it->second->complete()) {
+      spdlog::trace("Discarding packet for unknown or already completed TOI {} on TSI {}", toi, _tsi);
+      return;
+    }
+
+    auto file = it->second;
+    if (toi != 0 && Tracer::instance().enabled() && _traces.find(toi) == _traces.end()) {
+      auto trace = Tracer::instance().begin(file->meta().content_location);
+      if (trace) {
+        trace->stamp(SegmentTrace::Stage::FirstPacket);
+      }
+      _traces.emplace(toi, std::move(trace));
+    }
+    auto symbols = LibFlute::EncodingSymbol::from_payload(data + alc.header_length(), length - alc.header_length(),
+                                                          file->fec_oti(), alc.content_encoding());
+    for (const auto& symbol : symbols) {
+      file->put_symbol(symbol);
+    }
+    if (!file->complete()) {
+      if (toi != 0 && file->fec_oti().encoding_id == 0 && alc.content_encoding() == LibFlute::ContentEncoding::NONE) {
+        auto& received = _received[toi];
+        for (const auto& symbol : symbols) {
+          uint64_t begin = 0;
+          uint64_t end = 0;
+          if (symbol_range(file->fec_oti(), symbol.source_block_number(), symbol.id(), begin, end)) {
+            received.add(begin, end);
+          }
+        }
+      }
+      return;
+    }
+    _received.erase(toi);
+
+    spdlog::debug("File with TOI {} on TSI {} completed", toi, _tsi);
+    if (toi == 0) {
+      // A complete FDT: start reception of all files it announces
+      _fdt = std::make_unique<LibFlute::FileDeliveryTable>(alc.fdt_instance_id(), file->buffer(), file->length());
+      _files.erase(it);
+      for (const auto& entry : _fdt->file_entries()) {
+        if (_files.find(entry.toi) == _files.end()) {
+          spdlog::debug("Starting reception for file with TOI {} on TSI {}", entry.toi, _tsi);
+          _files.emplace(entry.toi, std::make_shared<LibFlute::File>(entry));
+        }
+      }
+      return;
+    }
+
+    // A new version replaces older files at the same location
+    for (auto old = _files.begin(); old != _files.end();) {
+      if (old->second != file && old->second->meta().content_location == file->meta().content_location) {
+        if (!old->second->complete()) {
+          _counters->lost.fetch_add(1, std::memory_order_relaxed);
+        }
+        _received.erase(old->first);
+        _traces.erase(old->first);
+        old = _files.erase(old);
+      } else {
+        ++old;
+      }
+    }
+    auto trace = _traces.find(toi);
+    if (trace != _traces.end()) {
+      if (trace->second) {
+        trace->second->stamp(SegmentTrace::Stage::FluteComplete);
+      }
+      _traces.erase(trace);
+    }
+    _counters->completed.fetch_add(1, std::memory_order_relaxed);
+    _counters->completed_bytes.fetch_add(file->length(), std::memory_order_relaxed);
+    completed = std::move(file);
+  } catch (const std::exception& ex) {
+    _counters->decode_errors.fetch_add(1, std::memory_order_relaxed);
+    static Logging::RateLimitedLog decode_log(Logging::Category::Flute);
+    decode_log.warn("Failed to decode ALC/FLUTE packet on TSI {}: {}", _tsi, ex.what());
+    return;
+  }
+
+  if (completed && _completion_cb) {
+    _completion_cb(completed);
+  }
+}
+
+auto MBMS_RT::FluteSessionDecoder::file_list() -> std::vector<std::shared_ptr<LibFlute::File>> {
+  const std::lock_guard<std::mutex> lock(_files_mutex);
+  std::vector<std::shared_ptr<LibFlute::File>> files;
+  files.reserve(_files.size());
+  for (const auto& file : _files) {
+    files.push_back(file.second);
+  }
+  return files;
+}
+
+auto MBMS_RT::FluteSessionDecoder::partial_file(const std::string& content_location, ByteRanges& received,
+    std::vector<uint8_t>& data) -> bool {
+  const std::lock_guard<std::mutex> lock(_files_mutex);
+  for (const auto& file : _files) {
+    if (file.first != 0 && !file.second->complete() && file.second->meta().content_location == content_location) {
+      auto ranges = _received.find(file.first);
+      received = ranges == _received.end() ? ByteRanges() : ranges->second;
+      data.clear();
+      if (!received.empty()) {
+        data.resize(file.second->length());
+        memcpy(data.data(), file.second->buffer(), data.size());
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+auto MBMS_RT::FluteSessionDecoder::received_run(const std::string& content_location, uint64_t offset,
+    std::vector<uint8_t>& chunk, uint64_t& length) -> bool {
+  const std::lock_guard<std::mutex> lock(_files_mutex);
+  for (const auto& file : _files) {
+    if (file.first != 0 && !file.second->complete() && file.second->meta().content_location == content_location) {
+      auto ranges = _received.find(file.first);
+      if (ranges == _received.end()) {
+        return false;
+      }
+      length = file.second->length();
+      auto end = std::min(ranges->second.contiguous_end(offset), length);
+      chunk.clear();
+      if (end > offset) {
+        chunk.assign(file.second->buffer() + offset, file.second->buffer() + end);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+auto MBMS_RT::FluteSessionDecoder::remove_expired_files(unsigned max_age) -> void {
+  const std::lock_guard<std::mutex> lock(_files_mutex);
+  auto now = static_cast<unsigned long>(time(nullptr));
+  for (auto it = _files.begin(); it != _files.end();) {
+    if (it->second->received_at() + max_age < now) {
+      if (!it->second->complete()) {
+        _counters->lost.fetch_add(1, std::memory_order_relaxed);
+      }
+      _received.erase(it->first);
+      _traces.erase(it->first);
+      it = _files.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+auto MBMS_RT::FluteSessionDecoder::symbol_range(const LibFlute::FecOti& fec_oti, uint32_t source_block_number,
+    uint32_t symbol_id, uint64_t& begin, uint64_t& end) -> bool {
+  uint64_t symbol_length = fec_oti.encoding_symbol_length;
+  if (symbol_length == 0 || fec_oti.max_source_block_length == 0 || fec_oti.transfer_length == 0) {
+    return false;
+  }
+  // RFC 5052 9.1: the first blocks hold one symbol more than the others
+  uint64_t symbols = (fec_oti.transfer_length + symbol_length - 1) / symbol_length;
+  uint64_t blocks = (symbols + fec_oti.max_source_block_length - 1) / fec_oti.max_source_block_length;
+  uint64_t large_length = (symbols + blocks - 1) / blocks;
+  uint64_t small_length = symbols / blocks;
+  uint64_t large_blocks = symbols - small_length * blocks;
+  if (source_block_number >= blocks ||
+      symbol_id >= (source_block_number < large_blocks ? large_length : small_length)) {
+    return false;
+  }
+  uint64_t first_symbol = source_block_number < large_blocks ? source_block_number * large_length :
+    large_blocks * large_length + (source_block_number - large_blocks) * small_length;
+  begin = (first_symbol + symbol_id) * symbol_length;
+  end = std::min(begin + symbol_length, fec_oti.transfer_length);
+  return true;
+}
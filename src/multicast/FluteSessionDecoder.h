@@ -0,0 +1,116 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "File.h"
+#include "FileDeliveryTable.h"
+#include "Metrics.h"
+#include "SegmentTrace.h"
+#include "seamless/ByteRanges.h"
+
+namespace MBMS_RT {
+  /**
+   *  Reassembles the files of one FLUTE session (TSI) from ALC packets.
+   *
+   *  This is the per-session half of LibFlute::Receiver without the socket: packets are handed in by
+   *  the MulticastReceiver that owns the group, so several sessions on one group share a single socket.
+   *  Unlike libflute, it also tracks which bytes of a file in reception have arrived.
+   */
+  class FluteSessionDecoder {
+    public:
+      typedef std::function<void(std::shared_ptr<LibFlute::File>)> completion_callback_t;
+
+      explicit FluteSessionDecoder(uint64_t tsi)
+        : _tsi( tsi )
+        , _counters( Metrics::instance().flute_session(tsi) ) {};
+      virtual ~FluteSessionDecoder() = default;
+      FluteSessionDecoder(const FluteSessionDecoder&) = delete;
+      FluteSessionDecoder& operator=(const FluteSessionDecoder&) = delete;
+
+      uint64_t tsi() const { return _tsi; };
+
+      /**
+       *  Register a function that is called, outside of the decoder's lock, for every completed file
+       */
+      void register_completion_callback(completion_callback_t cb) { _completion_cb = std::move(cb); };
+
+      /**
+       *  Decode one ALC packet of this session. Malformed packets are logged and dropped.
+       */
+      void handle_packet(char* data, size_t length);
+
+      /**
+       *  @return All files of the session, complete or still in reception
+       */
+      std::vector<std::shared_ptr<LibFlute::File>> file_list();
+
+      /**
+       *  Copy what has been received of a file that is still in reception. The copy is taken under the
+       *  decoder's lock, while symbols of the file keep being written.
+       *
+       *  @param received Set to the byte ranges of the file that hold received data. Only known for
+       *                  Compact No-Code FEC without content encoding, empty otherwise.
+       *  @param data     Set to a copy of the whole file buffer if any ranges are known. Only the bytes
+       *                  in received are valid.
+       *  @return false if there is no incomplete file at content_location
+       */
+      bool partial_file(const std::string& content_location, ByteRanges& received, std::vector<uint8_t>& data);
+
+      /**
+       *  Copy the bytes of a file in reception that have arrived without a gap from offset on, to serve
+       *  the file while it is still being received. Only the new bytes are copied under the lock.
+       *
+       *  @param chunk  Set to the bytes from offset up to the first one missing, empty if that is offset
+       *  @param length Set to the length of the whole file
+       *  @return false if there is no incomplete file at content_location, or its received ranges are
+       *          unknown (see partial_file)
+       */
+      bool received_run(const std::string& content_location, uint64_t offset, std::vector<uint8_t>& chunk,
+          uint64_t& length);
+
+      /**
+       *  Drop files that were received more than max_age seconds ago
+       */
+      void remove_expired_files(unsigned max_age);
+
+      /**
+       *  @return The byte range [begin, end) in the file that a source symbol of Compact No-Code FEC
+       *          carries, following the source block partitioning of RFC 5052 9.1. false if the
+       *          symbol lies outside the file.
+       */
+      static bool symbol_range(const LibFlute::FecOti& fec_oti, uint32_t source_block_number, uint32_t symbol_id,
+          uint64_t& begin, uint64_t& end);
+
+    private:
+      uint64_t _tsi;
+      completion_callback_t _completion_cb = nullptr;
+      std::shared_ptr<Metrics::FluteCounters> _counters;
+
+      std::mutex _files_mutex;
+      std::map<uint64_t, std::shared_ptr<LibFlute::File>> _files;
+      std::unique_ptr<LibFlute::FileDeliveryTable> _fdt;
+      std::map<uint64_t, ByteRanges> _received;   // by TOI, for files in reception
+      std::map<uint64_t, std::shared_ptr<SegmentTrace>> _traces;   // by TOI from the first packet on, nullptr if not sampled
+  };
+}
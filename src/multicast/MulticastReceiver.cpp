@@ -0,0 +1,193 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "multicast/MulticastReceiver.h"
+#include "Logging.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "spdlog/spdlog.h"
+
+std::mutex MBMS_RT::MulticastReceiver::_registry_mutex;
+std::map<std::string, std::weak_ptr<MBMS_RT::MulticastReceiver>> MBMS_RT::MulticastReceiver::_registry;
+
+auto MBMS_RT::MulticastReceiver::acquire(const std::string& iface, const std::string& address, unsigned short port,
+    boost::asio::io_service& io_service) -> std::shared_ptr<MulticastReceiver> {
+  auto key = iface + "/" + address + ":" + std::to_string(port);
+  const std::lock_guard<std::mutex> lock(_registry_mutex);
+  auto existing = _registry[key].lock();
+  if (existing) {
+    return existing;
+  }
+  auto receiver = std::make_shared<MulticastReceiver>(iface, address, port, io_service);
+  _registry[key] = receiver;
+  receiver->start_receive();
+  return receiver;
+}
+
+MBMS_RT::MulticastReceiver::MulticastReceiver(const std::string& iface, const std::string& address,
+    unsigned short port, boost::asio::io_service& io_service)
+  : _key(iface + "/" + address + ":" + std::to_string(port))
+  , _socket(io_service)
+  , _buffers(BATCH_SIZE * MAX_PACKET_SIZE)
+  , _messages(BATCH_SIZE)
+  , _iovecs(BATCH_SIZE)
+{
+  boost::asio::ip::udp::endpoint listen_endpoint(boost::asio::ip::address::from_string(address), port);
+  _socket.open(listen_endpoint.protocol());
+  _socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+  _socket.set_option(boost::asio::socket_base::receive_buffer_size(RECEIVE_BUFFER_SIZE));
+  _socket.bind(listen_endpoint);
+  _socket.set_option(boost::asio::ip::multicast::join_group(
+        boost::asio::ip::address::from_string(address).to_v4(),
+        boost::asio::ip::address::from_string(iface).to_v4()));
+  _socket.non_blocking(true);
+
+  for (unsigned i = 0; i < BATCH_SIZE; i++) {
+    _iovecs[i].iov_base = _buffers.data() + i * MAX_PACKET_SIZE;
+    _iovecs[i].iov_len = MAX_PACKET_SIZE;
+    memset(&_messages[i], 0, sizeof(struct mmsghdr));
+    _messages[i].msg_hdr.msg_iov = &_iovecs[i];
+    _messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  spdlog::info("Joined multicast group {}", _key);
+}
+
+MBMS_RT::MulticastReceiver::~MulticastReceiver() {
+  spdlog::info("Leaving multicast group {} after {} packets ({} for unknown TSIs)", _key, _packets, _unknown_tsi);
+  {
+    const std::lock_guard<std::mutex> lock(_registry_mutex);
+    auto it = _registry.find(_key);
+    if (it != _registry.end() && it->second.expired()) {
+      _registry.erase(it);
+    }
+  }
+  boost::system::error_code ec;
+  _socket.close(ec);
+}
+
+auto MBMS_RT::MulticastReceiver::add_session(const std::shared_ptr<FluteSessionDecoder>& session) -> void {
+  const std::lock_guard<std::mutex> lock(_sessions_mutex);
+  _sessions[session->tsi()].push_back(session);
+}
+
+auto MBMS_RT::MulticastReceiver::remove_session(const std::shared_ptr<FluteSessionDecoder>& session) -> void {
+  const std::lock_guard<std::mutex> lock(_sessions_mutex);
+  auto it = _sessions.find(session->tsi());
+  if (it == _sessions.end()) {
+    return;
+  }
+  auto& list = it->second;
+  list.erase(std::remove_if(list.begin(), list.end(), [&session](const std::weak_ptr<FluteSessionDecoder>& s) {
+        auto locked = s.lock();
+        return !locked || locked == session;
+      }), list.end());
+  if (list.empty()) {
+    _sessions.erase(it);
+  }
+}
+
+auto MBMS_RT::MulticastReceiver::start_receive() -> void {
+  std::weak_ptr<MulticastReceiver> weak_self = shared_from_this();
+  _socket.async_wait(boost::asio::ip::udp::socket::wait_read, [weak_self](const boost::system::error_code& ec) {
+      auto self = weak_self.lock();
+      if (!self || ec) {
+        return;
+      }
+      self->handle_readable();
+      self->start_receive();
+  });
+}
+
+auto MBMS_RT::MulticastReceiver::handle_readable() -> void {
+  // Drain what is queued, but return to the io_service now and then so other handlers get a turn
+  for (int round = 0; round < 4; round++) {
+    for (auto& message : _messages) {
+      message.msg_hdr.msg_flags = 0;
+    }
+    int count = recvmmsg(_socket.native_handle(), _messages.data(), BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        static Logging::RateLimitedLog receive_log(Logging::Category::Flute);
+        receive_log.warn("Receiving from multicast group {} failed: {}", _key, strerror(errno));
+      }
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      if (_messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        static Logging::RateLimitedLog oversized_log(Logging::Category::Flute);
+        oversized_log.warn("Dropping oversized packet on multicast group {}", _key);
+        continue;
+      }
+      dispatch(static_cast<char*>(_iovecs[i].iov_base), _messages[i].msg_len);
+    }
+    if (count < static_cast<int>(BATCH_SIZE)) {
+      return;
+    }
+  }
+}
+
+auto MBMS_RT::MulticastReceiver::dispatch(char* data, size_t length) -> void {
+  _packets++;
+  uint64_t tsi = 0;
+  if (!lct_tsi(data, length, tsi)) {
+    spdlog::trace("Dropping malformed LCT packet on multicast group {}", _key);
+    return;
+  }
+
+  std::vector<std::shared_ptr<FluteSessionDecoder>> sessions;
+  {
+    const std::lock_guard<std::mutex> lock(_sessions_mutex);
+    auto it = _sessions.find(tsi);
+    if (it != _sessions.end()) {
+      for (const auto& session : it->second) {
+        if (auto locked = session.lock()) {
+          sessions.push_back(std::move(locked));
+        }
+      }
+    }
+  }
+  if (sessions.empty()) {
+    _unknown_tsi++;
+    spdlog::trace("Discarding packet for unknown TSI {} on multicast group {}", tsi, _key);
+    return;
+  }
+  for (const auto& session : sessions) {
+    session->handle_packet(data, length);
+  }
+}
+
+auto MBMS_RT::MulticastReceiver::lct_tsi(const char* data, size_t length, uint64_t& tsi) -> bool {
+  if (length < 4) {
+    return false;
+  }
+  auto header = reinterpret_cast<const uint8_t*>(data);
+  auto version = header[0] >> 4;
+  size_t cci_length = 4 * (((header[0] >> 2) & 0x03) + 1);
+  size_t tsi_length = 4 * ((header[1] >> 7) & 0x01) + 2 * ((header[1] >> 4) & 0x01);
+  if (version != 1 || tsi_length == 0 || length < 4 + cci_length + tsi_length) {
+    return false;
+  }
+  tsi = 0;
+  for (size_t i = 0; i < tsi_length; i++) {
+    tsi = (tsi << 8) | header[4 + cci_length + i];
+  }
+  return true;
+}
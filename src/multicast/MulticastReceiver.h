@@ -0,0 +1,90 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <boost/asio.hpp>
+#include "multicast/FluteSessionDecoder.h"
+
+namespace MBMS_RT {
+  /**
+   *  The single receive path for one (interface, multicast group, port).
+   *
+   *  Packets are read in batches with recvmmsg and handed to the FLUTE sessions registered for
+   *  the TSI in their LCT header, so each packet is read from the kernel once no matter how many
+   *  streams share the group.
+   */
+  class MulticastReceiver : public std::enable_shared_from_this<MulticastReceiver> {
+    public:
+      /**
+       *  Get the receiver for a group, opening the socket and joining the group if no one holds it yet.
+       *  The group is left when the last holder releases the receiver.
+       *
+       *  @throws boost::system::system_error if the socket cannot be set up
+       */
+      static std::shared_ptr<MulticastReceiver> acquire(const std::string& iface, const std::string& address,
+          unsigned short port, boost::asio::io_service& io_service);
+
+      MulticastReceiver(const std::string& iface, const std::string& address, unsigned short port,
+          boost::asio::io_service& io_service);
+      virtual ~MulticastReceiver();
+      MulticastReceiver(const MulticastReceiver&) = delete;
+      MulticastReceiver& operator=(const MulticastReceiver&) = delete;
+
+      void add_session(const std::shared_ptr<FluteSessionDecoder>& session);
+      void remove_session(const std::shared_ptr<FluteSessionDecoder>& session);
+
+      /**
+       *  Extract the TSI from the LCT header of an ALC packet (RFC 5651)
+       *
+       *  @return false if the header is malformed or carries no TSI
+       */
+      static bool lct_tsi(const char* data, size_t length, uint64_t& tsi);
+
+    private:
+      static constexpr unsigned BATCH_SIZE = 32;
+      static constexpr size_t MAX_PACKET_SIZE = 2048;  // as LibFlute::Receiver
+      static constexpr int RECEIVE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+      void start_receive();
+      void handle_readable();
+      void dispatch(char* data, size_t length);
+
+      std::string _key;
+      boost::asio::ip::udp::socket _socket;
+
+      std::mutex _sessions_mutex;
+      std::map<uint64_t, std::vector<std::weak_ptr<FluteSessionDecoder>>> _sessions;
+
+      std::vector<char> _buffers;
+      std::vector<struct mmsghdr> _messages;
+      std::vector<struct iovec> _iovecs;
+
+      uint64_t _packets = 0;
+      uint64_t _unknown_tsi = 0;
+
+      static std::mutex _registry_mutex;
+      static std::map<std::string, std::weak_ptr<MulticastReceiver>> _registry;
+  };
+}
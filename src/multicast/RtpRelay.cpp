@@ -0,0 +1,221 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "multicast/RtpRelay.h"
+#include "Logging.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+
+#include "spdlog/spdlog.h"
+
+MBMS_RT::RtpRelay::RtpRelay(const std::string& iface, const std::string& address, unsigned short port,
+    const std::string& source_address, const std::vector<std::string>& destinations, int ttl,
+    boost::asio::io_service& io_service)
+  : _key(iface + "/" + address + ":" + std::to_string(port))
+  , _socket(io_service)
+  , _send_socket(io_service)
+  , _buffers(BATCH_SIZE * MAX_PACKET_SIZE)
+  , _messages(BATCH_SIZE)
+  , _iovecs(BATCH_SIZE)
+  , _senders(BATCH_SIZE)
+  , _send_iovecs(BATCH_SIZE)
+{
+  for (const auto& destination : destinations) {
+    auto colon = destination.rfind(':');
+    auto host = colon == std::string::npos ? destination : destination.substr(0, colon);
+    auto destination_port = colon == std::string::npos ? port :
+      static_cast<unsigned short>(std::stoul(destination.substr(colon + 1)));
+    _destinations.emplace_back(boost::asio::ip::address::from_string(host), destination_port);
+  }
+  if (!source_address.empty()) {
+    _source = boost::asio::ip::address::from_string(source_address);
+  }
+
+  boost::asio::ip::udp::endpoint listen_endpoint(boost::asio::ip::address::from_string(address), port);
+  _socket.open(listen_endpoint.protocol());
+  _socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+  _socket.set_option(boost::asio::socket_base::receive_buffer_size(RECEIVE_BUFFER_SIZE));
+  _socket.bind(listen_endpoint);
+  _socket.set_option(boost::asio::ip::multicast::join_group(
+        boost::asio::ip::address::from_string(address).to_v4(),
+        boost::asio::ip::address::from_string(iface).to_v4()));
+  _socket.non_blocking(true);
+
+  _send_socket.open(boost::asio::ip::udp::v4());
+  _send_socket.set_option(boost::asio::ip::multicast::hops(ttl));
+  _send_socket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+  _send_socket.non_blocking(true);
+
+  for (unsigned i = 0; i < BATCH_SIZE; i++) {
+    _iovecs[i].iov_base = _buffers.data() + i * MAX_PACKET_SIZE;
+    _iovecs[i].iov_len = MAX_PACKET_SIZE;
+    _send_iovecs[i].iov_base = _iovecs[i].iov_base;
+    memset(&_messages[i], 0, sizeof(struct mmsghdr));
+    _messages[i].msg_hdr.msg_iov = &_iovecs[i];
+    _messages[i].msg_hdr.msg_iovlen = 1;
+    _messages[i].msg_hdr.msg_name = &_senders[i];
+  }
+  _send_messages.resize(BATCH_SIZE * _destinations.size());
+  for (auto& message : _send_messages) {
+    memset(&message, 0, sizeof(struct mmsghdr));
+  }
+  spdlog::info("Relaying RTP from multicast group {} to {}", _key, this->destinations());
+}
+
+MBMS_RT::RtpRelay::~RtpRelay() {
+  spdlog::info("Stopping RTP relay for {} after {} packets ({} lost, {} forwarded)", _key, _packets.load(),
+               _lost.load(), _forwarded.load());
+  boost::system::error_code ec;
+  _socket.close(ec);
+  _send_socket.close(ec);
+}
+
+auto MBMS_RT::RtpRelay::start() -> void {
+  start_receive();
+}
+
+auto MBMS_RT::RtpRelay::start_receive() -> void {
+  std::weak_ptr<RtpRelay> weak_self = shared_from_this();
+  _socket.async_wait(boost::asio::ip::udp::socket::wait_read, [weak_self](const boost::system::error_code& ec) {
+      auto self = weak_self.lock();
+      if (!self || ec) {
+        return;
+      }
+      self->handle_readable();
+      self->start_receive();
+  });
+}
+
+auto MBMS_RT::RtpRelay::handle_readable() -> void {
+  // Drain what is queued, but return to the io_service now and then so other handlers get a turn
+  for (int round = 0; round < 4; round++) {
+    for (auto& message : _messages) {
+      message.msg_hdr.msg_flags = 0;
+      message.msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+    int count = recvmmsg(_socket.native_handle(), _messages.data(), BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        static Logging::RateLimitedLog receive_log(Logging::Category::Stream);
+        receive_log.warn("Receiving RTP from multicast group {} failed: {}", _key, strerror(errno));
+      }
+      return;
+    }
+    forward(static_cast<unsigned>(count));
+    if (count < static_cast<int>(BATCH_SIZE)) {
+      return;
+    }
+  }
+}
+
+auto MBMS_RT::RtpRelay::forward(unsigned count) -> void {
+  // Keep the packets worth relaying at the front of the batch, their buffers stay where they are
+  unsigned valid = 0;
+  for (unsigned i = 0; i < count; i++) {
+    auto length = _messages[i].msg_len;
+    uint16_t sequence = 0;
+    bool from_source = _source.is_unspecified() ||
+      (_senders[i].ss_family == AF_INET && _source.is_v4() &&
+       reinterpret_cast<const struct sockaddr_in*>(&_senders[i])->sin_addr.s_addr == htonl(_source.to_v4().to_ulong()));
+    if ((_messages[i].msg_hdr.msg_flags & MSG_TRUNC) || !from_source ||
+        !rtp_sequence(static_cast<const char*>(_iovecs[i].iov_base), length, sequence)) {
+      _invalid++;
+      continue;
+    }
+    if (_have_sequence) {
+      uint16_t gap = sequence - _last_sequence - 1;
+      if (gap < 0x8000) {   // larger gaps are late or duplicate packets
+        _lost += gap;
+        _last_sequence = sequence;
+      }
+    } else {
+      _have_sequence = true;
+      _last_sequence = sequence;
+    }
+    _packets++;
+    _bytes += length;
+    _send_iovecs[valid].iov_base = _iovecs[i].iov_base;
+    _send_iovecs[valid].iov_len = length;
+    valid++;
+  }
+  if (valid == 0 || _destinations.empty()) {
+    return;
+  }
+
+  unsigned total = 0;
+  for (auto& destination : _destinations) {
+    for (unsigned i = 0; i < valid; i++) {
+      auto& hdr = _send_messages[total++].msg_hdr;
+      hdr.msg_name = destination.data();
+      hdr.msg_namelen = destination.size();
+      hdr.msg_iov = &_send_iovecs[i];
+      hdr.msg_iovlen = 1;
+    }
+  }
+  unsigned done = 0;
+  unsigned sent = 0;
+  while (done < total) {
+    int result = sendmmsg(_send_socket.native_handle(), _send_messages.data() + done, total - done, MSG_DONTWAIT);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      // The first message failed for this destination only, e.g. an unreachable host. Skip it.
+      static Logging::RateLimitedLog send_log(Logging::Category::Stream);
+      send_log.warn("Relaying RTP from {} failed: {}", _key, strerror(errno));
+      done++;
+      continue;
+    }
+    done += static_cast<unsigned>(result);
+    sent += static_cast<unsigned>(result);
+  }
+  _forwarded += sent;
+  _send_dropped += total - sent;
+}
+
+auto MBMS_RT::RtpRelay::stats() const -> Stats {
+  return Stats{_packets.load(), _bytes.load(), _lost.load(), _invalid.load(), _forwarded.load(),
+               _send_dropped.load()};
+}
+
+auto MBMS_RT::RtpRelay::destinations() const -> std::string {
+  std::string result;
+  for (const auto& destination : _destinations) {
+    if (!result.empty()) {
+      result += ", ";
+    }
+    result += destination.address().to_string() + ":" + std::to_string(destination.port());
+  }
+  return result;
+}
+
+auto MBMS_RT::RtpRelay::rtp_sequence(const char* data, size_t length, uint16_t& sequence) -> bool {
+  if (length < 12) {
+    return false;
+  }
+  auto header = reinterpret_cast<const uint8_t*>(data);
+  if ((header[0] >> 6) != 2) {
+    return false;
+  }
+  sequence = static_cast<uint16_t>((header[2] << 8) | header[3]);
+  return true;
+}
@@ -0,0 +1,107 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <boost/asio.hpp>
+
+namespace MBMS_RT {
+  /**
+   *  Forwards an RTP session received on a multicast group to local clients, unicast or on a local
+   *  multicast group.
+   *
+   *  Packets are read with recvmmsg into preallocated buffers and the same buffers are handed to
+   *  sendmmsg for every destination, so relaying neither copies nor allocates per packet.
+   */
+  class RtpRelay : public std::enable_shared_from_this<RtpRelay> {
+    public:
+      /**
+       *  @param source_address  Only relay packets from this sender (SDP source-filter), empty for any
+       *  @param destinations    Where to send the packets, in host[:port] form. Without a port the
+       *                         port of the received session is used.
+       *  @param ttl             Multicast TTL for destinations that are multicast groups
+       *
+       *  @throws boost::system::system_error if a socket cannot be set up or a destination is invalid
+       */
+      RtpRelay(const std::string& iface, const std::string& address, unsigned short port,
+          const std::string& source_address, const std::vector<std::string>& destinations, int ttl,
+          boost::asio::io_service& io_service);
+      virtual ~RtpRelay();
+      RtpRelay(const RtpRelay&) = delete;
+      RtpRelay& operator=(const RtpRelay&) = delete;
+
+      void start();
+
+      struct Stats {
+        uint64_t packets;         // received RTP packets
+        uint64_t bytes;
+        uint64_t lost;            // missing sequence numbers
+        uint64_t invalid;         // not RTP, oversized or from another source
+        uint64_t forwarded;       // packets sent, counted once per destination
+        uint64_t send_dropped;    // packets the send socket could not take
+      };
+      Stats stats() const;
+
+      std::string destinations() const;
+
+      /**
+       *  Extract the sequence number from an RTP fixed header (RFC 3550 5.1)
+       *
+       *  @return false if this is not an RTP version 2 packet
+       */
+      static bool rtp_sequence(const char* data, size_t length, uint16_t& sequence);
+
+    private:
+      static constexpr unsigned BATCH_SIZE = 32;
+      static constexpr size_t MAX_PACKET_SIZE = 2048;
+      static constexpr int RECEIVE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+      void start_receive();
+      void handle_readable();
+      void forward(unsigned count);
+
+      std::string _key;
+      boost::asio::ip::udp::socket _socket;
+      boost::asio::ip::udp::socket _send_socket;
+      boost::asio::ip::address _source;
+      std::vector<boost::asio::ip::udp::endpoint> _destinations;
+
+      std::vector<char> _buffers;
+      std::vector<struct mmsghdr> _messages;
+      std::vector<struct iovec> _iovecs;
+      std::vector<struct sockaddr_storage> _senders;
+
+      // Send side: one iovec per received packet sized to its length, one header per packet and destination
+      std::vector<struct iovec> _send_iovecs;
+      std::vector<struct mmsghdr> _send_messages;
+
+      bool _have_sequence = false;
+      uint16_t _last_sequence = 0;
+
+      std::atomic<uint64_t> _packets = {0};
+      std::atomic<uint64_t> _bytes = {0};
+      std::atomic<uint64_t> _lost = {0};
+      std::atomic<uint64_t> _invalid = {0};
+      std::atomic<uint64_t> _forwarded = {0};
+      std::atomic<uint64_t> _send_dropped = {0};
+  };
+}
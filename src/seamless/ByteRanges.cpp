@@ -0,0 +1,91 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "ByteRanges.h"
+#include <algorithm>
+
+auto MBMS_RT::ByteRanges::add(uint64_t begin, uint64_t end) -> void
+{
+  if (begin >= end) {
+    return;
+  }
+  // First range that ends at or after begin, i.e. the first candidate for merging
+  auto it = std::lower_bound(_ranges.begin(), _ranges.end(), begin,
+      [](const Range& r, uint64_t value) { return r.end < value; });
+  auto last = it;
+  while (last != _ranges.end() && last->begin <= end) {
+    begin = std::min(begin, last->begin);
+    end = std::max(end, last->end);
+    ++last;
+  }
+  it = _ranges.erase(it, last);
+  _ranges.insert(it, Range{begin, end});
+}
+
+auto MBMS_RT::ByteRanges::gaps(uint64_t length) const -> ByteRanges
+{
+  ByteRanges result;
+  uint64_t pos = 0;
+  for (const auto& r : _ranges) {
+    if (r.begin >= length) {
+      break;
+    }
+    if (r.begin > pos) {
+      result._ranges.push_back({pos, r.begin});
+    }
+    pos = std::max(pos, r.end);
+  }
+  if (pos < length) {
+    result._ranges.push_back({pos, length});
+  }
+  return result;
+}
+
+auto MBMS_RT::ByteRanges::coalesced(uint64_t max_hole) const -> ByteRanges
+{
+  ByteRanges result;
+  for (const auto& r : _ranges) {
+    if (!result._ranges.empty() && r.begin - result._ranges.back().end < max_hole) {
+      result._ranges.back().end = r.end;
+    } else {
+      result._ranges.push_back(r);
+    }
+  }
+  return result;
+}
+
+auto MBMS_RT::ByteRanges::covered() const -> uint64_t
+{
+  uint64_t total = 0;
+  for (const auto& r : _ranges) {
+    total += r.length();
+  }
+  return total;
+}
+
+auto MBMS_RT::ByteRanges::contiguous_end(uint64_t offset) const -> uint64_t
+{
+  for (const auto& r : _ranges) {
+    if (r.begin > offset) {
+      break;
+    }
+    if (r.end > offset) {
+      return r.end;
+    }
+  }
+  return offset;
+}
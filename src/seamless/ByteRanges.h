@@ -0,0 +1,68 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MBMS_RT {
+  /**
+   *  A sorted set of disjoint half-open byte ranges [begin, end) within an object.
+   */
+  class ByteRanges {
+    public:
+      struct Range {
+        uint64_t begin;
+        uint64_t end;
+        uint64_t length() const { return end - begin; };
+      };
+
+      ByteRanges() = default;
+      virtual ~ByteRanges() = default;
+
+      /**
+       *  Add a range, merging it with overlapping or adjacent ranges
+       */
+      void add(uint64_t begin, uint64_t end);
+
+      /**
+       *  @return The ranges within [0, length) that are not covered
+       */
+      ByteRanges gaps(uint64_t length) const;
+
+      /**
+       *  @return A copy in which ranges separated by less than max_hole bytes are joined. Used to trade a
+       *          few redundantly fetched bytes for fewer requests.
+       */
+      ByteRanges coalesced(uint64_t max_hole) const;
+
+      uint64_t covered() const;
+
+      /**
+       *  @return The end of the range that holds offset, offset itself if it is not covered
+       */
+      uint64_t contiguous_end(uint64_t offset) const;
+      bool empty() const { return _ranges.empty(); };
+      size_t size() const { return _ranges.size(); };
+      const std::vector<Range>& ranges() const { return _ranges; };
+
+    private:
+      std::vector<Range> _ranges;
+  };
+}
@@ -16,7 +16,12 @@
 //
 
 #include "CdnClient.h"
+#include "Logging.h"
 #include "CdnFile.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cmath>
 
 #include "spdlog/spdlog.h"
 
@@ -24,33 +29,436 @@ using web::http::client::http_client;
 using web::http::status_codes;
 using web::http::methods;
 using web::http::http_response;
+using web::http::http_request;
+using web::http::header_names;
+
+// Smoothing of the per origin estimates, RFC 6298 gains for the round trip time
+static constexpr double RTT_GAIN = 0.125;
+static constexpr double RTT_VAR_GAIN = 0.25;
+static constexpr double THROUGHPUT_GAIN = 0.2;
+static constexpr double ERROR_GAIN = 0.1;
 
-MBMS_RT::CdnClient::CdnClient(const std::string& base_url)
+MBMS_RT::CdnClient::CdnClient(const libconfig::Config& cfg, boost::asio::io_service& io_service,
+    const std::string& base_url, std::shared_ptr<BufferPool> pool, std::shared_ptr<FetchEngine> engine,
+    std::string stream)
+  : _io_service( io_service )
+  , _pool( std::move(pool) )
+  , _engine( std::move(engine) )
+  , _stream( std::move(stream) )
 {
+  cfg.lookupValue("mw.seamless_switching.cdn_failover.hedging", _hedging);
+  cfg.lookupValue("mw.seamless_switching.cdn_failover.hedge_min_delay", _hedge_min_delay);
+  cfg.lookupValue("mw.seamless_switching.cdn_failover.failure_threshold", _failure_threshold);
+  cfg.lookupValue("mw.seamless_switching.cdn_failover.retry_interval", _retry_interval);
+  cfg.lookupValue("mw.seamless_switching.cdn_failover.max_retry_interval", _max_retry_interval);
   spdlog::debug("Cdn client constructed with base {}", base_url);
-  _client = std::make_unique<http_client>(base_url);
+  add_origin(base_url);
+}
+
+auto MBMS_RT::CdnClient::add_origin(const std::string& base_url) -> void
+{
+  const std::lock_guard<std::mutex> lock(_origins_mutex);
+  for (const auto& origin : _origins) {
+    if (origin->base_url == base_url) {
+      return;
+    }
+  }
+  if (!_origins.empty()) {
+    spdlog::info("Cdn client adding alternative origin {}", base_url);
+  }
+  auto origin = std::make_shared<Origin>();
+  origin->base_url = base_url;
+  if (!_engine) {
+    origin->client = std::make_unique<http_client>(base_url);
+  }
+  origin->breaker = std::make_unique<CircuitBreaker>("CDN origin " + base_url, _failure_threshold,
+      std::chrono::seconds(_retry_interval), std::chrono::seconds(_max_retry_interval));
+  _origins.push_back(std::move(origin));
+}
+
+auto MBMS_RT::CdnClient::select_origin(const std::vector<std::shared_ptr<Origin>>& exclude) -> std::shared_ptr<Origin>
+{
+  std::vector<std::pair<double, std::shared_ptr<Origin>>> candidates;
+  {
+    const std::lock_guard<std::mutex> lock(_origins_mutex);
+    for (const auto& origin : _origins) {
+      if (std::find(exclude.begin(), exclude.end(), origin) != exclude.end()) {
+        continue;
+      }
+      // Expected time to deliver a typical response, inflated by the recent error rate
+      double score = origin->rtt_ms;
+      if (origin->throughput > 0) {
+        score += _typical_size / origin->throughput * 1000;
+      }
+      candidates.emplace_back(score * (1 + 10 * origin->error_rate), origin);
+    }
+  }
+  std::stable_sort(candidates.begin(), candidates.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  for (const auto& candidate : candidates) {
+    if (candidate.second->breaker->allow()) {
+      return candidate.second;
+    }
+  }
+  return nullptr;
+}
+
+auto MBMS_RT::CdnClient::dispatch(Origin& origin, int64_t priority, FetchEngine::job_t job) -> void
+{
+  if (_engine) {
+    _engine->submit(origin.base_url, _stream, priority, std::move(job));
+  } else {
+    job(*origin.client);
+  }
 }
 
-auto MBMS_RT::CdnClient::get(const std::string& path, std::function<void(std::shared_ptr<CdnFile>)> completion_cb) -> void
+auto MBMS_RT::CdnClient::record_response(Origin& origin, double rtt_ms) -> void
 {
+  const std::lock_guard<std::mutex> lock(_origins_mutex);
+  if (origin.rtt_ms == 0) {
+    origin.rtt_ms = rtt_ms;
+    origin.rtt_var_ms = rtt_ms / 2;
+  } else {
+    origin.rtt_var_ms += RTT_VAR_GAIN * (std::abs(origin.rtt_ms - rtt_ms) - origin.rtt_var_ms);
+    origin.rtt_ms += RTT_GAIN * (rtt_ms - origin.rtt_ms);
+  }
+}
+
+auto MBMS_RT::CdnClient::failed_request_result(web::http::status_code status) -> Result
+{
+  // An answer other than the one wanted: only a server error speaks against the origin
+  return status != 0 && status < 500 ? Result::Missing : Result::Failed;
+}
+
+auto MBMS_RT::CdnClient::record_result(Origin& origin, Result result, uint64_t bytes, double body_ms) -> void
+{
+  // A miss shows the origin is up and answering, it counts like a success without data
+  bool success = result != Result::Failed;
+  {
+    const std::lock_guard<std::mutex> lock(_origins_mutex);
+    origin.error_rate += ERROR_GAIN * ((success ? 0.0 : 1.0) - origin.error_rate);
+    if (!success) {
+      origin.errors++;
+    } else if (result == Result::Delivered && bytes > 0) {
+      _typical_size = _typical_size == 0 ? bytes : _typical_size + THROUGHPUT_GAIN * (bytes - _typical_size);
+      if (body_ms > 0) {
+        auto throughput = bytes * 1000 / body_ms;
+        origin.throughput = origin.throughput == 0 ? throughput :
+          origin.throughput + THROUGHPUT_GAIN * (throughput - origin.throughput);
+      }
+    }
+  }
+  if (success) {
+    origin.breaker->record_success();
+  } else {
+    origin.breaker->record_failure();
+  }
+}
+
+auto MBMS_RT::CdnClient::get(const std::string& path, int64_t priority, const pplx::cancellation_token& token) -> pplx::task<std::shared_ptr<CdnFile>>
+{
+  pplx::task_completion_event<std::shared_ptr<CdnFile>> tce;
+  {
+    const std::lock_guard<std::mutex> lock(_in_flight_mutex);
+    auto it = _in_flight.find(path);
+    if (it != _in_flight.end()) {
+      spdlog::debug("Cdn client joining in-flight request for {}", path);
+      return it->second;
+    }
+    _in_flight.emplace(path, pplx::task<std::shared_ptr<CdnFile>>(tce));
+  }
+
   spdlog::debug("Cdn client requesting {}", path);
-  try {
-    _client->request(methods::GET, path)
-      .then([completion_cb](http_response response) { // NOLINT
-          if (response.status_code() == status_codes::OK) {
-            Concurrency::streams::container_buffer<std::vector<uint8_t>> buf;
-            response.body().read_to_end(buf)
-              .then([buf, completion_cb](size_t bytes_read){
-                spdlog::debug("Downloaded {} bytes", bytes_read);
-                auto cdn_file = std::make_shared<CdnFile>(bytes_read);
-                memcpy(cdn_file->buffer(), &(buf.collection())[0], bytes_read);
-                if (completion_cb) {
-                  completion_cb(cdn_file);
-                }
-            });
-          } else {
-                spdlog::debug("got status {}", response.status_code());
+  std::weak_ptr<CdnClient> weak_self = shared_from_this();
+  auto fetch = std::make_shared<Fetch>();
+  fetch->path = path;
+  fetch->priority = priority;
+  fetch->token = token;
+  fetch->complete = [weak_self, path, tce](std::shared_ptr<CdnFile> file) {
+    if (auto self = weak_self.lock()) {
+      const std::lock_guard<std::mutex> lock(self->_in_flight_mutex);
+      self->_in_flight.erase(path);
+    }
+    tce.set(std::move(file));
+  };
+
+  std::shared_ptr<Origin> origin;
+  {
+    const std::lock_guard<std::mutex> lock(fetch->mutex);
+    origin = select_origin({});
+    if (origin) {
+      fetch->tried.push_back(origin);
+      fetch->outstanding++;
+    }
+  }
+  if (!origin) {
+    spdlog::debug("Cdn client has no healthy origin for {}", path);
+    fetch->complete(nullptr);
+  } else {
+    attempt(fetch, origin, false);
+    if (_hedging) {
+      schedule_hedge(fetch, origin);
+    }
+  }
+  return pplx::task<std::shared_ptr<CdnFile>>(tce);
+}
+
+auto MBMS_RT::CdnClient::attempt(const std::shared_ptr<Fetch>& fetch, const std::shared_ptr<Origin>& origin, bool hedge) -> void
+{
+  auto cts = pplx::cancellation_token_source::create_linked_source(fetch->token);
+  {
+    const std::lock_guard<std::mutex> lock(fetch->mutex);
+    fetch->attempts.push_back(cts);
+  }
+  {
+    const std::lock_guard<std::mutex> lock(_origins_mutex);
+    origin->requests++;
+    if (hedge) {
+      origin->hedged++;
+    }
+  }
+
+  auto self = shared_from_this();
+  auto started_at = std::chrono::steady_clock::now();
+  auto rtt_ms = std::make_shared<double>(0);
+  auto status = std::make_shared<web::http::status_code>(0);   // of a response without usable body
+  dispatch(*origin, fetch->priority, [self, fetch, origin, hedge, cts, started_at, rtt_ms, status](http_client& client) -> pplx::task<void> {
+    try {
+      return client.request(methods::GET, fetch->path, cts.get_token())
+        .then([self, fetch, origin, started_at, rtt_ms, status](http_response response) -> pplx::task<std::shared_ptr<CdnFile>> { // NOLINT
+            *rtt_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_at).count();
+            self->record_response(*origin, *rtt_ms);
+            if (response.status_code() != status_codes::OK) {
+              spdlog::debug("Cdn client got status {} for {} from {}", response.status_code(), fetch->path, origin->base_url);
+              *status = response.status_code();
+              return pplx::task_from_result(std::shared_ptr<CdnFile>());
+            }
+            return self->read_body(response, fetch->path);
+          })
+        .then([self, fetch, origin, hedge, cts, started_at, rtt_ms, status](pplx::task<std::shared_ptr<CdnFile>> result) {
+            std::shared_ptr<CdnFile> file;
+            try {
+              file = result.get();
+            } catch (const std::exception& ex) {
+              spdlog::debug("Cdn client request for {} from {} failed: {}", fetch->path, origin->base_url, ex.what());
+            }
+            auto outcome = file ? Result::Delivered : failed_request_result(*status);
+            if (cts.get_token().is_canceled() && !file) {
+              // Lost to a hedged request, or no longer wanted: says nothing about the origin
+              origin->breaker->record_abandoned();
+            } else {
+              auto total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_at).count();
+              self->record_result(*origin, outcome, file ? file->length() : 0, total_ms - *rtt_ms);
+              Metrics::instance().cdn_fetch(total_ms, file != nullptr);
+            }
+            self->attempt_done(fetch, origin, hedge, std::move(file), outcome == Result::Missing);
+          });
+    } catch (const web::http::http_exception& ex) {
+      spdlog::debug("Cdn client request for {} from {} failed: {}", fetch->path, origin->base_url, ex.what());
+      self->record_result(*origin, Result::Failed, 0, 0);
+      Metrics::instance().cdn_fetch(0, false);
+      self->attempt_done(fetch, origin, hedge, nullptr, false);
+      return pplx::task_from_result();
+    }
+  });
+}
+
+auto MBMS_RT::CdnClient::attempt_done(const std::shared_ptr<Fetch>& fetch, const std::shared_ptr<Origin>& origin,
+    bool hedge, std::shared_ptr<CdnFile> file, bool missing) -> void
+{
+  std::shared_ptr<Origin> next;
+  std::vector<pplx::cancellation_token_source> attempts;
+  bool finished = false;
+  {
+    const std::lock_guard<std::mutex> lock(fetch->mutex);
+    fetch->outstanding--;
+    if (fetch->done) {
+      return;
+    }
+    fetch->missing = fetch->missing || missing;
+    if (file) {
+      if (hedge) {
+        spdlog::debug("Hedged request for {} to {} answered first", fetch->path, origin->base_url);
+        const std::lock_guard<std::mutex> origins_lock(_origins_mutex);
+        origin->hedge_wins++;
+      }
+      attempts = fetch->attempts;
+      finished = true;
+    } else if (fetch->outstanding == 0) {
+      // The origins serve identical content, one that does not have the file yet speaks for all
+      if (!fetch->token.is_canceled() && !fetch->missing) {
+        next = select_origin(fetch->tried);
+      }
+      if (next) {
+        fetch->tried.push_back(next);
+        fetch->outstanding++;
+      } else {
+        finished = true;
+      }
+    }
+    if (finished) {
+      fetch->done = true;
+      if (fetch->hedge_timer) {
+        fetch->hedge_timer->cancel();
+      }
+    }
+  }
+
+  // Stop the request still running on the other origin
+  for (auto& other : attempts) {
+    other.cancel();
+  }
+  if (next) {
+    static Logging::RateLimitedLog retry_log(Logging::Category::Cdn);
+    retry_log.info("Cdn client retrying {} on {}", fetch->path, next->base_url);
+    attempt(fetch, next, false);
+  }
+  if (finished) {
+    fetch->complete(std::move(file));
+  }
+}
+
+auto MBMS_RT::CdnClient::schedule_hedge(const std::shared_ptr<Fetch>& fetch, const std::shared_ptr<Origin>& origin) -> void
+{
+  double delay_ms = 0;
+  {
+    const std::lock_guard<std::mutex> lock(_origins_mutex);
+    // Without a measured round trip time there is no telling what is slow for this origin yet
+    if (_origins.size() < 2 || origin->rtt_ms == 0) {
+      return;
+    }
+    // Like a retransmission timeout: well beyond the usual response time
+    delay_ms = std::max(origin->rtt_ms + 4 * origin->rtt_var_ms, static_cast<double>(_hedge_min_delay));
+  }
+
+  auto timer = std::make_shared<boost::asio::deadline_timer>(_io_service,
+      boost::posix_time::milliseconds(static_cast<long>(delay_ms)));
+  {
+    const std::lock_guard<std::mutex> lock(fetch->mutex);
+    if (fetch->done) {
+      return;
+    }
+    fetch->hedge_timer = timer;
+  }
+  std::weak_ptr<CdnClient> weak_self = shared_from_this();
+  timer->async_wait([weak_self, fetch](const boost::system::error_code& ec) {
+    auto self = weak_self.lock();
+    if (ec == boost::asio::error::operation_aborted || !self) {
+      return;
+    }
+    std::shared_ptr<Origin> second;
+    {
+      const std::lock_guard<std::mutex> lock(fetch->mutex);
+      if (fetch->done || fetch->missing) {
+        return;
+      }
+      second = self->select_origin(fetch->tried);
+      if (second) {
+        fetch->tried.push_back(second);
+        fetch->outstanding++;
+      }
+    }
+    if (second) {
+      spdlog::debug("Cdn client response for {} is late, hedging on {}", fetch->path, second->base_url);
+      self->attempt(fetch, second, true);
+    }
+  });
+}
+
+auto MBMS_RT::CdnClient::get_range(const std::string& path, uint64_t begin, uint64_t end, int64_t priority) -> pplx::task<std::shared_ptr<CdnFile>>
+{
+  auto origin = select_origin({});
+  if (!origin) {
+    spdlog::debug("Cdn client has no healthy origin for range request on {}", path);
+    return pplx::task_from_result(std::shared_ptr<CdnFile>());
+  }
+  spdlog::debug("Cdn client requesting bytes {}-{} of {} from {}", begin, end - 1, path, origin->base_url);
+  {
+    const std::lock_guard<std::mutex> lock(_origins_mutex);
+    origin->requests++;
+  }
+  pplx::task_completion_event<std::shared_ptr<CdnFile>> tce;
+  auto self = shared_from_this();
+  dispatch(*origin, priority, [self, origin, path, begin, end, tce](http_client& client) -> pplx::task<void> {
+    http_request request(methods::GET);
+    request.set_request_uri(path);
+    request.headers().add(header_names::range, "bytes=" + std::to_string(begin) + "-" + std::to_string(end - 1));
+    auto started_at = std::chrono::steady_clock::now();
+    auto rtt_ms = std::make_shared<double>(0);
+    auto status = std::make_shared<web::http::status_code>(0);
+    try {
+      return client.request(request)
+        .then([self, origin, path, started_at, rtt_ms, status, length = end - begin](http_response response) -> pplx::task<std::shared_ptr<CdnFile>> { // NOLINT
+            *rtt_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_at).count();
+            self->record_response(*origin, *rtt_ms);
+            // A server ignoring the range would send the whole file with 200, which is not what was asked for
+            if (response.status_code() != status_codes::PartialContent ||
+                response.headers().content_length() != length) {
+              spdlog::debug("Cdn client got status {} for range request on {}", response.status_code(), path);
+              *status = response.status_code();
+              return pplx::task_from_result(std::shared_ptr<CdnFile>());
+            }
+            return self->read_body(response, path);
+          })
+        .then([self, origin, path, started_at, rtt_ms, status, tce](pplx::task<std::shared_ptr<CdnFile>> result) {
+            std::shared_ptr<CdnFile> file;
+            try {
+              file = result.get();
+            } catch (const std::exception& ex) {
+              spdlog::debug("Cdn client range request for {} failed: {}", path, ex.what());
+            }
+            auto total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_at).count();
+            self->record_result(*origin, file ? Result::Delivered : failed_request_result(*status),
+                file ? file->length() : 0, total_ms - *rtt_ms);
+            Metrics::instance().cdn_fetch(total_ms, file != nullptr);
+            tce.set(std::move(file));
+          });
+    } catch (const web::http::http_exception& ex) {
+      spdlog::debug("Cdn client range request for {} failed: {}", path, ex.what());
+      self->record_result(*origin, Result::Failed, 0, 0);
+      Metrics::instance().cdn_fetch(0, false);
+      tce.set(nullptr);
+      return pplx::task_from_result();
+    }
+  });
+  return pplx::task<std::shared_ptr<CdnFile>>(tce);
+}
+
+auto MBMS_RT::CdnClient::origin_stats() const -> std::vector<OriginStats>
+{
+  std::vector<OriginStats> stats;
+  const std::lock_guard<std::mutex> lock(_origins_mutex);
+  for (const auto& origin : _origins) {
+    stats.push_back({ origin->base_url, origin->breaker->state_string(), origin->rtt_ms, origin->rtt_var_ms,
+        origin->throughput, origin->error_rate, origin->requests, origin->errors, origin->hedged, origin->hedge_wins });
+  }
+  return stats;
+}
+
+auto MBMS_RT::CdnClient::read_body(const http_response& response, const std::string& path) -> pplx::task<std::shared_ptr<CdnFile>>
+{
+  auto content_length = response.headers().content_length();
+  if (_pool && content_length > 0) {
+    // Known length: read straight into a pooled buffer of the right size class
+    auto buffer = _pool->acquire(content_length);
+    Concurrency::streams::rawptr_buffer<uint8_t> buf(reinterpret_cast<uint8_t*>(buffer->data()), content_length, std::ios_base::out);
+    return response.body().read_to_end(buf)
+      .then([buffer, content_length, path](size_t bytes_read) -> std::shared_ptr<CdnFile> {
+          if (bytes_read != content_length) {
+            static Logging::RateLimitedLog short_read_log(Logging::Category::Cdn);
+            short_read_log.warn("Cdn client read {} of {} bytes for {}", bytes_read, content_length, path);
+            return nullptr;
           }
-        }).wait();
-  } catch (web::http::http_exception ex) { }
+          spdlog::debug("Downloaded {} bytes", bytes_read);
+          return std::make_shared<CdnFile>(buffer, bytes_read);
+        });
+  }
+  // Unknown length (chunked): let the vector grow, then adopt it
+  Concurrency::streams::container_buffer<std::vector<uint8_t>> buf(std::ios_base::out);
+  return response.body().read_to_end(buf)
+    .then([buf](size_t bytes_read) {
+        spdlog::debug("Downloaded {} bytes", bytes_read);
+        // Adopt the downloaded vector, the buffer is not used after this
+        return std::make_shared<CdnFile>(std::move(buf.collection()));
+      });
 }
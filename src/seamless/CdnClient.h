@@ -17,19 +17,174 @@
 #pragma once
 
 #include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <libconfig.h++>
+#include <boost/asio.hpp>
 #include "cpprest/http_client.h"
+#include "BufferPool.h"
 #include "CdnFile.h"
+#include "CircuitBreaker.h"
+#include "seamless/FetchEngine.h"
 
 namespace MBMS_RT {
-  class CdnClient {
+  /**
+   *  Downloads files of one stream from a set of identical CDN origins.
+   *
+   *  Each origin's round trip time, throughput and error rate are tracked, and requests go to the
+   *  origin expected to deliver fastest whose circuit breaker is closed. A request that fails is
+   *  retried on the next origin. If a response takes longer than the origin usually does, a hedged
+   *  request goes to a second origin and whichever answers first is used.
+   *  Only 5xx responses, timeouts and connection errors count as failures. Other answers, such as the
+   *  404 for a segment announced over broadcast before it reaches the CDN, are misses: they do not
+   *  count against the origin's health and are not retried elsewhere.
+   *  Configured in mw.seamless_switching.cdn_failover.
+   */
+  class CdnClient : public std::enable_shared_from_this<CdnClient> {
     public:
-      CdnClient(const std::string& base_url);
+      /**
+       *  @param base_url Base URL all requested paths are relative to
+       *  @param pool Pool to read bodies of known length into. Bodies are read into vectors if not set.
+       *  @param engine Schedules the requests alongside those of other streams. Requests are sent
+       *                directly on a client per origin if not set.
+       *  @param stream Identifies the stream in the fetch engine
+       */
+      CdnClient(const libconfig::Config& cfg, boost::asio::io_service& io_service, const std::string& base_url,
+          std::shared_ptr<BufferPool> pool = nullptr, std::shared_ptr<FetchEngine> engine = nullptr,
+          std::string stream = "");
       virtual ~CdnClient() = default;
 
-      void get(const std::string& path, std::function<void(std::shared_ptr<CdnFile>)> completion_cb);
+      /**
+       *  Add an origin serving the same paths as the first one. Ignored if it is already known.
+       */
+      void add_origin(const std::string& base_url);
+
+      /**
+       *  Request a file from the CDN. Concurrent requests for the same path share one upstream fetch.
+       *
+       *  @param path Path relative to the base URL
+       *  @param priority Requests with a higher priority are sent first when the origin is busy
+       *  @param token Cancels the upstream fetch, and with it every request sharing it
+       *  @return A task that yields the downloaded file, or nullptr if all origins failed or the request
+       *          was cancelled
+       */
+      pplx::task<std::shared_ptr<CdnFile>> get(const std::string& path, int64_t priority = 0,
+          const pplx::cancellation_token& token = pplx::cancellation_token::none());
+
+      /**
+       *  Request a byte range of a file from the best origin. Range requests are not coalesced or hedged.
+       *
+       *  @param path Path relative to the base URL
+       *  @param begin Offset of the first byte
+       *  @param end Offset one past the last byte
+       *  @param priority Requests with a higher priority are sent first when the origin is busy
+       *  @return A task that yields exactly the requested bytes, or nullptr if the server did not
+       *          answer with a matching 206 Partial Content
+       */
+      pplx::task<std::shared_ptr<CdnFile>> get_range(const std::string& path, uint64_t begin, uint64_t end,
+          int64_t priority = 0);
+
+      struct OriginStats {
+        std::string base_url;
+        std::string state;          // of the circuit breaker
+        double rtt_ms;              // smoothed time to response headers
+        double rtt_var_ms;
+        double throughput;          // smoothed body bytes per second
+        double error_rate;          // smoothed fraction of failed requests
+        uint64_t requests;
+        uint64_t errors;
+        uint64_t hedged;            // hedged requests sent to this origin
+        uint64_t hedge_wins;        // of which answered first
+      };
+      std::vector<OriginStats> origin_stats() const;
 
     private:
-      std::unique_ptr<web::http::client::http_client> _client;
+      struct Origin {
+        std::string base_url;
+        std::unique_ptr<web::http::client::http_client> client;
+        std::unique_ptr<CircuitBreaker> breaker;
+        double rtt_ms = 0;          // 0 until measured, so new origins get tried
+        double rtt_var_ms = 0;
+        double throughput = 0;
+        double error_rate = 0;
+        uint64_t requests = 0;
+        uint64_t errors = 0;
+        uint64_t hedged = 0;
+        uint64_t hedge_wins = 0;
+      };
+
+      /**
+       *  State shared by the attempts of one get() on different origins
+       */
+      struct Fetch {
+        std::string path;
+        int64_t priority;
+        pplx::cancellation_token token;
+        std::function<void(std::shared_ptr<CdnFile>)> complete;
+
+        std::mutex mutex;
+        bool done = false;
+        bool missing = false;       // an origin answered that it does not have the file
+        unsigned outstanding = 0;
+        std::vector<std::shared_ptr<Origin>> tried;
+        std::vector<pplx::cancellation_token_source> attempts;
+        std::shared_ptr<boost::asio::deadline_timer> hedge_timer;
+      };
+
+      /**
+       *  @return The origin expected to be fastest that is not in exclude and whose breaker lets a request
+       *          through, or nullptr if there is none
+       */
+      std::shared_ptr<Origin> select_origin(const std::vector<std::shared_ptr<Origin>>& exclude);
+
+      /**
+       *  Request the file of a fetch from one origin. Must be called with the fetch's mutex held.
+       */
+      void attempt(const std::shared_ptr<Fetch>& fetch, const std::shared_ptr<Origin>& origin, bool hedge);
+      void attempt_done(const std::shared_ptr<Fetch>& fetch, const std::shared_ptr<Origin>& origin, bool hedge,
+          std::shared_ptr<CdnFile> file, bool missing);
+      void schedule_hedge(const std::shared_ptr<Fetch>& fetch, const std::shared_ptr<Origin>& origin);
+
+      enum class Result {
+        Delivered,
+        Missing,      // the origin answered, but not with the file, e.g. 404
+        Failed        // 5xx, timeout or connection error
+      };
+
+      /**
+       *  @return The result of a request that yielded no file, from the status of its response or 0 if
+       *          there was none
+       */
+      static Result failed_request_result(web::http::status_code status);
+
+      void record_response(Origin& origin, double rtt_ms);
+      void record_result(Origin& origin, Result result, uint64_t bytes, double body_ms);
+
+      /**
+       *  Run a request job through the fetch engine, or directly if there is none
+       */
+      void dispatch(Origin& origin, int64_t priority, FetchEngine::job_t job);
+
+      pplx::task<std::shared_ptr<CdnFile>> read_body(const web::http::http_response& response, const std::string& path);
+
+      boost::asio::io_service& _io_service;
+      std::shared_ptr<BufferPool> _pool;
+      std::shared_ptr<FetchEngine> _engine;
+      std::string _stream;
+
+      bool _hedging = true;
+      unsigned _hedge_min_delay = 100;
+      unsigned _failure_threshold = 3;
+      unsigned _retry_interval = 5;
+      unsigned _max_retry_interval = 60;
+
+      mutable std::mutex _origins_mutex;
+      std::vector<std::shared_ptr<Origin>> _origins;
+      double _typical_size = 0;     // smoothed response size, weighs throughput against round trip time
+
+      std::mutex _in_flight_mutex;
+      std::map<std::string, pplx::task<std::shared_ptr<CdnFile>>> _in_flight;
   };
 }
@@ -17,19 +17,19 @@
 #include "CdnFile.h"
 #include "spdlog/spdlog.h"
 
-MBMS_RT::CdnFile::CdnFile(size_t length)
-  : _length( length )
+MBMS_RT::CdnFile::CdnFile(std::vector<uint8_t> data)
+  : _data( std::move(data) )
 {
-  spdlog::debug("CdnFile with size {} created", length);
-  _buffer = (char*)malloc(length);
-  if (_buffer == nullptr) {
-    throw "Failed to allocate CDN file buffer";
-  }
+  spdlog::debug("CdnFile with size {} created", _data.size());
+}
+
+MBMS_RT::CdnFile::CdnFile(std::shared_ptr<PooledBuffer> buffer, uint32_t length)
+  : _pooled( std::move(buffer) )
+  , _length( length )
+{
+  spdlog::debug("CdnFile with size {} created in pooled buffer of {}", _length, _pooled->capacity());
 }
 
 MBMS_RT::CdnFile::~CdnFile() {
   spdlog::debug("CdnFile destroyed");
-  if (_buffer != nullptr) {
-    free(_buffer);
-  }
 }
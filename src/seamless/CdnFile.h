@@ -17,17 +17,32 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include "BufferPool.h"
 
 namespace MBMS_RT {
+  /**
+   *  A file downloaded from the CDN. Takes ownership of the downloaded body without copying it, either
+   *  as a vector or as a buffer from the segment buffer pool.
+   */
   class CdnFile {
     public:
-      CdnFile(size_t length);
+      CdnFile(std::vector<uint8_t> data);
+      CdnFile(std::shared_ptr<PooledBuffer> buffer, uint32_t length);
       virtual ~CdnFile();
 
-      char* buffer() { return _buffer; };
-      uint32_t length() { return _length; };
+      char* buffer() { return _pooled ? _pooled->data() : reinterpret_cast<char*>(_data.data()); };
+      uint32_t length() const { return _pooled ? _length : _data.size(); };
+
+      /**
+       *  @return The memory held for the file, the full size class of a pooled buffer
+       */
+      uint32_t capacity() const { return _pooled ? _pooled->capacity() : _data.capacity(); };
     private:
-      char* _buffer = nullptr;
-      size_t _length;
+      std::vector<uint8_t> _data;
+      std::shared_ptr<PooledBuffer> _pooled;
+      uint32_t _length = 0;
   };
 }
@@ -0,0 +1,250 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "seamless/DashSeamlessContentStream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#include "spdlog/spdlog.h"
+
+static constexpr double LOSS_SMOOTHING = 0.2;
+
+MBMS_RT::DashSeamlessContentStream::DashSeamlessContentStream(std::string base, std::string flute_if,
+    boost::asio::io_service& io_service, CacheManagement& cache, DeliveryProtocol protocol,
+    const libconfig::Config& cfg, std::shared_ptr<PrefetchScheduler> prefetch, std::shared_ptr<FetchEngine> fetch_engine,
+    std::shared_ptr<RetentionBudget> retention)
+  : SeamlessContentStream(std::move(base), std::move(flute_if), io_service, cache, protocol, cfg,
+      std::move(prefetch), std::move(fetch_engine), std::move(retention))
+{
+}
+
+auto MBMS_RT::DashSeamlessContentStream::flute_file_received(std::shared_ptr<LibFlute::File> file) -> void {
+  const auto& location = file->meta().content_location;
+  spdlog::debug("DashSeamlessContentStream: {} (TOI {}, MIME type {}) has been received",
+      location, file->meta().toi, file->meta().content_type);
+
+  if (location == _playlist_path ||
+      (location.size() > 4 && location.compare(location.size() - 4, 4, ".mpd") == 0)) {
+    spdlog::info("DashSeamlessContentStream: got MPD at {}", location);
+    handle_playlist(std::string(file->buffer(), file->length()), ItemSource::Broadcast);
+    return;
+  }
+  auto it = _segments_by_uri.find(location);
+  if (it != _segments_by_uri.end()) {
+    it->second->set_flute_file(file);
+  } else {
+    _pending_files->add(file);
+  }
+}
+
+auto MBMS_RT::DashSeamlessContentStream::handle_playlist(const std::string& content, ItemSource source) -> void {
+  auto mpd = std::make_unique<DashMpd>(content);
+  if (!mpd->valid()) {
+    spdlog::warn("DashSeamlessContentStream: ignoring invalid MPD for {}", _playlist_path);
+    return;
+  }
+  auto now = time(nullptr);
+  _mpd_updates++;
+
+  if (source == ItemSource::Broadcast) {
+    _broadcast_playlist_received_at = now;
+    _broadcast_playlist_seqs.clear();
+    _broadcast_newest.clear();
+    for (const auto& rep : mpd->representations()) {
+      if (rep.segments.empty()) continue;
+      _broadcast_newest[rep.key] = rep.segments.back().number;
+      if (_broadcast_playlist_seqs.empty()) {
+        for (const auto& segment : rep.segments) {
+          _broadcast_playlist_seqs.push_back(static_cast<int>(segment.number));
+        }
+      }
+    }
+  }
+
+  bool same_structure = _mpd && _mpd->representations().size() == mpd->representations().size() &&
+    std::equal(_mpd->representations().begin(), _mpd->representations().end(), mpd->representations().begin(),
+        [](const auto& a, const auto& b) { return a.key == b.key; });
+  // With the disk tier, the timeline also keeps the segments that have left the memory window
+  auto keep = static_cast<size_t>(std::max(_segments_to_keep.load(), 1));
+  auto dvr_window = _cache.dvr_window();
+  auto listed = keep + dvr_window / static_cast<size_t>(std::max(_target_duration.load(), 1));
+  if (same_structure) {
+    _merged_segments += _mpd->merge(*mpd, now, listed);
+  } else {
+    if (_mpd) {
+      spdlog::info("DashSeamlessContentStream: representations of {} changed, replacing the MPD", _playlist_path);
+    }
+    // Parsing the same content again is cheaper than keeping the received MPD around for the loss check
+    _mpd = std::make_unique<DashMpd>(content);
+  }
+
+  _target_duration = std::max(static_cast<int>(std::ceil(_mpd->max_segment_duration())), 1);
+  if (dvr_window > 0 && _mpd->dynamic()) {
+    _mpd->set_time_shift_buffer_depth(std::max(mpd->time_shift_buffer_depth(),
+          static_cast<double>(keep * _target_duration)) + dvr_window);
+    _mpd->expand(now);
+  }
+  sync_segments();
+  if (source == ItemSource::Broadcast) {
+    sample_broadcast_loss(*mpd);
+  }
+  publish_mpd();
+}
+
+auto MBMS_RT::DashSeamlessContentStream::refresh_segments() -> void {
+  // Segments of @duration templates become available with time, without a new MPD
+  if (_mpd && _mpd->dynamic()) {
+    _mpd->expand(time(nullptr));
+    sync_segments();
+  }
+}
+
+auto MBMS_RT::DashSeamlessContentStream::sync_segments() -> void {
+  auto target_duration = std::max(_target_duration.load(), 1);
+  bool receiving_broadcast = !_broadcast_playlist_seqs.empty() &&
+    time(nullptr) - _broadcast_playlist_received_at <= target_duration * 3 / 2;
+  bool expect_on_broadcast = _max_broadcast_wait > 0 && receiving_broadcast;
+  auto keep = static_cast<size_t>(std::max(_segments_to_keep.load(), 1));
+
+  std::set<std::string> listed;
+  size_t count = 0;
+  for (const auto& rep : _mpd->representations()) {
+    listed.insert(rep.key);
+    auto& known = _representation_segments[rep.key];
+    if (!rep.initialization.empty()) {
+      auto init_uri = _playlist_dir + rep.initialization;
+      if (_segments_by_uri.find(init_uri) == _segments_by_uri.end()) {
+        _segments_by_uri[init_uri] = register_segment(init_uri, -1, target_duration, expect_on_broadcast);
+      }
+    }
+
+    auto first = rep.segments.size() > keep ? rep.segments.size() - keep : 0;
+    for (auto i = first; i < rep.segments.size(); i++) {
+      const auto& segment = rep.segments[i];
+      if (known.find(segment.number) != known.end()) {
+        continue;
+      }
+      auto full_uri = _playlist_dir + segment.uri;
+      auto seg = register_segment(full_uri, static_cast<int>(segment.number), segment.duration, expect_on_broadcast);
+      known[segment.number] = seg;
+      _segments_by_uri[full_uri] = seg;
+    }
+    while (known.size() > keep) {
+      auto oldest = known.begin();
+      spdlog::debug("Removing oldest segment and cache item at {}", oldest->second->uri());
+      _cache.remove_item(oldest->second->uri());
+      _segments_by_uri.erase(oldest->second->uri());
+      known.erase(oldest);
+    }
+    count += known.size();
+  }
+
+  for (auto it = _representation_segments.begin(); it != _representation_segments.end();) {
+    if (listed.count(it->first)) {
+      ++it;
+      continue;
+    }
+    for (const auto& segment : it->second) {
+      _cache.remove_item(segment.second->uri());
+      _segments_by_uri.erase(segment.second->uri());
+    }
+    it = _representation_segments.erase(it);
+  }
+  _representation_count = _mpd->representations().size();
+  _segment_count = count;
+}
+
+auto MBMS_RT::DashSeamlessContentStream::sample_broadcast_loss(const DashMpd& mpd) -> void {
+  for (const auto& rep : mpd.representations()) {
+    auto& sampled = _loss_sampled_number[rep.key];
+    const auto& known = _representation_segments[rep.key];
+    // The newest segment may legitimately still be in transmission
+    for (size_t i = 0; i + 1 < rep.segments.size(); i++) {
+      auto number = rep.segments[i].number;
+      if (number <= sampled) {
+        continue;
+      }
+      auto it = known.find(number);
+      if (it == known.end()) {
+        // Already out of the window, too old to say anything about current reception
+        continue;
+      }
+      bool lost = !it->second->received_over_broadcast();
+      _sampled_loss += LOSS_SMOOTHING * ((lost ? 1.0 : 0.0) - _sampled_loss);
+      sampled = number;
+    }
+  }
+}
+
+auto MBMS_RT::DashSeamlessContentStream::broadcast_on_time() -> bool {
+  auto target_duration = std::max(_target_duration.load(), 1);
+  if (_broadcast_newest.empty() || time(nullptr) - _broadcast_playlist_received_at > target_duration * 3 / 2) {
+    return false;
+  }
+  for (const auto& newest : _broadcast_newest) {
+    const auto& known = _representation_segments[newest.first];
+    auto it = known.find(newest.second - 1);
+    if (it != known.end() && !it->second->received_over_broadcast()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+auto MBMS_RT::DashSeamlessContentStream::newest_segments(unsigned count) -> std::vector<std::shared_ptr<Segment>> {
+  std::vector<std::shared_ptr<Segment>> newest;
+  for (const auto& rep : _representation_segments) {
+    unsigned taken = 0;
+    for (auto it = rep.second.rbegin(); it != rep.second.rend() && taken < count; ++it, ++taken) {
+      newest.push_back(it->second);
+    }
+  }
+  return newest;
+}
+
+auto MBMS_RT::DashSeamlessContentStream::retained_segments(size_t& positions) -> std::vector<std::shared_ptr<Segment>> {
+  // Initialization segments are included, their requests are demand for the representation as well
+  std::vector<std::shared_ptr<Segment>> segments;
+  segments.reserve(_segments_by_uri.size());
+  for (const auto& segment : _segments_by_uri) {
+    segments.push_back(segment.second);
+  }
+  positions = 0;
+  for (const auto& rep : _representation_segments) {
+    positions = std::max(positions, rep.second.size());
+  }
+  return segments;
+}
+
+auto MBMS_RT::DashSeamlessContentStream::publish_mpd() -> void {
+  if (!_playlist_item) {
+    return;
+  }
+  // A player should reload the MPD as often as it announces, or every half segment if it does not
+  auto update_period = _mpd->minimum_update_period();
+  _playlist_item->set_max_age(update_period > 0 ? std::max(static_cast<int>(update_period), 1) :
+      std::max(_target_duration.load() / 2, 1));
+  if (_playlist->publish(_mpd->to_string())) {
+    _cache.item_changed(_playlist_path);
+  }
+}
+
+auto MBMS_RT::DashSeamlessContentStream::mpd_stats() const -> MpdStats {
+  return { _representation_count, _segment_count, _mpd_updates, _merged_segments };
+}
@@ -0,0 +1,88 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "seamless/SeamlessContentStream.h"
+#include "DashMpd.h"
+
+namespace MBMS_RT {
+  /**
+   *  Seamless switching for a DASH stream.
+   *
+   *  The segments the MPD lists are registered ahead of their arrival, so a segment missing over broadcast
+   *  is fetched from the CDN instead of failing. MPDs from broadcast and from the CDN are merged and the
+   *  result is served at the MPD path.
+   */
+  class DashSeamlessContentStream : public SeamlessContentStream {
+    public:
+      DashSeamlessContentStream(std::string base, std::string flute_if, boost::asio::io_service& io_service,
+          CacheManagement& cache, DeliveryProtocol protocol, const libconfig::Config& cfg,
+          std::shared_ptr<PrefetchScheduler> prefetch = nullptr, std::shared_ptr<FetchEngine> fetch_engine = nullptr,
+          std::shared_ptr<RetentionBudget> retention = nullptr);
+      virtual ~DashSeamlessContentStream() = default;
+
+      virtual std::string stream_type_string() const { return "Seamless Switching (DASH)"; };
+      virtual void flute_file_received(std::shared_ptr<LibFlute::File> file);
+
+      struct MpdStats {
+        size_t representations;
+        size_t segments;
+        uint64_t updates;
+        uint64_t merged_segments;   // added to the served MPD from a later broadcast or CDN version
+      };
+      MpdStats mpd_stats() const;
+
+    protected:
+      virtual void handle_playlist(const std::string& content, ItemSource source);
+      virtual bool broadcast_on_time();
+      virtual void refresh_segments();
+
+      /**
+       *  @return Up to count of the newest segments of every representation. The player's choice of
+       *          representation is not known here, the prefetch budget bounds the cost.
+       */
+      virtual std::vector<std::shared_ptr<Segment>> newest_segments(unsigned count);
+      virtual std::vector<std::shared_ptr<Segment>> retained_segments(size_t& positions);
+
+    private:
+      /**
+       *  Register the listed media and initialization segments that are not known yet, and drop those
+       *  that slid out of the window
+       */
+      void sync_segments();
+      void sample_broadcast_loss(const DashMpd& mpd);
+      void publish_mpd();
+
+      std::unique_ptr<DashMpd> _mpd;
+      std::map<std::string, std::map<uint64_t, std::shared_ptr<Segment>>> _representation_segments;
+      std::unordered_map<std::string, std::shared_ptr<Segment>> _segments_by_uri;
+
+      // Newest segment number per representation in the last broadcast MPD
+      std::map<std::string, uint64_t> _broadcast_newest;
+      std::map<std::string, uint64_t> _loss_sampled_number;
+
+      std::atomic<size_t> _segment_count = 0;
+      std::atomic<size_t> _representation_count = 0;
+      std::atomic<uint64_t> _mpd_updates = 0;
+      std::atomic<uint64_t> _merged_segments = 0;
+  };
+}
@@ -0,0 +1,120 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "seamless/FetchEngine.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+using web::http::client::http_client;
+
+MBMS_RT::FetchEngine::FetchEngine(const libconfig::Config& cfg)
+{
+  cfg.lookupValue("mw.seamless_switching.cdn_fetch.max_parallel_per_origin", _max_parallel);
+  _max_parallel = std::max(_max_parallel, 1U);
+  unsigned timeout = 30;
+  cfg.lookupValue("mw.seamless_switching.cdn_fetch.timeout", timeout);
+  _client_config.set_timeout(std::chrono::seconds(timeout));
+  spdlog::info("CDN fetch engine running up to {} requests per origin", _max_parallel);
+}
+
+auto MBMS_RT::FetchEngine::submit(const std::string& origin, const std::string& stream, int64_t priority, job_t job) -> void
+{
+  std::shared_ptr<Origin> o;
+  Job next;
+  bool start = false;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto& entry = _origins[origin];
+    if (!entry) {
+      spdlog::debug("Fetch engine opening client for origin {}", origin);
+      entry = std::make_shared<Origin>();
+      entry->client = std::make_shared<http_client>(origin, _client_config);
+    }
+    o = entry;
+    o->queues[stream].push({ priority, _order++, std::chrono::steady_clock::now(), std::move(job) });
+    _queued++;
+    start = take_next(*o, next);
+  }
+  if (start) {
+    run(o, std::move(next));
+  }
+}
+
+auto MBMS_RT::FetchEngine::take_next(Origin& origin, Job& job) -> bool
+{
+  if (origin.active >= _max_parallel || origin.queues.empty()) {
+    return false;
+  }
+  auto it = origin.queues.upper_bound(origin.last_served);
+  if (it == origin.queues.end()) {
+    it = origin.queues.begin();
+  }
+  job = it->second.top();
+  it->second.pop();
+  origin.last_served = it->first;
+  if (it->second.empty()) {
+    origin.queues.erase(it);
+  }
+  origin.active++;
+  _queued--;
+  _active++;
+  _queue_wait.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job.queued_at).count());
+  return true;
+}
+
+auto MBMS_RT::FetchEngine::run(std::shared_ptr<Origin> origin, Job job) -> void
+{
+  auto started_at = std::chrono::steady_clock::now();
+  pplx::task<void> request;
+  try {
+    request = job.run(*origin->client);
+  } catch (const std::exception& ex) {
+    spdlog::debug("Fetch engine job failed to start: {}", ex.what());
+    request = pplx::task_from_result();
+  }
+
+  auto self = shared_from_this();
+  request.then([self, origin, started_at](pplx::task<void> result) {
+      try {
+        result.get();
+      } catch (const std::exception& ex) {
+        spdlog::debug("Fetch engine job failed: {}", ex.what());
+      }
+      Job next;
+      bool start = false;
+      {
+        const std::lock_guard<std::mutex> lock(self->_mutex);
+        self->_fetch_latency.record(
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_at).count());
+        self->_completed++;
+        self->_active--;
+        origin->active--;
+        start = self->take_next(*origin, next);
+      }
+      if (start) {
+        self->run(origin, std::move(next));
+      }
+    });
+}
+
+auto MBMS_RT::FetchEngine::stats() const -> Stats
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return { _origins.size(), _queued, _active, _completed, _queue_wait, _fetch_latency };
+}
@@ -0,0 +1,113 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+#include <libconfig.h++>
+#include "cpprest/http_client.h"
+#include "LatencyHistogram.h"
+
+namespace MBMS_RT {
+  /**
+   *  Schedules CDN requests of all streams.
+   *
+   *  Requests to one origin share one http_client, and with it its pool of keep-alive connections, and
+   *  at most max_parallel_per_origin of them run at a time. Queued requests are taken round robin
+   *  from the streams waiting on an origin, and within a stream highest priority first, so a stream
+   *  catching up after an outage gets the segments closest to the live edge first and cannot starve
+   *  the others. Configured in mw.seamless_switching.cdn_fetch.
+   */
+  class FetchEngine : public std::enable_shared_from_this<FetchEngine> {
+    public:
+      /**
+       *  A request on the origin's client. The slot is held until the returned task completes, so the
+       *  job should include reading the body.
+       */
+      typedef std::function<pplx::task<void>(web::http::client::http_client& client)> job_t;
+
+      FetchEngine(const libconfig::Config& cfg);
+      virtual ~FetchEngine() = default;
+      FetchEngine(const FetchEngine&) = delete;
+      FetchEngine& operator=(const FetchEngine&) = delete;
+
+      /**
+       *  Run a job against an origin, now if a slot is free, otherwise once it is this stream's turn.
+       *
+       *  @param origin Base URL, e.g. https://cdn.example.com
+       *  @param stream Identifies the stream the request is made for, for fair sharing
+       *  @param priority Higher runs first among the requests of one stream
+       */
+      void submit(const std::string& origin, const std::string& stream, int64_t priority, job_t job);
+
+      struct Stats {
+        size_t origins;
+        size_t queued;
+        size_t active;
+        uint64_t completed;
+        LatencyHistogram queue_wait;
+        LatencyHistogram fetch_latency;
+      };
+      Stats stats() const;
+
+    private:
+      struct Job {
+        int64_t priority;
+        uint64_t order;
+        std::chrono::steady_clock::time_point queued_at;
+        job_t run;
+        bool operator<(const Job& other) const {
+          // std::priority_queue pops the largest: highest priority, then first queued
+          return priority != other.priority ? priority < other.priority : order > other.order;
+        }
+      };
+      struct Origin {
+        std::shared_ptr<web::http::client::http_client> client;
+        unsigned active = 0;
+        std::map<std::string, std::priority_queue<Job>> queues;
+        std::string last_served;
+      };
+
+      /**
+       *  Take the next job of the stream after the one served last, and occupy a slot for it.
+       *  Must be called with _mutex held.
+       *
+       *  @return false if none is queued or all slots are busy
+       */
+      bool take_next(Origin& origin, Job& job);
+      void run(std::shared_ptr<Origin> origin, Job job);
+
+      unsigned _max_parallel = 6;
+      web::http::client::http_client_config _client_config;
+
+      mutable std::mutex _mutex;
+      std::map<std::string, std::shared_ptr<Origin>> _origins;
+      uint64_t _order = 0;
+      size_t _queued = 0;
+      size_t _active = 0;
+      uint64_t _completed = 0;
+      LatencyHistogram _queue_wait;
+      LatencyHistogram _fetch_latency;
+  };
+}
@@ -0,0 +1,111 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "PendingFileStore.h"
+#include "spdlog/spdlog.h"
+
+MBMS_RT::PendingFileStore::~PendingFileStore()
+{
+  _cache.release_external(_bytes);
+}
+
+auto MBMS_RT::PendingFileStore::add(std::shared_ptr<LibFlute::File> file) -> void
+{
+  uint64_t size = file->length();
+  uint64_t released = 0;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    const auto& location = file->meta().content_location;
+    auto existing = _files.find(location);
+    if (existing != _files.end()) {
+      released += existing->second.size;
+      drop(existing);
+      _dropped--;  // a replacement, not a drop
+    }
+    while (!_order.empty() && _bytes + size > _max_size) {
+      auto oldest = _files.find(_order.front());
+      spdlog::debug("Dropping pending file {}, staging area full", oldest->first);
+      released += oldest->second.size;
+      drop(oldest);
+    }
+    _order.push_back(location);
+    _files.emplace(location, Entry{std::move(file), time(nullptr), size, std::prev(_order.end())});
+    _bytes += size;
+  }
+  // Outside the lock, charging may evict cache items
+  _cache.release_external(released);
+  _cache.charge_external(size);
+}
+
+auto MBMS_RT::PendingFileStore::take(const std::string& location) -> std::shared_ptr<LibFlute::File>
+{
+  std::shared_ptr<LibFlute::File> file;
+  uint64_t released = 0;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _files.find(location);
+    if (it == _files.end()) {
+      _misses++;
+      return nullptr;
+    }
+    _hits++;
+    file = it->second.file;
+    released = it->second.size;
+    _order.erase(it->second.order_pos);
+    _bytes -= it->second.size;
+    _files.erase(it);
+  }
+  // The file is now held by a cache item, which accounts for it
+  _cache.release_external(released);
+  return file;
+}
+
+auto MBMS_RT::PendingFileStore::expire() -> void
+{
+  auto now = time(nullptr);
+  uint64_t released = 0;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    while (!_order.empty()) {
+      auto oldest = _files.find(_order.front());
+      if (now - oldest->second.added_at <= static_cast<time_t>(_max_age)) {
+        break;
+      }
+      spdlog::debug("Dropping pending file {}, never referenced by a playlist", oldest->first);
+      released += oldest->second.size;
+      drop(oldest);
+    }
+  }
+  if (released > 0) {
+    _cache.release_external(released);
+  }
+}
+
+auto MBMS_RT::PendingFileStore::stats() const -> Stats
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return Stats{ _files.size(), _bytes, _hits, _misses, _dropped };
+}
+
+// Must be called with _mutex held
+auto MBMS_RT::PendingFileStore::drop(std::unordered_map<std::string, Entry>::iterator it) -> void
+{
+  _order.erase(it->second.order_pos);
+  _bytes -= it->second.size;
+  _files.erase(it);
+  _dropped++;
+}
@@ -0,0 +1,89 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "File.h"
+#include "CacheManagement.h"
+
+namespace MBMS_RT {
+  /**
+   *  Staging area for FLUTE files that arrive before the playlist entry referring to them.
+   *
+   *  Files are indexed by content location and dropped after max_age seconds, or oldest first once
+   *  the staged bytes exceed max_size. Staged bytes are charged to the cache budget.
+   */
+  class PendingFileStore {
+    public:
+      PendingFileStore(CacheManagement& cache, unsigned max_age, uint64_t max_size)
+        : _cache( cache ), _max_age( max_age ), _max_size( max_size ) {};
+      virtual ~PendingFileStore();
+      PendingFileStore(const PendingFileStore&) = delete;
+      PendingFileStore& operator=(const PendingFileStore&) = delete;
+
+      /**
+       *  Stage a file, replacing a previously staged file at the same location
+       */
+      void add(std::shared_ptr<LibFlute::File> file);
+
+      /**
+       *  Remove and return the file staged for a location.
+       *
+       *  @return The file, or nullptr if none is staged (counted as a miss)
+       */
+      std::shared_ptr<LibFlute::File> take(const std::string& location);
+
+      /**
+       *  Drop all files older than max_age
+       */
+      void expire();
+
+      struct Stats {
+        size_t count;
+        uint64_t bytes;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t dropped;
+      };
+      Stats stats() const;
+
+    private:
+      struct Entry {
+        std::shared_ptr<LibFlute::File> file;
+        time_t added_at;
+        uint64_t size;
+        std::list<std::string>::iterator order_pos;
+      };
+      void drop(std::unordered_map<std::string, Entry>::iterator it);
+
+      CacheManagement& _cache;
+      unsigned _max_age;
+      uint64_t _max_size;
+
+      mutable std::mutex _mutex;
+      std::unordered_map<std::string, Entry> _files;
+      std::list<std::string> _order;          // oldest first
+      uint64_t _bytes = 0;
+      uint64_t _hits = 0;
+      uint64_t _misses = 0;
+      uint64_t _dropped = 0;
+  };
+}
@@ -0,0 +1,120 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "seamless/PrefetchScheduler.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+static constexpr double CINR_SMOOTHING = 0.3;
+
+MBMS_RT::PrefetchScheduler::PrefetchScheduler(const libconfig::Config& cfg)
+{
+  cfg.lookupValue("mw.seamless_switching.prefetch.enabled", _enabled);
+  cfg.lookupValue("mw.seamless_switching.prefetch.cinr_threshold", _cinr_threshold);
+  cfg.lookupValue("mw.seamless_switching.prefetch.cinr_horizon", _cinr_horizon);
+  cfg.lookupValue("mw.seamless_switching.prefetch.loss_threshold", _loss_threshold);
+  cfg.lookupValue("mw.seamless_switching.prefetch.max_segments", _max_segments);
+  unsigned bandwidth_kbps = 8000;
+  cfg.lookupValue("mw.seamless_switching.prefetch.bandwidth_kbps", bandwidth_kbps);
+  _bytes_per_second = bandwidth_kbps * 1000.0 / 8;
+  _burst_bytes = _bytes_per_second * 2;
+  _budget = _burst_bytes;
+  _refilled_at = std::chrono::steady_clock::now();
+  if (_enabled) {
+    spdlog::info("CDN prefetch enabled below {} dB CINR or {}% broadcast loss, up to {} segments within {} kbps",
+        _cinr_threshold, _loss_threshold * 100, _max_segments, bandwidth_kbps);
+  }
+}
+
+auto MBMS_RT::PrefetchScheduler::update_cinr(double cinr_db) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto now = std::chrono::steady_clock::now();
+  if (!_cinr_known) {
+    _cinr = cinr_db;
+    _cinr_slope = 0;
+    _cinr_known = true;
+  } else {
+    auto dt = std::chrono::duration<double>(now - _cinr_updated_at).count();
+    auto previous = _cinr;
+    _cinr += CINR_SMOOTHING * (cinr_db - _cinr);
+    if (dt > 0) {
+      _cinr_slope += CINR_SMOOTHING * ((_cinr - previous) / dt - _cinr_slope);
+    }
+  }
+  _cinr_updated_at = now;
+}
+
+auto MBMS_RT::PrefetchScheduler::depth(double loss_rate) const -> unsigned
+{
+  if (!_enabled || _max_segments == 0) {
+    return 0;
+  }
+  bool cinr_low = false;
+  bool cinr_falling = false;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (_cinr_known) {
+      cinr_low = _cinr < _cinr_threshold;
+      cinr_falling = _cinr + _cinr_slope * _cinr_horizon < _cinr_threshold;
+    }
+  }
+  if (cinr_low || loss_rate >= 2 * _loss_threshold) {
+    return _max_segments;
+  }
+  if (cinr_falling || loss_rate >= _loss_threshold) {
+    return (_max_segments + 1) / 2;
+  }
+  return 0;
+}
+
+auto MBMS_RT::PrefetchScheduler::refill() -> void
+{
+  auto now = std::chrono::steady_clock::now();
+  _budget = std::min(_burst_bytes,
+      _budget + std::chrono::duration<double>(now - _refilled_at).count() * _bytes_per_second);
+  _refilled_at = now;
+}
+
+auto MBMS_RT::PrefetchScheduler::try_acquire(uint64_t estimated_bytes) -> bool
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  refill();
+  if (_budget >= static_cast<double>(estimated_bytes) || _budget >= _burst_bytes) {
+    _budget -= static_cast<double>(estimated_bytes);
+    return true;
+  }
+  _rejected++;
+  return false;
+}
+
+auto MBMS_RT::PrefetchScheduler::release(uint64_t estimated_bytes, uint64_t transferred_bytes) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  refill();
+  _budget = std::min(_burst_bytes,
+      _budget + static_cast<double>(estimated_bytes) - static_cast<double>(transferred_bytes));
+}
+
+auto MBMS_RT::PrefetchScheduler::stats() const -> Stats
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return { _cinr_known, _cinr, _cinr_slope, _budget, _rejected };
+}
@@ -0,0 +1,95 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <libconfig.h++>
+
+namespace MBMS_RT {
+  /**
+   *  Decides how far seamless switching streams download ahead from the CDN while broadcast reception
+   *  degrades, and keeps those downloads within a unicast bandwidth budget.
+   *
+   *  Reception quality is judged from the modem's CINR trend, fed in by the middleware, and from the
+   *  FLUTE loss rate each stream observes. Configured in mw.seamless_switching.prefetch.
+   */
+  class PrefetchScheduler {
+    public:
+      PrefetchScheduler(const libconfig::Config& cfg);
+      virtual ~PrefetchScheduler() = default;
+
+      bool enabled() const { return _enabled; };
+
+      /**
+       *  Add a CINR sample in dB
+       */
+      void update_cinr(double cinr_db);
+
+      /**
+       *  @param loss_rate Fraction of recent broadcast segments of a stream that did not arrive complete
+       *  @return The number of upcoming segments the stream should prefetch from the CDN, 0 if none
+       */
+      unsigned depth(double loss_rate) const;
+
+      /**
+       *  Reserve budget for a prefetch of about estimated_bytes. A request larger than the burst size is
+       *  granted once the budget is full.
+       *
+       *  @return false if the budget is exhausted
+       */
+      bool try_acquire(uint64_t estimated_bytes);
+
+      /**
+       *  Settle a reservation once the prefetch finished. Budget that was not used, because the
+       *  download failed, was cancelled or was smaller than estimated, is returned.
+       */
+      void release(uint64_t estimated_bytes, uint64_t transferred_bytes);
+
+      struct Stats {
+        bool cinr_known;
+        double cinr_db;             // smoothed
+        double cinr_slope;          // dB per second, smoothed
+        double budget_bytes;        // currently available
+        uint64_t rejected;          // prefetches refused for lack of budget
+      };
+      Stats stats() const;
+
+    private:
+      void refill();
+
+      bool _enabled = false;
+      double _cinr_threshold = 5.0;
+      double _cinr_horizon = 5.0;
+      double _loss_threshold = 0.05;
+      unsigned _max_segments = 3;
+      double _bytes_per_second = 8000.0 * 1000 / 8;
+      double _burst_bytes = 0;
+
+      mutable std::mutex _mutex;
+      bool _cinr_known = false;
+      double _cinr = 0;
+      double _cinr_slope = 0;
+      std::chrono::steady_clock::time_point _cinr_updated_at;
+      double _budget = 0;
+      std::chrono::steady_clock::time_point _refilled_at;
+      uint64_t _rejected = 0;
+  };
+}
@@ -0,0 +1,150 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "seamless/RetentionBudget.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+MBMS_RT::RetentionBudget::RetentionBudget(const libconfig::Config& cfg)
+{
+  cfg.lookupValue("mw.seamless_switching.retention.enabled", _enabled);
+  cfg.lookupValue("mw.seamless_switching.retention.min_segments", _min_segments);
+  cfg.lookupValue("mw.seamless_switching.retention.idle_timeout", _idle_timeout);
+  cfg.lookupValue("mw.seamless_switching.retention.rate_smoothing", _rate_smoothing);
+  unsigned total_size = 0;
+  cfg.lookupValue("mw.seamless_switching.retention.total_size", total_size);
+  if (total_size == 0) {
+    total_size = 512;
+    cfg.lookupValue("mw.cache.max_total_size", total_size);
+  }
+  _total_size = static_cast<uint64_t>(total_size) * 1024 * 1024;
+  _min_segments = std::max(_min_segments, 1U);
+  _idle_timeout = std::max(_idle_timeout, 1U);
+  if (_enabled) {
+    spdlog::info("Segment retention shares {} MB by demand, at least {} segments per stream, idle after {} s",
+        total_size, _min_segments, _idle_timeout);
+  }
+}
+
+auto MBMS_RT::RetentionBudget::idle(const Stream& stream, std::chrono::steady_clock::time_point now) const -> bool
+{
+  return now - stream.requested_at > std::chrono::seconds(_idle_timeout);
+}
+
+auto MBMS_RT::RetentionBudget::update(const void* stream, uint64_t requests, uint64_t segment_bytes,
+    unsigned max_segments) -> unsigned
+{
+  if (!_enabled) {
+    return max_segments;
+  }
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto now = std::chrono::steady_clock::now();
+  auto [it, inserted] = _streams.try_emplace(stream);
+  auto& entry = it->second;
+  if (inserted) {
+    // A new stream gets the idle timeout to attract its first requests before it shrinks
+    entry.requested_at = now;
+  } else {
+    auto dt = std::chrono::duration<double>(now - entry.reported_at).count();
+    if (dt > 0) {
+      entry.rate += _rate_smoothing * (requests / dt - entry.rate);
+    }
+  }
+  if (requests > 0) {
+    entry.requested_at = now;
+  }
+  entry.reported_at = now;
+  entry.segment_bytes = segment_bytes;
+  entry.max_segments = max_segments;
+
+  distribute(now);
+  return entry.segments;
+}
+
+auto MBMS_RT::RetentionBudget::distribute(std::chrono::steady_clock::time_point now) -> void
+{
+  // Reserve the minimum window of every stream, then fill the active ones up by weight. A stream
+  // that reaches its maximum hands its excess back to the others.
+  uint64_t spare = _total_size;
+  std::vector<std::pair<Stream*, double>> open;
+  for (auto& [key, stream] : _streams) {
+    auto floor = std::min(_min_segments, stream.max_segments);
+    stream.segments = floor;
+    if (stream.segment_bytes == 0) {
+      // Nothing retained yet, so there is nothing to size the window by
+      stream.segments = stream.max_segments;
+      stream.budget = 0;
+      continue;
+    }
+    stream.budget = floor * stream.segment_bytes;
+    spare -= std::min(spare, stream.budget);
+    if (!idle(stream, now) && stream.segments < stream.max_segments) {
+      // Active streams that see no requests right now still get a small share
+      open.emplace_back(&stream, stream.rate + 1.0 / _idle_timeout);
+    }
+  }
+
+  while (spare > 0 && !open.empty()) {
+    double weights = 0;
+    for (const auto& candidate : open) {
+      weights += candidate.second;
+    }
+    uint64_t handed_back = 0;
+    bool capped = false;
+    for (auto candidate = open.begin(); candidate != open.end();) {
+      auto& stream = *candidate->first;
+      auto share = static_cast<uint64_t>(spare * (candidate->second / weights));
+      auto limit = static_cast<uint64_t>(stream.max_segments) * stream.segment_bytes;
+      if (stream.budget + share >= limit) {
+        handed_back += stream.budget + share - limit;
+        stream.budget = limit;
+        stream.segments = stream.max_segments;
+        candidate = open.erase(candidate);
+        capped = true;
+      } else {
+        stream.budget += share;
+        stream.segments = static_cast<unsigned>(stream.budget / stream.segment_bytes);
+        ++candidate;
+      }
+    }
+    if (!capped) {
+      break;
+    }
+    // Only the excess of streams that reached their maximum is shared again
+    spare = handed_back;
+  }
+}
+
+auto MBMS_RT::RetentionBudget::unregister(const void* stream) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  _streams.erase(stream);
+}
+
+auto MBMS_RT::RetentionBudget::stream_stats(const void* stream) const -> StreamStats
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _streams.find(stream);
+  if (it == _streams.end()) {
+    return {};
+  }
+  return { it->second.rate, idle(it->second, std::chrono::steady_clock::now()), it->second.budget,
+    it->second.segments };
+}
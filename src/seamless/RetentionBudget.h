@@ -0,0 +1,84 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <libconfig.h++>
+
+namespace MBMS_RT {
+  /**
+   *  Splits a byte budget for retained segments between the seamless switching streams.
+   *
+   *  Every stream keeps at least min_segments. The rest of the budget is shared in proportion to
+   *  the rate at which each stream's segments are requested, so popular renditions keep a long window
+   *  and renditions nobody watches shrink to the minimum. CacheManagement still enforces the overall
+   *  cache limits. Configured in mw.seamless_switching.retention.
+   */
+  class RetentionBudget {
+    public:
+      RetentionBudget(const libconfig::Config& cfg);
+      virtual ~RetentionBudget() = default;
+
+      bool enabled() const { return _enabled; };
+
+      /**
+       *  Report the current demand of a stream and get the number of segments it should keep.
+       *
+       *  @param stream         Identifies the stream until unregister is called
+       *  @param requests       Segment requests served since the previous report
+       *  @param segment_bytes  Average size of one retained segment position, over all renditions the
+       *                        stream carries
+       *  @param max_segments   Upper limit of the stream, mw.cache.max_segments_per_stream
+       */
+      unsigned update(const void* stream, uint64_t requests, uint64_t segment_bytes, unsigned max_segments);
+      void unregister(const void* stream);
+
+      struct StreamStats {
+        double request_rate;      // segment requests per second, smoothed
+        bool idle;
+        uint64_t budget_bytes;
+        unsigned segments;
+      };
+      StreamStats stream_stats(const void* stream) const;
+
+    private:
+      struct Stream {
+        double rate = 0;
+        uint64_t segment_bytes = 0;
+        unsigned max_segments = 0;
+        std::chrono::steady_clock::time_point reported_at;
+        std::chrono::steady_clock::time_point requested_at;  // registration counts as a request
+        uint64_t budget = 0;
+        unsigned segments = 0;
+      };
+      bool idle(const Stream& stream, std::chrono::steady_clock::time_point now) const;
+      void distribute(std::chrono::steady_clock::time_point now);
+
+      bool _enabled = true;
+      uint64_t _total_size = 0;
+      unsigned _min_segments = 3;
+      unsigned _idle_timeout = 60;
+      double _rate_smoothing = 0.2;
+
+      mutable std::mutex _mutex;
+      std::unordered_map<const void*, Stream> _streams;
+  };
+}
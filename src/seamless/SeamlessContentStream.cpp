@@ -17,28 +17,48 @@
 
 #include <regex>
 #include "SeamlessContentStream.h"
+#include "Logging.h"
 #include "CdnClient.h"
 #include "CacheItems.h"
 #include "HlsMediaPlaylist.h"
 #include <libgen.h>
+#include <algorithm>
+#include <limits>
 
 #include "spdlog/spdlog.h"
 #include "cpprest/base_uri.h"
 
 MBMS_RT::SeamlessContentStream::SeamlessContentStream(std::string base, std::string flute_if,
                                                       boost::asio::io_service &io_service, CacheManagement &cache,
-                                                      DeliveryProtocol protocol, const libconfig::Config &cfg)
+                                                      DeliveryProtocol protocol, const libconfig::Config &cfg,
+                                                      std::shared_ptr<PrefetchScheduler> prefetch,
+                                                      std::shared_ptr<FetchEngine> fetch_engine,
+                                                      std::shared_ptr<RetentionBudget> retention)
     : ContentStream(std::move(base), std::move(flute_if), io_service, cache, protocol, cfg), _tick_interval(1),
-      _timer(io_service, _tick_interval) {
-  cfg.lookupValue("mw.cache.max_segments_per_stream", _segments_to_keep);
+      _timer(io_service, _tick_interval), _jitter_rng(std::random_device{}()), _prefetch(std::move(prefetch)),
+      _fetch_engine(std::move(fetch_engine)), _retention(std::move(retention)) {
+  cfg.lookupValue("mw.cache.max_segments_per_stream", _max_segments_to_keep);
+  _segments_to_keep = _max_segments_to_keep;
   cfg.lookupValue("mw.seamless_switching.truncate_cdn_playlist_segments", _truncate_cdn_playlist_segments);
-  _timer.async_wait(boost::bind(&SeamlessContentStream::tick_handler, this)); //NOLINT
+  cfg.lookupValue("mw.seamless_switching.max_poll_backoff", _max_poll_backoff);
+  cfg.lookupValue("mw.seamless_switching.max_broadcast_wait", _max_broadcast_wait);
+
+  unsigned pending_max_age = 30;
+  unsigned pending_max_size = 32;
+  cfg.lookupValue("mw.seamless_switching.pending_files_max_age", pending_max_age);
+  cfg.lookupValue("mw.seamless_switching.pending_files_max_size", pending_max_size);
+  _pending_files = std::make_unique<PendingFileStore>(cache, pending_max_age,
+      static_cast<uint64_t>(pending_max_size) * 1024 * 1024);
+  _timer.async_wait(_strand.wrap(boost::bind(&SeamlessContentStream::tick_handler, this))); //NOLINT
 }
 
 MBMS_RT::SeamlessContentStream::~SeamlessContentStream() {
   spdlog::debug("Destroying seamless content stream at base {}", _base);
   _running = false;
   _timer.cancel();
+  if (_retention) {
+    _retention->unregister(this);
+  }
 }
 
 auto MBMS_RT::SeamlessContentStream::flute_file_received(std::shared_ptr<LibFlute::File> file) -> void {
@@ -46,13 +66,22 @@ auto MBMS_RT::SeamlessContentStream::flute_file_received(std::shared_ptr<LibFlut
                 file->meta().content_location, file->meta().toi, file->meta().content_type);
 
   if (file->meta().content_location == _playlist_path) {
-    spdlog::info("ContentStream: got PLAYLIST at {}", file->meta().content_location);
+    static Logging::RateLimitedLog playlist_log(Logging::Category::Stream);
+    playlist_log.info("ContentStream: got PLAYLIST at {}", file->meta().content_location);
     handle_playlist(std::string(file->buffer(), file->length()), MBMS_RT::ItemSource::Broadcast);
   } else if (file->meta().content_location == "index.m3u8") {
     // ignore the pathless master manifest generated by the core
   } else {
-    spdlog::info("ContentStream: got SEGMENT at {}", file->meta().content_location);
-    _flute_files[file->meta().content_location] = file;
+    static Logging::RateLimitedLog segment_log(Logging::Category::Stream);
+    segment_log.info("ContentStream: got SEGMENT at {}", file->meta().content_location);
+    // The playlist may already list this segment if it was first seen on the CDN playlist
+    for (const auto& seg : _segments) {
+      if (seg.second->uri() == file->meta().content_location) {
+        seg.second->set_flute_file(file);
+        return;
+      }
+    }
+    _pending_files->add(file);
   }
 }
 
@@ -75,23 +104,39 @@ auto MBMS_RT::SeamlessContentStream::set_cdn_endpoint(const std::string &cdn_ept
   _cdn_endpoint = cdn_base.to_string();
   spdlog::info("ContentStream: setting CDN ept for {} to {}", cdn_ept, _cdn_endpoint);
 
-  _cdn_client = std::make_shared<CdnClient>(_cdn_endpoint);
+  _cdn_client = std::make_shared<CdnClient>(_cfg, _io_service, _cdn_endpoint, _cache.buffer_pool(), _fetch_engine,
+      _playlist_path);
 
-  _cache.add_item(std::make_shared<CachedPlaylist>(
-      _playlist_path,
-      0,
-      [&]() -> const std::string & {
-        spdlog::debug("ContentStream: {} playlist requested", _playlist_path);
-        return _playlist;
-      }
-  ));
+  _playlist_item = std::make_shared<CachedPlaylist>(_playlist_path, 0, _playlist);
+  // Revalidate until the target duration is known
+  _playlist_item->set_max_age(0);
+  _cache.add_item(_playlist_item);
 };
 
+auto MBMS_RT::SeamlessContentStream::add_cdn_endpoint(const std::string &cdn_ept) -> void {
+  if (!_cdn_client) {
+    set_cdn_endpoint(cdn_ept);
+    return;
+  }
+  web::uri uri(cdn_ept);
+  std::string path = uri.path();
+  std::string playlist_path = path.erase(0, 1);
+  if (uri.query().length() > 0) {
+    playlist_path += "?" + uri.query();
+  }
+  if (playlist_path != _playlist_path) {
+    spdlog::warn("ContentStream: ignoring CDN ept {}, its playlist path differs from {}", cdn_ept, _playlist_path);
+    return;
+  }
+  web::uri_builder cdn_base(cdn_ept);
+  cdn_base.set_path("");
+  cdn_base.set_query("");
+  _cdn_client->add_origin(cdn_base.to_string());
+}
+
 
 auto MBMS_RT::SeamlessContentStream::handle_playlist(const std::string &content, ItemSource source) -> void {
   auto playlist = MBMS_RT::HlsMediaPlaylist(content);
-  int seq = 0;
-  double extinf = 0;
 
   auto count = playlist.segments().size();
   if (source == ItemSource::CDN) {
@@ -99,65 +144,325 @@ auto MBMS_RT::SeamlessContentStream::handle_playlist(const std::string &content,
   }
   int idx = 0;
 
-  const std::lock_guard<std::mutex> lock(_segments_mutex);
+  if (playlist.target_duration() > 0) {
+    _target_duration = playlist.target_duration();
+  }
+
+  bool changed = false;
+  if (source == ItemSource::Broadcast) {
+    _broadcast_playlist_received_at = time(nullptr);
+    _broadcast_playlist_seqs.clear();
+    for (const auto &segment: playlist.segments()) {
+      _broadcast_playlist_seqs.push_back(segment.seq);
+    }
+  }
+  bool sample_loss = source == ItemSource::Broadcast;
+  // Segments that broadcast is currently carrying, or will carry next, are worth waiting for instead
+  // of sending requests for them straight to the CDN
+  bool receiving_broadcast = !_broadcast_playlist_seqs.empty() &&
+    time(nullptr) - _broadcast_playlist_received_at <= std::max(_target_duration.load(), 1) * 3 / 2;
   for (const auto &segment: playlist.segments()) {
     spdlog::debug("segment: seq {}, extinf {}, uri {}", segment.seq, segment.extinf, segment.uri);
     if (_segments.find(segment.seq) == _segments.end()) {
       std::string full_uri = _playlist_dir + segment.uri;
-      auto seg =
-          std::make_shared<Segment>(full_uri, segment.seq, segment.extinf);
-      if (_cdn_client) {
-        seg->set_cdn_client(_cdn_client);
-      }
-
-      if (_flute_files.find(full_uri) != _flute_files.end()) {
-        seg->set_flute_file(_flute_files[full_uri]);
-        _flute_files.erase(full_uri);
-        spdlog::debug("Assigned already received flute file");
-      }
-
+      auto seg = register_segment(full_uri, segment.seq, segment.extinf, _max_broadcast_wait > 0 && receiving_broadcast &&
+          (source == ItemSource::Broadcast || segment.seq > _broadcast_playlist_seqs.back()));
       _segments[segment.seq] = seg;
-
-      _cache.add_item(std::make_shared<CachedSegment>(
-          full_uri, 0, seg)
-      );
+      _playlist_writer.add_segment({full_uri, segment.seq, segment.extinf});
+      changed = true;
     }
     if (idx++ > count) {
       break;
     }
   }
 
+  if (sample_loss) {
+    // After the new segments are known, so a playlist naming a segment not seen yet counts it as lost
+    sample_broadcast_loss();
+  }
+
   while (_segments.size() > _segments_to_keep) {
     auto seg = _segments.extract(_segments.begin());
     spdlog::debug("Removing oldest segment and cache item at {}", seg.mapped()->uri());
     _cache.remove_item(seg.mapped()->uri());
+    if (_cache.dvr_window() > 0) {
+      // Still listed for time-shifted playback, the disk tier serves it from now on
+      _dvr_segments.emplace_back(seg.key(), seg.mapped()->extinf());
+      _dvr_duration += seg.mapped()->extinf();
+    } else {
+      _playlist_writer.remove_segment(seg.key());
+    }
+    changed = true;
+  }
+  while (!_dvr_segments.empty() && _dvr_duration > _cache.dvr_window()) {
+    _playlist_writer.remove_segment(_dvr_segments.front().first);
+    _dvr_duration -= _dvr_segments.front().second;
+    _dvr_segments.pop_front();
+    changed = true;
+  }
+  if (!changed) {
+    return;
+  }
+  // [TODO] this will fail when targetdurations change or do not match
+  _playlist_writer.set_target_duration(playlist.target_duration());
+  if (_playlist_item && playlist.target_duration() > 0) {
+    // Half a target duration, like a player reloading an unchanged live playlist
+    _playlist_item->set_max_age(std::max(playlist.target_duration() / 2, 1));
+  }
+  if (_playlist->publish(_playlist_writer.to_string())) {
+    _cache.item_changed(_playlist_path);
+  }
+}
+
+auto MBMS_RT::SeamlessContentStream::register_segment(const std::string& full_uri, int seq, double duration,
+    bool expect_on_broadcast) -> std::shared_ptr<Segment> {
+  auto seg = std::make_shared<Segment>(full_uri, seq, duration);
+  if (seg->trace()) {
+    seg->trace()->matched(_playlist_path);
+  }
+  if (_cdn_client) {
+    seg->set_cdn_client(_cdn_client);
   }
-  HlsMediaPlaylist pl;
-  pl.set_target_duration(
-      playlist.target_duration());  // [TODO] this will fail when targetdurations change or do not match
-  for (const auto &seg: _segments) {
-    HlsMediaPlaylist::Segment s{
-        seg.second->uri(),
-        seg.second->seq(),
-        seg.second->extinf(),
-    };
-    pl.add_segment(s);
+  seg->set_data_callback([&cache = _cache, full_uri]() { cache.item_changed(full_uri); });
+  std::weak_ptr<ContentStream> weak_self = shared_from_this();
+  seg->set_partial_source([weak_self](const std::string& location) -> Segment::PartialObject {
+    auto self = std::static_pointer_cast<SeamlessContentStream>(weak_self.lock());
+    return self ? self->partial_flute_object(location) : Segment::PartialObject{};
+  });
+  seg->set_run_source([weak_self](const std::string& location, uint64_t offset, std::vector<uint8_t>& chunk,
+        uint64_t& length) {
+    auto self = std::static_pointer_cast<SeamlessContentStream>(weak_self.lock());
+    return self && self->find_flute_run(location, offset, chunk, length);
+  });
+  if (expect_on_broadcast) {
+    seg->expect_on_broadcast(_io_service, boost::posix_time::milliseconds(_max_broadcast_wait));
   }
-  _playlist = pl.to_string();
+
+  if (auto file = _pending_files->take(full_uri)) {
+    seg->set_flute_file(file);
+    spdlog::debug("Assigned already received flute file");
+  }
+
+  auto item = std::make_shared<CachedSegment>(full_uri, 0, seg);
+  // A segment never changes, and it is listed until it slides out of the window
+  item->set_max_age(static_cast<int>(duration * _segments_to_keep));
+  _cache.add_item(item);
+  return seg;
+}
+
+auto MBMS_RT::SeamlessContentStream::partial_flute_object(const std::string& content_location) -> Segment::PartialObject {
+  Segment::PartialObject partial;
+  return find_partial_flute_file(content_location, partial.received, partial.data) ? partial : Segment::PartialObject{};
+}
+
+auto MBMS_RT::SeamlessContentStream::broadcast_on_time() -> bool {
+  auto target_duration = std::max(_target_duration.load(), 1);
+  if (_broadcast_playlist_seqs.empty() ||
+      time(nullptr) - _broadcast_playlist_received_at > target_duration * 3 / 2) {
+    return false;
+  }
+  // The newest segment may legitimately still be in transmission
+  for (size_t i = 0; i + 1 < _broadcast_playlist_seqs.size(); i++) {
+    auto it = _segments.find(_broadcast_playlist_seqs[i]);
+    if (it == _segments.end() || it->second->data_source() != ItemSource::Broadcast) {
+      return false;
+    }
+  }
+  return true;
+}
+
+auto MBMS_RT::SeamlessContentStream::sample_broadcast_loss() -> void {
+  static constexpr double LOSS_SMOOTHING = 0.2;
+  // The newest segment may legitimately still be in transmission
+  for (size_t i = 0; i + 1 < _broadcast_playlist_seqs.size(); i++) {
+    auto seq = _broadcast_playlist_seqs[i];
+    if (seq <= _loss_sampled_seq) {
+      continue;
+    }
+    auto it = _segments.find(seq);
+    bool lost = it == _segments.end() || !it->second->received_over_broadcast();
+    _sampled_loss += LOSS_SMOOTHING * ((lost ? 1.0 : 0.0) - _sampled_loss);
+    _loss_sampled_seq = seq;
+  }
+}
+
+auto MBMS_RT::SeamlessContentStream::prefetch_segments() -> void {
+  // Segments of streams without a known bandwidth are budgeted at a fixed size
+  static constexpr uint64_t DEFAULT_SEGMENT_BYTES = 1024 * 1024;
+
+  auto depth = _prefetch->depth(_broadcast_loss);
+  if (depth == 0) {
+    return;
+  }
+  for (const auto& seg : newest_segments(depth)) {
+    if (seg->covered()) {
+      continue;
+    }
+    uint64_t estimate = bandwidth() > 0 ?
+      static_cast<uint64_t>(bandwidth() / 8 * seg->extinf()) : DEFAULT_SEGMENT_BYTES;
+    if (!_prefetch->try_acquire(estimate)) {
+      spdlog::debug("Prefetch budget exhausted, not prefetching {}", seg->uri());
+      break;
+    }
+    _prefetch_started++;
+    std::weak_ptr<ContentStream> weak_self = shared_from_this();
+    seg->prefetch_from_cdn()
+      .then([weak_self, prefetch = _prefetch, estimate](Segment::PrefetchResult result) {
+          prefetch->release(estimate, result.bytes);
+          auto self = std::static_pointer_cast<SeamlessContentStream>(weak_self.lock());
+          if (!self) return;
+          if (result.cancelled) {
+            self->_prefetch_cancelled++;
+          } else if (result.bytes > 0) {
+            self->_prefetch_completed++;
+          } else {
+            self->_prefetch_failed++;
+          }
+          self->_prefetch_bytes += result.bytes;
+        });
+  }
+}
+
+auto MBMS_RT::SeamlessContentStream::newest_segments(unsigned count) -> std::vector<std::shared_ptr<Segment>> {
+  std::vector<std::shared_ptr<Segment>> newest;
+  for (auto it = _segments.rbegin(); it != _segments.rend() && newest.size() < count; ++it) {
+    newest.push_back(it->second);
+  }
+  return newest;
+}
+
+auto MBMS_RT::SeamlessContentStream::retained_segments(size_t& positions) -> std::vector<std::shared_ptr<Segment>> {
+  std::vector<std::shared_ptr<Segment>> segments;
+  segments.reserve(_segments.size());
+  for (const auto& seg : _segments) {
+    segments.push_back(seg.second);
+  }
+  positions = segments.size();
+  return segments;
+}
+
+auto MBMS_RT::SeamlessContentStream::update_retention() -> void {
+  size_t positions = 0;
+  uint64_t requests = 0;
+  uint64_t bytes = 0;
+  size_t with_data = 0;
+  auto segments = retained_segments(positions);
+  for (const auto& seg : segments) {
+    requests += seg->take_requests();
+    if (auto length = seg->content_length(); length > 0) {
+      bytes += length;
+      with_data++;
+    }
+  }
+  // Segments without data yet are assumed to be as large as the ones that have it
+  uint64_t position_bytes = with_data > 0 && positions > 0 ?
+    bytes / with_data * segments.size() / positions : 0;
+  auto keep = static_cast<int>(_retention->update(this, requests, position_bytes,
+        static_cast<unsigned>(std::max(_max_segments_to_keep, 1))));
+  if (keep != _segments_to_keep) {
+    spdlog::debug("Retention window of {} is now {} segments", _playlist_path, keep);
+    _segments_to_keep = keep;
+  }
+}
+
+auto MBMS_RT::SeamlessContentStream::retention_stats(RetentionBudget::StreamStats& stats) const -> bool {
+  if (!_retention || !_retention->enabled()) {
+    return false;
+  }
+  stats = _retention->stream_stats(this);
+  return true;
+}
+
+auto MBMS_RT::SeamlessContentStream::prefetch_stats() const -> PrefetchStats {
+  return { _prefetch_started, _prefetch_completed, _prefetch_cancelled, _prefetch_failed, _prefetch_bytes };
+}
+
+auto MBMS_RT::SeamlessContentStream::next_poll_interval() -> boost::posix_time::milliseconds {
+  auto target_duration = _target_duration.load();
+  if (target_duration <= 0) {
+    // Target duration not known yet, keep polling at the base tick
+    return boost::posix_time::milliseconds(_tick_interval.total_milliseconds());
+  }
+  long interval = target_duration * 1000 / 2;
+  auto backoff = std::min(_unchanged_polls.load(), _max_poll_backoff);
+  interval <<= backoff;
+  std::uniform_int_distribution<long> jitter(-interval / 10, interval / 10);
+  return boost::posix_time::milliseconds(interval + jitter(_jitter_rng));
 }
 
 auto MBMS_RT::SeamlessContentStream::tick_handler() -> void {
   if (!_running) return;
 
-  spdlog::debug("Getting playlist from CDN at {}", _playlist_path);
+  _pending_files->expire();
+  refresh_segments();
+  if (_retention && _retention->enabled()) {
+    update_retention();
+  }
+
+  if (joined()) {
+    auto target_duration = std::max(_target_duration.load(), 1);
+    bool stale = _broadcast_playlist_seqs.empty() ||
+      time(nullptr) - _broadcast_playlist_received_at > target_duration * 3 / 2;
+    _broadcast_loss = stale ? 1.0 : _sampled_loss;
+  } else {
+    // Not receiving, so there is no broadcast delivery to cover for
+    _broadcast_loss = 0;
+  }
+  if (_prefetch && _prefetch->enabled() && _cdn_client) {
+    prefetch_segments();
+  }
+
   if (_cdn_client) {
-    _cdn_client->get(_playlist_path,
-                     [&](std::shared_ptr<CdnFile> file) -> void { //NOLINT
-                       spdlog::debug("Playlist received from CDN");
-                       handle_playlist(std::string(file->buffer(), file->length()), MBMS_RT::ItemSource::CDN);
-                     });
+    if (broadcast_on_time()) {
+      if (!_cdn_polling_suppressed) {
+        spdlog::info("Broadcast is delivering {} on time, suspending CDN playlist polling", _playlist_path);
+        _cdn_polling_suppressed = true;
+      }
+    } else {
+      if (_cdn_polling_suppressed) {
+        spdlog::info("Broadcast is behind for {}, resuming CDN playlist polling", _playlist_path);
+        _cdn_polling_suppressed = false;
+        _unchanged_polls = 0;
+      }
+      if (!_playlist_fetch_in_flight.exchange(true)) {
+        spdlog::debug("Getting playlist from CDN at {}", _playlist_path);
+        std::weak_ptr<ContentStream> weak_self = shared_from_this();
+        // The playlist goes ahead of any segment, it is what tells players what to request next
+        _cdn_client->get(_playlist_path, std::numeric_limits<int64_t>::max())
+          .then([weak_self](std::shared_ptr<CdnFile> file) { //NOLINT
+              auto self = std::static_pointer_cast<SeamlessContentStream>(weak_self.lock());
+              if (!self) return;
+              if (!file) {
+                self->_playlist_fetch_in_flight = false;
+                return;
+              }
+              // Continue on the stream's strand, which owns the segment state
+              self->_strand.post([weak_self, file]() {
+                auto self = std::static_pointer_cast<SeamlessContentStream>(weak_self.lock());
+                if (!self) return;
+                std::string content(file->buffer(), file->length());
+                auto hash = std::hash<std::string>{}(content);
+                if (hash == self->_last_cdn_playlist_hash) {
+                  spdlog::debug("Playlist from CDN unchanged");
+                  self->_unchanged_polls++;
+                } else {
+                  spdlog::debug("Playlist received from CDN");
+                  self->_last_cdn_playlist_hash = hash;
+                  self->_unchanged_polls = 0;
+                  try {
+                    self->handle_playlist(content, MBMS_RT::ItemSource::CDN);
+                  } catch (...) {
+                    spdlog::warn("Failed to handle CDN playlist for {}", self->_playlist_path);
+                  }
+                }
+                self->_playlist_fetch_in_flight = false;
+              });
+            });
+      }
+    }
   }
-  _timer.expires_at(_timer.expires_at() + _tick_interval);
-  _timer.async_wait(boost::bind(&SeamlessContentStream::tick_handler, this)); //NOLINT
+  // While suppressed, keep checking at the unbacked-off rate so polling resumes promptly
+  _timer.expires_from_now(_cdn_polling_suppressed ?
+      boost::posix_time::milliseconds(std::max(_target_duration.load(), 1) * 1000 / 2) : next_poll_interval());
+  _timer.async_wait(_strand.wrap(boost::bind(&SeamlessContentStream::tick_handler, this))); //NOLINT
 }
-
@@ -20,46 +20,175 @@
 #include <thread>
 #include <libconfig.h++>
 #include "File.h"
-#include "Receiver.h"
 #include "CacheManagement.h"
 #include "CdnClient.h"
 #include "seamless/Segment.h"
+#include "seamless/PendingFileStore.h"
+#include "seamless/PrefetchScheduler.h"
+#include "seamless/FetchEngine.h"
+#include "seamless/RetentionBudget.h"
 #include "ContentStream.h"
+#include "HlsMediaPlaylistWriter.h"
+#include <atomic>
+#include <deque>
 #include <mutex>
+#include <random>
+#include <vector>
 
 namespace MBMS_RT {
   class SeamlessContentStream : public ContentStream{
     public:
-      SeamlessContentStream(std::string base, std::string flute_if, boost::asio::io_service& io_service, CacheManagement& cache, DeliveryProtocol protocol, const libconfig::Config& cfg);
+      SeamlessContentStream(std::string base, std::string flute_if, boost::asio::io_service& io_service, CacheManagement& cache, DeliveryProtocol protocol, const libconfig::Config& cfg,
+          std::shared_ptr<PrefetchScheduler> prefetch = nullptr, std::shared_ptr<FetchEngine> fetch_engine = nullptr,
+          std::shared_ptr<RetentionBudget> retention = nullptr);
       virtual ~SeamlessContentStream();
 
       virtual StreamType stream_type() const { return StreamType::SeamlessSwitching; };
       virtual std::string stream_type_string() const { return "Seamless Switching"; };
 
       void set_cdn_endpoint(const std::string& cdn_ept);
+
+      /**
+       *  Add a CDN endpoint carrying identical content. The first one configures the stream like
+       *  set_cdn_endpoint, later ones with the same playlist path become alternative origins.
+       */
+      void add_cdn_endpoint(const std::string& cdn_ept);
       virtual void flute_file_received(std::shared_ptr<LibFlute::File> file);
 
       std::string cdn_endpoint() const { return _cdn_endpoint + _playlist_path; };
-    private:
-      void handle_playlist( const std::string& content, ItemSource source);
+      PendingFileStore::Stats pending_file_stats() const { return _pending_files->stats(); };
+      std::vector<CdnClient::OriginStats> cdn_origin_stats() const {
+        return _cdn_client ? _cdn_client->origin_stats() : std::vector<CdnClient::OriginStats>{};
+      };
+
+      /**
+       *  @return Smoothed fraction of segments listed in broadcast playlists that did not arrive complete
+       *          over broadcast. 1 while broadcast playlists have stopped arriving.
+       */
+      double broadcast_loss() const { return _broadcast_loss; };
+
+      struct PrefetchStats {
+        uint64_t started;
+        uint64_t completed;
+        uint64_t cancelled;       // broadcast delivered first
+        uint64_t failed;
+        uint64_t bytes;
+      };
+      PrefetchStats prefetch_stats() const;
+      std::shared_ptr<PrefetchScheduler> prefetch_scheduler() const { return _prefetch; };
+
+      /**
+       *  @return Demand and window of this stream as seen by the retention budget, if there is one
+       */
+      bool retention_stats(RetentionBudget::StreamStats& stats) const;
+      unsigned segments_to_keep() const { return _segments_to_keep; };
+    protected:
+      virtual void handle_playlist( const std::string& content, ItemSource source);
       void tick_handler();
 
+      /**
+       *  Time until the next CDN playlist poll: half the target duration, doubled for every poll that
+       *  returned an unchanged playlist up to max_poll_backoff, and jittered by +/- 10% so streams
+       *  started together do not poll in lockstep.
+       */
+      boost::posix_time::milliseconds next_poll_interval();
+
+      /**
+       *  @return true if the last broadcast playlist is recent and every segment it lists, apart from
+       *          the newest, has been received completely over broadcast
+       */
+      virtual bool broadcast_on_time();
+
+      /**
+       *  Called on every tick, for segment lists that change with time rather than with playlist updates
+       */
+      virtual void refresh_segments() {};
+
+      /**
+       *  Update the broadcast loss rate from the segments of a broadcast playlist that should have been
+       *  received by now
+       */
+      void sample_broadcast_loss();
+
+      /**
+       *  Download the newest listed segments that have no data yet from the CDN, as many as the prefetch
+       *  scheduler asks for and its budget allows
+       */
+      void prefetch_segments();
+
+      /**
+       *  @return Up to count of the segments listed last, newest first
+       */
+      virtual std::vector<std::shared_ptr<Segment>> newest_segments(unsigned count);
+
+      /**
+       *  @return All segments currently held, and the number of positions in the window they fill
+       *          (more than one segment share a position if the stream carries several renditions)
+       */
+      virtual std::vector<std::shared_ptr<Segment>> retained_segments(size_t& positions);
+
+      /**
+       *  Report the requests served since the last tick to the retention budget and adopt the window
+       *  size it grants. Segments beyond it are dropped with the next playlist update.
+       */
+      void update_retention();
+
+      /**
+       *  Create a segment at full_uri, wire it to the CDN and the FLUTE receiver and add its cache item
+       *
+       *  @param expect_on_broadcast Requests wait up to max_broadcast_wait for the segment to arrive over broadcast
+       */
+      std::shared_ptr<Segment> register_segment(const std::string& full_uri, int seq, double duration,
+          bool expect_on_broadcast);
+
+      Segment::PartialObject partial_flute_object(const std::string& content_location);
+
       std::string _cdn_endpoint = "none";
       std::shared_ptr<CdnClient> _cdn_client;
       std::string _playlist_dir;
-      std::string _playlist = "none";
+      std::shared_ptr<SnapshotPublisher> _playlist = std::make_shared<SnapshotPublisher>();
+      std::shared_ptr<CachedPlaylist> _playlist_item;
       std::string _manifest;
 
       std::map<int, std::shared_ptr<Segment>> _segments;
-      std::map<std::string, std::shared_ptr<LibFlute::File>> _flute_files;
-      std::mutex _segments_mutex;
+      std::unique_ptr<PendingFileStore> _pending_files;
+      HlsMediaPlaylistWriter _playlist_writer;
+      // Segments that left the memory window but are still listed for DVR playback, oldest first
+      std::deque<std::pair<int, double>> _dvr_segments;
+      double _dvr_duration = 0;
 
       boost::posix_time::seconds _tick_interval;
       boost::asio::deadline_timer _timer;
 
-      int _segments_to_keep = 10;
+      int _max_segments_to_keep = 10;
+      std::atomic<int> _segments_to_keep = 10;
       int _truncate_cdn_playlist_segments = 7;
       
       bool _running = true;
+      std::atomic<bool> _playlist_fetch_in_flight = false;
+
+      std::atomic<int> _target_duration = 0;
+      std::atomic<unsigned> _unchanged_polls = 0;
+      size_t _last_cdn_playlist_hash = 0;
+      unsigned _max_poll_backoff = 2;
+      unsigned _max_broadcast_wait = 2000;
+      bool _cdn_polling_suppressed = false;
+      std::mt19937 _jitter_rng;
+
+      // Written when a playlist arrives over broadcast
+      time_t _broadcast_playlist_received_at = 0;
+      std::vector<int> _broadcast_playlist_seqs;
+
+      std::shared_ptr<PrefetchScheduler> _prefetch;
+      std::shared_ptr<FetchEngine> _fetch_engine;
+      std::shared_ptr<RetentionBudget> _retention;
+      double _sampled_loss = 0;
+      int _loss_sampled_seq = -1;
+      std::atomic<double> _broadcast_loss = 0;
+      std::atomic<uint64_t> _prefetch_started = 0;
+      std::atomic<uint64_t> _prefetch_completed = 0;
+      std::atomic<uint64_t> _prefetch_cancelled = 0;
+      std::atomic<uint64_t> _prefetch_failed = 0;
+      std::atomic<uint64_t> _prefetch_bytes = 0;
   };
 }
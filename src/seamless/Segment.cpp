@@ -16,8 +16,9 @@
 //
 
 #include "Segment.h"
-#include <future>
 
+#include <cstring>
+#include <limits>
 #include "spdlog/spdlog.h"
 
 MBMS_RT::Segment::Segment(std::string content_location,
@@ -25,6 +26,7 @@ MBMS_RT::Segment::Segment(std::string content_location,
   : _content_location( std::move(content_location) )
   , _seq(seq)
   , _extinf(extinf)
+  , _trace( Tracer::instance().begin(_content_location) )
 {
   spdlog::debug(" Segment at {} created", _content_location);
 }
@@ -33,36 +35,210 @@ MBMS_RT::Segment::~Segment() {
   spdlog::debug(" Segment at {} destroyed", _content_location);
 }
 
-auto MBMS_RT::Segment::fetch_from_cdn() -> void
+auto MBMS_RT::Segment::fetch_from_cdn() -> pplx::task<bool>
 {
-  if (_cdn_client) {
-    spdlog::debug("Requesting segment from CDN at {}", _content_location);
-    _cdn_client->get(_content_location,
-        [&](std::shared_ptr<CdnFile> file) -> void {
-        spdlog::debug("Segment at {} received data from CDN", _content_location);
-        _content_received_at = time(nullptr);
-        _cdn_file = std::move(file);
-        });
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (has_data()) {
+      return pplx::task_from_result(true);
+    }
   }
+  if (!_cdn_client) {
+    return pplx::task_from_result(false);
+  }
+
+  if (_partial_source) {
+    auto partial = _partial_source(_content_location);
+    if (!partial.received.empty()) {
+      return repair_from_cdn(std::move(partial));
+    }
+  }
+  return fetch_whole_from_cdn();
+}
+
+auto MBMS_RT::Segment::fetch_whole_from_cdn() -> pplx::task<bool>
+{
+  spdlog::debug("Requesting segment from CDN at {}", _content_location);
+  if (_trace) {
+    _trace->stamp(SegmentTrace::Stage::CdnRequested);
+  }
+  auto self = shared_from_this();
+  return _cdn_client->get(_content_location, _seq)
+    .then([self](std::shared_ptr<CdnFile> file) -> bool {
+        if (!file) {
+          return self->data_source() != ItemSource::Unavailable;
+        }
+        spdlog::debug("Segment at {} received data from CDN", self->_content_location);
+        self->set_cdn_file(std::move(file));
+        return true;
+      });
+}
+
+auto MBMS_RT::Segment::repair_from_cdn(PartialObject partial) -> pplx::task<bool>
+{
+  uint64_t length = partial.data.size();
+  auto missing = partial.received.gaps(length).coalesced(MIN_REPAIR_HOLE);
+  if (missing.size() > MAX_REPAIR_RANGES || missing.covered() > length / 2) {
+    spdlog::debug("Segment at {} is missing {} bytes in {} ranges, requesting it whole",
+        _content_location, missing.covered(), missing.size());
+    return fetch_whole_from_cdn();
+  }
+
+  spdlog::debug("Repairing segment at {}: requesting {} of {} bytes in {} ranges from CDN",
+      _content_location, missing.covered(), length, missing.size());
+  if (_trace) {
+    _trace->stamp(SegmentTrace::Stage::CdnRequested);
+  }
+  std::vector<pplx::task<std::shared_ptr<CdnFile>>> requests;
+  for (const auto& range : missing.ranges()) {
+    requests.push_back(_cdn_client->get_range(_content_location, range.begin, range.end, _seq));
+  }
+
+  // The received bytes were copied from the decoder, the parts are spliced into that copy
+  auto data = std::make_shared<std::vector<uint8_t>>(std::move(partial.data));
+  auto self = shared_from_this();
+  return pplx::when_all(requests.begin(), requests.end())
+    .then([self, data, missing](std::vector<std::shared_ptr<CdnFile>> parts) {
+        for (const auto& part : parts) {
+          if (!part) {
+            spdlog::debug("Range repair of {} failed, requesting it whole", self->_content_location);
+            return self->fetch_whole_from_cdn();
+          }
+        }
+        for (size_t i = 0; i < parts.size(); i++) {
+          const auto& range = missing.ranges()[i];
+          memcpy(data->data() + range.begin, parts[i]->buffer(), range.length());
+        }
+        spdlog::debug("Segment at {} repaired from CDN", self->_content_location);
+        self->set_cdn_file(std::make_shared<CdnFile>(std::move(*data)));
+        return pplx::task_from_result(true);
+      });
+}
+
+auto MBMS_RT::Segment::set_cdn_file(std::shared_ptr<CdnFile> file) -> void
+{
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _content_received_at = time(nullptr);
+    _cdn_file = std::move(file);
+  }
+  if (_trace) {
+    _trace->stamp(SegmentTrace::Stage::CdnCompleted);
+  }
+  notify_data_available();
+}
+
+auto MBMS_RT::Segment::set_flute_file(std::shared_ptr<LibFlute::File> file) -> void
+{
+  pplx::cancellation_token_source prefetch;
+  bool cancel_prefetch = false;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _content_received_at = file->received_at();
+    _flute_file = std::move(file);
+    if (_prefetching && !_prefetch_cancelled && _flute_file->complete()) {
+      _prefetch_cancelled = cancel_prefetch = true;
+      prefetch = _prefetch_cts;
+    }
+  }
+  if (cancel_prefetch) {
+    spdlog::debug("Segment at {} arrived over broadcast, cancelling CDN prefetch", _content_location);
+    prefetch.cancel();
+  }
+  notify_data_available();
 }
 
-auto MBMS_RT::Segment::buffer() -> char*
+auto MBMS_RT::Segment::prefetch_from_cdn() -> pplx::task<PrefetchResult>
 {
+  pplx::cancellation_token token = pplx::cancellation_token::none();
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (!_cdn_client || _prefetching || has_data()) {
+      return pplx::task_from_result(PrefetchResult{ false, 0 });
+    }
+    _prefetching = true;
+    _prefetch_cancelled = false;
+    _prefetch_cts = pplx::cancellation_token_source();
+    token = _prefetch_cts.get_token();
+  }
+
+  spdlog::debug("Prefetching segment from CDN at {}", _content_location);
+  if (_trace) {
+    _trace->stamp(SegmentTrace::Stage::CdnRequested);
+  }
+  auto self = shared_from_this();
+  return _cdn_client->get(_content_location, _seq, token)
+    .then([self](std::shared_ptr<CdnFile> file) {
+        bool cancelled = false;
+        {
+          const std::lock_guard<std::mutex> lock(self->_mutex);
+          self->_prefetching = false;
+          cancelled = self->_prefetch_cancelled;
+        }
+        if (!file) {
+          return PrefetchResult{ cancelled, 0 };
+        }
+        uint64_t bytes = file->length();
+        spdlog::debug("Segment at {} prefetched from CDN", self->_content_location);
+        self->set_cdn_file(std::move(file));
+        return PrefetchResult{ cancelled, bytes };
+      });
+}
+
+auto MBMS_RT::Segment::prefetching() const -> bool
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _prefetching;
+}
+
+auto MBMS_RT::Segment::covered() const -> bool
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _prefetching || has_data();
+}
+
+auto MBMS_RT::Segment::received_over_broadcast() const -> bool
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _flute_file && _flute_file->complete();
+}
+
+auto MBMS_RT::Segment::notify_data_available() -> void
+{
+  std::map<uint64_t, pplx::task_completion_event<bool>> waiters;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (!has_data()) {
+      return;
+    }
+    waiters.swap(_data_waiters);
+  }
+  if (_data_cb) {
+    _data_cb();
+  }
+  for (auto& waiter : waiters) {
+    waiter.second.set(true);
+  }
+}
+
+auto MBMS_RT::Segment::payload() const -> ItemPayload
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
   if (_flute_file && _flute_file->complete()) {
-    spdlog::debug("Segment at {} returning FLUTE file buffer ptr", _content_location);
-    return _flute_file->buffer();
+    spdlog::debug("Segment at {} returning FLUTE file buffer", _content_location);
+    return { _flute_file, _flute_file->buffer(), static_cast<uint32_t>(_flute_file->length()) };
   } else if (_cdn_file) {
-    spdlog::debug("Segment at {} returning CDN file buffer ptr", _content_location);
-    return _cdn_file->buffer();
+    spdlog::debug("Segment at {} returning CDN file buffer", _content_location);
+    return { _cdn_file, _cdn_file->buffer(), _cdn_file->length() };
   } else {
-    fetch_from_cdn();
     spdlog::debug("Segment at {} has no data", _content_location);
-    return nullptr;
+    return {};
   };
 }
 
 auto MBMS_RT::Segment::content_length() const -> uint32_t
 {
+  const std::lock_guard<std::mutex> lock(_mutex);
   if (_flute_file &&_flute_file->complete()) {
     return _flute_file->length();
   } else if (_cdn_file) {
@@ -72,8 +248,21 @@ auto MBMS_RT::Segment::content_length() const -> uint32_t
   };
 }
 
+auto MBMS_RT::Segment::memory_size() const -> uint32_t
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  if (_flute_file && _flute_file->complete()) {
+    return _flute_file->length();
+  } else if (_cdn_file) {
+    return _cdn_file->capacity();
+  } else {
+    return 0;
+  };
+}
+
 auto MBMS_RT::Segment::data_source() const -> MBMS_RT::ItemSource
 {
+  const std::lock_guard<std::mutex> lock(_mutex);
   if (_flute_file &&_flute_file->complete()) {
     return MBMS_RT::ItemSource::Broadcast;
   } else if (_cdn_file) {
@@ -82,3 +271,174 @@ auto MBMS_RT::Segment::data_source() const -> MBMS_RT::ItemSource
     return MBMS_RT::ItemSource::Unavailable;
   }
 }
+
+auto MBMS_RT::Segment::received_at() const -> unsigned long
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  return _content_received_at;
+}
+
+auto MBMS_RT::Segment::expect_on_broadcast(boost::asio::io_service& io_service, boost::posix_time::milliseconds max_wait) -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  _io_service = &io_service;
+  _broadcast_wait = max_wait;
+}
+
+auto MBMS_RT::Segment::fetch() -> pplx::task<bool>
+{
+  pplx::task_completion_event<bool> arrived;
+  boost::asio::io_service* io_service = nullptr;
+  auto max_wait = boost::posix_time::milliseconds(0);
+  uint64_t waiter_id = 0;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (has_data()) {
+      return pplx::task_from_result(true);
+    }
+    if (_io_service != nullptr && _broadcast_wait.total_milliseconds() > 0) {
+      io_service = _io_service;
+      max_wait = _broadcast_wait;
+      waiter_id = _next_waiter_id++;
+      _data_waiters.emplace(waiter_id, arrived);
+    }
+  }
+
+  if (io_service == nullptr) {
+    return fetch_from_cdn();
+  }
+
+  spdlog::debug("Holding request for {} up to {} ms for broadcast", _content_location, max_wait.total_milliseconds());
+  auto timer = std::make_shared<boost::asio::deadline_timer>(*io_service, max_wait);
+  std::weak_ptr<Segment> weak_self = shared_from_this();
+  timer->async_wait([weak_self, waiter_id, arrived, timer](const boost::system::error_code& /*ec*/) {
+      // Drop the waiter, or every request that timed out would stay queued until the segment arrives
+      if (auto self = weak_self.lock()) {
+        const std::lock_guard<std::mutex> lock(self->_mutex);
+        self->_data_waiters.erase(waiter_id);
+      }
+      arrived.set(false);
+    });
+
+  auto self = shared_from_this();
+  return pplx::task<bool>(arrived)
+    .then([self, timer](bool ok) {
+        timer->cancel();
+        if (ok) {
+          return pplx::task_from_result(true);
+        }
+        spdlog::debug("Segment at {} not received over broadcast in time, falling back to CDN", self->_content_location);
+        return self->fetch_from_cdn();
+      });
+}
+
+auto MBMS_RT::Segment::length_in_reception() const -> uint64_t
+{
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (has_data() || _io_service == nullptr || _broadcast_wait.total_milliseconds() <= 0) {
+      return 0;
+    }
+  }
+  if (!_run_source) {
+    return 0;
+  }
+  // Asking from the end copies nothing, only the length is of interest here
+  std::vector<uint8_t> chunk;
+  uint64_t length = 0;
+  return _run_source(_content_location, std::numeric_limits<uint64_t>::max(), chunk, length) ? length : 0;
+}
+
+struct MBMS_RT::Segment::StreamState {
+  StreamState(boost::asio::io_service& io_service, chunk_callback_t cb, boost::posix_time::milliseconds wait)
+    : timer( io_service )
+    , on_chunk( std::move(cb) )
+    , max_wait( wait )
+    , deadline( boost::posix_time::microsec_clock::universal_time() + wait )
+  {}
+
+  boost::asio::deadline_timer timer;
+  chunk_callback_t on_chunk;
+  boost::posix_time::milliseconds max_wait;
+  boost::posix_time::ptime deadline;   // of the next received byte, before falling back to the CDN
+  uint64_t offset = 0;                 // bytes delivered so far
+  pplx::task_completion_event<bool> done;
+};
+
+auto MBMS_RT::Segment::stream(chunk_callback_t on_chunk) -> pplx::task<bool>
+{
+  boost::asio::io_service* io_service = nullptr;
+  auto max_wait = boost::posix_time::milliseconds(0);
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    io_service = _io_service;
+    max_wait = _broadcast_wait;
+  }
+
+  if (io_service == nullptr || !_run_source) {
+    // Nothing arrives over broadcast to stream, deliver the segment in one piece
+    auto self = shared_from_this();
+    return fetch().then([self, on_chunk](bool ok) { return ok && deliver_rest(self->payload(), on_chunk, 0); });
+  }
+
+  auto state = std::make_shared<StreamState>(*io_service, std::move(on_chunk), max_wait);
+  poll_stream(state);
+  return pplx::task<bool>(state->done);
+}
+
+auto MBMS_RT::Segment::poll_stream(const std::shared_ptr<StreamState>& state) -> void
+{
+  // Completed over broadcast, or fetched from the CDN for another request in the meantime
+  auto data = payload();
+  if (data.data != nullptr) {
+    state->done.set(deliver_rest(data, state->on_chunk, state->offset));
+    return;
+  }
+
+  auto now = boost::posix_time::microsec_clock::universal_time();
+  std::vector<uint8_t> chunk;
+  uint64_t length = 0;
+  if (_run_source(_content_location, state->offset, chunk, length) && !chunk.empty()) {
+    state->on_chunk(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    state->offset += chunk.size();
+    state->deadline = now + state->max_wait;
+  }
+
+  if (now >= state->deadline) {
+    spdlog::debug("Segment at {} stalled over broadcast after {} bytes, completing it from the CDN",
+        _content_location, state->offset);
+    auto self = shared_from_this();
+    fetch_from_cdn().then([self, state](pplx::task<bool> fetched) {
+        bool ok = false;
+        try {
+          ok = fetched.get() && deliver_rest(self->payload(), state->on_chunk, state->offset);
+        } catch (const std::exception& ex) {
+          spdlog::debug("Completing {} from the CDN failed: {}", self->_content_location, ex.what());
+        }
+        state->done.set(ok);
+      });
+    return;
+  }
+
+  state->timer.expires_from_now(boost::posix_time::milliseconds(STREAM_POLL_INTERVAL_MS));
+  std::weak_ptr<Segment> weak_self = shared_from_this();
+  state->timer.async_wait([weak_self, state](const boost::system::error_code& ec) {
+      auto self = weak_self.lock();
+      if (ec || !self) {
+        state->done.set(false);
+        return;
+      }
+      self->poll_stream(state);
+    });
+}
+
+auto MBMS_RT::Segment::deliver_rest(const ItemPayload& data, const chunk_callback_t& on_chunk, uint64_t offset) -> bool
+{
+  if (data.data == nullptr || data.length < offset) {
+    return false;
+  }
+  if (data.length > offset) {
+    on_chunk(data.data + offset, data.length - offset);
+  }
+  return true;
+}
@@ -17,37 +17,172 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
 #include "File.h"
 #include "seamless/CdnClient.h"
 #include "seamless/CdnFile.h"
+#include "seamless/ByteRanges.h"
+#include "ItemPayload.h"
 #include "ItemSource.h"
+#include "SegmentTrace.h"
 #include "Segment.h"
 
 namespace MBMS_RT {
-  class Segment {
+  class Segment : public std::enable_shared_from_this<Segment> {
     public:
       Segment(std::string content_location, 
           int seq, double extinf);
       virtual ~Segment();
 
-      char* buffer();
+      /**
+       *  @return The segment data from FLUTE if complete, or from the CDN. Empty if neither is available.
+       */
+      ItemPayload payload() const;
       uint32_t content_length() const;
+      uint32_t memory_size() const;
       virtual ItemSource data_source() const;
 
       void set_cdn_client(std::shared_ptr<CdnClient> client) { _cdn_client = client; };
-      void fetch_from_cdn();
 
-      void set_flute_file(std::shared_ptr<LibFlute::File> file) { _flute_file = file; _content_received_at = file->received_at(); };
+      /**
+       *  A copy of an incompletely received FLUTE object, valid within the byte ranges known to be received
+       */
+      struct PartialObject {
+        ByteRanges received;
+        std::vector<uint8_t> data;   // the whole object, empty if no ranges are known
+      };
+      typedef std::function<PartialObject(const std::string& content_location)> partial_source_t;
+
+      /**
+       *  Register a lookup for partially received FLUTE data. If it yields usable ranges, fetch_from_cdn
+       *  only requests the missing bytes and assembles the segment from both.
+       */
+      void set_partial_source(partial_source_t source) { _partial_source = std::move(source); };
+
+      typedef std::function<bool(const std::string& content_location, uint64_t offset,
+          std::vector<uint8_t>& chunk, uint64_t& length)> run_source_t;
+
+      /**
+       *  Register a lookup for the bytes of the FLUTE object in reception that arrived without a gap from
+       *  an offset on, see FluteSessionDecoder::received_run. It lets stream() serve the object as it arrives.
+       */
+      void set_run_source(run_source_t source) { _run_source = std::move(source); };
+
+      /**
+       *  Request the segment from the CDN unless data is already available. 
+       *
+       *  @return A task that yields true once the segment has data
+       */
+      pplx::task<bool> fetch_from_cdn();
+
+      /**
+       *  Mark the segment as expected over broadcast. fetch() then waits up to max_wait for the FLUTE
+       *  object to complete before falling back to the CDN.
+       */
+      void expect_on_broadcast(boost::asio::io_service& io_service, boost::posix_time::milliseconds max_wait);
+
+      /**
+       *  Get data for the segment: immediately if available, from broadcast if it is expected there
+       *  and completes in time, otherwise from the CDN.
+       *
+       *  @return A task that yields true once the segment has data
+       */
+      pplx::task<bool> fetch();
+
+      /**
+       *  @return The length of the FLUTE object if it is in reception and the segment is expected over
+       *          broadcast, so stream() can serve it as it arrives. 0 otherwise.
+       */
+      uint64_t length_in_reception() const;
+
+      typedef std::function<void(const char* data, size_t length)> chunk_callback_t;
+
+      /**
+       *  Deliver the segment as it arrives: on_chunk is called in order with the bytes received without
+       *  a gap over broadcast, then with the rest once the FLUTE object completes. If reception makes no
+       *  progress for max_wait (see expect_on_broadcast), the rest is taken from the CDN instead.
+       *
+       *  @return A task that yields true once all bytes were delivered
+       */
+      pplx::task<bool> stream(chunk_callback_t on_chunk);
+
+      struct PrefetchResult {
+        bool cancelled;       // broadcast delivered the segment first
+        uint64_t bytes;       // downloaded from the CDN, 0 if cancelled or failed
+      };
+
+      /**
+       *  Download the segment from the CDN ahead of any request, e.g. while broadcast reception is poor.
+       *  The download is cancelled if the segment completes over broadcast first. Player requests
+       *  arriving meanwhile share the download.
+       *
+       *  @return A task that yields the outcome. Nothing is requested if data is already available or a
+       *          prefetch is running.
+       */
+      pplx::task<PrefetchResult> prefetch_from_cdn();
+      bool prefetching() const;
+
+      /**
+       *  @return true if data is available or being prefetched
+       */
+      bool covered() const;
+
+      /**
+       *  @return true if the segment was received complete over broadcast
+       */
+      bool received_over_broadcast() const;
+
+      void set_flute_file(std::shared_ptr<LibFlute::File> file);
+
+      /**
+       *  Register a callback that is called whenever data for this segment becomes available
+       */
+      void set_data_callback(std::function<void()> cb) { _data_cb = std::move(cb); };
 
       std::string uri() const { return _content_location; };
       int seq() const { return _seq; };
       double extinf() const { return _extinf; };
 
-      unsigned long received_at() const { return _content_received_at; };
+      unsigned long received_at() const;
+
+      /**
+       *  @return The trace of this segment, nullptr if it is not sampled
+       */
+      const std::shared_ptr<SegmentTrace>& trace() const { return _trace; };
+
+      /**
+       *  Count a request by an HTTP client. take_requests returns the count since its last call.
+       */
+      void record_request() { _requests++; };
+      uint64_t take_requests() { return _requests.exchange(0); };
     private:
+      // Repair is abandoned for a full download if it would need more requests or bytes than this
+      static constexpr size_t MAX_REPAIR_RANGES = 8;
+      static constexpr uint64_t MIN_REPAIR_HOLE = 16 * 1024;
+
+      // How often stream() looks for newly received bytes
+      static constexpr long STREAM_POLL_INTERVAL_MS = 20;
+
+      struct StreamState;
+      void poll_stream(const std::shared_ptr<StreamState>& state);
+      static bool deliver_rest(const ItemPayload& data, const chunk_callback_t& on_chunk, uint64_t offset);
+
+      pplx::task<bool> repair_from_cdn(PartialObject partial);
+      pplx::task<bool> fetch_whole_from_cdn();
+      void set_cdn_file(std::shared_ptr<CdnFile> file);
+      void notify_data_available();
+      bool has_data() const { return (_flute_file && _flute_file->complete()) || _cdn_file; };
+
       std::string _content_location;
       std::shared_ptr<CdnClient> _cdn_client;
+      partial_source_t _partial_source;
+      run_source_t _run_source;
 
       std::shared_ptr<LibFlute::File> _flute_file;
       std::shared_ptr<CdnFile> _cdn_file;
@@ -55,6 +190,22 @@ namespace MBMS_RT {
       double _extinf;
 
       unsigned long _content_received_at = 0;
+      std::function<void()> _data_cb;
+
+      boost::asio::io_service* _io_service = nullptr;
+      boost::posix_time::milliseconds _broadcast_wait = boost::posix_time::milliseconds(0);
+      std::map<uint64_t, pplx::task_completion_event<bool>> _data_waiters;   // requests held for broadcast, by id
+      uint64_t _next_waiter_id = 0;
+
+      std::atomic<uint64_t> _requests = 0;
+      std::shared_ptr<SegmentTrace> _trace;
+
+      bool _prefetching = false;
+      bool _prefetch_cancelled = false;
+      pplx::cancellation_token_source _prefetch_cts;
+
+      // Guards the data members above, which are set from the FLUTE and CDN threads
+      mutable std::mutex _mutex;
 
   };
 }
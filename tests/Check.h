@@ -0,0 +1,89 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace MBMS_RT::Test {
+  /**
+   *  Minimal test runner. A test is a function that reports failed expectations through CHECK, the
+   *  process exits non-zero if any of them failed, so every test binary is a CTest test.
+   */
+  class Runner {
+    public:
+      typedef std::function<void()> test_t;
+
+      void add(std::string name, test_t test) { _tests.push_back({ std::move(name), std::move(test) }); };
+
+      int run() {
+        for (const auto& test : _tests) {
+          auto failures_before = failures();
+          test.run();
+          std::printf("%-60s %s\n", test.name.c_str(), failures() == failures_before ? "ok" : "FAILED");
+        }
+        return failures() == 0 ? 0 : 1;
+      }
+
+      static unsigned& failures() {
+        static unsigned count = 0;
+        return count;
+      }
+
+    private:
+      struct Entry {
+        std::string name;
+        test_t run;
+      };
+      std::vector<Entry> _tests;
+  };
+
+  /**
+   *  @return A local TCP port the kernel just handed out as free. Tests listen on these instead of fixed
+   *          ports, so test binaries can run in parallel.
+   */
+  inline unsigned short free_port() {
+    unsigned short port = 0;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (fd >= 0 && bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length) == 0) {
+      port = ntohs(addr.sin_port);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    return port;
+  }
+}
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      MBMS_RT::Test::Runner::failures()++; \
+    } \
+  } while (false)
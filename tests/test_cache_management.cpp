@@ -0,0 +1,193 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Check.h"
+#include "CacheManagement.h"
+
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <libconfig.h++>
+
+#include "spdlog/spdlog.h"
+
+namespace {
+  /**
+   *  A cached file with a fixed body and receive time
+   */
+  class TestItem : public MBMS_RT::CacheItem {
+    public:
+      TestItem(const std::string& content_location, unsigned long received_at, std::string body = "body",
+          MBMS_RT::ItemSource source = MBMS_RT::ItemSource::Broadcast)
+        : MBMS_RT::CacheItem( content_location, received_at )
+        , _body( std::move(body) )
+        , _source( source ) {}
+
+      virtual ItemType item_type() const { return ItemType::File; };
+      virtual MBMS_RT::ItemPayload payload() const {
+        return { nullptr, _body.data(), static_cast<uint32_t>(_body.size()) };
+      };
+      virtual uint32_t content_length() const { return _body.size(); };
+      virtual MBMS_RT::ItemSource item_source() const { return _source; };
+
+    private:
+      std::string _body;
+      MBMS_RT::ItemSource _source;
+  };
+
+  constexpr size_t KB = 1024;
+
+  auto now() -> unsigned long { return static_cast<unsigned long>(time(nullptr)); }
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  libconfig::Config cfg;
+  cfg.readString("mw: { cache: { max_total_size: 1; max_file_age: 30; }; };");
+  boost::asio::io_service io_service;
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("CacheManagement/find_add_replace_remove", [&]() {
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    CHECK(cache.find_item("a/1.ts") == nullptr);
+
+    auto first = std::make_shared<TestItem>("a/1.ts", now());
+    cache.add_item(first);
+    CHECK(cache.find_item("a/1.ts") == first);
+    CHECK(cache.find_item("a/2.ts") == nullptr);
+
+    auto second = std::make_shared<TestItem>("a/1.ts", now());
+    cache.add_item(second);
+    CHECK(cache.find_item("a/1.ts") == second);
+    CHECK(cache.item_count() == 1);
+
+    cache.remove_item("a/1.ts");
+    CHECK(cache.find_item("a/1.ts") == nullptr);
+    CHECK(cache.item_count() == 0);
+  });
+
+  runner.add("CacheManagement/for_each_item_visits_all_shards", [&]() {
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    for (int i = 0; i < 200; i++) {
+      cache.add_item(std::make_shared<TestItem>("seg/" + std::to_string(i) + ".ts", now()));
+    }
+    CHECK(cache.item_count() == 200);
+    std::vector<bool> seen(200, false);
+    cache.for_each_item([&seen](const std::shared_ptr<MBMS_RT::CacheItem>& item) {
+        seen[std::stoi(item->content_location().substr(4))] = true;
+    });
+    CHECK(std::find(seen.begin(), seen.end(), false) == seen.end());
+  });
+
+  runner.add("CacheManagement/concurrent_lookups_and_updates", [&]() {
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    for (int i = 0; i < 64; i++) {
+      cache.add_item(std::make_shared<TestItem>("seg/" + std::to_string(i) + ".ts", now()));
+    }
+    std::atomic<bool> stop = false;
+    std::atomic<unsigned> misses = 0;
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; r++) {
+      readers.emplace_back([&]() {
+        while (!stop) {
+          for (int i = 0; i < 64; i++) {
+            auto item = cache.find_item("seg/" + std::to_string(i) + ".ts");
+            if (!item || item->content_length() != 4) {
+              misses++;
+            }
+          }
+        }
+      });
+    }
+    // Items are only ever replaced, so readers must always find one
+    for (int round = 0; round < 200; round++) {
+      for (int i = 0; i < 64; i++) {
+        cache.add_item(std::make_shared<TestItem>("seg/" + std::to_string(i) + ".ts", now()));
+      }
+      cache.add_item(std::make_shared<TestItem>("tmp/" + std::to_string(round), now()));
+      cache.remove_item("tmp/" + std::to_string(round));
+    }
+    stop = true;
+    for (auto& reader : readers) {
+      reader.join();
+    }
+    CHECK(misses == 0);
+    CHECK(cache.item_count() == 64);
+  });
+
+  runner.add("CacheManagement/expiry_removes_old_items", [&]() {
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    cache.add_item(std::make_shared<TestItem>("old.ts", now() - 60));
+    auto fresh = std::make_shared<TestItem>("fresh.ts", now());
+    cache.add_item(fresh);
+    cache.check_file_expiry_and_cache_size();
+    CHECK(cache.find_item("old.ts") == nullptr);
+    CHECK(cache.find_item("fresh.ts") == fresh);
+  });
+
+  runner.add("CacheManagement/expiry_follows_receive_time", [&]() {
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    cache.add_item(std::make_shared<TestItem>("fresh.ts", now()));
+    // Accounted after the fresh item, but received long before it
+    cache.add_item(std::make_shared<TestItem>("late.ts", now() - 60));
+    cache.check_file_expiry_and_cache_size();
+    CHECK(cache.find_item("late.ts") == nullptr);
+    CHECK(cache.find_item("fresh.ts") != nullptr);
+  });
+
+  runner.add("CacheManagement/size_limit_evicts_oldest_received", [&]() {
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    cache.add_item(std::make_shared<TestItem>("b.ts", now() - 10, std::string(400 * KB, 'b')));
+    // Accounted after b.ts, but received before it
+    cache.add_item(std::make_shared<TestItem>("a.ts", now() - 20, std::string(400 * KB, 'a')));
+    CHECK(cache.total_size() == 800 * KB);
+
+    cache.add_item(std::make_shared<TestItem>("c.ts", now(), std::string(400 * KB, 'c')));
+    CHECK(cache.find_item("a.ts") == nullptr);
+    CHECK(cache.find_item("b.ts") != nullptr);
+    CHECK(cache.find_item("c.ts") != nullptr);
+    CHECK(cache.total_size() == 800 * KB);
+  });
+
+  runner.add("CacheManagement/generated_items_outside_total", [&]() {
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    auto playlist = std::make_shared<TestItem>("index.m3u8", now() - 60, std::string(2048 * KB, '#'),
+        MBMS_RT::ItemSource::Generated);
+    cache.add_item(playlist);
+    CHECK(cache.total_size() == 0);
+    CHECK(cache.size_by_source(MBMS_RT::ItemSource::Generated) == 2048 * KB);
+
+    // Received content is still bounded by the total, generated items neither expire nor get evicted
+    cache.add_item(std::make_shared<TestItem>("a.ts", now(), std::string(600 * KB, 'a')));
+    cache.add_item(std::make_shared<TestItem>("b.ts", now(), std::string(600 * KB, 'b')));
+    cache.check_file_expiry_and_cache_size();
+    CHECK(cache.find_item("index.m3u8") == playlist);
+    CHECK(cache.find_item("a.ts") == nullptr);
+    CHECK(cache.total_size() == 600 * KB);
+
+    cache.remove_item("index.m3u8");
+    CHECK(cache.size_by_source(MBMS_RT::ItemSource::Generated) == 0);
+  });
+
+  return runner.run();
+}
@@ -0,0 +1,124 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Check.h"
+#include "seamless/CdnClient.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "cpprest/http_listener.h"
+#include "spdlog/spdlog.h"
+
+using web::http::methods;
+using web::http::http_request;
+using web::http::status_codes;
+using web::http::experimental::listener::http_listener;
+using web::http::experimental::listener::http_listener_config;
+
+namespace {
+  /**
+   *  An origin on a free local port that answers every request with the same status
+   */
+  class StatusOrigin {
+    public:
+      StatusOrigin(web::http::status_code status)
+        : _url( "http://127.0.0.1:" + std::to_string(MBMS_RT::Test::free_port()) + "/" )
+        , _listener( _url, http_listener_config() )
+      {
+        _listener.support(methods::GET, [this, status](http_request message) {
+            _requests++;
+            message.reply(status);
+        });
+        _listener.open().wait();
+      }
+      ~StatusOrigin() { _listener.close().wait(); }
+
+      const std::string& url() const { return _url; };
+      unsigned requests() const { return _requests; };
+
+    private:
+      std::string _url;
+      http_listener _listener;
+      std::atomic<unsigned> _requests = {0};
+  };
+
+  const char* CONFIG = "mw: { seamless_switching: { cdn_failover: { hedging: false; failure_threshold: 1; } } }";
+
+  const MBMS_RT::CdnClient::OriginStats& stats_of(const std::vector<MBMS_RT::CdnClient::OriginStats>& stats,
+      const std::string& url)
+  {
+    return *std::find_if(stats.begin(), stats.end(), [&url](const auto& s) { return s.base_url == url; });
+  }
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  libconfig::Config cfg;
+  cfg.readString(CONFIG);
+  boost::asio::io_service io_service;
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("CdnClient/404_leaves_breakers_closed", [&]() {
+    StatusOrigin first(status_codes::NotFound);
+    StatusOrigin second(status_codes::NotFound);
+    auto client = std::make_shared<MBMS_RT::CdnClient>(cfg, io_service, first.url());
+    client->add_origin(second.url());
+
+    for (int i = 0; i < 5; i++) {
+      CHECK(client->get("seg_" + std::to_string(i) + ".ts").get() == nullptr);
+    }
+    auto stats = client->origin_stats();
+    for (const auto& origin : stats) {
+      CHECK(origin.state == "closed");
+      CHECK(origin.errors == 0);
+      CHECK(origin.error_rate == 0);
+    }
+    // Every request was answered by one origin, a miss is not retried on the other
+    CHECK(first.requests() + second.requests() == 5);
+  });
+
+  runner.add("CdnClient/404_range_request_leaves_breaker_closed", [&]() {
+    StatusOrigin origin(status_codes::NotFound);
+    auto client = std::make_shared<MBMS_RT::CdnClient>(cfg, io_service, origin.url());
+    for (int i = 0; i < 5; i++) {
+      CHECK(client->get_range("seg.ts", 0, 100).get() == nullptr);
+    }
+    auto stats = client->origin_stats();
+    CHECK(stats_of(stats, origin.url()).state == "closed");
+    CHECK(stats_of(stats, origin.url()).errors == 0);
+  });
+
+  runner.add("CdnClient/503_opens_breaker_and_fails_over", [&]() {
+    StatusOrigin failing(status_codes::ServiceUnavailable);
+    StatusOrigin missing(status_codes::NotFound);
+    auto client = std::make_shared<MBMS_RT::CdnClient>(cfg, io_service, failing.url());
+    client->add_origin(missing.url());
+
+    // The failing origin is tried first, the request is retried on the other one
+    CHECK(client->get("seg.ts").get() == nullptr);
+    auto stats = client->origin_stats();
+    CHECK(stats_of(stats, failing.url()).state == "open");
+    CHECK(stats_of(stats, failing.url()).errors == 1);
+    CHECK(stats_of(stats, missing.url()).state == "closed");
+    CHECK(stats_of(stats, missing.url()).errors == 0);
+    CHECK(missing.requests() == 1);
+  });
+
+  return runner.run();
+}
@@ -0,0 +1,93 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Check.h"
+#include "CircuitBreaker.h"
+
+#include <chrono>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+
+using MBMS_RT::CircuitBreaker;
+using namespace std::chrono_literals;
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::off);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("CircuitBreaker/opens_after_threshold", [&]() {
+    CircuitBreaker breaker("peer", 3, 10s, 60s);
+    CHECK(breaker.state() == CircuitBreaker::State::Closed);
+    for (int i = 0; i < 2; i++) {
+      CHECK(breaker.allow());
+      breaker.record_failure();
+    }
+    CHECK(breaker.state() == CircuitBreaker::State::Closed);
+    // A success resets the count of consecutive failures
+    CHECK(breaker.allow());
+    breaker.record_success();
+    for (int i = 0; i < 3; i++) {
+      CHECK(breaker.allow());
+      breaker.record_failure();
+    }
+    CHECK(breaker.state() == CircuitBreaker::State::Open);
+    CHECK(breaker.state_string() == "open");
+    CHECK(!breaker.allow());
+    CHECK(!breaker.allow());
+    CHECK(breaker.rejected() == 2);
+  });
+
+  runner.add("CircuitBreaker/half_open_single_trial", [&]() {
+    CircuitBreaker breaker("peer", 1, 0ms, 0ms);
+    CHECK(breaker.allow());
+    breaker.record_failure();
+    CHECK(breaker.state() == CircuitBreaker::State::Open);
+    CHECK(breaker.allow());
+    CHECK(breaker.state() == CircuitBreaker::State::HalfOpen);
+    // Only one trial at a time
+    CHECK(!breaker.allow());
+    breaker.record_success();
+    CHECK(breaker.state() == CircuitBreaker::State::Closed);
+    CHECK(breaker.allow());
+    CHECK(breaker.allow());
+  });
+
+  runner.add("CircuitBreaker/failed_trial_backs_off", [&]() {
+    CircuitBreaker breaker("peer", 1, 50ms, 150ms);
+    CHECK(breaker.allow());
+    breaker.record_failure();
+    CHECK(!breaker.allow());
+    std::this_thread::sleep_for(70ms);
+    CHECK(breaker.allow());
+    breaker.record_failure();
+    // The retry interval doubled to 100 ms
+    std::this_thread::sleep_for(30ms);
+    CHECK(!breaker.allow());
+    std::this_thread::sleep_for(90ms);
+    CHECK(breaker.allow());
+    breaker.record_failure();
+    // and is capped at 150 ms
+    std::this_thread::sleep_for(160ms);
+    CHECK(breaker.allow());
+    breaker.record_success();
+    CHECK(breaker.state_string() == "closed");
+  });
+
+  return runner.run();
+}
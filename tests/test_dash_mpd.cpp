@@ -0,0 +1,79 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Check.h"
+#include "DashMpd.h"
+
+#include <string>
+
+#include "spdlog/spdlog.h"
+
+namespace {
+  /**
+   *  A dynamic MPD with one timeline on the AdaptationSet and @startNumber on each Representation
+   */
+  auto mpd(int repeat) -> std::string {
+    return "<?xml version=\"1.0\"?>\n"
+      "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" type=\"dynamic\" availabilityStartTime=\"2024-01-01T00:00:00Z\">\n"
+      "  <Period id=\"p0\" start=\"PT0S\">\n"
+      "    <AdaptationSet id=\"0\" mimeType=\"video/mp4\">\n"
+      "      <SegmentTemplate timescale=\"1\" media=\"$RepresentationID$/seg_$Number$.m4s\">\n"
+      "        <SegmentTimeline><S t=\"0\" d=\"2\" r=\"" + std::to_string(repeat) + "\"/></SegmentTimeline>\n"
+      "      </SegmentTemplate>\n"
+      "      <Representation id=\"low\" bandwidth=\"1000000\"><SegmentTemplate startNumber=\"10\"/></Representation>\n"
+      "      <Representation id=\"high\" bandwidth=\"4000000\"><SegmentTemplate startNumber=\"20\"/></Representation>\n"
+      "    </AdaptationSet>\n"
+      "  </Period>\n"
+      "</MPD>\n";
+  }
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::off);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("DashMpd/merge_renumbers_representation_templates", [&]() {
+    MBMS_RT::DashMpd current(mpd(2));
+    MBMS_RT::DashMpd update(mpd(4));
+    CHECK(current.merge(update, time(nullptr), 3) == 2);
+
+    // Two of five segments dropped: both representations still number t=4 as their third segment
+    const auto& reps = current.representations();
+    CHECK(reps.size() == 2);
+    CHECK(reps[0].segments.size() == 3);
+    CHECK(reps[0].segments.front().number == 12);
+    CHECK(reps[0].segments.front().time == 4);
+    CHECK(reps[1].segments.front().number == 22);
+
+    MBMS_RT::DashMpd reparsed(current.to_string());
+    CHECK(reparsed.representations()[0].segments.front().number == 12);
+    CHECK(reparsed.representations()[1].segments.front().number == 22);
+  });
+
+  runner.add("DashMpd/segment_list_is_left_out", [&]() {
+    MBMS_RT::DashMpd list("<?xml version=\"1.0\"?>\n"
+      "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" type=\"static\" mediaPresentationDuration=\"PT4S\">\n"
+      "  <Period><AdaptationSet><Representation id=\"0\" bandwidth=\"1000\">\n"
+      "    <SegmentList duration=\"2\"><SegmentURL media=\"a.m4s\"/><SegmentURL media=\"b.m4s\"/></SegmentList>\n"
+      "  </Representation></AdaptationSet></Period>\n"
+      "</MPD>\n");
+    CHECK(list.valid());
+    CHECK(list.representations().empty());
+  });
+
+  return runner.run();
+}
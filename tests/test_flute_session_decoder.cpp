@@ -0,0 +1,106 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Check.h"
+#include "multicast/FluteSessionDecoder.h"
+
+#include "spdlog/spdlog.h"
+
+namespace {
+  auto fec_oti(uint64_t transfer_length, uint32_t symbol_length, uint32_t max_source_block_length) -> LibFlute::FecOti {
+    LibFlute::FecOti oti{};  // Compact No-Code
+    oti.transfer_length = transfer_length;
+    oti.encoding_symbol_length = symbol_length;
+    oti.max_source_block_length = max_source_block_length;
+    return oti;
+  }
+
+  auto range_of(const LibFlute::FecOti& oti, uint32_t sbn, uint32_t id, uint64_t& begin, uint64_t& end) -> bool {
+    return MBMS_RT::FluteSessionDecoder::symbol_range(oti, sbn, id, begin, end);
+  }
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("FluteSessionDecoder/symbol_range_single_block", [&]() {
+    auto oti = fec_oti(2500, 1000, 64);
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    CHECK(range_of(oti, 0, 0, begin, end) && begin == 0 && end == 1000);
+    CHECK(range_of(oti, 0, 1, begin, end) && begin == 1000 && end == 2000);
+    // The last symbol is cut at the end of the file
+    CHECK(range_of(oti, 0, 2, begin, end) && begin == 2000 && end == 2500);
+    CHECK(!range_of(oti, 0, 3, begin, end));
+    CHECK(!range_of(oti, 1, 0, begin, end));
+  });
+
+  runner.add("FluteSessionDecoder/symbol_range_rfc5052_blocks", [&]() {
+    // 10 symbols in blocks of at most 4: one large block of 4, then two small ones of 3 (RFC 5052 9.1)
+    auto oti = fec_oti(9500, 1000, 4);
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    CHECK(range_of(oti, 0, 3, begin, end) && begin == 3000 && end == 4000);
+    CHECK(range_of(oti, 1, 0, begin, end) && begin == 4000 && end == 5000);
+    CHECK(!range_of(oti, 1, 3, begin, end));
+    CHECK(range_of(oti, 2, 0, begin, end) && begin == 7000 && end == 8000);
+    CHECK(range_of(oti, 2, 2, begin, end) && begin == 9000 && end == 9500);
+    CHECK(!range_of(oti, 3, 0, begin, end));
+  });
+
+  runner.add("FluteSessionDecoder/symbol_range_rejects_empty_parameters", [&]() {
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    CHECK(!range_of(fec_oti(0, 1000, 4), 0, 0, begin, end));
+    CHECK(!range_of(fec_oti(9500, 0, 4), 0, 0, begin, end));
+    CHECK(!range_of(fec_oti(9500, 1000, 0), 0, 0, begin, end));
+  });
+
+  runner.add("FluteSessionDecoder/partial_file_unknown_location", [&]() {
+    MBMS_RT::FluteSessionDecoder session(1);
+    MBMS_RT::ByteRanges received;
+    std::vector<uint8_t> data;
+    CHECK(!session.partial_file("seg/1.ts", received, data));
+    CHECK(received.empty());
+    CHECK(data.empty());
+  });
+
+  runner.add("FluteSessionDecoder/received_run_unknown_location", [&]() {
+    MBMS_RT::FluteSessionDecoder session(1);
+    std::vector<uint8_t> chunk;
+    uint64_t length = 0;
+    CHECK(!session.received_run("seg/1.ts", 0, chunk, length));
+    CHECK(chunk.empty());
+  });
+
+  runner.add("ByteRanges/contiguous_end", [&]() {
+    MBMS_RT::ByteRanges received;
+    received.add(0, 1000);
+    received.add(2000, 3000);
+    CHECK(received.contiguous_end(0) == 1000);
+    CHECK(received.contiguous_end(500) == 1000);
+    // Not covered, including the end of a range, which is exclusive
+    CHECK(received.contiguous_end(1000) == 1000);
+    CHECK(received.contiguous_end(1500) == 1500);
+    CHECK(received.contiguous_end(2000) == 3000);
+    CHECK(received.contiguous_end(5000) == 5000);
+    CHECK(MBMS_RT::ByteRanges().contiguous_end(0) == 0);
+  });
+
+    return runner.run();
+}
@@ -0,0 +1,158 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Check.h"
+#include "HttpCaching.h"
+
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+using MBMS_RT::HttpCaching::ByteRange;
+using MBMS_RT::HttpCaching::RangeResult;
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("HttpCaching/http_date_round_trip", [&]() {
+    CHECK(MBMS_RT::HttpCaching::format_http_date(784111777) == "Sun, 06 Nov 1994 08:49:37 GMT");
+    CHECK(MBMS_RT::HttpCaching::parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT") == 784111777);
+    CHECK(MBMS_RT::HttpCaching::parse_http_date("yesterday") == 0);
+  });
+
+  runner.add("HttpCaching/etag_matches", [&]() {
+    CHECK(MBMS_RT::HttpCaching::etag_matches("\"7\"", "\"7\""));
+    CHECK(MBMS_RT::HttpCaching::etag_matches("W/\"7\"", "\"7\""));
+    CHECK(MBMS_RT::HttpCaching::etag_matches("\"1\", \"7\"", "\"7\""));
+    CHECK(MBMS_RT::HttpCaching::etag_matches("*", "\"7\""));
+    CHECK(!MBMS_RT::HttpCaching::etag_matches("\"8\"", "\"7\""));
+    CHECK(!MBMS_RT::HttpCaching::etag_matches("", "\"7\""));
+  });
+
+  runner.add("HttpCaching/if_none_match_takes_precedence", [&]() {
+    auto date = MBMS_RT::HttpCaching::format_http_date(1000);
+    CHECK(MBMS_RT::HttpCaching::not_modified("\"7\"", "", "\"7\"", 1000));
+    // A stale entity tag is not overridden by a matching date
+    CHECK(!MBMS_RT::HttpCaching::not_modified("\"6\"", date, "\"7\"", 1000));
+    CHECK(!MBMS_RT::HttpCaching::not_modified("", "", "\"7\"", 1000));
+  });
+
+  runner.add("HttpCaching/if_modified_since", [&]() {
+    CHECK(MBMS_RT::HttpCaching::not_modified("", MBMS_RT::HttpCaching::format_http_date(1000), "\"7\"", 1000));
+    CHECK(MBMS_RT::HttpCaching::not_modified("", MBMS_RT::HttpCaching::format_http_date(1001), "\"7\"", 1000));
+    CHECK(!MBMS_RT::HttpCaching::not_modified("", MBMS_RT::HttpCaching::format_http_date(999), "\"7\"", 1000));
+    CHECK(!MBMS_RT::HttpCaching::not_modified("", "not a date", "\"7\"", 1000));
+    // Without a modification time, as for generated playlists, only the entity tag validates
+    CHECK(!MBMS_RT::HttpCaching::not_modified("", MBMS_RT::HttpCaching::format_http_date(1000), "\"7\"", 0));
+  });
+
+  runner.add("HttpCaching/parse_range", [&]() {
+    ByteRange range{};
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=0-99", 1000, range) == RangeResult::Satisfiable);
+    CHECK(range.first == 0 && range.last == 99 && range.length() == 100);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=900-", 1000, range) == RangeResult::Satisfiable);
+    CHECK(range.first == 900 && range.last == 999);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=-100", 1000, range) == RangeResult::Satisfiable);
+    CHECK(range.first == 900 && range.last == 999);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=-5000", 1000, range) == RangeResult::Satisfiable);
+    CHECK(range.first == 0 && range.last == 999);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=500-5000", 1000, range) == RangeResult::Satisfiable);
+    CHECK(range.last == 999);
+  });
+
+  runner.add("HttpCaching/parse_range_rejects", [&]() {
+    ByteRange range{};
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=1000-", 1000, range) == RangeResult::Unsatisfiable);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=-0", 1000, range) == RangeResult::Unsatisfiable);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=0-1,5-9", 1000, range) == RangeResult::Ignore);
+    CHECK(MBMS_RT::HttpCaching::parse_range("items=0-1", 1000, range) == RangeResult::Ignore);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=9-1", 1000, range) == RangeResult::Ignore);
+    CHECK(MBMS_RT::HttpCaching::parse_range("bytes=a-b", 1000, range) == RangeResult::Ignore);
+  });
+
+  runner.add("HttpCaching/evaluate", [&]() {
+    MBMS_RT::HttpCaching::Representation segment{ MBMS_RT::HttpCaching::etag_for(0, 1000, 100), 1000, 6, 100 };
+    auto full = MBMS_RT::HttpCaching::evaluate({}, segment);
+    CHECK(full.status == 200 && full.offset == 0 && full.length == 100);
+
+    MBMS_RT::HttpCaching::RequestHeaders request;
+    request.range = "bytes=10-19";
+    auto partial = MBMS_RT::HttpCaching::evaluate(request, segment);
+    CHECK(partial.status == 206 && partial.offset == 10 && partial.length == 10);
+
+    request.if_range = "\"older\"";
+    CHECK(MBMS_RT::HttpCaching::evaluate(request, segment).status == 200);
+
+    request = {};
+    request.range = "bytes=100-";
+    auto unsatisfiable = MBMS_RT::HttpCaching::evaluate(request, segment);
+    CHECK(unsatisfiable.status == 416 && unsatisfiable.length == 0);
+
+    request = {};
+    request.if_none_match = segment.etag;
+    auto not_modified = MBMS_RT::HttpCaching::evaluate(request, segment);
+    CHECK(not_modified.status == 304 && not_modified.length == 0);
+  });
+
+  runner.add("HttpCaching/generated_items_validated_by_etag", [&]() {
+    CHECK(MBMS_RT::HttpCaching::last_modified_for(3, 1000) == 0);
+    CHECK(MBMS_RT::HttpCaching::last_modified_for(0, 1000) == 1000);
+    MBMS_RT::HttpCaching::Representation playlist{ MBMS_RT::HttpCaching::etag_for(4, 1000, 100),
+        MBMS_RT::HttpCaching::last_modified_for(4, 1000), 3, 100 };
+    MBMS_RT::HttpCaching::RequestHeaders request;
+    request.if_modified_since = MBMS_RT::HttpCaching::format_http_date(1000);
+    auto response = MBMS_RT::HttpCaching::evaluate(request, playlist);
+    CHECK(response.status == 200);
+    for (const auto& header : response.headers) {
+      CHECK(header.first != "Last-Modified");
+    }
+  });
+
+  runner.add("HttpCaching/negotiate_encoding", [&]() {
+    std::vector<std::string> available{ "br", "gzip" };
+    CHECK(MBMS_RT::HttpCaching::negotiate_encoding("gzip, deflate, br", available) == "br");
+    CHECK(MBMS_RT::HttpCaching::negotiate_encoding("br;q=0.5, GZIP", available) == "gzip");
+    CHECK(MBMS_RT::HttpCaching::negotiate_encoding("*;q=0.1, br;q=0", available) == "gzip");
+    CHECK(MBMS_RT::HttpCaching::negotiate_encoding("identity", available).empty());
+    CHECK(MBMS_RT::HttpCaching::negotiate_encoding("", available).empty());
+    CHECK(MBMS_RT::HttpCaching::etag_for(4, 1000, 100, "gzip") != MBMS_RT::HttpCaching::etag_for(4, 1000, 100));
+  });
+
+  runner.add("HttpCaching/encoded_representation_headers", [&]() {
+    MBMS_RT::HttpCaching::Representation playlist{ MBMS_RT::HttpCaching::etag_for(4, 1000, 40, "gzip"), 0, 3, 40,
+        "gzip", true };
+    auto response = MBMS_RT::HttpCaching::evaluate({}, playlist);
+    CHECK(response.status == 200);
+    bool content_encoding = false;
+    bool vary = false;
+    for (const auto& header : response.headers) {
+      content_encoding |= header.first == "Content-Encoding" && header.second == "gzip";
+      vary |= header.first == "Vary" && header.second == "Accept-Encoding";
+    }
+    CHECK(content_encoding && vary);
+  });
+
+  runner.add("HttpCaching/cache_control", [&]() {
+    CHECK(MBMS_RT::HttpCaching::cache_control(0) == "no-cache");
+    CHECK(MBMS_RT::HttpCaching::cache_control(6) == "max-age=6");
+  });
+
+  return runner.run();
+}
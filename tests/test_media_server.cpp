@@ -0,0 +1,254 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Check.h"
+#include "MediaServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <libconfig.h++>
+
+#include "spdlog/spdlog.h"
+
+using MBMS_RT::MediaServer;
+
+namespace {
+  /**
+   *  An item whose data is in a file, like a segment of the disk tier. Its in-memory payload is
+   *  filler, so a response carrying the file content shows that the body was sent with sendfile.
+   */
+  class FileItem : public MBMS_RT::CacheItem {
+    public:
+      FileItem(const std::string& content_location, int fd, uint32_t length)
+        : MBMS_RT::CacheItem( content_location, static_cast<unsigned long>(time(nullptr)) )
+        , _filler( length, '-' )
+        , _fd( fd ) {}
+
+      virtual ItemType item_type() const { return ItemType::Segment; };
+      virtual MBMS_RT::ItemPayload payload() const {
+        return { nullptr, _filler.data(), static_cast<uint32_t>(_filler.size()) };
+      };
+      virtual uint32_t content_length() const { return _filler.size(); };
+      virtual MBMS_RT::ItemSource item_source() const { return MBMS_RT::ItemSource::Broadcast; };
+      virtual FileRegion file_region() const { return { nullptr, _fd, 0 }; };
+
+    private:
+      std::string _filler;
+      int _fd;
+  };
+
+  /**
+   *  An item still in reception, like a segment whose FLUTE object is arriving: stream_content hands
+   *  out its content a few bytes at a time from another thread. Delivery fails after fail_after bytes.
+   */
+  class ArrivingItem : public MBMS_RT::CacheItem {
+    public:
+      ArrivingItem(const std::string& content_location, std::string content, size_t fail_after = std::string::npos)
+        : MBMS_RT::CacheItem( content_location, static_cast<unsigned long>(time(nullptr)) )
+        , _content( std::move(content) )
+        , _fail_after( fail_after ) {}
+      virtual ~ArrivingItem() {
+        if (_sender.joinable()) {
+          _sender.join();
+        }
+      }
+
+      virtual ItemType item_type() const { return ItemType::Segment; };
+      virtual MBMS_RT::ItemPayload payload() const { return {}; };
+      virtual uint32_t content_length() const { return 0; };
+      virtual MBMS_RT::ItemSource item_source() const { return MBMS_RT::ItemSource::Unavailable; };
+      virtual uint64_t length_in_reception() const { return _content.size(); };
+      virtual pplx::task<bool> stream_content(MBMS_RT::Segment::chunk_callback_t on_chunk) {
+        pplx::task_completion_event<bool> done;
+        _sender = std::thread([this, on_chunk, done]() {
+            auto end = std::min(_content.size(), _fail_after);
+            for (size_t offset = 0; offset < end; offset += 4) {
+              std::this_thread::sleep_for(std::chrono::milliseconds(10));
+              on_chunk(_content.data() + offset, std::min<size_t>(4, end - offset));
+            }
+            done.set(end == _content.size());
+          });
+        return pplx::create_task(done);
+      };
+
+    private:
+      std::string _content;
+      size_t _fail_after;
+      std::thread _sender;
+  };
+
+  /**
+   *  Send a request to the media server on port and read the response until the server closes
+   */
+  auto exchange(unsigned short port, const std::string& request) -> std::string {
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::socket socket(io_service);
+    socket.connect({ boost::asio::ip::address_v4::loopback(), port });
+    boost::asio::write(socket, boost::asio::buffer(request));
+    std::string response;
+    boost::system::error_code ec;
+    boost::asio::read(socket, boost::asio::dynamic_buffer(response), ec);
+    return response;
+  }
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("MediaServer/parse_request_head", [&]() {
+    std::string buffer = "GET /a/1.ts HTTP/1.1\r\nHost: mw\r\nif-none-match:  \"7\" \r\n"
+        "Range: bytes=0-99\r\nIf-Range: \"7\"\r\nIf-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+        "Accept-Encoding: gzip, br\r\nAuthorization: Bearer key\r\n\r\n";
+    MediaServer::Request request;
+    size_t consumed = 0;
+    CHECK(MediaServer::parse_request(buffer, request, consumed) == MediaServer::ParseResult::Complete);
+    CHECK(consumed == buffer.size());
+    CHECK(request.method == "GET");
+    CHECK(request.target == "/a/1.ts");
+    CHECK(request.keep_alive);
+    CHECK(request.conditional.if_none_match == "\"7\"");
+    CHECK(request.conditional.range == "bytes=0-99");
+    CHECK(request.conditional.if_range == "\"7\"");
+    CHECK(request.conditional.if_modified_since == "Sun, 06 Nov 1994 08:49:37 GMT");
+    CHECK(request.conditional.accept_encoding == "gzip, br");
+    CHECK(request.authorization == "Bearer key");
+  });
+
+  runner.add("MediaServer/parse_pipelined_requests", [&]() {
+    std::string buffer = "GET /a.m3u8 HTTP/1.1\r\n\r\nHEAD /b.ts HTTP/1.1\r\nConnection: close\r\n\r\nGET /c";
+    MediaServer::Request request;
+    size_t consumed = 0;
+    CHECK(MediaServer::parse_request(buffer, request, consumed) == MediaServer::ParseResult::Complete);
+    CHECK(request.target == "/a.m3u8");
+    buffer.erase(0, consumed);
+    CHECK(MediaServer::parse_request(buffer, request, consumed) == MediaServer::ParseResult::Complete);
+    CHECK(request.method == "HEAD");
+    CHECK(!request.keep_alive);
+    buffer.erase(0, consumed);
+    CHECK(MediaServer::parse_request(buffer, request, consumed) == MediaServer::ParseResult::Incomplete);
+  });
+
+  runner.add("MediaServer/parse_connection_semantics", [&]() {
+    MediaServer::Request request;
+    size_t consumed = 0;
+    CHECK(MediaServer::parse_request("GET / HTTP/1.0\r\n\r\n", request, consumed) == MediaServer::ParseResult::Complete);
+    CHECK(!request.keep_alive);
+    CHECK(MediaServer::parse_request("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", request, consumed) ==
+        MediaServer::ParseResult::Complete);
+    CHECK(request.keep_alive);
+  });
+
+  runner.add("MediaServer/parse_rejects_invalid", [&]() {
+    MediaServer::Request request;
+    size_t consumed = 0;
+    CHECK(MediaServer::parse_request("GET /\r\n\r\n", request, consumed) == MediaServer::ParseResult::Invalid);
+    CHECK(MediaServer::parse_request("GET / HTTP/2\r\n\r\n", request, consumed) ==
+        MediaServer::ParseResult::Invalid);
+    CHECK(MediaServer::parse_request("GET / HTTP/1.1\r\nno colon\r\n\r\n", request, consumed) ==
+        MediaServer::ParseResult::Invalid);
+    // Request bodies are not supported
+    CHECK(MediaServer::parse_request("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\n", request, consumed) ==
+        MediaServer::ParseResult::Invalid);
+    CHECK(MediaServer::parse_request("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", request, consumed) ==
+        MediaServer::ParseResult::Invalid);
+    CHECK(MediaServer::parse_request("GET / HTTP/1.1\r\nContent-Length: 0\r\n\r\n", request, consumed) ==
+        MediaServer::ParseResult::Complete);
+  });
+
+  runner.add("MediaServer/parse_limits_header_size", [&]() {
+    MediaServer::Request request;
+    size_t consumed = 0;
+    std::string partial = "GET / HTTP/1.1\r\nX-Filler: ";
+    CHECK(MediaServer::parse_request(partial, request, consumed) == MediaServer::ParseResult::Incomplete);
+    partial.append(32 * 1024, 'x');
+    CHECK(MediaServer::parse_request(partial, request, consumed) == MediaServer::ParseResult::Invalid);
+  });
+
+  runner.add("MediaServer/sends_file_regions", [&]() {
+    char path[] = "/tmp/test_media_server_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    unlink(path);
+    std::string content = "0123456789abcdef";
+    CHECK(write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()));
+
+    auto port = MBMS_RT::Test::free_port();
+    auto settings = "mw: { media_server: { address: \"127.0.0.1\"; port: " + std::to_string(port) +
+      "; threads: 1; }; };";
+    libconfig::Config cfg;
+    cfg.readString(settings.c_str());
+    boost::asio::io_service io_service;
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    cache.add_item(std::make_shared<FileItem>("a/1.ts", fd, content.size()));
+    MediaServer server(cfg, cache);
+    server.start();
+
+    auto full = exchange(port, "GET /a/1.ts HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(full.rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+    CHECK(full.find("\r\nContent-Length: 16\r\n") != std::string::npos);
+    CHECK(full.size() > content.size() && full.substr(full.size() - content.size()) == content);
+
+    auto range = exchange(port, "GET /a/1.ts HTTP/1.1\r\nRange: bytes=4-9\r\nConnection: close\r\n\r\n");
+    CHECK(range.rfind("HTTP/1.1 206 Partial Content\r\n", 0) == 0);
+    CHECK(range.substr(range.size() - 6) == "456789");
+
+    auto head = exchange(port, "HEAD /a/1.ts HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(head.size() >= 4 && head.substr(head.size() - 4) == "\r\n\r\n");
+
+    server.stop();
+    close(fd);
+  });
+
+  runner.add("MediaServer/streams_items_in_reception", [&]() {
+    auto port = MBMS_RT::Test::free_port();
+    auto settings = "mw: { media_server: { address: \"127.0.0.1\"; port: " + std::to_string(port) +
+      "; threads: 1; }; };";
+    libconfig::Config cfg;
+    cfg.readString(settings.c_str());
+    boost::asio::io_service io_service;
+    MBMS_RT::CacheManagement cache(cfg, io_service);
+    std::string content = "0123456789abcdefghij";
+    cache.add_item(std::make_shared<ArrivingItem>("a/2.ts", content));
+    cache.add_item(std::make_shared<ArrivingItem>("a/3.ts", content, 8));
+    MediaServer server(cfg, cache);
+    server.start();
+
+    auto complete = exchange(port, "GET /a/2.ts HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(complete.rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+    CHECK(complete.find("\r\nContent-Length: 20\r\n") != std::string::npos);
+    CHECK(complete.find("\r\nRT-MBMS-MW-File-Origin: 5G-BC\r\n") != std::string::npos);
+    CHECK(complete.size() > content.size() && complete.substr(complete.size() - content.size()) == content);
+
+    // A body that stops arriving ends with the connection, short of its Content-Length
+    auto cut = exchange(port, "GET /a/3.ts HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(cut.find("\r\nContent-Length: 20\r\n") != std::string::npos);
+    CHECK(cut.size() == cut.find("\r\n\r\n") + 4 + 8 && cut.substr(cut.size() - 8) == "01234567");
+
+    server.stop();
+  });
+
+  return runner.run();
+}
@@ -0,0 +1,86 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Check.h"
+#include "multicast/MulticastReceiver.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+namespace {
+  /**
+   *  The start of an LCT header (RFC 5651 5.1) up to the TSI, followed by a TOI field
+   */
+  auto lct_header(uint8_t cci_flag, bool s, bool h, std::vector<uint8_t> tsi) -> std::vector<char> {
+    std::vector<char> header;
+    header.push_back(static_cast<char>(0x10 | (cci_flag << 2)));   // V = 1
+    header.push_back(static_cast<char>((s ? 0x80 : 0) | 0x20 | (h ? 0x10 : 0)));   // O = 1
+    header.push_back(0);
+    header.push_back(0);
+    header.insert(header.end(), 4 * (cci_flag + 1), 0);
+    header.insert(header.end(), tsi.begin(), tsi.end());
+    header.insert(header.end(), { 0, 0, 0, 7 });
+    return header;
+  }
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("MulticastReceiver/lct_tsi_lengths", [&]() {
+    uint64_t tsi = 0;
+    auto half_word = lct_header(0, false, true, { 0x12, 0x34 });
+    CHECK(MBMS_RT::MulticastReceiver::lct_tsi(half_word.data(), half_word.size(), tsi));
+    CHECK(tsi == 0x1234);
+
+    auto word = lct_header(0, true, false, { 0x00, 0x01, 0x02, 0x03 });
+    CHECK(MBMS_RT::MulticastReceiver::lct_tsi(word.data(), word.size(), tsi));
+    CHECK(tsi == 0x010203);
+
+    auto six_bytes = lct_header(0, true, true, { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 });
+    CHECK(MBMS_RT::MulticastReceiver::lct_tsi(six_bytes.data(), six_bytes.size(), tsi));
+    CHECK(tsi == 0x010203040506);
+  });
+
+  runner.add("MulticastReceiver/lct_tsi_after_long_cci", [&]() {
+    uint64_t tsi = 0;
+    auto header = lct_header(3, true, false, { 0x00, 0x00, 0x00, 0x2a });
+    CHECK(MBMS_RT::MulticastReceiver::lct_tsi(header.data(), header.size(), tsi));
+    CHECK(tsi == 42);
+  });
+
+  runner.add("MulticastReceiver/lct_tsi_rejects_malformed", [&]() {
+    uint64_t tsi = 0;
+    auto no_tsi = lct_header(0, false, false, {});
+    CHECK(!MBMS_RT::MulticastReceiver::lct_tsi(no_tsi.data(), no_tsi.size(), tsi));
+
+    auto version_2 = lct_header(0, true, false, { 0, 0, 0, 1 });
+    version_2[0] = static_cast<char>(0x20);
+    CHECK(!MBMS_RT::MulticastReceiver::lct_tsi(version_2.data(), version_2.size(), tsi));
+
+    auto truncated = lct_header(1, true, false, { 0, 0, 0, 1 });
+    CHECK(!MBMS_RT::MulticastReceiver::lct_tsi(truncated.data(), 4 + 8 + 3, tsi));
+    CHECK(MBMS_RT::MulticastReceiver::lct_tsi(truncated.data(), 4 + 8 + 4, tsi));
+    CHECK(!MBMS_RT::MulticastReceiver::lct_tsi(truncated.data(), 3, tsi));
+  });
+
+  return runner.run();
+}
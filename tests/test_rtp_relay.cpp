@@ -0,0 +1,154 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Check.h"
+#include "multicast/RtpRelay.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+using boost::asio::ip::udp;
+
+namespace {
+  const char* GROUP = "239.255.42.1";
+
+  /**
+   *  An RTP packet (RFC 3550 5.1) with a fixed header and payload_size bytes of payload
+   */
+  auto rtp_packet(uint16_t sequence, size_t payload_size) -> std::vector<char> {
+    std::vector<char> packet = { static_cast<char>(0x80), 96, static_cast<char>(sequence >> 8),
+      static_cast<char>(sequence & 0xff), 0, 0, 0, 0, 0, 0, 0, 1 };
+    packet.resize(packet.size() + payload_size, static_cast<char>(sequence));
+    return packet;
+  }
+
+  /**
+   *  Sends to the multicast group on the loopback interface, where the relay under test listens
+   */
+  class Sender {
+    public:
+      Sender(boost::asio::io_service& io_service, unsigned short port)
+        : _socket(io_service, udp::v4())
+        , _group(boost::asio::ip::address::from_string(GROUP), port) {
+        _socket.set_option(boost::asio::ip::multicast::outbound_interface(
+              boost::asio::ip::address_v4::loopback()));
+        _socket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+      }
+      void send(const std::vector<char>& packet) { _socket.send_to(boost::asio::buffer(packet), _group); };
+
+    private:
+      udp::socket _socket;
+      udp::endpoint _group;
+  };
+
+  /**
+   *  Run the io_service until count datagrams have arrived on the receiver or a second has passed
+   */
+  auto receive(boost::asio::io_service& io_service, udp::socket& receiver, size_t count)
+      -> std::vector<std::vector<char>> {
+    std::vector<std::vector<char>> received;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (received.size() < count && std::chrono::steady_clock::now() < deadline) {
+      io_service.poll();
+      io_service.restart();
+      while (receiver.available() > 0) {
+        std::vector<char> datagram(receiver.available());
+        datagram.resize(receiver.receive(boost::asio::buffer(datagram)));
+        received.push_back(std::move(datagram));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return received;
+  }
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("RtpRelay/rtp_sequence", [&]() {
+    uint16_t sequence = 0;
+    auto packet = rtp_packet(0x1234, 0);
+    CHECK(MBMS_RT::RtpRelay::rtp_sequence(packet.data(), packet.size(), sequence));
+    CHECK(sequence == 0x1234);
+    CHECK(!MBMS_RT::RtpRelay::rtp_sequence(packet.data(), 11, sequence));
+    packet[0] = 0x40;   // version 1
+    CHECK(!MBMS_RT::RtpRelay::rtp_sequence(packet.data(), packet.size(), sequence));
+  });
+
+  runner.add("RtpRelay/forward_to_every_destination", [&]() {
+    boost::asio::io_service io_service;
+    udp::socket first(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    udp::socket second(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    auto port = MBMS_RT::Test::free_port();
+    auto relay = std::make_shared<MBMS_RT::RtpRelay>("127.0.0.1", GROUP, port, "",
+        std::vector<std::string>{ "127.0.0.1:" + std::to_string(first.local_endpoint().port()),
+                                  "127.0.0.1:" + std::to_string(second.local_endpoint().port()) },
+        1, io_service);
+    relay->start();
+
+    Sender sender(io_service, port);
+    sender.send(rtp_packet(10, 100));
+    sender.send(rtp_packet(11, 1300));
+    sender.send({ 'n', 'o', 't', ' ', 'r', 't', 'p' });
+    sender.send(rtp_packet(14, 0));   // 12 and 13 lost
+
+    auto received = receive(io_service, first, 3);
+    CHECK(received.size() == 3);
+    if (received.size() == 3) {
+      CHECK(received[0] == rtp_packet(10, 100));
+      CHECK(received[1] == rtp_packet(11, 1300));
+      CHECK(received[2] == rtp_packet(14, 0));
+    }
+    CHECK(receive(io_service, second, 3).size() == 3);
+
+    auto stats = relay->stats();
+    CHECK(stats.packets == 3);
+    CHECK(stats.bytes == 3 * 12 + 1400);
+    CHECK(stats.lost == 2);
+    CHECK(stats.invalid == 1);
+    CHECK(stats.forwarded == 6);
+    CHECK(stats.send_dropped == 0);
+  });
+
+  runner.add("RtpRelay/source_filter", [&]() {
+    boost::asio::io_service io_service;
+    udp::socket destination(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    auto port = MBMS_RT::Test::free_port();
+    auto relay = std::make_shared<MBMS_RT::RtpRelay>("127.0.0.1", GROUP, port, "192.0.2.1",
+        std::vector<std::string>{ "127.0.0.1:" + std::to_string(destination.local_endpoint().port()) },
+        1, io_service);
+    relay->start();
+
+    Sender sender(io_service, port);
+    sender.send(rtp_packet(1, 10));
+    receive(io_service, destination, 1);
+    auto stats = relay->stats();
+    CHECK(stats.packets == 0);
+    CHECK(stats.invalid == 1);
+    CHECK(stats.forwarded == 0);
+  });
+
+  return runner.run();
+}
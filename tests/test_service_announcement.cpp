@@ -0,0 +1,118 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "Check.h"
+#include "CacheManagement.h"
+#include "ServiceAnnouncement.h"
+#include "WarmStart.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <boost/asio.hpp>
+#include <libconfig.h++>
+
+#include "spdlog/spdlog.h"
+
+namespace {
+  auto part(std::string& out, const std::string& type, const std::string& location, const std::string& body) -> void {
+    out += "--boundary-5gmag\r\nContent-Type: " + type + "\r\nContent-Location: " + location + "\r\n\r\n" + body + "\r\n";
+  }
+
+  /**
+   *  A bootstrap with an envelope and a bundle without services, so parsing it starts no reception
+   */
+  auto bootstrap() -> std::string {
+    std::string envelope = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<metadataEnvelope xmlns=\"urn:3gpp:metadata:2005:MBMS:envelope\">\n"
+      "  <item metadataURI=\"http://localhost/usd.xml\" version=\"1\" validFrom=\"2024-01-01T00:00:00.000Z\" "
+      "validUntil=\"2034-01-01T00:00:00.000Z\" contentType=\"\"/>\n"
+      "</metadataEnvelope>\n";
+    std::string usd = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<bundleDescription xmlns=\"urn:3GPP:metadata:2005:MBMS:userServiceDescription\"/>\n";
+    std::string out = "MIME-Version: 1.0\r\nContent-Type: multipart/related; boundary=\"boundary-5gmag\"\r\n\r\n";
+    part(out, "application/mbms-envelope+xml", "http://localhost/envelope.xml", envelope);
+    part(out, "application/mbms-user-service-description+xml", "http://localhost/usd.xml", usd);
+    out += "--boundary-5gmag--\r\n";
+    return out;
+  }
+
+  struct Environment {
+    Environment(const std::string& warm_restart_path) {
+      auto config = "mw: { cache: { max_total_size: 16; }; warm_restart: { enabled: true; path: \"" +
+          warm_restart_path + "\"; }; };";
+      cfg.readString(config.c_str());
+      cache = std::make_unique<MBMS_RT::CacheManagement>(cfg, io_service);
+    }
+    auto announcement() -> std::unique_ptr<MBMS_RT::ServiceAnnouncement> {
+      return std::make_unique<MBMS_RT::ServiceAnnouncement>(cfg, "000001", "", 0, "lo", io_service, *cache, false,
+          nullptr, nullptr, nullptr,
+          [this](const std::string& id) { auto it = services.find(id); return it == services.end() ? nullptr : it->second; },
+          [this](const std::string& id, std::shared_ptr<MBMS_RT::Service> service) { services[id] = std::move(service); });
+    }
+
+    libconfig::Config cfg;
+    boost::asio::io_service io_service;
+    std::unique_ptr<MBMS_RT::CacheManagement> cache;
+    std::map<std::string, std::shared_ptr<MBMS_RT::Service>> services;
+  };
+}
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  char dir_template[] = "/tmp/mw_test_sa_XXXXXX";
+  std::string dir = mkdtemp(dir_template);
+  Environment env(dir);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("ServiceAnnouncement/local_bootstrap_keeps_content", [&]() {
+    auto content = bootstrap();
+    auto sa = env.announcement();
+    sa->parse_bootstrap(content);
+    CHECK(sa->content() == content);
+    CHECK(!sa->items().empty());
+  });
+
+  runner.add("ServiceAnnouncement/warm_start_keeps_content", [&]() {
+    auto content = bootstrap();
+    {
+      MBMS_RT::WarmStart warm_start(env.cfg);
+      warm_start.save_service_announcement({ "000001", "", 0, content });
+    }
+
+    // The next run restores the saved bootstrap, as Middleware does before the first carousel arrives
+    MBMS_RT::WarmStart warm_start(env.cfg);
+    MBMS_RT::WarmStart::ServiceAnnouncementState state;
+    CHECK(warm_start.load_service_announcement(state));
+    auto sa = env.announcement();
+    sa->parse_bootstrap(state.content);
+    CHECK(sa->content() == content);
+
+    // Saving the restored announcement again must not lose it for the run after
+    std::filesystem::remove(dir + "/service_announcement");
+    warm_start.save_service_announcement({ sa->tmgi(), sa->multicast_address(), sa->tsi(), sa->content() });
+    MBMS_RT::WarmStart::ServiceAnnouncementState saved_again;
+    CHECK(warm_start.load_service_announcement(saved_again));
+    CHECK(saved_again.content == content);
+  });
+
+  auto result = runner.run();
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+  return result;
+}
@@ -0,0 +1,93 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+
+#include "Check.h"
+#include "SessionDescription.h"
+
+#include <string>
+
+#include "spdlog/spdlog.h"
+
+int main(int /*argc*/, char** /*argv*/) {
+  spdlog::set_level(spdlog::level::warn);
+  MBMS_RT::Test::Runner runner;
+
+  runner.add("SessionDescription/flute_session", [&]() {
+    std::string sdp = "v=0\r\n"
+        "o=- 1 1 IN IP4 10.0.0.1\r\n"
+        "s=Stream\r\n"
+        "t=0 0\r\n"
+        "a=source-filter: incl IN IP4 238.1.1.95 10.0.0.1\r\n"
+        "a=flute-tsi:13\r\n"
+        "a=FEC-declaration:0 encoding-id=1; instance-id=0\r\n"
+        "m=application 40085 FLUTE/UDP 0\r\n"
+        "c=IN IP4 238.1.1.95/64\r\n"
+        "b=AS:4000\r\n"
+        "a=FEC:0\r\n";
+    MBMS_RT::SessionDescription session(sdp);
+    CHECK(session.complete());
+    CHECK(session.connection_address() == "238.1.1.95");
+    CHECK(session.source_address() == "10.0.0.1");
+    CHECK(session.port() == 40085);
+    CHECK(session.protocol() == "FLUTE/UDP");
+    CHECK(session.flute_tsi() == 13);
+    CHECK(session.bandwidth_kbps() == 4000);
+    CHECK(session.fec_declarations().size() == 1);
+    CHECK(session.fec_declarations()[0].reference == 0);
+    CHECK(session.fec_declarations()[0].encoding_id == 1);
+    CHECK(session.fec_declarations()[0].instance_id == 0);
+    CHECK(session.fec_reference() == 0);
+  });
+
+  runner.add("SessionDescription/bare_newlines_and_spacing", [&]() {
+    MBMS_RT::SessionDescription session("c=IN IP4 233.252.0.1\nm=application  5000 FLUTE/UDP 0\na=flute-tsi: 7\n");
+    CHECK(session.complete());
+    CHECK(session.connection_address() == "233.252.0.1");
+    CHECK(session.port() == 5000);
+    CHECK(session.flute_tsi() == 7);
+    CHECK(session.fec_reference() == -1);
+  });
+
+  runner.add("SessionDescription/incomplete", [&]() {
+    CHECK(!MBMS_RT::SessionDescription("").complete());
+    CHECK(!MBMS_RT::SessionDescription("c=IN IP4 233.252.0.1\r\n").complete());
+    // Only IPv4 connections, and application media or audio/video over RTP, are used
+    MBMS_RT::SessionDescription ipv6("c=IN IP6 ff0e::1\r\nm=application 5000 FLUTE/UDP 0\r\n");
+    CHECK(ipv6.connection_address().empty());
+    CHECK(!ipv6.complete());
+    MBMS_RT::SessionDescription text("c=IN IP4 233.252.0.1\r\nm=text 5000 TCP/MSRP *\r\n");
+    CHECK(text.port() == 0);
+    CHECK(!text.complete());
+  });
+
+  runner.add("SessionDescription/rtp_session", [&]() {
+    std::string sdp = "v=0\r\n"
+        "a=source-filter: incl IN IP4 232.0.0.7 10.0.0.2\r\n"
+        "m=video 5004 RTP/AVP 96\r\n"
+        "c=IN IP4 232.0.0.7/16\r\n"
+        "m=audio 5006 RTP/AVP 97\r\n";
+    MBMS_RT::SessionDescription session(sdp);
+    CHECK(session.complete());
+    CHECK(session.connection_address() == "232.0.0.7");
+    CHECK(session.source_address() == "10.0.0.2");
+    CHECK(session.port() == 5004);
+    CHECK(session.protocol() == "RTP/AVP");
+  });
+
+  return runner.run();
+}
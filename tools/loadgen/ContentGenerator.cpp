@@ -0,0 +1,196 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "ContentGenerator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <boost/asio/ip/address_v4.hpp>
+
+MBMS_RT::LoadGen::ContentGenerator::ContentGenerator(const Options& options)
+  : _options( options )
+{
+  for (unsigned s = 0; s < options.services; s++) {
+    for (unsigned r = 0; r < options.renditions; r++) {
+      auto dir = "svc" + std::to_string(s) + "/r" + std::to_string(r) + "/";
+      _renditions.push_back({ s, r, options.bitrates_kbps[r % options.bitrates_kbps.size()], dir, dir + "index.m3u8" });
+    }
+  }
+  // Start with a full window, so players and the middleware find a playable playlist right away
+  for (unsigned i = 0; i < options.window; i++) {
+    next();
+  }
+}
+
+auto MBMS_RT::LoadGen::ContentGenerator::make_segment(const Rendition& rendition, int seq) const
+    -> std::shared_ptr<const std::string>
+{
+  // MPEG-TS sized packets with a sync byte, so the data at least looks like a transport stream
+  static constexpr size_t TS_PACKET = 188;
+  auto length = static_cast<size_t>(rendition.bitrate_kbps) * 125 * _options.segment_duration;
+  length = std::max(length / TS_PACKET, static_cast<size_t>(1)) * TS_PACKET;
+  auto data = std::make_shared<std::string>(length, '\xff');
+  for (size_t offset = 0; offset < length; offset += TS_PACKET) {
+    (*data)[offset] = 0x47;
+  }
+  auto tag = rendition.dir + std::to_string(seq);
+  memcpy(data->data() + 4, tag.data(), std::min(tag.size(), TS_PACKET - 4));
+  return data;
+}
+
+auto MBMS_RT::LoadGen::ContentGenerator::media_playlist() const -> std::string
+{
+  // Written by hand: HlsMediaPlaylist::to_string() emits the rooted URIs of the middleware playlists,
+  // an origin playlist refers to its segments relative to itself
+  auto first = std::max(_next_seq - static_cast<int>(_options.window), 0);
+  std::string playlist = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:" +
+    std::to_string(_options.segment_duration) + "\n#EXT-X-MEDIA-SEQUENCE:" + std::to_string(first) + "\n";
+  for (int seq = first; seq < _next_seq; seq++) {
+    playlist += "#EXTINF:" + std::to_string(_options.segment_duration) + "\nseg_" + std::to_string(seq) + ".ts\n";
+  }
+  return playlist;
+}
+
+auto MBMS_RT::LoadGen::ContentGenerator::next() -> std::vector<std::vector<Object>>
+{
+  std::vector<std::vector<Object>> objects(_options.services);
+  std::vector<Object> playlists;
+  auto seq = _next_seq++;
+  const std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto& rendition : _renditions) {
+    auto location = rendition.dir + "seg_" + std::to_string(seq) + ".ts";
+    auto segment = make_segment(rendition, seq);
+    _objects[location] = segment;
+    _history.push_back(location);
+    objects[rendition.service].push_back({ location, "video/mp2t", segment });
+  }
+  for (const auto& rendition : _renditions) {
+    auto playlist = std::make_shared<const std::string>(media_playlist());
+    _objects[rendition.playlist_path] = playlist;
+    objects[rendition.service].push_back({ rendition.playlist_path, "application/vnd.apple.mpegurl", playlist });
+  }
+  while (_history.size() > _renditions.size() * _options.window * HISTORY_WINDOWS) {
+    _objects.erase(_history.front());
+    _history.pop_front();
+  }
+  return objects;
+}
+
+auto MBMS_RT::LoadGen::ContentGenerator::find(const std::string& location) const -> std::shared_ptr<const std::string>
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _objects.find(location);
+  return it == _objects.end() ? nullptr : it->second;
+}
+
+auto MBMS_RT::LoadGen::ContentGenerator::mcast_address(unsigned service) const -> std::string
+{
+  auto base = boost::asio::ip::make_address_v4(_options.mcast_address).to_uint();
+  return boost::asio::ip::address_v4(base + service).to_string();
+}
+
+auto MBMS_RT::LoadGen::ContentGenerator::sdp(unsigned service) const -> std::string
+{
+  auto group = mcast_address(service);
+  unsigned bandwidth_kbps = 0;
+  for (const auto& rendition : _renditions) {
+    if (rendition.service == service) {
+      bandwidth_kbps += rendition.bitrate_kbps;
+    }
+  }
+  return "v=0\r\n"
+    "o=- 0 0 IN IP4 0.0.0.0\r\n"
+    "s=mw-loadgen service " + std::to_string(service) + "\r\n"
+    "c=IN IP4 " + group + "/255\r\n"
+    "t=0 0\r\n"
+    "b=AS:" + std::to_string(bandwidth_kbps) + "\r\n"
+    "a=FEC-declaration:0 encoding-id=0; instance-id=0\r\n"
+    "a=flute-tsi:" + std::to_string(tsi(service)) + "\r\n"
+    "m=application " + std::to_string(_options.mcast_port) + " FLUTE/UDP 0\r\n"
+    "a=FEC:0\r\n";
+}
+
+auto MBMS_RT::LoadGen::ContentGenerator::bootstrap(const std::string& broadcast_host, const std::string& cdn_host) const
+    -> std::string
+{
+  static constexpr const char* BOUNDARY = "mw-loadgen-boundary";
+  auto part = [](std::string& out, const std::string& type, const std::string& location, const std::string& body) {
+    out += std::string("--") + BOUNDARY + "\r\nContent-Type: " + type + "\r\nContent-Location: " + location +
+      "\r\n\r\n" + body + "\r\n";
+  };
+
+  std::string envelope = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<metadataEnvelope xmlns=\"urn:3gpp:metadata:2005:MBMS:envelope\">\n";
+  auto add_item = [&](const std::string& uri) {
+    envelope += "  <item metadataURI=\"" + uri + "\" version=\"1\" validFrom=\"2020-01-01T00:00:00.000Z\" "
+      "validUntil=\"2100-01-01T00:00:00.000Z\"/>\n";
+  };
+  std::string usd = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<bundleDescription xmlns=\"urn:3GPP:metadata:2005:MBMS:userServiceDescription\" "
+    "xmlns:r12=\"urn:3GPP:metadata:2013:MBMS:userServiceDescription\">\n";
+  std::string fragments;
+  std::string usd_uri = broadcast_host + "usd.xml";
+  add_item(usd_uri);
+
+  for (unsigned s = 0; s < _options.services; s++) {
+    auto service_dir = broadcast_host + "svc" + std::to_string(s) + "/";
+    auto manifest = service_dir + "manifest.m3u8";
+    auto session = service_dir + "session.sdp";
+    std::string primary = "#EXTM3U\n#EXT-X-VERSION:3\n";
+    std::string delivery;
+    std::string alternative;
+    std::string identical;
+    for (const auto& rendition : _renditions) {
+      if (rendition.service != s) {
+        continue;
+      }
+      primary += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string(rendition.bitrate_kbps * 1000) +
+        ",CODECS=\"avc1.64001f,mp4a.40.2\"\nr" + std::to_string(rendition.index) + "/index.m3u8\n";
+      auto broadcast_url = broadcast_host + rendition.playlist_path;
+      auto cdn_url = cdn_host + rendition.playlist_path;
+      delivery += "    <deliveryMethod sessionDescriptionURI=\"" + session + "\">\n"
+        "      <r12:broadcastAppService><r12:basePattern>" + broadcast_url + "</r12:basePattern></r12:broadcastAppService>\n"
+        "      <r12:unicastAppService><r12:basePattern>" + cdn_url + "</r12:basePattern></r12:unicastAppService>\n"
+        "    </deliveryMethod>\n";
+      alternative += "        <r12:basePattern>" + broadcast_url + "</r12:basePattern>\n";
+      identical += "      <r12:identicalContent>\n"
+        "        <r12:basePattern>" + broadcast_url + "</r12:basePattern>\n"
+        "        <r12:basePattern>" + cdn_url + "</r12:basePattern>\n"
+        "      </r12:identicalContent>\n";
+    }
+    usd += "  <userServiceDescription serviceId=\"urn:mw-loadgen:service:" + std::to_string(s) + "\">\n"
+      "    <name lang=\"en\">mw-loadgen service " + std::to_string(s) + "</name>\n" + delivery +
+      "    <r12:appService mimeType=\"application/vnd.apple.mpegurl\" appServiceDescriptionURI=\"" + manifest + "\">\n"
+      "      <r12:alternativeContent>\n" + alternative + "      </r12:alternativeContent>\n" + identical +
+      "    </r12:appService>\n"
+      "  </userServiceDescription>\n";
+    part(fragments, "application/vnd.apple.mpegurl", manifest, primary);
+    part(fragments, "application/sdp", session, sdp(s));
+    add_item(manifest);
+    add_item(session);
+  }
+  envelope += "</metadataEnvelope>\n";
+  usd += "</bundleDescription>\n";
+
+  std::string out = std::string("MIME-Version: 1.0\r\nContent-Type: multipart/related; boundary=\"") + BOUNDARY +
+    "\"\r\n\r\n";
+  part(out, "application/mbms-envelope+xml", broadcast_host + "envelope.xml", envelope);
+  part(out, "application/mbms-user-service-description+xml", usd_uri, usd);
+  out += fragments;
+  out += std::string("--") + BOUNDARY + "--\r\n";
+  return out;
+}
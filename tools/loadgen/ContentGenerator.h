@@ -0,0 +1,96 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Options.h"
+
+namespace MBMS_RT::LoadGen {
+  /**
+   *  Synthetic live HLS content: N services with M renditions each, segments of the configured bitrate
+   *  and a sliding window media playlist per rendition.
+   *
+   *  Content locations are <service>/<rendition>/..., the same on FLUTE, on the mock CDN and at the
+   *  middleware. The generator also writes the service announcement and the SDPs describing it.
+   */
+  class ContentGenerator {
+    public:
+      explicit ContentGenerator(const Options& options);
+      virtual ~ContentGenerator() = default;
+
+      struct Rendition {
+        unsigned service;
+        unsigned index;
+        unsigned bitrate_kbps;
+        std::string dir;              // svc<service>/r<index>/
+        std::string playlist_path;    // <dir>index.m3u8
+      };
+      const std::vector<Rendition>& renditions() const { return _renditions; };
+
+      struct Object {
+        std::string location;
+        std::string content_type;
+        std::shared_ptr<const std::string> data;
+      };
+
+      /**
+       *  Produce the next segment of every rendition and republish the playlists.
+       *
+       *  @return Per service, the new segments followed by the updated playlists, in sending order
+       */
+      std::vector<std::vector<Object>> next();
+
+      /**
+       *  @return A current playlist or a segment still in the CDN history, nullptr if there is none
+       */
+      std::shared_ptr<const std::string> find(const std::string& location) const;
+
+      /**
+       *  The bootstrap for mw.local_service.bootstrap_file. Broadcast base patterns name the
+       *  playlists at broadcast_host, the identical unicast copies the same paths at cdn_host.
+       */
+      std::string bootstrap(const std::string& broadcast_host, const std::string& cdn_host) const;
+      std::string sdp(unsigned service) const;
+
+      /**
+       *  Multicast group of a service: the base address with service added to its last octet
+       */
+      std::string mcast_address(unsigned service) const;
+      static uint64_t tsi(unsigned service) { return service + 1; };
+
+    private:
+      // Segments stay on the CDN for this many windows, for players and repairs lagging behind
+      static constexpr unsigned HISTORY_WINDOWS = 3;
+
+      std::string media_playlist() const;
+      std::shared_ptr<const std::string> make_segment(const Rendition& rendition, int seq) const;
+
+      const Options& _options;
+      std::vector<Rendition> _renditions;
+      int _next_seq = 0;
+
+      mutable std::mutex _mutex;
+      std::map<std::string, std::shared_ptr<const std::string>> _objects;   // playlists and segment history
+      std::deque<std::string> _history;                                     // segment locations, oldest first
+  };
+}
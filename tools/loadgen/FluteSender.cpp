@@ -0,0 +1,127 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "FluteSender.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+MBMS_RT::LoadGen::FluteSender::FluteSender(const Options& options, const ContentGenerator& generator,
+    boost::asio::io_service& io_service)
+{
+  for (unsigned s = 0; s < options.services; s++) {
+    auto service = std::make_unique<Service>();
+    auto rate_limit = options.rate_limit_kbps;
+    if (rate_limit == 0) {
+      for (const auto& rendition : generator.renditions()) {
+        if (rendition.service == s) {
+          rate_limit += 2 * rendition.bitrate_kbps;
+        }
+      }
+    }
+
+    std::string address = generator.mcast_address(s);
+    unsigned short port = options.mcast_port;
+    if (options.loss > 0) {
+      boost::asio::ip::udp::endpoint group(boost::asio::ip::make_address(address), port);
+      service->relay = std::make_unique<LossyRelay>(io_service, group, options.loss, options.burst);
+      address = "127.0.0.1";
+      port = service->relay->port();
+    }
+    service->transmitter = std::make_unique<LibFlute::Transmitter>(address, static_cast<short>(port),
+        ContentGenerator::tsi(s), options.mtu, rate_limit, io_service);
+    service->transmitter->register_completion_callback([svc = service.get()](uint32_t toi) {
+        svc->in_flight.erase(toi);
+    });
+    spdlog::info("FLUTE: service {} on {}:{}, TSI {}, {} kbps{}", s, generator.mcast_address(s), options.mcast_port,
+        ContentGenerator::tsi(s), rate_limit, options.loss > 0 ? " (through lossy relay)" : "");
+    _services.push_back(std::move(service));
+  }
+}
+
+auto MBMS_RT::LoadGen::FluteSender::send(const std::vector<std::vector<ContentGenerator::Object>>& objects) -> void
+{
+  for (size_t s = 0; s < objects.size() && s < _services.size(); s++) {
+    auto& service = *_services[s];
+    for (const auto& object : objects[s]) {
+      // libflute does not copy the data, and does not modify it either
+      auto toi = service.transmitter->send(object.location, object.content_type,
+          service.transmitter->seconds_since_epoch() + 60, const_cast<char*>(object.data->data()), object.data->size());
+      service.in_flight[toi] = object.data;
+      _objects++;
+      _bytes += object.data->size();
+    }
+  }
+}
+
+auto MBMS_RT::LoadGen::FluteSender::stats() const -> Stats
+{
+  Stats stats = { _objects, _bytes, 0, 0, 0 };
+  for (const auto& service : _services) {
+    stats.in_flight += service->in_flight.size();
+    if (service->relay) {
+      stats.packets += service->relay->packets;
+      stats.dropped += service->relay->dropped;
+    }
+  }
+  return stats;
+}
+
+MBMS_RT::LoadGen::FluteSender::LossyRelay::LossyRelay(boost::asio::io_service& io_service,
+    const boost::asio::ip::udp::endpoint& destination, double loss, double burst)
+  : _socket( io_service, boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 0) )
+  , _destination( destination )
+  , _random( std::random_device()() )
+{
+  // Mean burst length 1/p_bg, stationary loss p_gb / (p_gb + p_bg)
+  loss = std::min(loss, 0.99);
+  _p_bad_good = 1.0 / std::max(burst, 1.0);
+  _p_good_bad = loss * _p_bad_good / (1.0 - loss);
+  _socket.set_option(boost::asio::ip::multicast::hops(255));
+  receive();
+}
+
+auto MBMS_RT::LoadGen::FluteSender::LossyRelay::drop() -> bool
+{
+  _bad = _bad ? _uniform(_random) >= _p_bad_good : _uniform(_random) < _p_good_bad;
+  return _bad;
+}
+
+auto MBMS_RT::LoadGen::FluteSender::LossyRelay::receive() -> void
+{
+  _socket.async_receive_from(boost::asio::buffer(_buffer), _sender,
+      [this](const boost::system::error_code& error, size_t length) {
+        if (error) {
+          if (error != boost::asio::error::operation_aborted) {
+            spdlog::warn("FLUTE relay: receive failed: {}", error.message());
+          }
+          return;
+        }
+        packets++;
+        if (drop()) {
+          dropped++;
+        } else {
+          boost::system::error_code send_error;
+          _socket.send_to(boost::asio::buffer(_buffer.data(), length), _destination, 0, send_error);
+          if (send_error) {
+            spdlog::warn("FLUTE relay: send failed: {}", send_error.message());
+          }
+        }
+        receive();
+      });
+}
@@ -0,0 +1,94 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Transmitter.h"
+#include "ContentGenerator.h"
+#include "Options.h"
+
+namespace MBMS_RT::LoadGen {
+  /**
+   *  Multicasts the generated objects with one libflute Transmitter per service.
+   *
+   *  With a loss rate configured, each Transmitter sends to a local UDP relay instead, which forwards to
+   *  the multicast group and drops packets following a Gilbert-Elliott model: every packet sent in the
+   *  bad state is lost, and the state changes are chosen to give the configured rate and mean burst length.
+   *
+   *  Not thread safe, all calls and the io_service must run on one thread.
+   */
+  class FluteSender {
+    public:
+      FluteSender(const Options& options, const ContentGenerator& generator, boost::asio::io_service& io_service);
+      virtual ~FluteSender() = default;
+
+      /**
+       *  Send the objects of each service, in order. Data is held until the transmitter completes it.
+       */
+      void send(const std::vector<std::vector<ContentGenerator::Object>>& objects);
+
+      struct Stats {
+        uint64_t objects;
+        uint64_t bytes;
+        uint64_t in_flight;
+        uint64_t packets;
+        uint64_t dropped;
+      };
+      Stats stats() const;
+
+    private:
+      class LossyRelay {
+        public:
+          LossyRelay(boost::asio::io_service& io_service, const boost::asio::ip::udp::endpoint& destination,
+              double loss, double burst);
+          unsigned short port() const { return _socket.local_endpoint().port(); };
+
+          uint64_t packets = 0;
+          uint64_t dropped = 0;
+
+        private:
+          void receive();
+          bool drop();
+
+          boost::asio::ip::udp::socket _socket;
+          boost::asio::ip::udp::endpoint _destination;
+          boost::asio::ip::udp::endpoint _sender;
+          std::array<char, 65536> _buffer = {};
+          std::mt19937 _random;
+          std::uniform_real_distribution<double> _uniform = std::uniform_real_distribution<double>(0, 1);
+          double _p_good_bad;
+          double _p_bad_good;
+          bool _bad = false;
+      };
+
+      struct Service {
+        std::unique_ptr<LossyRelay> relay;
+        std::unique_ptr<LibFlute::Transmitter> transmitter;
+        std::map<uint32_t, std::shared_ptr<const std::string>> in_flight;   // by TOI
+      };
+
+      std::vector<std::unique_ptr<Service>> _services;
+      uint64_t _objects = 0;
+      uint64_t _bytes = 0;
+  };
+}
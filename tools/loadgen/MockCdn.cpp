@@ -0,0 +1,122 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "MockCdn.h"
+#include "HttpCaching.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "spdlog/spdlog.h"
+
+using web::http::methods;
+using web::http::uri;
+using web::http::http_request;
+using web::http::http_response;
+using web::http::status_codes;
+using web::http::header_names;
+using web::http::experimental::listener::http_listener;
+using web::http::experimental::listener::http_listener_config;
+
+MBMS_RT::LoadGen::MockCdn::MockCdn(const Options& options, const ContentGenerator& generator,
+    boost::asio::io_service& io_service)
+  : _options( options )
+  , _generator( generator )
+  , _io_service( io_service )
+  , _random( std::random_device()() )
+{
+  auto url = "http://0.0.0.0:" + std::to_string(options.cdn_port);
+  _listener = std::make_unique<http_listener>(url, http_listener_config());
+  _listener->support(methods::GET, std::bind(&MockCdn::get, this, std::placeholders::_1));  // NOLINT
+  _listener->open().wait();
+  spdlog::info("Mock CDN listening on {}, latency {} ms, error rate {}", url, options.cdn_latency_ms,
+      options.cdn_error_rate);
+}
+
+MBMS_RT::LoadGen::MockCdn::~MockCdn()
+{
+  _listener->close().wait();
+}
+
+auto MBMS_RT::LoadGen::MockCdn::fail() -> bool
+{
+  if (_options.cdn_error_rate <= 0) {
+    return false;
+  }
+  const std::lock_guard<std::mutex> lock(_random_mutex);
+  return std::uniform_real_distribution<double>(0, 1)(_random) < _options.cdn_error_rate;
+}
+
+auto MBMS_RT::LoadGen::MockCdn::get(http_request message) -> void
+{
+  _requests++;
+  if (fail()) {
+    _errors++;
+    reply(std::move(message), http_response(status_codes::ServiceUnavailable));
+    return;
+  }
+
+  auto path = uri::decode(message.relative_uri().path());
+  if (!path.empty() && path[0] == '/') {
+    path.erase(0, 1);
+  }
+  auto data = _generator.find(path);
+  if (!data) {
+    _not_found++;
+    reply(std::move(message), http_response(status_codes::NotFound));
+    return;
+  }
+
+  // Segments never change, playlists are versioned by their content
+  bool playlist = path.size() > 5 && path.compare(path.size() - 5, 5, ".m3u8") == 0;
+  auto version = playlist ? std::hash<std::string>()(*data) : std::hash<std::string>()(path);
+  HttpCaching::RequestHeaders request;
+  message.headers().match(header_names::if_none_match, request.if_none_match);
+  message.headers().match(header_names::range, request.range);
+  auto result = HttpCaching::evaluate(request, { HttpCaching::etag_for(version, 0, data->size()), 0,
+      playlist ? static_cast<int>(std::max(_options.segment_duration / 2, 1U)) : 3600,
+      static_cast<uint64_t>(data->size()) });
+
+  http_response response(result.status);
+  for (const auto& header : result.headers) {
+    response.headers().add(header.first, header.second);
+  }
+  if (result.length > 0) {
+    response.set_body(std::string(data->data() + result.offset, result.length),
+        playlist ? "application/vnd.apple.mpegurl" : "video/mp2t");
+    _bytes += result.length;
+  }
+  reply(std::move(message), std::move(response));
+}
+
+auto MBMS_RT::LoadGen::MockCdn::reply(http_request message, http_response response) -> void
+{
+  if (_options.cdn_latency_ms == 0) {
+    message.reply(response);
+    return;
+  }
+  auto timer = std::make_shared<boost::asio::deadline_timer>(_io_service,
+      boost::posix_time::milliseconds(_options.cdn_latency_ms));
+  timer->async_wait([timer, message, response](const boost::system::error_code& /*error*/) mutable {
+      message.reply(response);
+  });
+}
+
+auto MBMS_RT::LoadGen::MockCdn::stats() const -> Stats
+{
+  return { _requests, _not_found, _errors, _bytes };
+}
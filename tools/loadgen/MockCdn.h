@@ -0,0 +1,67 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <boost/asio.hpp>
+#include "cpprest/http_listener.h"
+#include "ContentGenerator.h"
+#include "Options.h"
+
+namespace MBMS_RT::LoadGen {
+  /**
+   *  Unicast origin for the generated content, standing in for the CDN of the identicalContent base patterns.
+   *
+   *  Serves current playlists and the recent segment history, with single byte ranges for repairs.
+   *  Replies are delayed by the configured latency and fail with 503 at the configured error rate.
+   */
+  class MockCdn {
+    public:
+      MockCdn(const Options& options, const ContentGenerator& generator, boost::asio::io_service& io_service);
+      virtual ~MockCdn();
+
+      struct Stats {
+        uint64_t requests;
+        uint64_t not_found;
+        uint64_t errors;
+        uint64_t bytes;
+      };
+      Stats stats() const;
+
+    private:
+      void get(web::http::http_request message);
+      void reply(web::http::http_request message, web::http::http_response response);
+      bool fail();
+
+      const Options& _options;
+      const ContentGenerator& _generator;
+      boost::asio::io_service& _io_service;
+      std::unique_ptr<web::http::experimental::listener::http_listener> _listener;
+
+      std::mutex _random_mutex;
+      std::mt19937 _random;
+
+      std::atomic<uint64_t> _requests = 0;
+      std::atomic<uint64_t> _not_found = 0;
+      std::atomic<uint64_t> _errors = 0;
+      std::atomic<uint64_t> _bytes = 0;
+  };
+}
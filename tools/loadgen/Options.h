@@ -0,0 +1,61 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace MBMS_RT::LoadGen {
+  /**
+   *  Command line settings of mw-loadgen
+   */
+  struct Options {
+    // Content
+    unsigned services = 2;
+    unsigned renditions = 3;
+    std::vector<unsigned> bitrates_kbps = { 6000, 3000, 1000 };   // per rendition, repeated if there are more renditions
+    unsigned segment_duration = 2;                                // seconds
+    unsigned window = 6;                                          // segments listed in a media playlist
+    std::string output_dir = ".";
+
+    // FLUTE
+    bool flute = true;
+    std::string mcast_address = "238.1.1.1";                      // service i is sent to this address + i
+    unsigned short mcast_port = 40085;
+    unsigned short mtu = 1500;
+    unsigned rate_limit_kbps = 0;                                 // 0: twice the service bitrate
+    double loss = 0;                                              // packet loss rate, 0..1
+    double burst = 1;                                             // mean loss burst length in packets
+
+    // Mock CDN
+    bool cdn = true;
+    unsigned short cdn_port = 3030;
+    unsigned cdn_latency_ms = 0;
+    double cdn_error_rate = 0;
+
+    // Player swarm
+    unsigned players = 0;
+    std::string mw_url = "http://127.0.0.1:3020/";
+    unsigned startup_segments = 3;                                // behind the live edge when a player joins
+
+    unsigned duration = 0;                                        // seconds, 0 runs until interrupted
+    unsigned report_interval = 5;                                 // seconds
+    std::string report_file;                                      // JSON summary written on exit
+    unsigned io_threads = 4;
+  };
+}
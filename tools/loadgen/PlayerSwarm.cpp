@@ -0,0 +1,294 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#include "PlayerSwarm.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "spdlog/spdlog.h"
+
+using web::json::value;
+using web::http::methods;
+using web::http::http_response;
+using web::http::status_codes;
+
+MBMS_RT::LoadGen::PlayerSwarm::PlayerSwarm(const Options& options, const ContentGenerator& generator,
+    boost::asio::io_service& io_service)
+  : _options( options )
+  , _io_service( io_service )
+  , _play_timer( io_service )
+  , _started_at( std::chrono::steady_clock::now() )
+  , _interval_started_at( _started_at )
+  , _played_at( _started_at )
+{
+  const auto& renditions = generator.renditions();
+  for (unsigned i = 0; i < options.players && !renditions.empty(); i++) {
+    const auto& rendition = renditions[i % renditions.size()];
+    auto player = std::make_shared<Player>(i, options.mw_url, "/" + rendition.playlist_path);
+    player->playlist_dir = "/" + rendition.dir;
+    _players.push_back(player);
+
+    // Spread the joins over one segment duration instead of having all players poll in lockstep
+    auto timer = std::make_shared<boost::asio::deadline_timer>(_io_service,
+        boost::posix_time::milliseconds(options.segment_duration * 1000 * i / options.players));
+    timer->async_wait([this, timer, player](const boost::system::error_code& error) {
+        if (!error) {
+          poll(player);
+        }
+    });
+  }
+  spdlog::info("Player swarm: {} players against {}", _players.size(), options.mw_url);
+  _play_timer.expires_from_now(boost::posix_time::milliseconds(PLAY_INTERVAL_MS));
+  _play_timer.async_wait([this](const boost::system::error_code& error) { if (!error) play(); });
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::stop() -> void
+{
+  _stopped = true;
+  _play_timer.cancel();
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::request_path(const Player& player, const std::string& uri) -> std::string
+{
+  if (uri.rfind("http://", 0) == 0 || uri.rfind("https://", 0) == 0) {
+    return web::uri(uri).path();
+  }
+  if (!uri.empty() && uri[0] == '/') {
+    return uri;
+  }
+  return player.playlist_dir + uri;
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::record_error() -> void
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  _interval.errors++;
+  _run.errors++;
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::schedule(const std::shared_ptr<Player>& player) -> void
+{
+  if (_stopped) {
+    return;
+  }
+  auto timer = std::make_shared<boost::asio::deadline_timer>(_io_service,
+      boost::posix_time::milliseconds(_options.segment_duration * 1000 / 2));
+  timer->async_wait([this, timer, player](const boost::system::error_code& error) {
+      if (!error) {
+        poll(player);
+      }
+  });
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::poll(const std::shared_ptr<Player>& player) -> void
+{
+  if (_stopped) {
+    return;
+  }
+  auto requested_at = std::chrono::steady_clock::now();
+  player->client.request(methods::GET, player->playlist_path)
+    .then([](http_response response) {
+        if (response.status_code() != status_codes::OK) {
+          throw std::runtime_error("status " + std::to_string(response.status_code()));
+        }
+        return response.extract_string(true);
+    })
+    .then([this, player, requested_at](pplx::task<std::string> body) {
+        std::vector<HlsMediaPlaylist::Segment> segments;
+        try {
+          auto content = body.get();
+          auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - requested_at).count();
+          HlsMediaPlaylist playlist(content);
+          segments = playlist.segments();
+
+          const std::lock_guard<std::mutex> lock(_mutex);
+          _interval.playlist_requests++;
+          _run.playlist_requests++;
+          _interval.playlist_ms.push_back(ms);
+          _run.playlist_ms.push_back(ms);
+          _interval.bytes += content.size();
+          _run.bytes += content.size();
+
+          if (player->next_seq < 0 && !segments.empty()) {
+            auto start = segments.size() > _options.startup_segments ? segments.size() - _options.startup_segments : 0;
+            player->next_seq = segments[start].seq;
+          }
+          segments.erase(std::remove_if(segments.begin(), segments.end(),
+                [seq = player->next_seq](const auto& segment) { return segment.seq < seq; }), segments.end());
+          if (player->busy || segments.empty()) {
+            segments.clear();
+          } else {
+            player->busy = true;
+          }
+        } catch (const std::exception& ex) {
+          spdlog::debug("Player {}: playlist request failed: {}", player->id, ex.what());
+          record_error();
+        }
+        if (!segments.empty()) {
+          fetch_segments(player, std::move(segments));
+        }
+        schedule(player);
+    });
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::fetch_segments(const std::shared_ptr<Player>& player,
+    std::vector<HlsMediaPlaylist::Segment> segments) -> void
+{
+  if (_stopped || segments.empty()) {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    player->busy = false;
+    return;
+  }
+  auto segment = segments.front();
+  segments.erase(segments.begin());
+  auto requested_at = std::chrono::steady_clock::now();
+  player->client.request(methods::GET, request_path(*player, segment.uri))
+    .then([](http_response response) {
+        if (response.status_code() != status_codes::OK) {
+          throw std::runtime_error("status " + std::to_string(response.status_code()));
+        }
+        return response.extract_vector();
+    })
+    .then([this, player, segment, segments = std::move(segments), requested_at](
+          pplx::task<std::vector<unsigned char>> body) mutable {
+        try {
+          auto length = body.get().size();
+          auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - requested_at).count();
+          const std::lock_guard<std::mutex> lock(_mutex);
+          _interval.segment_requests++;
+          _run.segment_requests++;
+          _interval.segment_ms.push_back(ms);
+          _run.segment_ms.push_back(ms);
+          _interval.bytes += length;
+          _run.bytes += length;
+          player->buffer += segment.extinf;
+          player->next_seq = segment.seq + 1;
+        } catch (const std::exception& ex) {
+          // Retried from the next playlist poll
+          spdlog::debug("Player {}: segment {} failed: {}", player->id, segment.uri, ex.what());
+          record_error();
+          const std::lock_guard<std::mutex> lock(_mutex);
+          player->busy = false;
+          return;
+        }
+        fetch_segments(player, std::move(segments));
+    });
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::play() -> void
+{
+  auto now = std::chrono::steady_clock::now();
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto elapsed = std::chrono::duration<double>(now - _played_at).count();
+    _played_at = now;
+    for (auto& player : _players) {
+      if (player->playing) {
+        player->buffer -= elapsed;
+        if (player->buffer <= 0) {
+          player->buffer = 0;
+          player->playing = false;
+          player->stalled = true;
+          player->stalled_at = now;
+          _interval.stalls++;
+          _run.stalls++;
+        }
+      } else if (player->buffer >= START_SEGMENTS * _options.segment_duration) {
+        player->playing = true;
+        if (player->stalled) {
+          auto stall_time = std::chrono::duration<double>(now - player->stalled_at).count();
+          _interval.stall_time += stall_time;
+          _run.stall_time += stall_time;
+          player->stalled = false;
+        }
+      }
+    }
+  }
+  if (!_stopped) {
+    _play_timer.expires_from_now(boost::posix_time::milliseconds(PLAY_INTERVAL_MS));
+    _play_timer.async_wait([this](const boost::system::error_code& error) { if (!error) play(); });
+  }
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::percentile(std::vector<double> samples, double p) -> double
+{
+  if (samples.empty()) {
+    return 0;
+  }
+  auto rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(samples.size()))) - 1;
+  rank = std::min(rank, samples.size() - 1);
+  std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(rank), samples.end());
+  return samples[rank];
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::to_json(const Totals& totals, double seconds) -> value
+{
+  auto latency = [](const std::vector<double>& samples) {
+    value v;
+    v["p50_ms"] = value(percentile(samples, 50));
+    v["p90_ms"] = value(percentile(samples, 90));
+    v["p99_ms"] = value(percentile(samples, 99));
+    return v;
+  };
+  value v;
+  v["seconds"] = value(seconds);
+  v["playlist_requests"] = value(totals.playlist_requests);
+  v["segment_requests"] = value(totals.segment_requests);
+  v["errors"] = value(totals.errors);
+  v["bytes"] = value(totals.bytes);
+  v["throughput_mbps"] = value(seconds > 0 ? static_cast<double>(totals.bytes) * 8 / seconds / 1e6 : 0);
+  v["stalls"] = value(totals.stalls);
+  v["stall_seconds"] = value(totals.stall_time);
+  v["playlist_latency"] = latency(totals.playlist_ms);
+  v["segment_latency"] = latency(totals.segment_ms);
+  return v;
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::report() -> void
+{
+  Totals interval;
+  unsigned playing = 0;
+  unsigned stalled = 0;
+  auto now = std::chrono::steady_clock::now();
+  double seconds = 0;
+  {
+    const std::lock_guard<std::mutex> lock(_mutex);
+    interval = std::move(_interval);
+    _interval = Totals();
+    seconds = std::chrono::duration<double>(now - _interval_started_at).count();
+    _interval_started_at = now;
+    for (const auto& player : _players) {
+      playing += player->playing ? 1 : 0;
+      stalled += player->stalled ? 1 : 0;
+    }
+  }
+  auto mbps = seconds > 0 ? static_cast<double>(interval.bytes) * 8 / seconds / 1e6 : 0;
+  spdlog::info("Players: {} playing, {} stalled | {:.1f} Mbit/s, {} segments, {} errors, {} new stalls | "
+      "playlist p50/p90/p99 {:.1f}/{:.1f}/{:.1f} ms | segment p50/p90/p99 {:.1f}/{:.1f}/{:.1f} ms",
+      playing, stalled, mbps, interval.segment_requests, interval.errors, interval.stalls,
+      percentile(interval.playlist_ms, 50), percentile(interval.playlist_ms, 90), percentile(interval.playlist_ms, 99),
+      percentile(interval.segment_ms, 50), percentile(interval.segment_ms, 90), percentile(interval.segment_ms, 99));
+}
+
+auto MBMS_RT::LoadGen::PlayerSwarm::summary() const -> value
+{
+  const std::lock_guard<std::mutex> lock(_mutex);
+  auto v = to_json(_run, std::chrono::duration<double>(std::chrono::steady_clock::now() - _started_at).count());
+  v["players"] = value(static_cast<uint64_t>(_players.size()));
+  return v;
+}
@@ -0,0 +1,115 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include "cpprest/http_client.h"
+#include "cpprest/json.h"
+#include "ContentGenerator.h"
+#include "HlsMediaPlaylist.h"
+#include "Options.h"
+
+namespace MBMS_RT::LoadGen {
+  /**
+   *  Emulated HLS players fetching from the middleware's HTTP server.
+   *
+   *  Players are spread round robin over the renditions. Each one joins startup_segments behind the live
+   *  edge, polls its media playlist twice per segment duration and downloads new segments in order.
+   *  Playback starts once two segments are buffered; running out of buffer counts as a stall, which
+   *  lasts until two segments are buffered again.
+   */
+  class PlayerSwarm {
+    public:
+      PlayerSwarm(const Options& options, const ContentGenerator& generator, boost::asio::io_service& io_service);
+      virtual ~PlayerSwarm() = default;
+
+      /**
+       *  Log the figures of the interval since the previous report
+       */
+      void report();
+
+      /**
+       *  @return Totals and latency percentiles of the whole run
+       */
+      web::json::value summary() const;
+
+      /**
+       *  Stop issuing requests. Requests already sent still complete.
+       */
+      void stop();
+
+    private:
+      struct Player {
+        Player(unsigned id, const std::string& mw_url, std::string playlist_path)
+          : id( id ), client( mw_url ), playlist_path( std::move(playlist_path) ) {};
+
+        unsigned id;
+        web::http::client::http_client client;
+        std::string playlist_path;
+        std::string playlist_dir;
+        int next_seq = -1;
+        bool busy = false;
+        bool playing = false;
+        bool stalled = false;
+        double buffer = 0;    // seconds
+        std::chrono::steady_clock::time_point stalled_at;
+      };
+
+      struct Totals {
+        uint64_t playlist_requests = 0;
+        uint64_t segment_requests = 0;
+        uint64_t errors = 0;
+        uint64_t bytes = 0;
+        uint64_t stalls = 0;
+        double stall_time = 0;
+        std::vector<double> playlist_ms;
+        std::vector<double> segment_ms;
+      };
+
+      void poll(const std::shared_ptr<Player>& player);
+      void fetch_segments(const std::shared_ptr<Player>& player, std::vector<HlsMediaPlaylist::Segment> segments);
+      void play();
+      void schedule(const std::shared_ptr<Player>& player);
+      void record_error();
+
+      static std::string request_path(const Player& player, const std::string& uri);
+      static web::json::value to_json(const Totals& totals, double seconds);
+      static double percentile(std::vector<double> samples, double p);
+
+      static constexpr unsigned START_SEGMENTS = 2;
+      static constexpr unsigned PLAY_INTERVAL_MS = 100;
+
+      const Options& _options;
+      boost::asio::io_service& _io_service;
+      boost::asio::deadline_timer _play_timer;
+      std::vector<std::shared_ptr<Player>> _players;
+      std::atomic<bool> _stopped = false;
+
+      mutable std::mutex _mutex;
+      Totals _interval;
+      Totals _run;
+      std::chrono::steady_clock::time_point _started_at;
+      std::chrono::steady_clock::time_point _interval_started_at;
+      std::chrono::steady_clock::time_point _played_at;
+  };
+}
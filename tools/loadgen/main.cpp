@@ -0,0 +1,326 @@
+// 5G-MAG Reference Tools
+// MBMS Middleware Process
+//
+// Copyright (C) 2021 Klaus Kühnhammer (Österreichische Rundfunksender GmbH & Co KG)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+// 
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+
+/**
+ * @file main.cpp
+ * @brief mw-loadgen: synthetic service announcement, FLUTE multicast, mock CDN and player swarm for
+ *        driving the middleware without broadcast hardware.
+ */
+
+#include <argp.h>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "ContentGenerator.h"
+#include "FluteSender.h"
+#include "MockCdn.h"
+#include "Options.h"
+#include "PlayerSwarm.h"
+#include "spdlog/spdlog.h"
+
+using MBMS_RT::LoadGen::Options;
+
+const char *argp_program_bug_address = "5G-MAG Reference Tools <reference-tools@5g-mag.com>";
+static char doc[] = "5G-MAG-RT MBMS Middleware load generator";  // NOLINT
+
+enum LongOptions {
+  OPT_BITRATES = 256, OPT_SEGMENT_DURATION, OPT_WINDOW, OPT_NO_FLUTE, OPT_MCAST_PORT, OPT_MTU, OPT_RATE_LIMIT,
+  OPT_BURST, OPT_NO_CDN, OPT_CDN_LATENCY, OPT_CDN_ERRORS, OPT_STARTUP_SEGMENTS, OPT_REPORT_INTERVAL, OPT_IO_THREADS
+};
+
+static struct argp_option options[] = {  // NOLINT
+    {"services", 's', "N", 0, "Number of services (default: 2)", 0},
+    {"renditions", 'r', "M", 0, "Renditions per service (default: 3)", 0},
+    {"bitrates", OPT_BITRATES, "KBPS,...", 0,
+     "Rendition bitrates in kbit/s, repeated if there are more renditions (default: 6000,3000,1000)", 0},
+    {"segment-duration", OPT_SEGMENT_DURATION, "SECONDS", 0, "Segment duration (default: 2)", 0},
+    {"window", OPT_WINDOW, "SEGMENTS", 0, "Segments listed in the media playlists (default: 6)", 0},
+    {"output-dir", 'o', "DIR", 0, "Where to write bootstrap.multipart and the SDPs (default: .)", 0},
+    {"no-flute", OPT_NO_FLUTE, nullptr, 0, "Do not multicast, serve the content from the mock CDN only", 0},
+    {"mcast-address", 'm', "ADDRESS", 0,
+     "Multicast group of the first service, service i uses this address + i (default: 238.1.1.1)", 0},
+    {"mcast-port", OPT_MCAST_PORT, "PORT", 0, "Multicast port (default: 40085)", 0},
+    {"mtu", OPT_MTU, "BYTES", 0, "FLUTE MTU (default: 1500)", 0},
+    {"rate-limit", OPT_RATE_LIMIT, "KBPS", 0, "FLUTE rate per service (default: twice the service bitrate)", 0},
+    {"loss", 'L', "RATE", 0, "FLUTE packet loss rate, 0..1 (default: 0)", 0},
+    {"burst", OPT_BURST, "PACKETS", 0, "Mean length of loss bursts (default: 1, independent losses)", 0},
+    {"no-cdn", OPT_NO_CDN, nullptr, 0, "Do not run the mock CDN", 0},
+    {"cdn-port", 'C', "PORT", 0, "Mock CDN port (default: 3030)", 0},
+    {"cdn-latency", OPT_CDN_LATENCY, "MS", 0, "Delay of every mock CDN reply (default: 0)", 0},
+    {"cdn-errors", OPT_CDN_ERRORS, "RATE", 0, "Share of mock CDN requests failing with 503 (default: 0)", 0},
+    {"players", 'p', "N", 0, "Number of emulated players (default: 0)", 0},
+    {"mw-url", 'u', "URL", 0, "Middleware HTTP server the players fetch from (default: http://127.0.0.1:3020/)", 0},
+    {"startup-segments", OPT_STARTUP_SEGMENTS, "N", 0, "Segments behind the live edge players join at (default: 3)", 0},
+    {"duration", 'd', "SECONDS", 0, "Run time, 0 runs until interrupted (default: 0)", 0},
+    {"report-interval", OPT_REPORT_INTERVAL, "SECONDS", 0, "Report interval (default: 5)", 0},
+    {"report-file", 'R', "FILE", 0, "Write a JSON summary of the run to FILE on exit", 0},
+    {"io-threads", OPT_IO_THREADS, "N", 0, "Threads for the mock CDN and the players (default: 4)", 0},
+    {"log-level", 'l', "LEVEL", 0,
+     "Log verbosity: 0 = trace, 1 = debug, 2 = info, 3 = warn, 4 = error, 5 = "
+     "critical, 6 = none. Default: 2.",
+     0},
+    {nullptr, 0, nullptr, 0, nullptr, 0}};
+
+/**
+ * Holds all options passed on the command line
+ */
+struct arguments {
+  Options options;
+  unsigned log_level = 2;        /**< log level */
+};
+
+static auto parse_bitrates(const char* arg) -> std::vector<unsigned> {
+  std::vector<unsigned> bitrates;
+  std::stringstream ss(arg);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    auto kbps = static_cast<unsigned>(strtoul(item.c_str(), nullptr, 10));
+    if (kbps > 0) {
+      bitrates.push_back(kbps);
+    }
+  }
+  return bitrates;
+}
+
+/**
+ * Parses the command line options into the arguments struct.
+ */
+static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
+  auto arguments = static_cast<struct arguments *>(state->input);
+  auto& o = arguments->options;
+  switch (key) {
+    case 's': o.services = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case 'r': o.renditions = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case OPT_BITRATES:
+      o.bitrates_kbps = parse_bitrates(arg);
+      if (o.bitrates_kbps.empty()) {
+        argp_error(state, "invalid bitrates: %s", arg);
+      }
+      break;
+    case OPT_SEGMENT_DURATION: o.segment_duration = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case OPT_WINDOW: o.window = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case 'o': o.output_dir = arg; break;
+    case OPT_NO_FLUTE: o.flute = false; break;
+    case 'm': o.mcast_address = arg; break;
+    case OPT_MCAST_PORT: o.mcast_port = static_cast<unsigned short>(strtoul(arg, nullptr, 10)); break;
+    case OPT_MTU: o.mtu = static_cast<unsigned short>(strtoul(arg, nullptr, 10)); break;
+    case OPT_RATE_LIMIT: o.rate_limit_kbps = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case 'L': o.loss = strtod(arg, nullptr); break;
+    case OPT_BURST: o.burst = strtod(arg, nullptr); break;
+    case OPT_NO_CDN: o.cdn = false; break;
+    case 'C': o.cdn_port = static_cast<unsigned short>(strtoul(arg, nullptr, 10)); break;
+    case OPT_CDN_LATENCY: o.cdn_latency_ms = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case OPT_CDN_ERRORS: o.cdn_error_rate = strtod(arg, nullptr); break;
+    case 'p': o.players = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case 'u': o.mw_url = arg; break;
+    case OPT_STARTUP_SEGMENTS: o.startup_segments = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case 'd': o.duration = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case OPT_REPORT_INTERVAL: o.report_interval = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case 'R': o.report_file = arg; break;
+    case OPT_IO_THREADS: o.io_threads = static_cast<unsigned>(strtoul(arg, nullptr, 10)); break;
+    case 'l':
+      arguments->log_level = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+      break;
+    case ARGP_KEY_END:
+      if (o.services == 0 || o.renditions == 0 || o.segment_duration == 0 || o.window == 0) {
+        argp_error(state, "services, renditions, segment duration and window must be at least 1");
+      }
+      if (o.loss < 0 || o.loss >= 1 || o.cdn_error_rate < 0 || o.cdn_error_rate > 1) {
+        argp_error(state, "loss must be in [0, 1), cdn-errors in [0, 1]");
+      }
+      if (o.report_interval == 0 || o.io_threads == 0) {
+        argp_error(state, "report interval and io threads must be at least 1");
+      }
+      break;
+    case ARGP_KEY_ARG:
+      argp_usage(state);
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = {options, parse_opt, nullptr, doc,
+                           nullptr, nullptr,   nullptr};
+
+static auto write_file(const std::string& path, const std::string& content) -> bool {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << content;
+  return static_cast<bool>(out);
+}
+
+static boost::asio::io_service* stop_service = nullptr;
+static boost::asio::io_service* stop_flute_service = nullptr;
+
+static void handle_signal(int /*signal*/) {
+  if (stop_service) {
+    stop_service->stop();
+  }
+  if (stop_flute_service) {
+    stop_flute_service->stop();
+  }
+}
+
+/**
+ *  Main entry point for the program.
+ *
+ *  FLUTE transmission and content generation run on one thread, libflute's Transmitter is not thread
+ *  safe. The mock CDN timers and the players share a pool of io_threads.
+ */
+auto main(int argc, char **argv) -> int {
+  struct arguments arguments;
+  argp_parse(&argp, argc, argv, 0, nullptr, &arguments);
+  const auto& options = arguments.options;
+
+  spdlog::set_level(static_cast<spdlog::level::level_enum>(arguments.log_level));
+  spdlog::set_pattern("[%H:%M:%S.%f %z] [%^%l%$] [thr %t] %v");
+
+  MBMS_RT::LoadGen::ContentGenerator generator(options);
+
+  // Both base patterns resolve to the mock CDN. The hosts differ so the middleware takes the unicast one
+  // as an additional origin.
+  auto broadcast_host = "http://localhost:" + std::to_string(options.cdn_port) + "/";
+  auto cdn_host = "http://127.0.0.1:" + std::to_string(options.cdn_port) + "/";
+  auto bootstrap_file = options.output_dir + "/bootstrap.multipart";
+  if (!write_file(bootstrap_file, generator.bootstrap(broadcast_host, cdn_host))) {
+    spdlog::error("Cannot write {}", bootstrap_file);
+    return 1;
+  }
+  for (unsigned s = 0; s < options.services; s++) {
+    write_file(options.output_dir + "/svc" + std::to_string(s) + ".sdp", generator.sdp(s));
+  }
+  spdlog::info("Wrote {} with {} services x {} renditions. Middleware configuration:", bootstrap_file,
+      options.services, options.renditions);
+  spdlog::info("  mw.local_service: {{ enabled: true; bootstrap_file: \"{}\"; }}", bootstrap_file);
+  spdlog::info("  mw.seamless_switching: {{ enabled: true; }}");
+
+  boost::asio::io_service io_service;
+  boost::asio::io_service flute_service;
+  boost::asio::io_service::work work(io_service);
+  boost::asio::io_service::work flute_work(flute_service);
+  stop_service = &io_service;
+  stop_flute_service = &flute_service;
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  std::unique_ptr<MBMS_RT::LoadGen::FluteSender> flute;
+  std::unique_ptr<MBMS_RT::LoadGen::MockCdn> cdn;
+  std::unique_ptr<MBMS_RT::LoadGen::PlayerSwarm> players;
+  try {
+    if (options.flute) {
+      flute = std::make_unique<MBMS_RT::LoadGen::FluteSender>(options, generator, flute_service);
+    }
+    if (options.cdn) {
+      cdn = std::make_unique<MBMS_RT::LoadGen::MockCdn>(options, generator, io_service);
+    }
+    if (options.players > 0) {
+      players = std::make_unique<MBMS_RT::LoadGen::PlayerSwarm>(options, generator, io_service);
+    }
+  } catch (const std::exception& ex) {
+    spdlog::error("Startup failed: {}", ex.what());
+    return 1;
+  }
+
+  // A new segment per rendition every segment duration, sent over FLUTE as soon as it exists
+  boost::asio::deadline_timer segment_timer(flute_service);
+  std::function<void()> next_segment = [&]() {
+    auto objects = generator.next();
+    if (flute) {
+      flute->send(objects);
+    }
+    segment_timer.expires_at(segment_timer.expires_at() + boost::posix_time::seconds(options.segment_duration));
+    segment_timer.async_wait([&](const boost::system::error_code& error) { if (!error) next_segment(); });
+  };
+  segment_timer.expires_from_now(boost::posix_time::seconds(options.segment_duration));
+  segment_timer.async_wait([&](const boost::system::error_code& error) { if (!error) next_segment(); });
+
+  boost::asio::deadline_timer report_timer(io_service);
+  std::function<void()> report = [&]() {
+    if (players) {
+      players->report();
+    }
+    if (flute) {
+      auto stats = flute->stats();
+      spdlog::info("FLUTE: {} objects, {} MB sent, {} in flight, {} of {} relayed packets dropped", stats.objects,
+          stats.bytes / 1000000, stats.in_flight, stats.dropped, stats.packets);
+    }
+    if (cdn) {
+      auto stats = cdn->stats();
+      spdlog::info("Mock CDN: {} requests, {} not found, {} errors, {} MB served", stats.requests, stats.not_found,
+          stats.errors, stats.bytes / 1000000);
+    }
+    report_timer.expires_at(report_timer.expires_at() + boost::posix_time::seconds(options.report_interval));
+    report_timer.async_wait([&](const boost::system::error_code& error) { if (!error) report(); });
+  };
+  report_timer.expires_from_now(boost::posix_time::seconds(options.report_interval));
+  report_timer.async_wait([&](const boost::system::error_code& error) { if (!error) report(); });
+
+  boost::asio::deadline_timer end_timer(io_service);
+  if (options.duration > 0) {
+    end_timer.expires_from_now(boost::posix_time::seconds(options.duration));
+    end_timer.async_wait([&](const boost::system::error_code& error) {
+        if (!error) {
+          handle_signal(SIGTERM);
+        }
+    });
+  }
+
+  std::thread flute_thread([&flute_service]() { flute_service.run(); });
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < options.io_threads; i++) {
+    threads.emplace_back([&io_service]() { io_service.run(); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  flute_thread.join();
+
+  if (players) {
+    players->stop();
+  }
+  if (!options.report_file.empty()) {
+    web::json::value summary;
+    if (players) {
+      summary["players"] = players->summary();
+    }
+    if (flute) {
+      auto stats = flute->stats();
+      summary["flute"]["objects"] = web::json::value(stats.objects);
+      summary["flute"]["bytes"] = web::json::value(stats.bytes);
+      summary["flute"]["packets"] = web::json::value(stats.packets);
+      summary["flute"]["dropped"] = web::json::value(stats.dropped);
+    }
+    if (cdn) {
+      auto stats = cdn->stats();
+      summary["cdn"]["requests"] = web::json::value(stats.requests);
+      summary["cdn"]["not_found"] = web::json::value(stats.not_found);
+      summary["cdn"]["errors"] = web::json::value(stats.errors);
+      summary["cdn"]["bytes"] = web::json::value(stats.bytes);
+    }
+    if (!write_file(options.report_file, summary.serialize())) {
+      spdlog::error("Cannot write {}", options.report_file);
+    }
+  }
+  spdlog::info("mw-loadgen stopped");
+  return 0;
+}